@@ -0,0 +1,62 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "camerapath.h"
+#include "skybox.h"
+
+#include <string>
+
+// Output and scheduling of an offline render, see Batch::RenderPath
+struct BatchSettings {
+    int width = Config::WINDOW_WIDTH;
+    int height = Config::WINDOW_HEIGHT;
+    // printf pattern of the frame number. Files ending in .hdr get the float
+    // frame, anything else an 8-bit PNG.
+    std::string output = "frame_%05d.png";
+    int firstFrame = 0;
+    int lastFrame = -1;         // -1 for the path's last frame
+    int framesInFlight = 2;
+    int threads = 0;            // tracer threads per frame in flight, 0 to share the cores between them
+    bool lensCache = false;     // see Tracer::SetLensCache
+    // Above 1, each frame is traced coarse to fine from this stride as the
+    // window does after a drag, see Tracer::RenderProgressive. The frame
+    // written is the finished one.
+    int progressiveStride = 0;
+    // Above 0, each frame is traced on a log-polar grid of this many rays a
+    // pixel and resampled, see Tracer::RenderLogPolar
+    float logPolarQuality = 0.0f;
+    // Above 0, each frame is traced with Tracer::RenderAdaptive at this
+    // tolerance in radians
+    float adaptiveTolerance = 0.0f;
+    // printf pattern of the frame number that the adaptive frames' sample
+    // masks are written to, see Tracer::SaveSampleMask. Empty for none.
+    std::string sampleMask;
+    // printf pattern of the frame number that StepStats::Export writes each
+    // frame's step counts to. Empty for none.
+    std::string stepStats;
+    // CSV of every tile's time and thread, see Tracer::GetTileTimings.
+    // Empty for none.
+    std::string tileTimings;
+};
+
+struct BatchReport {
+    int frames = 0;             // written
+    int failed = 0;             // rendered but not written
+    double seconds = 0.0;
+    long long rays = 0;
+    long long analyticRays = 0;     // resolved without finishing the march, see TraceStats
+    long long skippedSteps = 0;
+};
+
+namespace Batch {
+    // Renders the frames of path with the CPU tracer, no GL context needed.
+    // framesInFlight frames are traced at once, each by its own Tracer, so
+    // while one frame is down to its last tiles around the photon ring the
+    // next frame's tiles keep the other cores busy, and writing a finished
+    // frame never leaves them idle.
+    BatchReport RenderPath(const CameraPath& path, const Skybox& skybox, const BatchSettings& settings);
+
+    std::string FramePath(const std::string& pattern, int frame);
+}
+
+#endif
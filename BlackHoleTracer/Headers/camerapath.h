@@ -0,0 +1,57 @@
+#ifndef CAMERAPATH_H
+#define CAMERAPATH_H
+
+#include "scene.h"
+
+#include <string>
+#include <vector>
+
+// Camera and hole at one point of a path. Angles in radians, zoom in
+// degrees like Camera.
+struct CameraKeyframe {
+    float time = 0.0f;          // seconds
+    float radius = 40.0f;
+    float azimuth = 1.46f;
+    float polar = 1.46f;
+    float zoom = 90.0f;
+    float mass = 2.0f;
+    uint32_t flags = SceneFlags::USE_RELATIVITY;
+};
+
+// Keyframed scene for offline renders, read from a text file with one
+// setting per line and # comments:
+//
+//   fps 30
+//   sizeBuffer 1.08            also diskThickness, tolerance, farFieldRadius,
+//                              weakFieldThreshold, weakFieldTolerance
+//   key 0 radius 40 azimuth 0 polar 1.46 flags relativity,disk
+//   key 12 azimuth 6.283
+//
+// A key starts from the one before it, so it only lists what changes.
+// Flags are relativity, disk, adaptive, planar, deflection, farfield and
+// weakfield, or none.
+struct CameraPath {
+    float fps = 30.0f;
+    float bhSizeBuffer = 1.08f;
+    float diskThickness = 0.2f;
+    float tolerance = 1e-4f;
+    float farFieldRadius = 30.0f;
+    float weakFieldThreshold = 0.0f;
+    float weakFieldTolerance = 2.5e-4f;
+    std::vector<CameraKeyframe> keys;   // sorted by time
+
+    bool Load(const std::string& path);
+
+    // Between keys the camera and mass follow a Catmull-Rom spline through
+    // the keys, flags switch at each key. Clamped to the first and last key.
+    CameraKeyframe Evaluate(float time) const;
+    // Same uniforms Display::UpdateUniforms would set for that keyframe
+    SceneParams GetScene(float time, float aspectRatio) const;
+
+    float GetDuration() const { return keys.empty() ? 0.0f : keys.back().time - keys.front().time; }
+    // One frame every 1 / fps from the first key, the last key included
+    int GetFrameCount() const;
+    float GetFrameTime(int frame) const;
+};
+
+#endif
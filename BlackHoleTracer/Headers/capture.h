@@ -0,0 +1,83 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "boiler.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Screenshots without stalling the render loop. Capture starts a
+// glReadPixels into the next of a ring of pixel buffer objects and fences
+// it. Poll picks up the buffers whose fence has passed, copies the pixels
+// out and queues them for a pool of threads that encode and write the PNGs.
+// When every buffer is still in flight, or the queue is full, the frame is
+// dropped and counted rather than waited for.
+class FrameCapture {
+public:
+    FrameCapture(int width, int height, int ringSize = 3, int workerCount = 2, int queueLimit = 8);
+    ~FrameCapture();
+
+    FrameCapture(const FrameCapture&) = delete;
+    FrameCapture& operator=(const FrameCapture&) = delete;
+
+    // Reads the bound read framebuffer, bottom row first. False if dropped.
+    bool Capture(const std::string& path);
+    // Call once a frame, hands finished readbacks to the workers
+    void Poll();
+    // Waits for every capture so far to be written
+    void Flush();
+
+    // Offline renders that must not lose frames wait for a free buffer and
+    // queue space instead of dropping
+    void SetBlocking(bool blocking) { m_Blocking = blocking; }
+
+    // Getters
+    long long GetCaptured() const { return m_Captured; }
+    long long GetDropped() const { return m_Dropped; }
+    long long GetWritten() const { return m_Written; }
+    long long GetFailed() const { return m_Failed; }
+    int GetInFlight() const { return m_InFlight; }
+
+private:
+    struct Slot {
+        GLuint pbo = 0;
+        GLsync fence = nullptr;
+        std::string path;
+    };
+    struct Job {
+        std::string path;
+        std::vector<unsigned char> pixels;
+    };
+
+    // Hands the oldest readback to the queue. With wait it blocks on the GPU
+    // and on queue space, otherwise it returns false while the fence is up.
+    bool Retire(bool wait);
+    void WorkerLoop();
+
+    int m_Width, m_Height;
+    std::vector<Slot> m_Slots;
+    int m_Head = 0;             // oldest slot in flight
+    int m_InFlight = 0;
+    bool m_Blocking = false;
+
+    std::mutex m_Mutex;
+    std::condition_variable m_Wake;     // workers, a job or quit
+    std::condition_variable m_Idle;     // writer, queue space or all done
+    std::deque<Job> m_Queue;
+    std::vector<std::vector<unsigned char>> m_FreeBuffers;
+    size_t m_QueueLimit;
+    int m_Encoding = 0;
+    bool m_Quit = false;
+    std::vector<std::thread> m_Workers;
+
+    long long m_Captured = 0;
+    long long m_Dropped = 0;
+    std::atomic<long long> m_Written{0};
+    std::atomic<long long> m_Failed{0};
+};
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef DEFLECTION_H
+#define DEFLECTION_H
+
+#include "scene.h"
+
+// For a Schwarzschild hole the fate of a ray only depends on the camera
+// radius and the angle alpha between the ray and the direction to the hole
+// (equivalently the impact parameter and whether the ray starts inward).
+// The table holds the Binet march result over alpha so a pixel becomes a
+// lookup plus a rotation in the orbit plane.
+//
+// Rays with alpha < critical angle are captured. Above it entry i covers
+// alpha = critical + (PI - critical) * t^2, t = i / (SIZE - 1), so samples
+// bunch up at the photon ring where the deflection diverges. Each entry is
+// (psi, escaped): the exit direction is cos(psi) e1 + sin(psi) e2 in the
+// orbit plane (e1 = hole to camera, e2 along the ray).
+class DeflectionTable {
+public:
+    static constexpr int SIZE = 2048;
+
+    void Build(const SceneParams& scene);
+    bool IsBuiltFor(const SceneParams& scene) const;
+
+    // False if the ray is captured, otherwise its direction at ESCAPE_RADIUS
+    bool Lookup(const SceneParams& scene, const glm::vec3& rayDir, glm::vec3& outDir) const;
+
+    float GetCriticalAngle() const { return m_CriticalAngle; }
+    const std::vector<glm::vec2>& GetEntries() const { return m_Entries; }
+
+private:
+    // Table coordinate t in [0, 1] for alpha >= critical angle
+    float AlphaToT(float alpha) const;
+    float TToAlpha(float t) const;
+
+    std::vector<glm::vec2> m_Entries;
+    float m_CriticalAngle = 0.0f;
+
+    float m_CameraRadius = -1.0f;
+    float m_BhRadius = 0.0f;
+    float m_BhSizeBuffer = 0.0f;
+};
+
+#endif
@@ -5,6 +5,16 @@
 #include "shader.h"
 #include "camera.h"
 #include "blackhole.h"
+#include "capture.h"
+#include "deflection.h"
+#include "lensmap.h"
+#include "logpolar.h"
+#include "skystream.h"
+#include "stepstats.h"
+#include "wavefront.h"
+#include <cstddef>
+#include <map>
+#include <memory>
 #include <string>
 
 class Display {
@@ -14,25 +24,204 @@ public:
     
     // Main interface
     void Draw();
-    void UpdateUniforms(Camera& camera, BlackHole& bh, uint32_t& flags, float& bhSizeBuffer, float& diskThickness);
+    void UpdateUniforms(Camera& camera, BlackHole& bh, uint32_t& flags, float& bhSizeBuffer, float& diskThickness, float& tolerance, float& farFieldRadius,
+                        float& weakFieldThreshold, float& weakFieldTolerance);
+
+    // Screenshots go through a FrameCapture (see capture.h), so saving does
+    // not hitch the frame. While recording every Draw is captured into
+    // numbered files, frames the capture cannot keep up with are dropped.
     void SaveFrame(const std::string& filename);
+    void SetRecording(bool recording);
+    bool IsRecording() const { return m_Recording; }
+    // Waits for every capture to be written, call before the context goes
+    void FlushCapture();
+    const FrameCapture* GetCapture() const { return m_Capture.get(); }
+
+    // Step count buffer. While enabled Draw renders into an offscreen target
+    // with a second attachment for StepInfo and reads it back every frame.
+    void SetStepStatsEnabled(bool enabled);
+    bool IsStepStatsEnabled() const { return m_StepStatsEnabled; }
+    void UpdateHeatmap(HeatmapMode mode, float opacity);
+    void SaveStepStats(const std::string& filename);
+
+    // Coarse-to-fine rendering. While interacting, or after the scene
+    // changes, Draw traces every coarseStride-th pixel. Each later Draw halves
+    // the stride and reuses the samples already traced until the frame is
+    // complete, then only presents it. Off while step stats are on.
+    void SetProgressive(bool enabled, int coarseStride);
+    void SetInteracting(bool interacting) { m_Interacting = interacting; }
+    bool IsProgressiveComplete() const { return m_ProgressiveStride == 1; }
+    int GetProgressiveStride() const { return m_ProgressiveStride; }
+
+    // Lens map cache (see lensmap.h). Full frames are traced into an
+    // offscreen target that also keeps where every ray went, and while the
+    // camera only orbits Draw shades from that instead of tracing. Takes over
+    // from progressive refinement, off while step stats are on.
+    void SetLensCache(bool enabled);
+    bool IsLensCacheEnabled() const { return m_LensCache; }
+    bool WasLensMapReused() const { return m_LensReused; }
+
+    // Traces a LogPolarGrid of about quality rays per pixel around the hole's
+    // image and resamples it to the frame (see logpolar.h). Lens map cache
+    // and step stats take precedence.
+    void SetLogPolar(bool enabled, float quality);
+    bool IsLogPolarEnabled() const { return m_LogPolar; }
+    const LogPolarGrid& GetLogPolarGrid() const { return m_LogPolarGrid; }
+
+    // Set when the sky is a .bhtiles file, which is streamed instead of
+    // uploaded (see skystream.h). Draw runs its feedback pass whenever the
+    // scene moved or tiles are still coming in.
+    SkyStreamer* GetSkyStreamer() const { return m_SkyStreamer.get(); }
+
+    // Recompiles the shaders in the background when their sources change
+    // and swaps them in between frames (see Shader::SetHotReload). Builds
+    // that know their source tree watch the shaders there.
+    // Traced frames kept for reuse are dropped when a new program arrives.
+    void SetShaderHotReload(bool enabled);
+    bool IsShaderHotReloading() const { return m_ShaderHotReload; }
+
+    // Draws with a build of blackhole.frag specialized to the flags of the
+    // last UpdateUniforms, so the integrators and disk code they turn off
+    // are compiled out instead of branched around every step. A variant is
+    // compiled in the background the first time its flags are seen and
+    // the uber-shader draws until it is ready, unless wait is set. Variants
+    // are dropped and rebuilt when the uber-shader is hot reloaded.
+    void SetSpecializedShaders(bool enabled, bool wait = false);
+    bool IsDrawingSpecialized() const { return m_ShaderProgram != m_UberShader; }
+    int GetShaderVariantCount() const { return (int)m_ShaderVariants.size(); }
+
+    // Traces full frames with the compute shader WavefrontTracer (see
+    // wavefront.h) instead of blackhole.frag, on GL 4.3 and later. Lens
+    // map cache, log-polar sampling and progressive refinement take
+    // precedence, off while step stats are on.
+    void SetWavefront(bool enabled, int stepsPerDispatch);
+    bool IsWavefrontSupported() const { return m_WavefrontSupported; }
+    const WavefrontTracer* GetWavefront() const { return m_Wavefront.get(); }
 
     // Getters
     int GetWidth() const { return m_Width; }
     int GetHeight() const { return m_Height; }
-    Shader* GetShader() const { return m_ShaderProgram; }
+    Shader* GetShader() const { return m_ShaderProgram; }   // the one the last Draw used
+    const StepBuffer& GetStepBuffer() const { return m_StepBuffer; }
+    GLuint GetHeatmapTexture() const { return m_HeatmapTextureID; }
     
 private:
+    void DrawFrame();
+    void BindSceneTextures();
+    bool CaptureFrame(const std::string& path);
     void InitializeOpenGL();
     void CreateShaders();
+    // What a program keeps between draws, again after every reload
+    void ConfigureShader(Shader& shader);
+    void SelectShader();
     void CreateQuad();
     
     void LoadSkyboxTexture(const std::string& path);
+    void UpdateDeflectionTexture(const SceneParams& scene);
+    void CreateStepTargets();
+    void DeleteStepTargets();
+    void ReadStepBuffer();
+    void DrawProgressive();
+    void DeleteProgressiveLevels();
+    void DrawLensCache();
+    void CreateLensTargets();
+    void DeleteLensTargets();
+    void DrawLogPolar();
+    void DeleteLogPolarTarget();
+    void DrawSkyFeedback();
+    void DrawWavefront();
     
+    // std140 mirror of SceneBlock in trace.glsl. Every vec3 shares its
+    // 16 bytes with the float after it.
+    struct SceneUniforms {
+        glm::mat4 invView;
+        glm::vec3 camPos;
+        float fov;
+        glm::vec3 bhPos;
+        float bhMass;
+        float bhRadius;
+        float aspectRatio;
+        float bhSizeBuffer;
+        float diskThickness;
+        float tolerance;
+        float farFieldRadius;
+        float weakFieldImpact;
+        float weakFieldTolerance;
+        float deflectionCritical;
+        uint32_t flags;
+        float skyLevel;
+        float padding;
+    };
+    static_assert(sizeof(SceneUniforms) == 144 && offsetof(SceneUniforms, flags) == 132,
+                  "SceneUniforms must match the std140 layout of SceneBlock");
+    static constexpr GLuint SCENE_BLOCK_BINDING = 0;
+
     // OpenGL resources
     GLuint m_SkyboxTextureID;
+    int m_SkyFaceSize = 0;          // for the sky level, see Skybox::LevelForPixelAngle
+    int m_SkyLevelCount = 0;
+    GLuint m_DeflectionTextureID = 0;
+    DeflectionTable m_DeflectionTable;
     GLuint m_VAO, m_VBO;
-    Shader* m_ShaderProgram;
+    Shader* m_UberShader;
+    Shader* m_ShaderProgram;        // m_UberShader or a variant
+    bool m_ShaderHotReload = false;
+    bool m_SpecializedShaders = false;
+    bool m_WaitForVariants = false;
+    std::map<uint32_t, std::unique_ptr<Shader>> m_ShaderVariants;  // by flags
+    GLuint m_SceneUBO = 0;
+    SceneUniforms m_SceneUniforms;  // what the buffer holds
+
+    bool m_StepStatsEnabled = false;
+    GLuint m_StepFBO = 0;
+    GLuint m_StepColorTextureID = 0;
+    GLuint m_StepInfoTextureID = 0;
+    GLuint m_HeatmapTextureID = 0;
+    StepBuffer m_StepBuffer;
+    std::vector<float> m_StepReadback;
+
+    // One target per stride, index log2(stride)
+    struct ProgressiveLevel {
+        GLuint fbo = 0;
+        GLuint texture = 0;
+        int width = 0;
+        int height = 0;
+    };
+    bool m_Progressive = false;
+    bool m_Interacting = false;
+    int m_CoarseStride = 8;
+    int m_ProgressiveStride = 0;    // stride of the last pass, 0 before the first
+    std::vector<ProgressiveLevel> m_ProgressiveLevels;
+    SceneParams m_Scene;            // from the last UpdateUniforms
+    SceneParams m_ProgressiveScene; // what the progressive levels hold
+
+    bool m_LensCache = false;
+    bool m_LensValid = false;
+    bool m_LensReused = false;      // the last Draw only resampled the sky
+    GLuint m_LensFBO = 0;
+    GLuint m_LensColorTextureID = 0;
+    GLuint m_LensDirectionTextureID = 0;
+    GLuint m_LensDiskTextureID = 0;
+    SceneParams m_LensScene;        // what the lens targets hold
+
+    bool m_LogPolar = false;
+    float m_LogPolarQuality = 0.5f;
+    LogPolarGrid m_LogPolarGrid;
+    Shader* m_LogPolarShader = nullptr;
+    GLuint m_LogPolarFBO = 0;
+    GLuint m_LogPolarTextureID = 0;
+    int m_LogPolarWidth = 0, m_LogPolarHeight = 0;
+
+    bool m_WavefrontSupported = false;
+    std::unique_ptr<WavefrontTracer> m_Wavefront;   // while enabled
+
+    std::unique_ptr<SkyStreamer> m_SkyStreamer;
+    SceneParams m_SkyFeedbackScene; // what the last feedback pass drew
+
+    std::unique_ptr<FrameCapture> m_Capture;
+    bool m_Recording = false;
+    std::string m_RecordingPrefix;
+    int m_RecordedFrames = 0;
     
     int m_Width, m_Height;
 };
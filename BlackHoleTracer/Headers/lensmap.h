@@ -0,0 +1,53 @@
+#ifndef LENSMAP_H
+#define LENSMAP_H
+
+#include "ray.h"
+#include "scene.h"
+
+#include <vector>
+
+// Where every pixel's ray ended up, kept in the camera's frame. The camera
+// always looks at the origin from a sphere around it and the hole is
+// spherically symmetric, so orbiting at a fixed radius only rotates the
+// bundle of geodesics along with the camera. In the camera frame nothing
+// moves and a new frame is one skybox lookup per pixel. The disk is only
+// symmetric about the y axis, so with the disk on only azimuth may change.
+class LensMap {
+public:
+    void Reset(int width, int height);
+    // ray.vel goes into the camera frame of scene, the rest is frame independent
+    void Set(int x, int y, const SceneParams& scene, const RayResult& ray);
+    // The stored ray with its escape direction rotated into the frame of scene
+    RayResult Get(int x, int y, const SceneParams& scene) const;
+
+    // Marks the map complete for scene
+    void Finish(const SceneParams& scene);
+    void Invalidate() { m_Valid = false; }
+    bool CanReuse(const SceneParams& scene) const { return m_Valid && SameGeodesics(m_Scene, scene); }
+
+    // True when b only differs from a by a rotation of the camera about the
+    // hole that leaves every traced ray the same in the camera frame
+    static bool SameGeodesics(const SceneParams& a, const SceneParams& b);
+
+    // Getters
+    int GetWidth() const { return m_Width; }
+    int GetHeight() const { return m_Height; }
+    bool IsValid() const { return m_Valid; }
+
+private:
+    struct Sample {
+        glm::vec3 direction = glm::vec3(0.0f);  // camera frame, escaped rays only
+        float bhDist = 0.0f;
+        glm::vec3 accumulatedColor = glm::vec3(0.0f);
+        float transmission = 1.0f;
+        RayTermination termination = RayTermination::Exhausted;
+    };
+
+    std::vector<Sample> m_Samples;
+    int m_Width = 0;
+    int m_Height = 0;
+    bool m_Valid = false;
+    SceneParams m_Scene;
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef LOGPOLAR_H
+#define LOGPOLAR_H
+
+#include "scene.h"
+
+#include <vector>
+
+// Polar sampling grid centred on the hole's image. Detail in these frames is
+// radial, it piles up in thin rings around the shadow and thins out towards
+// the edges, so rays are spent the same way.
+//
+// Sample (i, j) sits at angle angularStep * (i + 0.5) and radius
+// inner * (exp(radialStep * (j + 0.5)) - 1) pixels from center. Rings are
+// about evenly spaced inside the apparent photon ring radius (inner) and
+// spread in proportion to the radius beyond it. The rings themselves are
+// smooth along their length, so cells are CELL_ASPECT times longer than
+// they are deep. Positions are in pixels with pixel centers at x + 0.5, so
+// a sample's texCoord is its position over the frame size.
+struct LogPolarGrid {
+    static constexpr float CELL_ASPECT = 8.0f;
+
+    glm::vec2 center = glm::vec2(0.0f);
+    float inner = 1.0f;
+    float angularStep = 1.0f;       // 2pi / angular
+    float radialStep = 1.0f;
+    int angular = 0;
+    int radial = 0;
+
+    // quality is rays per output pixel, the grid gets about that many
+    // rays in total whatever the hole's size on screen
+    static LogPolarGrid Build(const SceneParams& scene, int width, int height, float quality);
+
+    glm::vec2 SamplePosition(int i, int j) const;
+    // Continuous grid coordinates of a frame position, sample (i, j) at (i, j)
+    glm::vec2 GridCoordinate(const glm::vec2& position) const;
+    // Rays further out than this from the frame are never seen, not even
+    // through the bilinear footprint of the resample
+    bool IsVisible(const glm::vec2& position, int width, int height) const;
+
+    int Count() const { return angular * radial; }
+};
+
+namespace LogPolar {
+    // Bilinear resample of an RGB grid (angular fastest) onto a width x
+    // height RGB frame, bottom row first
+    void Resample(const LogPolarGrid& grid, const std::vector<float>& samples, int width, int height,
+                  std::vector<float>& pixels);
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef OFFSCREEN_H
+#define OFFSCREEN_H
+
+#include "boiler.hpp"
+
+// OpenGL core context without a window, for CI and render boxes with no
+// display. Uses Mesa's surfaceless EGL platform where there is one and the
+// default EGL display with a 1x1 pbuffer otherwise. With
+// LIBGL_ALWAYS_SOFTWARE=1 Mesa runs it on llvmpipe, so no GPU is needed either.
+class OffscreenContext {
+public:
+    OffscreenContext() {}
+    ~OffscreenContext();
+
+    OffscreenContext(const OffscreenContext&) = delete;
+    OffscreenContext& operator=(const OffscreenContext&) = delete;
+
+    // Makes the context current and loads the GL functions with glad
+    bool Create(int major = 4, int minor = 0);
+    bool IsValid() const { return m_Context != nullptr; }
+
+private:
+    void* m_Display = nullptr;  // EGLDisplay
+    void* m_Context = nullptr;  // EGLContext
+    void* m_Surface = nullptr;  // EGLSurface, only without the surfaceless platform
+};
+
+// Framebuffer Display draws into in place of a window, any size
+class OffscreenTarget {
+public:
+    OffscreenTarget(int width, int height);
+    ~OffscreenTarget();
+
+    OffscreenTarget(const OffscreenTarget&) = delete;
+    OffscreenTarget& operator=(const OffscreenTarget&) = delete;
+
+    // Binds the framebuffer for drawing and reading and sets the viewport
+    void Bind() const;
+
+    // Getters
+    int GetWidth() const { return m_Width; }
+    int GetHeight() const { return m_Height; }
+    GLuint GetFramebuffer() const { return m_FBO; }
+
+private:
+    GLuint m_FBO = 0;
+    GLuint m_ColorTextureID = 0;
+    int m_Width, m_Height;
+};
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef PACKET_H
+#define PACKET_H
+
+#include "ray.h"
+#include "scene.h"
+
+// SIMD ray-packet kernels, picked at runtime from what the CPU supports
+enum class PacketKernel {
+    Auto,
+    Scalar,
+    AVX2,     // 8 lanes
+    AVX512    // 16 lanes
+};
+
+namespace Packet {
+    // Best kernel this CPU (and this build) can run
+    PacketKernel Detect();
+    bool IsSupported(PacketKernel kernel);
+
+    int Width(PacketKernel kernel);
+    const char* Name(PacketKernel kernel);
+
+    // Marches every lane of the packet until it is captured, escapes,
+    // turns opaque or runs out of steps. Same per-ray rules as blackhole.frag.
+    void March(PacketKernel kernel, const SceneParams& scene, RayPacket& packet);
+}
+
+#endif
@@ -0,0 +1,485 @@
+#ifndef PACKET_MARCH_H
+#define PACKET_MARCH_H
+
+// Lane-generic march loop shared by the SIMD kernels. Only include this from
+// the per-ISA translation units (packet_avx2.cpp, packet_avx512.cpp), which
+// define the lane type L before instantiating MarchPacket<L>:
+//   L::WIDTH, L::Float (with + - * / operators), L::Mask,
+//   Set, Load, Store, Sqrt, Min, Max, Less, Greater, And, Or, AndNot,
+//   Select(mask, a, b), Bits, FirstLanes.
+
+#include "physics.h"
+#include "ray.h"
+#include "scene.h"
+
+#include <algorithm>
+#include <cmath>
+
+template <typename F>
+struct LaneVec3 {
+    F x, y, z;
+};
+
+template <typename F>
+inline LaneVec3<F> operator+(const LaneVec3<F>& a, const LaneVec3<F>& b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+template <typename F>
+inline LaneVec3<F> operator-(const LaneVec3<F>& a, const LaneVec3<F>& b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+template <typename F>
+inline LaneVec3<F> operator*(const F& s, const LaneVec3<F>& a) { return { s * a.x, s * a.y, s * a.z }; }
+template <typename F>
+inline F Dot(const LaneVec3<F>& a, const LaneVec3<F>& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+template <typename L>
+inline LaneVec3<typename L::Float> SelectVec3(typename L::Mask m, const LaneVec3<typename L::Float>& a,
+                                             const LaneVec3<typename L::Float>& b) {
+    return { L::Select(m, a.x, b.x), L::Select(m, a.y, b.y), L::Select(m, a.z, b.z) };
+}
+
+template <typename L>
+inline LaneVec3<typename L::Float> PacketGeodesicAcceleration(const SceneParams& scene,
+                                                              const LaneVec3<typename L::Float>& loc,
+                                                              const LaneVec3<typename L::Float>& vel) {
+    using F = typename L::Float;
+    LaneVec3<F> bhPos = { L::Set(scene.bhPos.x), L::Set(scene.bhPos.y), L::Set(scene.bhPos.z) };
+
+    LaneVec3<F> relativeLoc = loc - bhPos;
+    F r = L::Max(L::Sqrt(Dot(relativeLoc, relativeLoc)), L::Set(0.001f));
+
+    F factor = L::Set(1.0f) - L::Set(scene.bhRadius) / r;
+
+    F invR = L::Set(1.0f) / r;
+    LaneVec3<F> nLoc = invR * relativeLoc;
+
+    F radial = L::Set(-1.5f * Constants::G * scene.bhMass) / (r * r * factor)
+             * (Dot(vel, vel) * L::Set(1.0f / (Constants::c * Constants::c)) - factor);
+    F tangential = Dot(vel, nLoc) / (r * factor);
+
+    return radial * nLoc + tangential * vel;
+}
+
+template <typename L>
+inline LaneVec3<typename L::Float> PacketNewtonianAcceleration(const SceneParams& scene,
+                                                               const LaneVec3<typename L::Float>& loc) {
+    using F = typename L::Float;
+    LaneVec3<F> bhPos = { L::Set(scene.bhPos.x), L::Set(scene.bhPos.y), L::Set(scene.bhPos.z) };
+
+    LaneVec3<F> dir = bhPos - loc;
+    F d2 = Dot(dir, dir);
+    F d3 = d2 * L::Sqrt(d2);
+    return (L::Set(Constants::G * scene.bhMass) / d3) * dir;
+}
+
+template <typename L, bool Relativity>
+inline void PacketRK4(const SceneParams& scene, LaneVec3<typename L::Float>& loc,
+                      LaneVec3<typename L::Float>& vel, typename L::Float c_dt) {
+    using F = typename L::Float;
+    auto accel = [&](const LaneVec3<F>& x, const LaneVec3<F>& v) {
+        return Relativity ? PacketGeodesicAcceleration<L>(scene, x, v)
+                          : PacketNewtonianAcceleration<L>(scene, x);
+    };
+
+    F half = c_dt * L::Set(0.5f);
+
+    LaneVec3<F> k1v = accel(loc, vel);
+    LaneVec3<F> k1x = vel;
+
+    LaneVec3<F> k2x = vel + half * k1v;
+    LaneVec3<F> k2v = accel(loc + half * k1x, k2x);
+
+    LaneVec3<F> k3x = vel + half * k2v;
+    LaneVec3<F> k3v = accel(loc + half * k2x, k3x);
+
+    LaneVec3<F> k4x = vel + c_dt * k3v;
+    LaneVec3<F> k4v = accel(loc + c_dt * k3x, k4x);
+
+    F sixth = c_dt * L::Set(1.0f / 6.0f);
+    F two = L::Set(2.0f);
+    loc = loc + sixth * (k1x + two * k2x + two * k3x + k4x);
+    vel = vel + sixth * (k1v + two * k2v + two * k3v + k4v);
+
+    F scale = L::Set(Constants::c) / L::Sqrt(Dot(vel, vel));
+    vel = scale * vel;
+}
+
+template <typename L>
+inline void PacketSetTermination(RayPacket& packet, typename L::Mask mask, RayTermination termination) {
+    int bits = L::Bits(mask);
+    for (int lane = 0; lane < L::WIDTH; lane++) {
+        if (bits & (1 << lane))
+            packet.termination[lane] = termination;
+    }
+}
+
+// Disk absorption needs exp(), so the few lanes inside the disk shell are
+// updated one at a time with the scalar code from blackhole.frag.
+template <typename L>
+inline void PacketAccumulateDisk(const SceneParams& scene, typename L::Mask inDisk,
+                                 typename L::Float bhDist, typename L::Float locY,
+                                 typename L::Float currentDt, typename L::Float& transmission,
+                                 LaneVec3<typename L::Float>& accumulated) {
+    alignas(64) float dist[L::WIDTH], height[L::WIDTH], stepDt[L::WIDTH], trans[L::WIDTH];
+    alignas(64) float accR[L::WIDTH], accG[L::WIDTH], accB[L::WIDTH];
+    L::Store(dist, bhDist);
+    L::Store(height, locY);
+    L::Store(stepDt, currentDt);
+    L::Store(trans, transmission);
+    L::Store(accR, accumulated.x);
+    L::Store(accG, accumulated.y);
+    L::Store(accB, accumulated.z);
+
+    float diskInner = scene.bhRadius * 2.0f;
+    float diskOuter = scene.bhRadius * 6.0f;
+
+    int bits = L::Bits(inDisk);
+    for (int lane = 0; lane < L::WIDTH; lane++) {
+        if (!(bits & (1 << lane)))
+            continue;
+
+        float h = std::abs(height[lane] - scene.bhPos.y);
+        float density = std::exp(-(h * h) / (scene.diskThickness * scene.diskThickness));
+
+        float radialT = (dist[lane] - diskInner) / (diskOuter - diskInner);
+        density *= 1.0f - radialT;
+
+        glm::vec3 diskColor = glm::mix(glm::vec3(1.0f, 0.7f, 0.2f), glm::vec3(0.5f, 0.1f, 0.0f), radialT);
+
+        float stepOpacity = density * stepDt[lane] * 2.0f;
+        accR[lane] += trans[lane] * diskColor.x * stepOpacity;
+        accG[lane] += trans[lane] * diskColor.y * stepOpacity;
+        accB[lane] += trans[lane] * diskColor.z * stepOpacity;
+        trans[lane] *= std::max(0.0f, 1.0f - stepOpacity);
+    }
+
+    transmission = L::Load(trans);
+    accumulated = { L::Load(accR), L::Load(accG), L::Load(accB) };
+}
+
+// Lanes that went outbound past the far-field radius froze where they were,
+// finish them with the scalar completion once the loop is done
+template <typename L>
+inline void PacketCompleteFarField(const SceneParams& scene, RayPacket& packet, int bits) {
+    for (int lane = 0; lane < L::WIDTH; lane++) {
+        if (!(bits & (1 << lane)))
+            continue;
+
+        glm::vec3 loc(packet.locX[lane], packet.locY[lane], packet.locZ[lane]);
+        glm::vec3 vel(packet.velX[lane], packet.velY[lane], packet.velZ[lane]);
+
+        RayResult result;
+        Physics::CompleteFarField(scene, loc, vel, result);
+        packet.termination[lane] = result.termination;
+        packet.velX[lane] = result.vel.x;
+        packet.velY[lane] = result.vel.y;
+        packet.velZ[lane] = result.vel.z;
+        packet.bhDist[lane] = result.bhDist;
+        packet.skippedSteps[lane] = result.skippedSteps;
+    }
+}
+
+// Step counts are kept as floats in a lane register, exact far past MAX_STEPS
+template <typename L>
+inline void PacketStoreSteps(RayPacket& packet, typename L::Float steps, int evalsPerStep, int startEvals) {
+    alignas(64) float lanes[L::WIDTH];
+    L::Store(lanes, steps);
+    for (int lane = 0; lane < packet.count; lane++) {
+        packet.steps[lane] = (int)lanes[lane];
+        packet.accelEvals[lane] = startEvals + evalsPerStep * (int)lanes[lane];
+    }
+}
+
+template <typename L, bool Relativity>
+void MarchPacketLanes(const SceneParams& scene, RayPacket& packet) {
+    using F = typename L::Float;
+    using M = typename L::Mask;
+
+    LaneVec3<F> loc = { L::Load(packet.locX), L::Load(packet.locY), L::Load(packet.locZ) };
+    LaneVec3<F> vel = { L::Load(packet.velX), L::Load(packet.velY), L::Load(packet.velZ) };
+    LaneVec3<F> accumulated = { L::Load(packet.accR), L::Load(packet.accG), L::Load(packet.accB) };
+    F transmission = L::Load(packet.transmission);
+    F escapeDist = L::Load(packet.bhDist);
+
+    LaneVec3<F> bhPos = { L::Set(scene.bhPos.x), L::Set(scene.bhPos.y), L::Set(scene.bhPos.z) };
+    F captureRadius = L::Set(scene.bhRadius * scene.bhSizeBuffer);
+    F escapeRadius = L::Set(Physics::ESCAPE_RADIUS);
+    F diskInner = L::Set(scene.bhRadius * 2.0f);
+    F diskOuter = L::Set(scene.bhRadius * 6.0f);
+    F opaqueCutoff = L::Set(0.01f);
+    F farFieldRadius = L::Set(scene.FarFieldRadius());
+    bool showDisk = scene.ShowDisk();
+    bool farField = scene.FarField();
+    int farFieldBits = 0;
+    F steps = L::Set(0.0f);
+
+    M active = L::FirstLanes(packet.count);
+
+    for (int i = 0; i < Physics::MAX_STEPS && L::Bits(active); i++) {
+        LaneVec3<F> relativeLoc = loc - bhPos;
+        F bhDist = L::Sqrt(Dot(relativeLoc, relativeLoc));
+
+        // BlackHole Collision
+        M captured = L::And(active, L::Less(bhDist, captureRadius));
+        // Escape
+        M escaped = L::And(active, L::Greater(bhDist, escapeRadius));
+
+        M finished = L::Or(captured, escaped);
+        if (L::Bits(finished)) {
+            PacketSetTermination<L>(packet, captured, RayTermination::Captured);
+            PacketSetTermination<L>(packet, escaped, RayTermination::Escaped);
+            escapeDist = L::Select(escaped, bhDist, escapeDist);
+            active = L::AndNot(active, finished);
+        }
+
+        // Outbound in the weak field, the rest of the bend is analytic
+        if (farField) {
+            M outbound = L::And(active, L::And(L::Greater(bhDist, farFieldRadius),
+                                               L::Greater(Dot(relativeLoc, vel), L::Set(0.0f))));
+            farFieldBits |= L::Bits(outbound);
+            active = L::AndNot(active, outbound);
+        }
+
+        F currentDt = L::Set(Physics::dt) * L::Min(L::Max(bhDist * L::Set(0.5f), L::Set(0.05f)), L::Set(5.0f));
+
+        // Disk Collision
+        if (showDisk) {
+            M inDisk = L::And(active, L::And(L::Greater(bhDist, diskInner), L::Less(bhDist, diskOuter)));
+            if (L::Bits(inDisk))
+                PacketAccumulateDisk<L>(scene, inDisk, bhDist, loc.y, currentDt, transmission, accumulated);
+        }
+
+        M opaque = L::And(active, L::Less(transmission, opaqueCutoff));
+        if (L::Bits(opaque)) {
+            PacketSetTermination<L>(packet, opaque, RayTermination::Opaque);
+            active = L::AndNot(active, opaque);
+        }
+
+        if (!L::Bits(active))
+            break;
+
+        // Finished lanes keep their state, only active ones take the step
+        LaneVec3<F> nextLoc = loc;
+        LaneVec3<F> nextVel = vel;
+        PacketRK4<L, Relativity>(scene, nextLoc, nextVel, currentDt);
+        loc = SelectVec3<L>(active, nextLoc, loc);
+        vel = SelectVec3<L>(active, nextVel, vel);
+        steps = steps + L::Select(active, L::Set(1.0f), L::Set(0.0f));
+    }
+
+    L::Store(packet.locX, loc.x);
+    L::Store(packet.locY, loc.y);
+    L::Store(packet.locZ, loc.z);
+    L::Store(packet.velX, vel.x);
+    L::Store(packet.velY, vel.y);
+    L::Store(packet.velZ, vel.z);
+    L::Store(packet.bhDist, escapeDist);
+    L::Store(packet.accR, accumulated.x);
+    L::Store(packet.accG, accumulated.y);
+    L::Store(packet.accB, accumulated.z);
+    L::Store(packet.transmission, transmission);
+    PacketStoreSteps<L>(packet, steps, 4, 0);
+
+    PacketCompleteFarField<L>(scene, packet, farFieldBits);
+}
+
+template <typename L, bool Relativity>
+inline LaneVec3<typename L::Float> PacketProjectedAcceleration(const SceneParams& scene,
+                                                               const LaneVec3<typename L::Float>& loc,
+                                                               const LaneVec3<typename L::Float>& vel) {
+    using F = typename L::Float;
+    LaneVec3<F> acc = Relativity ? PacketGeodesicAcceleration<L>(scene, loc, vel)
+                                 : PacketNewtonianAcceleration<L>(scene, loc);
+    F along = Dot(acc, vel) / Dot(vel, vel);
+    return acc - along * vel;
+}
+
+// Lane version of Physics::March_DormandPrince, h is per lane
+template <typename L, bool Relativity>
+inline typename L::Float PacketDormandPrince(const SceneParams& scene, const LaneVec3<typename L::Float>& loc,
+                                             const LaneVec3<typename L::Float>& vel,
+                                             const LaneVec3<typename L::Float>& k1v, typename L::Float h,
+                                             LaneVec3<typename L::Float>& outLoc,
+                                             LaneVec3<typename L::Float>& outVel,
+                                             LaneVec3<typename L::Float>& outK1v) {
+    using F = typename L::Float;
+    auto accel = [&](const LaneVec3<F>& x, const LaneVec3<F>& v) {
+        return PacketProjectedAcceleration<L, Relativity>(scene, x, v);
+    };
+    auto k = [&](float a) { return h * L::Set(a); };
+
+    const LaneVec3<F> k1x = vel;
+
+    LaneVec3<F> k2x = vel + k(1.0f / 5.0f) * k1v;
+    LaneVec3<F> k2v = accel(loc + k(1.0f / 5.0f) * k1x, k2x);
+
+    LaneVec3<F> k3x = vel + k(3.0f / 40.0f) * k1v + k(9.0f / 40.0f) * k2v;
+    LaneVec3<F> k3v = accel(loc + k(3.0f / 40.0f) * k1x + k(9.0f / 40.0f) * k2x, k3x);
+
+    LaneVec3<F> k4x = vel + k(44.0f / 45.0f) * k1v - k(56.0f / 15.0f) * k2v + k(32.0f / 9.0f) * k3v;
+    LaneVec3<F> k4v = accel(loc + k(44.0f / 45.0f) * k1x - k(56.0f / 15.0f) * k2x + k(32.0f / 9.0f) * k3x, k4x);
+
+    LaneVec3<F> k5x = vel + k(19372.0f / 6561.0f) * k1v - k(25360.0f / 2187.0f) * k2v
+                    + k(64448.0f / 6561.0f) * k3v - k(212.0f / 729.0f) * k4v;
+    LaneVec3<F> k5v = accel(loc + k(19372.0f / 6561.0f) * k1x - k(25360.0f / 2187.0f) * k2x
+                          + k(64448.0f / 6561.0f) * k3x - k(212.0f / 729.0f) * k4x, k5x);
+
+    LaneVec3<F> k6x = vel + k(9017.0f / 3168.0f) * k1v - k(355.0f / 33.0f) * k2v + k(46732.0f / 5247.0f) * k3v
+                    + k(49.0f / 176.0f) * k4v - k(5103.0f / 18656.0f) * k5v;
+    LaneVec3<F> k6v = accel(loc + k(9017.0f / 3168.0f) * k1x - k(355.0f / 33.0f) * k2x + k(46732.0f / 5247.0f) * k3x
+                          + k(49.0f / 176.0f) * k4x - k(5103.0f / 18656.0f) * k5x, k6x);
+
+    outLoc = loc + k(35.0f / 384.0f) * k1x + k(500.0f / 1113.0f) * k3x + k(125.0f / 192.0f) * k4x
+           - k(2187.0f / 6784.0f) * k5x + k(11.0f / 84.0f) * k6x;
+    outVel = vel + k(35.0f / 384.0f) * k1v + k(500.0f / 1113.0f) * k3v + k(125.0f / 192.0f) * k4v
+           - k(2187.0f / 6784.0f) * k5v + k(11.0f / 84.0f) * k6v;
+
+    LaneVec3<F> k7x = outVel;
+    LaneVec3<F> k7v = accel(outLoc, outVel);
+    outK1v = k7v;
+
+    LaneVec3<F> errLoc = k(71.0f / 57600.0f) * k1x - k(71.0f / 16695.0f) * k3x + k(71.0f / 1920.0f) * k4x
+                       - k(17253.0f / 339200.0f) * k5x + k(22.0f / 525.0f) * k6x - k(1.0f / 40.0f) * k7x;
+    LaneVec3<F> errVel = k(71.0f / 57600.0f) * k1v - k(71.0f / 16695.0f) * k3v + k(71.0f / 1920.0f) * k4v
+                       - k(17253.0f / 339200.0f) * k5v + k(22.0f / 525.0f) * k6v - k(1.0f / 40.0f) * k7v;
+
+    LaneVec3<F> bhPos = { L::Set(scene.bhPos.x), L::Set(scene.bhPos.y), L::Set(scene.bhPos.z) };
+    LaneVec3<F> relativeLoc = loc - bhPos;
+    F r = L::Max(L::Sqrt(Dot(relativeLoc, relativeLoc)), L::Set(1.0f));
+    F error = L::Max(L::Sqrt(Dot(errLoc, errLoc)) / r, L::Sqrt(Dot(errVel, errVel)) * L::Set(1.0f / Constants::c));
+    return error * L::Set(1.0f / scene.tolerance);
+}
+
+// No vector pow(), the step scale is computed lane by lane
+template <typename L>
+inline typename L::Float PacketNextStepScale(typename L::Float error) {
+    alignas(64) float lanes[L::WIDTH];
+    L::Store(lanes, error);
+    for (int lane = 0; lane < L::WIDTH; lane++)
+        lanes[lane] = Physics::NextStepScale(lanes[lane]);
+    return L::Load(lanes);
+}
+
+// Lane version of Physics::MarchRay_DormandPrince
+template <typename L, bool Relativity>
+void MarchPacketAdaptive(const SceneParams& scene, RayPacket& packet) {
+    using F = typename L::Float;
+    using M = typename L::Mask;
+
+    LaneVec3<F> loc = { L::Load(packet.locX), L::Load(packet.locY), L::Load(packet.locZ) };
+    LaneVec3<F> vel = { L::Load(packet.velX), L::Load(packet.velY), L::Load(packet.velZ) };
+    LaneVec3<F> accumulated = { L::Load(packet.accR), L::Load(packet.accG), L::Load(packet.accB) };
+    F transmission = L::Load(packet.transmission);
+    F escapeDist = L::Load(packet.bhDist);
+
+    LaneVec3<F> bhPos = { L::Set(scene.bhPos.x), L::Set(scene.bhPos.y), L::Set(scene.bhPos.z) };
+    F captureRadius = L::Set(scene.bhRadius * scene.bhSizeBuffer);
+    F escapeRadius = L::Set(Physics::ESCAPE_RADIUS);
+    F diskInner = L::Set(scene.bhRadius * 2.0f);
+    F diskOuter = L::Set(scene.bhRadius * 6.0f);
+    F opaqueCutoff = L::Set(0.01f);
+    F minStep = L::Set(Physics::MIN_ADAPTIVE_STEP);
+    F one = L::Set(1.0f);
+    F farFieldRadius = L::Set(scene.FarFieldRadius());
+    bool showDisk = scene.ShowDisk();
+    bool farField = scene.FarField();
+    int farFieldBits = 0;
+    F steps = L::Set(0.0f);
+
+    M active = L::FirstLanes(packet.count);
+
+    LaneVec3<F> startRel = loc - bhPos;
+    F h = L::Set(Physics::dt) * L::Min(L::Max(L::Sqrt(Dot(startRel, startRel)) * L::Set(0.5f), L::Set(0.05f)), L::Set(5.0f));
+    LaneVec3<F> k1v = PacketProjectedAcceleration<L, Relativity>(scene, loc, vel);
+
+    for (int i = 0; i < Physics::MAX_STEPS && L::Bits(active); i++) {
+        LaneVec3<F> relativeLoc = loc - bhPos;
+        F bhDist = L::Sqrt(Dot(relativeLoc, relativeLoc));
+
+        M captured = L::And(active, L::Less(bhDist, captureRadius));
+        M escaped = L::And(active, L::Greater(bhDist, escapeRadius));
+
+        M finished = L::Or(captured, escaped);
+        if (L::Bits(finished)) {
+            PacketSetTermination<L>(packet, captured, RayTermination::Captured);
+            PacketSetTermination<L>(packet, escaped, RayTermination::Escaped);
+            escapeDist = L::Select(escaped, bhDist, escapeDist);
+            active = L::AndNot(active, finished);
+        }
+
+        if (farField) {
+            M outbound = L::And(active, L::And(L::Greater(bhDist, farFieldRadius),
+                                               L::Greater(Dot(relativeLoc, vel), L::Set(0.0f))));
+            farFieldBits |= L::Bits(outbound);
+            active = L::AndNot(active, outbound);
+        }
+
+        if (!L::Bits(active))
+            break;
+
+        M inDisk = showDisk ? L::And(active, L::And(L::Greater(bhDist, diskInner), L::Less(bhDist, diskOuter)))
+                            : L::FirstLanes(0);
+
+        F currentDt = L::Min(h, bhDist * L::Set(0.5f));
+        if (L::Bits(inDisk)) {
+            F heuristicDt = L::Set(Physics::dt) * L::Min(L::Max(bhDist * L::Set(0.5f), L::Set(0.05f)), L::Set(5.0f));
+            currentDt = L::Select(inDisk, L::Min(currentDt, heuristicDt), currentDt);
+        }
+
+        LaneVec3<F> nextLoc, nextVel, nextK1v;
+        F error = PacketDormandPrince<L, Relativity>(scene, loc, vel, k1v, currentDt, nextLoc, nextVel, nextK1v);
+        F scale = PacketNextStepScale<L>(error);
+        steps = steps + L::Select(active, one, L::Set(0.0f));
+
+        // Rejected lanes retry with a smaller step next iteration
+        M rejected = L::And(active, L::And(L::Greater(error, one), L::Greater(currentDt, minStep)));
+        M accepted = L::AndNot(active, rejected);
+        h = L::Select(rejected, L::Max(currentDt * scale, minStep), h);
+
+        M acceptedDisk = L::And(inDisk, accepted);
+        if (L::Bits(acceptedDisk))
+            PacketAccumulateDisk<L>(scene, acceptedDisk, bhDist, loc.y, currentDt, transmission, accumulated);
+
+        M opaque = L::And(accepted, L::Less(transmission, opaqueCutoff));
+        if (L::Bits(opaque)) {
+            PacketSetTermination<L>(packet, opaque, RayTermination::Opaque);
+            active = L::AndNot(active, opaque);
+            accepted = L::AndNot(accepted, opaque);
+        }
+
+        loc = SelectVec3<L>(accepted, nextLoc, loc);
+        vel = SelectVec3<L>(accepted, nextVel, vel);
+        k1v = SelectVec3<L>(accepted, nextK1v, k1v);
+        h = L::Select(accepted, currentDt * scale, h);
+    }
+
+    L::Store(packet.locX, loc.x);
+    L::Store(packet.locY, loc.y);
+    L::Store(packet.locZ, loc.z);
+    L::Store(packet.velX, vel.x);
+    L::Store(packet.velY, vel.y);
+    L::Store(packet.velZ, vel.z);
+    L::Store(packet.bhDist, escapeDist);
+    L::Store(packet.accR, accumulated.x);
+    L::Store(packet.accG, accumulated.y);
+    L::Store(packet.accB, accumulated.z);
+    L::Store(packet.transmission, transmission);
+    PacketStoreSteps<L>(packet, steps, 6, 1);
+
+    PacketCompleteFarField<L>(scene, packet, farFieldBits);
+}
+
+template <typename L>
+void MarchPacket(const SceneParams& scene, RayPacket& packet) {
+    if (scene.AdaptiveStep()) {
+        if (scene.UseRelativity())
+            MarchPacketAdaptive<L, true>(scene, packet);
+        else
+            MarchPacketAdaptive<L, false>(scene, packet);
+        return;
+    }
+
+    if (scene.UseRelativity())
+        MarchPacketLanes<L, true>(scene, packet);
+    else
+        MarchPacketLanes<L, false>(scene, packet);
+}
+
+#endif
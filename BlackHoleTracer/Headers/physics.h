@@ -0,0 +1,809 @@
+#ifndef PHYSICS_H
+#define PHYSICS_H
+
+#include "scene.h"
+#include "ray.h"
+
+#include <algorithm>
+#include <cmath>
+
+// CPU port of the integrators in Shaders/trace.glsl. Names and constants
+// match the shader so the two can be compared side by side.
+namespace Physics {
+    constexpr float dt = 0.05f;
+    constexpr int MAX_STEPS = 4000;
+    constexpr float ESCAPE_RADIUS = 100.0f;
+
+    // Dormand-Prince step control
+    constexpr float MIN_ADAPTIVE_STEP = 1e-4f;
+    constexpr float SAFETY = 0.9f;
+    constexpr float MIN_STEP_SCALE = 0.2f;
+    constexpr float MAX_STEP_SCALE = 5.0f;
+
+    // Step in orbit angle for the Binet integrator
+    constexpr float PLANAR_STEP = 0.01f;
+
+    inline glm::vec3 NewtonianAcceleration(const SceneParams& scene, const glm::vec3& loc) {
+        glm::vec3 dir = scene.bhPos - loc;
+        float d2 = glm::dot(dir, dir);
+        float d3 = d2 * std::sqrt(d2);
+        return Constants::G * scene.bhMass * dir / d3;
+    }
+
+    inline glm::vec3 GeodesicAcceleration(const SceneParams& scene, const glm::vec3& loc, const glm::vec3& vel) {
+        glm::vec3 relativeLoc = loc - scene.bhPos;
+        float r = glm::length(relativeLoc);
+        r = std::max(r, 0.001f);
+
+        float factor = 1.0f - scene.bhRadius / r;
+
+        glm::vec3 nLoc = relativeLoc / r;
+
+        glm::vec3 dVel = -1.5f * (Constants::G * scene.bhMass / (r * r * factor))
+                       * (glm::dot(vel, vel) / (Constants::c * Constants::c) - factor) * nLoc;
+
+        dVel += (glm::dot(vel, nLoc) / (r * factor)) * vel;
+
+        return dVel;
+    }
+
+    inline void March_Geodesic_RK4(const SceneParams& scene, glm::vec3& loc, glm::vec3& vel, float c_dt) {
+        glm::vec3 k1v = GeodesicAcceleration(scene, loc, vel);
+        glm::vec3 k1x = vel;
+
+        glm::vec3 k2v = GeodesicAcceleration(scene, loc + k1x * c_dt * 0.5f, vel + k1v * c_dt * 0.5f);
+        glm::vec3 k2x = vel + k1v * c_dt * 0.5f;
+
+        glm::vec3 k3v = GeodesicAcceleration(scene, loc + k2x * c_dt * 0.5f, vel + k2v * c_dt * 0.5f);
+        glm::vec3 k3x = vel + k2v * c_dt * 0.5f;
+
+        glm::vec3 k4v = GeodesicAcceleration(scene, loc + k3x * c_dt, vel + k3v * c_dt);
+        glm::vec3 k4x = vel + k3v * c_dt;
+
+        loc += (c_dt / 6.0f) * (k1x + 2.0f * k2x + 2.0f * k3x + k4x);
+        vel += (c_dt / 6.0f) * (k1v + 2.0f * k2v + 2.0f * k3v + k4v);
+
+        vel *= Constants::c / glm::length(vel);
+    }
+
+    inline void March_Newtonian_RK4(const SceneParams& scene, glm::vec3& loc, glm::vec3& vel, float c_dt) {
+        glm::vec3 k1v = NewtonianAcceleration(scene, loc);
+        glm::vec3 k1x = vel;
+
+        glm::vec3 k2v = NewtonianAcceleration(scene, loc + c_dt / 2.0f * k1x);
+        glm::vec3 k2x = vel + c_dt / 2.0f * k1v;
+
+        glm::vec3 k3v = NewtonianAcceleration(scene, loc + c_dt / 2.0f * k2x);
+        glm::vec3 k3x = vel + c_dt / 2.0f * k2v;
+
+        glm::vec3 k4v = NewtonianAcceleration(scene, loc + c_dt * k3x);
+        glm::vec3 k4x = vel + c_dt * k3v;
+
+        vel += c_dt / 6.0f * (k1v + 2.0f * k2v + 2.0f * k3v + k4v);
+        vel = glm::normalize(vel) * Constants::c;
+
+        loc += c_dt / 6.0f * (k1x + 2.0f * k2x + 2.0f * k3x + k4x);
+    }
+
+    inline glm::vec2 DirectionToUV(const glm::vec3& dir) {
+        float phi = std::atan2(dir.z, dir.x);
+        float theta = std::asin(glm::clamp(dir.y, -1.0f, 1.0f));
+
+        float u = 1.0f - (phi + Constants::PI) / (2.0f * Constants::PI);
+        float v = theta / Constants::PI + 0.5f;
+
+        return glm::vec2(u, v);
+    }
+
+    // March_Geodesic_RK4 renormalizes |vel| to c after every step. In the
+    // limit of small steps that is the same as dropping the part of the
+    // acceleration along vel, so the adaptive integrator solves that ODE
+    // directly and |vel| stays at c without a correction.
+    inline glm::vec3 ProjectedAcceleration(const SceneParams& scene, const glm::vec3& loc, const glm::vec3& vel) {
+        glm::vec3 acc = scene.UseRelativity() ? GeodesicAcceleration(scene, loc, vel)
+                                              : NewtonianAcceleration(scene, loc);
+        return acc - (glm::dot(acc, vel) / glm::dot(vel, vel)) * vel;
+    }
+
+    // One Dormand-Prince 5(4) attempt of size h. k1v holds the acceleration
+    // at the start and gets the one at the end (first same as last), so an
+    // accepted step costs 6 acceleration evaluations. Returns the error
+    // estimate divided by the tolerance, the step is good when it is <= 1.
+    inline float March_DormandPrince(const SceneParams& scene, const glm::vec3& loc, const glm::vec3& vel,
+                                     const glm::vec3& k1v, float h, glm::vec3& outLoc, glm::vec3& outVel,
+                                     glm::vec3& outK1v) {
+        const glm::vec3 k1x = vel;
+
+        glm::vec3 k2x = vel + h * (1.0f / 5.0f) * k1v;
+        glm::vec3 k2v = ProjectedAcceleration(scene, loc + h * (1.0f / 5.0f) * k1x, k2x);
+
+        glm::vec3 k3x = vel + h * ((3.0f / 40.0f) * k1v + (9.0f / 40.0f) * k2v);
+        glm::vec3 k3v = ProjectedAcceleration(scene,
+            loc + h * ((3.0f / 40.0f) * k1x + (9.0f / 40.0f) * k2x), k3x);
+
+        glm::vec3 k4x = vel + h * ((44.0f / 45.0f) * k1v - (56.0f / 15.0f) * k2v + (32.0f / 9.0f) * k3v);
+        glm::vec3 k4v = ProjectedAcceleration(scene,
+            loc + h * ((44.0f / 45.0f) * k1x - (56.0f / 15.0f) * k2x + (32.0f / 9.0f) * k3x), k4x);
+
+        glm::vec3 k5x = vel + h * ((19372.0f / 6561.0f) * k1v - (25360.0f / 2187.0f) * k2v
+                                 + (64448.0f / 6561.0f) * k3v - (212.0f / 729.0f) * k4v);
+        glm::vec3 k5v = ProjectedAcceleration(scene,
+            loc + h * ((19372.0f / 6561.0f) * k1x - (25360.0f / 2187.0f) * k2x
+                     + (64448.0f / 6561.0f) * k3x - (212.0f / 729.0f) * k4x), k5x);
+
+        glm::vec3 k6x = vel + h * ((9017.0f / 3168.0f) * k1v - (355.0f / 33.0f) * k2v + (46732.0f / 5247.0f) * k3v
+                                 + (49.0f / 176.0f) * k4v - (5103.0f / 18656.0f) * k5v);
+        glm::vec3 k6v = ProjectedAcceleration(scene,
+            loc + h * ((9017.0f / 3168.0f) * k1x - (355.0f / 33.0f) * k2x + (46732.0f / 5247.0f) * k3x
+                     + (49.0f / 176.0f) * k4x - (5103.0f / 18656.0f) * k5x), k6x);
+
+        // 5th order solution
+        outLoc = loc + h * ((35.0f / 384.0f) * k1x + (500.0f / 1113.0f) * k3x + (125.0f / 192.0f) * k4x
+                          - (2187.0f / 6784.0f) * k5x + (11.0f / 84.0f) * k6x);
+        outVel = vel + h * ((35.0f / 384.0f) * k1v + (500.0f / 1113.0f) * k3v + (125.0f / 192.0f) * k4v
+                          - (2187.0f / 6784.0f) * k5v + (11.0f / 84.0f) * k6v);
+
+        glm::vec3 k7x = outVel;
+        glm::vec3 k7v = ProjectedAcceleration(scene, outLoc, outVel);
+        outK1v = k7v;
+
+        // Difference to the embedded 4th order solution
+        glm::vec3 errLoc = h * ((71.0f / 57600.0f) * k1x - (71.0f / 16695.0f) * k3x + (71.0f / 1920.0f) * k4x
+                              - (17253.0f / 339200.0f) * k5x + (22.0f / 525.0f) * k6x - (1.0f / 40.0f) * k7x);
+        glm::vec3 errVel = h * ((71.0f / 57600.0f) * k1v - (71.0f / 16695.0f) * k3v + (71.0f / 1920.0f) * k4v
+                              - (17253.0f / 339200.0f) * k5v + (22.0f / 525.0f) * k6v - (1.0f / 40.0f) * k7v);
+
+        // Position error is relative to the distance from the hole, velocity to c
+        float r = std::max(glm::length(loc - scene.bhPos), 1.0f);
+        return std::max(glm::length(errLoc) / r, glm::length(errVel) / Constants::c) / scene.tolerance;
+    }
+
+    inline float NextStepScale(float error) {
+        if (error <= 0.0f)
+            return MAX_STEP_SCALE;
+        return glm::clamp(SAFETY * std::pow(error, -0.2f), MIN_STEP_SCALE, MAX_STEP_SCALE);
+    }
+
+    // Same as the start of StartRay in trace.glsl, texCoord in [0, 1]
+    inline glm::vec3 PrimaryRayDirection(const SceneParams& scene, const glm::vec2& texCoord) {
+        glm::vec2 ndc = texCoord * 2.0f - 1.0f;
+        ndc.x *= scene.aspectRatio;
+
+        float fovFactor = std::tan(scene.fov * 0.5f);
+        glm::vec3 rayDirCam = glm::normalize(glm::vec3(ndc.x * fovFactor, ndc.y * fovFactor, -1.0f));
+        return glm::normalize(glm::vec3(scene.invView * glm::vec4(rayDirCam, 0.0f)));
+    }
+
+    // Direction at infinity of a ray that stays far from the hole, from
+    // integrating the sideways part of the acceleration along the straight
+    // line from loc onwards. With |v| = c the acceleration falls off as 1/r^2
+    // (Newtonian) or 1/r^3 (GeodesicAcceleration), and both integrals have
+    // closed forms.
+    inline glm::vec3 WeakFieldDirection(const SceneParams& scene, const glm::vec3& loc, const glm::vec3& vel) {
+        glm::vec3 dir = glm::normalize(vel);
+        glm::vec3 relativeLoc = loc - scene.bhPos;
+        float r = glm::length(relativeLoc);
+
+        // Distance past closest approach (negative before it) and the
+        // closest approach itself
+        float s = glm::dot(relativeLoc, dir);
+        glm::vec3 impact = relativeLoc - s * dir;
+        float b = glm::length(impact);
+
+        float strength, integral;
+        if (scene.UseRelativity()) {
+            // 1 / (r^4 f) to first order in bhRadius / r, integrals of ds / r^4
+            // and ds / r^5. Series in (b / s)^2 where the closed forms cancel.
+            strength = 1.5f * Constants::G * scene.bhMass * scene.bhRadius;
+            float b2 = b * b, s2 = s * s;
+            float r4, r5;
+            if (s > 0.0f && b < 0.3f * s) {
+                float y = b2 / s2;
+                r4 = (1.0f - y * (6.0f / 5.0f - y * (9.0f / 7.0f - y * (4.0f / 3.0f)))) / (3.0f * s2 * s);
+                r5 = (1.0f - y * (5.0f / 3.0f - y * (35.0f / 16.0f - y * (21.0f / 8.0f)))) / (4.0f * s2 * s2);
+            } else {
+                r4 = (0.5f * Constants::PI - std::atan(s / b)) / (2.0f * b2 * b) - s / (2.0f * b2 * r * r);
+                r5 = (2.0f * r * r * r - s * (2.0f * s2 + 3.0f * b2)) / (3.0f * b2 * b2 * r * r * r);
+            }
+            integral = r4 + scene.bhRadius * r5;
+        } else {
+            // Integral of ds / r^3
+            strength = Constants::G * scene.bhMass;
+            integral = s > 0.0f ? 1.0f / (r * (r + s)) : (1.0f - s / r) / (b * b);
+        }
+
+        glm::vec3 bend = -(strength * integral / (Constants::c * Constants::c)) * impact;
+        return glm::normalize(dir + bend);
+    }
+
+    // Steps the march would have needed from loc to ESCAPE_RADIUS
+    inline int EstimateFarFieldSteps(const SceneParams& scene, const glm::vec3& loc, const glm::vec3& vel) {
+        glm::vec3 relativeLoc = loc - scene.bhPos;
+        float r = glm::length(relativeLoc);
+        if (r >= ESCAPE_RADIUS)
+            return 0;
+
+        // Steps are capped at half the distance to the hole
+        if (scene.AdaptiveStep())
+            return (int)std::ceil(std::log(ESCAPE_RADIUS / r) / std::log(1.5f));
+
+        float s = glm::dot(relativeLoc, glm::normalize(vel));
+        float b2 = std::max(r * r - s * s, 0.0f);
+        float remaining = std::sqrt(ESCAPE_RADIUS * ESCAPE_RADIUS - b2) - s;
+        float step = dt * glm::clamp(r * 0.5f, 0.05f, 5.0f) * Constants::c;
+        return std::min((int)std::ceil(remaining / step), MAX_STEPS);
+    }
+
+    // Finishes an outbound ray past FarFieldRadius() as if it had been marched
+    // to ESCAPE_RADIUS and beyond
+    inline void CompleteFarField(const SceneParams& scene, const glm::vec3& loc, const glm::vec3& vel, RayResult& result) {
+        result.termination = RayTermination::Escaped;
+        result.vel = WeakFieldDirection(scene, loc, vel) * Constants::c;
+        result.bhDist = ESCAPE_RADIUS;
+        result.skippedSteps = EstimateFarFieldSteps(scene, loc, vel);
+    }
+
+    // The MarchStep loop of blackhole.frag, without the final shading
+    inline RayResult MarchRay_RK4(const SceneParams& scene, glm::vec3 loc, glm::vec3 vel) {
+        bool useRelativity = scene.UseRelativity();
+        bool showDisk = scene.ShowDisk();
+        bool farField = scene.FarField();
+        float farFieldRadius = scene.FarFieldRadius();
+
+        RayResult result;
+        float transmission = 1.0f;
+        glm::vec3 accumulatedColor = glm::vec3(0.0f);
+
+        for (int i = 0; i < MAX_STEPS; i++) {
+            float bhDist = glm::length(loc - scene.bhPos);
+
+            float diskInner = scene.bhRadius * 2.0f;
+            float diskOuter = scene.bhRadius * 6.0f;
+
+            // BlackHole Collision
+            if (bhDist < scene.bhRadius * scene.bhSizeBuffer) {
+                result.termination = RayTermination::Captured;
+                break;
+            }
+
+            // Escape
+            if (bhDist > ESCAPE_RADIUS) {
+                result.termination = RayTermination::Escaped;
+                result.bhDist = bhDist;
+                break;
+            }
+
+            // Outbound in the weak field, the rest of the bend is analytic
+            if (farField && bhDist > farFieldRadius && glm::dot(loc - scene.bhPos, vel) > 0.0f) {
+                CompleteFarField(scene, loc, vel, result);
+                result.loc = loc;
+                result.accumulatedColor = accumulatedColor;
+                result.transmission = transmission;
+                return result;
+            }
+
+            float currentDt = dt * glm::clamp(bhDist * 0.5f, 0.05f, 5.0f);
+
+            // Disk Collision
+            if (bhDist > diskInner && bhDist < diskOuter && showDisk) {
+                float height = std::abs(loc.y - scene.bhPos.y);
+                float density = std::exp(-(height * height) / (scene.diskThickness * scene.diskThickness));
+
+                float radialT = (bhDist - diskInner) / (diskOuter - diskInner);
+                density *= 1.0f - radialT;
+
+                glm::vec3 diskColor = glm::mix(glm::vec3(1.0f, 0.7f, 0.2f), glm::vec3(0.5f, 0.1f, 0.0f), radialT);
+
+                float stepOpacity = density * currentDt * 2.0f;
+                accumulatedColor += transmission * diskColor * stepOpacity;
+                transmission *= std::max(0.0f, 1.0f - stepOpacity);
+            }
+
+            if (transmission < 0.01f) {
+                result.termination = RayTermination::Opaque;
+                break;
+            }
+
+            if (useRelativity) {
+                March_Geodesic_RK4(scene, loc, vel, currentDt);
+            } else {
+                March_Newtonian_RK4(scene, loc, vel, currentDt);
+            }
+            result.steps++;
+            result.accelEvals += 4;
+        }
+
+        result.loc = loc;
+        result.vel = vel;
+        result.accumulatedColor = accumulatedColor;
+        result.transmission = transmission;
+        return result;
+    }
+
+    // Same loop with Dormand-Prince steps. Each ray keeps its own step size,
+    // rejected steps are retried smaller and count against MAX_STEPS. Inside
+    // the disk shell steps are capped at the RK4 heuristic so the disk is
+    // sampled as densely as before.
+    inline RayResult MarchRay_DormandPrince(const SceneParams& scene, glm::vec3 loc, glm::vec3 vel) {
+        bool showDisk = scene.ShowDisk();
+        bool farField = scene.FarField();
+        float farFieldRadius = scene.FarFieldRadius();
+
+        RayResult result;
+        float transmission = 1.0f;
+        glm::vec3 accumulatedColor = glm::vec3(0.0f);
+
+        float h = dt * glm::clamp(glm::length(loc - scene.bhPos) * 0.5f, 0.05f, 5.0f);
+        glm::vec3 k1v = ProjectedAcceleration(scene, loc, vel);
+        result.accelEvals = 1;
+
+        for (int i = 0; i < MAX_STEPS; i++) {
+            float bhDist = glm::length(loc - scene.bhPos);
+
+            float diskInner = scene.bhRadius * 2.0f;
+            float diskOuter = scene.bhRadius * 6.0f;
+
+            // BlackHole Collision
+            if (bhDist < scene.bhRadius * scene.bhSizeBuffer) {
+                result.termination = RayTermination::Captured;
+                break;
+            }
+
+            // Escape
+            if (bhDist > ESCAPE_RADIUS) {
+                result.termination = RayTermination::Escaped;
+                result.bhDist = bhDist;
+                break;
+            }
+
+            // Outbound in the weak field, the rest of the bend is analytic
+            if (farField && bhDist > farFieldRadius && glm::dot(loc - scene.bhPos, vel) > 0.0f) {
+                CompleteFarField(scene, loc, vel, result);
+                result.loc = loc;
+                result.accumulatedColor = accumulatedColor;
+                result.transmission = transmission;
+                return result;
+            }
+
+            bool inDisk = showDisk && bhDist > diskInner && bhDist < diskOuter;
+
+            // Never step further than half the distance to the hole
+            float currentDt = std::min(h, 0.5f * bhDist);
+            if (inDisk)
+                currentDt = std::min(currentDt, dt * glm::clamp(bhDist * 0.5f, 0.05f, 5.0f));
+
+            glm::vec3 nextLoc, nextVel, nextK1v;
+            float error = March_DormandPrince(scene, loc, vel, k1v, currentDt, nextLoc, nextVel, nextK1v);
+            result.steps++;
+            result.accelEvals += 6;
+
+            if (error > 1.0f && currentDt > MIN_ADAPTIVE_STEP) {
+                h = std::max(currentDt * NextStepScale(error), MIN_ADAPTIVE_STEP);
+                continue;
+            }
+
+            // Disk Collision
+            if (inDisk) {
+                float height = std::abs(loc.y - scene.bhPos.y);
+                float density = std::exp(-(height * height) / (scene.diskThickness * scene.diskThickness));
+
+                float radialT = (bhDist - diskInner) / (diskOuter - diskInner);
+                density *= 1.0f - radialT;
+
+                glm::vec3 diskColor = glm::mix(glm::vec3(1.0f, 0.7f, 0.2f), glm::vec3(0.5f, 0.1f, 0.0f), radialT);
+
+                float stepOpacity = density * currentDt * 2.0f;
+                accumulatedColor += transmission * diskColor * stepOpacity;
+                transmission *= std::max(0.0f, 1.0f - stepOpacity);
+            }
+
+            if (transmission < 0.01f) {
+                result.termination = RayTermination::Opaque;
+                break;
+            }
+
+            loc = nextLoc;
+            vel = nextVel;
+            k1v = nextK1v;
+            h = currentDt * NextStepScale(error);
+        }
+
+        result.loc = loc;
+        result.vel = vel;
+        result.accumulatedColor = accumulatedColor;
+        result.transmission = transmission;
+        return result;
+    }
+
+    // Plane of a Schwarzschild orbit, e1 points from the hole to the start
+    // point and e2 is perpendicular to it along the direction of motion.
+    // u = 1 / r and du = du/dphi at phi = 0.
+    struct OrbitPlane {
+        glm::vec3 e1, e2;
+        float u, du;
+    };
+
+    // False for purely radial rays, which have no plane (and no bending)
+    inline bool MakeOrbitPlane(const SceneParams& scene, const glm::vec3& loc, const glm::vec3& vel, OrbitPlane& plane) {
+        glm::vec3 relativeLoc = loc - scene.bhPos;
+        float r = glm::length(relativeLoc);
+        glm::vec3 dir = glm::normalize(vel);
+
+        plane.e1 = relativeLoc / r;
+        float radial = glm::dot(dir, plane.e1);
+        glm::vec3 perp = dir - radial * plane.e1;
+        float perpLen = glm::length(perp);
+        if (perpLen < 1e-6f)
+            return false;
+
+        plane.e2 = perp / perpLen;
+        plane.u = 1.0f / r;
+        plane.du = -radial / (r * perpLen);
+        return true;
+    }
+
+    // Binet equation for light, u'' = -u + 3Mu^2 (3M = 1.5 * bhRadius)
+    inline glm::vec2 BinetDerivative(const SceneParams& scene, const glm::vec2& state) {
+        return glm::vec2(state.y, -state.x + 1.5f * scene.bhRadius * state.x * state.x);
+    }
+
+    inline void March_Binet_RK4(const SceneParams& scene, glm::vec2& state, float dPhi) {
+        glm::vec2 k1 = BinetDerivative(scene, state);
+        glm::vec2 k2 = BinetDerivative(scene, state + k1 * dPhi * 0.5f);
+        glm::vec2 k3 = BinetDerivative(scene, state + k2 * dPhi * 0.5f);
+        glm::vec2 k4 = BinetDerivative(scene, state + k3 * dPhi);
+        state += (dPhi / 6.0f) * (k1 + 2.0f * k2 + 2.0f * k3 + k4);
+    }
+
+    // Back to 3D, state = (u, du/dphi)
+    inline glm::vec3 OrbitPosition(const SceneParams& scene, const OrbitPlane& plane, const glm::vec2& state, float phi) {
+        return scene.bhPos + (std::cos(phi) * plane.e1 + std::sin(phi) * plane.e2) / state.x;
+    }
+
+    inline glm::vec3 OrbitDirection(const OrbitPlane& plane, const glm::vec2& state, float phi) {
+        glm::vec3 radialDir = std::cos(phi) * plane.e1 + std::sin(phi) * plane.e2;
+        glm::vec3 angularDir = -std::sin(phi) * plane.e1 + std::cos(phi) * plane.e2;
+        return glm::normalize(-state.y * radialDir + state.x * angularDir);
+    }
+
+    // u^2 (1 - 2Mu), a ray at u with u' = du/dphi has 1/b^2 = u'^2 + V(u)
+    inline float OrbitPotential(const SceneParams& scene, float u) {
+        return u * u * (1.0f - scene.bhRadius * u);
+    }
+
+    // Positive half of the 8 point Gauss-Legendre rule on [-1, 1]
+    constexpr float GAUSS_NODES[4] = { 0.1834346425f, 0.5255324099f, 0.7966664774f, 0.9602898565f };
+    constexpr float GAUSS_WEIGHTS[4] = { 0.3626837834f, 0.3137066459f, 0.2223810345f, 0.1012285363f };
+
+    // Whether the conserved impact parameter already decides that the ray
+    // falls in. The potential peaks at the photon sphere r = 3M, which for
+    // b = 3 sqrt(3) M is exactly 1/b^2. If the capture radius sits outside
+    // the photon sphere the barrier that matters is at the capture radius.
+    inline bool IsCaptureCertain(const SceneParams& scene, const glm::vec2& state) {
+        float uCapture = 1.0f / (scene.bhRadius * scene.bhSizeBuffer);
+        float uPhoton = 1.0f / (1.5f * scene.bhRadius);
+        float uPeak = std::min(uCapture, uPhoton);
+
+        float invB2 = state.y * state.y + OrbitPotential(scene, state.x);
+        bool inward = state.y > 0.0f;
+
+        // Outside the barrier: inward rays fall in when they clear it
+        if (state.x < uPeak)
+            return inward && invB2 > OrbitPotential(scene, uPeak);
+
+        // Inside the photon sphere: inward rays always fall in, outward ones
+        // turn back unless they clear the barrier
+        return inward || invB2 <= OrbitPotential(scene, uPhoton);
+    }
+
+    // Binet steps an inward captured ray would have taken to reach the
+    // capture radius, dphi = du / sqrt(1/b^2 - V(u)) by 8 point Gauss-Legendre
+    inline int EstimateCaptureSteps(const SceneParams& scene, const glm::vec2& state) {
+        if (state.y <= 0.0f)
+            return 0;
+
+        float invB2 = state.y * state.y + OrbitPotential(scene, state.x);
+        float uStart = state.x;
+        float uEnd = 1.0f / (scene.bhRadius * scene.bhSizeBuffer);
+        float halfWidth = 0.5f * (uEnd - uStart);
+        float center = 0.5f * (uEnd + uStart);
+
+        float phi = 0.0f;
+        for (int i = 0; i < 4; i++) {
+            for (float sign : { -1.0f, 1.0f }) {
+                float u = center + sign * halfWidth * GAUSS_NODES[i];
+                phi += GAUSS_WEIGHTS[i] / std::sqrt(std::max(invB2 - OrbitPotential(scene, u), 1e-12f));
+            }
+        }
+        phi *= halfWidth;
+
+        return std::clamp((int)(phi / PLANAR_STEP), 1, MAX_STEPS);
+    }
+
+    // Orbit angle an outbound ray still turns through on its way from u to 0,
+    // dphi = du / sqrt(1/b^2 - V(u)). Near periapsis u_p the integrand has an
+    // inverse square root, substituting u = u_p (1 - t^2) makes it smooth.
+    // Steep rays are nowhere near one and substitute about the start instead.
+    inline float RemainingOrbitAngle(const SceneParams& scene, const glm::vec2& state) {
+        float u0 = state.x;
+        float du2 = state.y * state.y;
+        float rs = scene.bhRadius;
+        float slope = 2.0f * u0 - 3.0f * rs * u0 * u0;
+
+        // Periapsis by Newton's method on V(u0 + d) - V(u0) = u'^2, only for
+        // rays that turn well short of the photon sphere
+        float uPhoton = 1.0f / (1.5f * rs);
+        float headroom = OrbitPotential(scene, uPhoton) - OrbitPotential(scene, u0);
+        float uPeak = u0;
+        if (du2 < 0.5f * slope * u0 && du2 < 0.5f * headroom) {
+            float d = du2 / slope;
+            for (int i = 0; i < 4; i++) {
+                float rise = d * ((2.0f * u0 + d) - rs * (3.0f * u0 * u0 + 3.0f * u0 * d + d * d));
+                float riseSlope = 2.0f * (u0 + d) - 3.0f * rs * (u0 + d) * (u0 + d);
+                d = glm::clamp(d - (rise - du2) / riseSlope, 0.0f, uPhoton - u0);
+            }
+            uPeak = u0 + d;
+        }
+
+        float tStart = std::sqrt(std::max(1.0f - u0 / uPeak, 0.0f));
+        float halfWidth = 0.5f * (1.0f - tStart);
+        float center = 0.5f * (1.0f + tStart);
+
+        // 1/b^2 - V(u) = rest + V(uPeak) - V(u), the difference factored so
+        // it keeps precision near t = 0
+        float rest = (uPeak == u0) ? du2 : 0.0f;
+
+        float phi = 0.0f;
+        for (int i = 0; i < 4; i++) {
+            for (float sign : { -1.0f, 1.0f }) {
+                float t = center + sign * halfWidth * GAUSS_NODES[i];
+                float u = uPeak * (1.0f - t * t);
+                float drop = uPeak * t * t * ((uPeak + u) - rs * (uPeak * uPeak + uPeak * u + u * u));
+                phi += GAUSS_WEIGHTS[i] * 2.0f * uPeak * t / std::sqrt(rest + drop);
+            }
+        }
+        return halfWidth * phi;
+    }
+
+    // Impact parameter above which a ray skips the march. From the tolerance
+    // the first omitted term of each approximation sets it: about 180 (M/b)^4
+    // for the orbit series below, and twice the squared bend of the straight
+    // line integral in WeakFieldDirection. Never lets a ray reach the disk.
+    inline float WeakFieldImpact(const SceneParams& scene) {
+        float M = Constants::G * scene.bhMass / (Constants::c * Constants::c);
+        float multiple = scene.weakFieldThreshold;
+        if (multiple <= 0.0f) {
+            float tolerance = std::max(scene.weakFieldTolerance, 1e-7f);
+            if (scene.PlanarOrbit())
+                multiple = std::pow(180.0f / tolerance, 0.25f);
+            else if (scene.UseRelativity())
+                multiple = std::sqrt(1.5f * Constants::PI / std::sqrt(0.5f * tolerance));
+            else
+                multiple = 2.0f / std::sqrt(0.5f * tolerance);
+        }
+
+        float impact = multiple * M;
+        if (scene.ShowDisk())
+            impact = std::max(impact, scene.bhRadius * 7.0f);
+        return impact;
+    }
+
+    // Orbit angle from the camera to infinity in the weak field. The Binet
+    // integral dphi = dw / sqrt(1 - w^2 + 2m w^3), w = b u and m = M / b,
+    // expanded to third order in m. From infinity to periapsis it is
+    // pi/2 + 2m + 15pi/8 m^2 + 64/3 m^3 (half the usual bending series), the
+    // camera side adds terms that grow as the ray leaves it tangentially.
+    // errorEstimate is the size of the first omitted terms.
+    inline float WeakFieldOrbitAngle(float m, float w, bool inward, float& errorEstimate) {
+        float v = 1.0f - w * w;
+        float sv = std::sqrt(v);
+        float theta = std::asin(w);
+        float tn = w / sv;
+
+        float j1 = 1.0f / sv + sv - 2.0f;
+        float j2 = tn * tn * tn / 3.0f - 2.0f * tn + 2.5f * theta - 0.5f * w * sv;
+        float j3 = 0.2f / (v * v * sv) - 4.0f / (3.0f * v * sv) + 6.0f / sv + 4.0f * sv - v * sv / 3.0f - 128.0f / 15.0f;
+
+        float m2 = m * m;
+        float cameraSide = theta - m * j1 + 1.5f * m2 * j2 - 2.5f * m2 * m * j3;
+        float periapsisSide = 0.5f * Constants::PI + m * (2.0f + m * (15.0f * Constants::PI / 8.0f + m * (64.0f / 3.0f)));
+
+        float m4 = m2 * m2;
+        errorEstimate = 0.3f * m4 / (v * v * v * sv);
+        if (!inward)
+            return cameraSide;
+
+        errorEstimate += 180.0f * m4;
+        return 2.0f * periapsisSide - cameraSide;
+    }
+
+    // Resolves a ray that never gets near the hole without marching it.
+    // False if it passes inside WeakFieldImpact or the estimate is too rough.
+    inline bool TryWeakField(const SceneParams& scene, const glm::vec3& loc, const glm::vec3& vel, RayResult& result) {
+        glm::vec3 relativeLoc = loc - scene.bhPos;
+        float r = glm::length(relativeLoc);
+        glm::vec3 dir = glm::normalize(vel);
+
+        glm::vec3 e1 = relativeLoc / r;
+        float radial = glm::dot(dir, e1);
+        glm::vec3 perp = dir - radial * e1;
+        float perpLen = glm::length(perp);
+
+        float impact = r * perpLen;
+        if (impact < WeakFieldImpact(scene) || r > ESCAPE_RADIUS)
+            return false;
+
+        glm::vec3 escapeDir;
+        float errorEstimate;
+        if (scene.PlanarOrbit()) {
+            // The Binet start state of MakeOrbitPlane, u' = -u cot(alpha), has
+            // 1/b^2 = u^2 (1 / sin^2(alpha) - 2Mu), slightly above r sin(alpha)
+            float M = 0.5f * scene.bhRadius;
+            float u = 1.0f / r;
+            float b = r * perpLen / std::sqrt(1.0f - 2.0f * M * u * perpLen * perpLen);
+            float phi = WeakFieldOrbitAngle(M / b, b * u, radial < 0.0f, errorEstimate);
+            glm::vec3 e2 = perp / perpLen;
+            escapeDir = std::cos(phi) * e1 + std::sin(phi) * e2;
+            result.skippedSteps = std::max((int)(phi / PLANAR_STEP), 1);
+        } else {
+            escapeDir = WeakFieldDirection(scene, loc, vel);
+            float bend = glm::length(glm::cross(escapeDir, dir));
+            errorEstimate = 2.0f * bend * bend;
+            result.skippedSteps = EstimateFarFieldSteps(scene, loc, vel);
+        }
+
+        if (errorEstimate > scene.weakFieldTolerance) {
+            result.skippedSteps = 0;
+            return false;
+        }
+
+        result.termination = RayTermination::Escaped;
+        result.loc = loc;
+        result.vel = escapeDir * Constants::c;
+        result.bhDist = ESCAPE_RADIUS;
+        return true;
+    }
+
+    // Schwarzschild light rays stay in one plane, so instead of the 6D state
+    // of March_Geodesic_RK4 this integrates u(phi) and rotates the result back.
+    inline RayResult MarchRay_Planar(const SceneParams& scene, const glm::vec3& startLoc, const glm::vec3& startVel) {
+        bool showDisk = scene.ShowDisk();
+
+        RayResult result;
+        result.loc = startLoc;
+        result.vel = startVel;
+
+        float startDist = glm::length(startLoc - scene.bhPos);
+        float captureRadius = scene.bhRadius * scene.bhSizeBuffer;
+        if (startDist < captureRadius) {
+            result.termination = RayTermination::Captured;
+            return result;
+        }
+        if (startDist > ESCAPE_RADIUS) {
+            result.termination = RayTermination::Escaped;
+            result.bhDist = startDist;
+            return result;
+        }
+
+        OrbitPlane plane;
+        if (!MakeOrbitPlane(scene, startLoc, startVel, plane)) {
+            // Radial rays fall straight in or leave unbent
+            bool inward = glm::dot(startVel, startLoc - scene.bhPos) < 0.0f;
+            result.termination = inward ? RayTermination::Captured : RayTermination::Escaped;
+            result.bhDist = ESCAPE_RADIUS;
+            return result;
+        }
+
+        float transmission = 1.0f;
+        glm::vec3 accumulatedColor = glm::vec3(0.0f);
+
+        float diskInner = scene.bhRadius * 2.0f;
+        float diskOuter = scene.bhRadius * 6.0f;
+
+        glm::vec2 state(plane.u, plane.du);
+        float phi = 0.0f;
+
+        // Rays aimed inside the shadow are done before the first step, the
+        // disk can still add light in front of the hole so it needs the march
+        if (!showDisk && IsCaptureCertain(scene, state)) {
+            result.termination = RayTermination::Captured;
+            result.skippedSteps = EstimateCaptureSteps(scene, state);
+            return result;
+        }
+
+        float uPhoton = 1.0f / (1.5f * scene.bhRadius);
+        bool farField = scene.FarField();
+        float uFarField = 1.0f / scene.FarFieldRadius();
+
+        for (int i = 0; i < MAX_STEPS; i++) {
+            // BlackHole Collision, or heading inward below the photon sphere
+            // which nothing comes back from
+            if (state.x > 1.0f / captureRadius || (state.x > uPhoton && state.y > 0.0f)) {
+                if (state.x <= 1.0f / captureRadius)
+                    result.skippedSteps = EstimateCaptureSteps(scene, state);
+                result.termination = RayTermination::Captured;
+                break;
+            }
+
+            // Escape, also catches u passing through 0 within one step
+            if (state.x < 1.0f / ESCAPE_RADIUS) {
+                result.termination = RayTermination::Escaped;
+                break;
+            }
+
+            // Outbound in the weak field, the rest of the orbit angle is a quadrature
+            if (farField && state.x < uFarField && state.y < 0.0f) {
+                float remainingPhi = RemainingOrbitAngle(scene, state);
+                float endPhi = phi + remainingPhi;
+
+                result.termination = RayTermination::Escaped;
+                result.loc = OrbitPosition(scene, plane, state, phi);
+                result.vel = (std::cos(endPhi) * plane.e1 + std::sin(endPhi) * plane.e2) * Constants::c;
+                result.bhDist = ESCAPE_RADIUS;
+                result.accumulatedColor = accumulatedColor;
+                result.transmission = transmission;
+
+                // The march would have stopped at u = 1 / ESCAPE_RADIUS, a
+                // straight line's worth short of u = 0
+                float amplitude = std::sqrt(state.x * state.x + state.y * state.y);
+                float escapePhi = remainingPhi - std::asin(std::min(1.0f / (ESCAPE_RADIUS * amplitude), 1.0f));
+                result.skippedSteps = std::max((int)(escapePhi / PLANAR_STEP), 1);
+                return result;
+            }
+
+            // Disk Collision, path length of this step is ds = r sqrt(1 + (u'/u)^2) dphi
+            if (showDisk) {
+                float bhDist = 1.0f / state.x;
+                if (bhDist > diskInner && bhDist < diskOuter) {
+                    glm::vec3 loc = OrbitPosition(scene, plane, state, phi);
+                    float ds = PLANAR_STEP * bhDist * std::sqrt(1.0f + (state.y * state.y) / (state.x * state.x));
+
+                    float height = std::abs(loc.y - scene.bhPos.y);
+                    float density = std::exp(-(height * height) / (scene.diskThickness * scene.diskThickness));
+
+                    float radialT = (bhDist - diskInner) / (diskOuter - diskInner);
+                    density *= 1.0f - radialT;
+
+                    glm::vec3 diskColor = glm::mix(glm::vec3(1.0f, 0.7f, 0.2f), glm::vec3(0.5f, 0.1f, 0.0f), radialT);
+
+                    float stepOpacity = density * ds * 2.0f;
+                    accumulatedColor += transmission * diskColor * stepOpacity;
+                    transmission *= std::max(0.0f, 1.0f - stepOpacity);
+                }
+            }
+
+            if (transmission < 0.01f) {
+                result.termination = RayTermination::Opaque;
+                break;
+            }
+
+            March_Binet_RK4(scene, state, PLANAR_STEP);
+            phi += PLANAR_STEP;
+            result.steps++;
+            result.accelEvals += 4;
+        }
+
+        // u can dip to or below 0 on the last step, clamp before going back to 3D
+        glm::vec2 endState(std::max(state.x, 1.0f / (2.0f * ESCAPE_RADIUS)), state.y);
+        result.loc = OrbitPosition(scene, plane, endState, phi);
+        result.vel = OrbitDirection(plane, endState, phi) * Constants::c;
+        result.bhDist = 1.0f / endState.x;
+        result.accumulatedColor = accumulatedColor;
+        result.transmission = transmission;
+        return result;
+    }
+
+    inline RayResult MarchRay(const SceneParams& scene, const glm::vec3& loc, const glm::vec3& vel) {
+        RayResult result;
+        if (scene.WeakField() && TryWeakField(scene, loc, vel, result))
+            return result;
+
+        if (scene.PlanarOrbit())
+            return MarchRay_Planar(scene, loc, vel);
+        if (scene.AdaptiveStep())
+            return MarchRay_DormandPrince(scene, loc, vel);
+        return MarchRay_RK4(scene, loc, vel);
+    }
+}
+
+#endif
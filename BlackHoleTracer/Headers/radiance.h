@@ -0,0 +1,37 @@
+#ifndef RADIANCE_H
+#define RADIANCE_H
+
+#include "skybox.h"
+
+#include <cstddef>
+#include <vector>
+
+// Where the scanlines of a Radiance .hdr (RGBE) sit in its bytes. The
+// scanlines of a run length encoded file only have a length once they are
+// walked, so they are found in one cheap pass over the run headers and then
+// decoded on every core at once.
+//
+// Only the "-Y <height> +X <width>" orientation is read, as stbi_loadf. Old
+// style RLE and files that mix encodings are rejected and left to stb.
+struct RadianceImage {
+    int width = 0;
+    int height = 0;
+    bool encoded = false;               // new style RLE, otherwise 4 bytes a pixel
+    const unsigned char* data = nullptr;
+    std::vector<size_t> scanlines;      // offset of every scanline, top first, then the end
+
+    bool IsValid() const { return height > 0 && (int)scanlines.size() == height + 1; }
+};
+
+namespace Radiance {
+    // "#?RADIANCE" or "#?RGBE"
+    bool IsRadiance(const unsigned char* data, size_t size);
+    // Reads the header and finds every scanline, data must outlive the image
+    bool Index(const unsigned char* data, size_t size, RadianceImage& image);
+    // Decodes into width * height texels of format, bottom row first as the
+    // texture uploads want. Texels come out as stbi_loadf gives them, then
+    // encoded. threadCount 0 uses every core.
+    void Decode(const RadianceImage& image, SkyFormat format, void* pixels, int threadCount = 0);
+}
+
+#endif
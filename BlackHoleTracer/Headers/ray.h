@@ -0,0 +1,97 @@
+#ifndef RAY_H
+#define RAY_H
+
+#include "boiler.hpp"
+
+#include <cstdint>
+
+// Why the march loop in blackhole.frag stopped for a ray
+enum class RayTermination : uint8_t {
+    Captured,   // bhDist < bhRadius * bhSizeBuffer
+    Escaped,    // bhDist > ESCAPE_RADIUS, sample the sky along vel
+    Opaque,     // disk transmission dropped below 0.01
+    Exhausted   // ran out of MAX_STEPS
+};
+
+// State of a single ray after marching, everything the shading step needs
+struct RayResult {
+    RayTermination termination = RayTermination::Exhausted;
+    glm::vec3 loc = glm::vec3(0.0f);
+    glm::vec3 vel = glm::vec3(0.0f);
+    float bhDist = 0.0f;
+
+    glm::vec3 accumulatedColor = glm::vec3(0.0f);
+    float transmission = 1.0f;
+
+    // Estimated march steps saved by resolving the ray analytically
+    int skippedSteps = 0;
+
+    // Cost of the march, rejected adaptive steps included
+    int steps = 0;
+    int accelEvals = 0;
+};
+
+// Structure-of-arrays batch of rays marched together by the SIMD kernels.
+// Lanes at or past count are ignored, see FillTail.
+constexpr int MAX_PACKET_WIDTH = 16;
+
+struct RayPacket {
+    int count = 0;
+
+    alignas(64) float locX[MAX_PACKET_WIDTH];
+    alignas(64) float locY[MAX_PACKET_WIDTH];
+    alignas(64) float locZ[MAX_PACKET_WIDTH];
+    alignas(64) float velX[MAX_PACKET_WIDTH];
+    alignas(64) float velY[MAX_PACKET_WIDTH];
+    alignas(64) float velZ[MAX_PACKET_WIDTH];
+    alignas(64) float bhDist[MAX_PACKET_WIDTH];
+
+    alignas(64) float accR[MAX_PACKET_WIDTH];
+    alignas(64) float accG[MAX_PACKET_WIDTH];
+    alignas(64) float accB[MAX_PACKET_WIDTH];
+    alignas(64) float transmission[MAX_PACKET_WIDTH];
+
+    RayTermination termination[MAX_PACKET_WIDTH];
+    int skippedSteps[MAX_PACKET_WIDTH];
+    int steps[MAX_PACKET_WIDTH];
+    int accelEvals[MAX_PACKET_WIDTH];
+
+    void SetRay(int lane, const glm::vec3& loc, const glm::vec3& vel) {
+        locX[lane] = loc.x; locY[lane] = loc.y; locZ[lane] = loc.z;
+        velX[lane] = vel.x; velY[lane] = vel.y; velZ[lane] = vel.z;
+        bhDist[lane] = 0.0f;
+        accR[lane] = accG[lane] = accB[lane] = 0.0f;
+        transmission[lane] = 1.0f;
+        termination[lane] = RayTermination::Exhausted;
+        skippedSteps[lane] = 0;
+        steps[lane] = 0;
+        accelEvals[lane] = 0;
+    }
+
+    // Lanes past count are still loaded and stepped, only masked out. Left
+    // uninitialized they can hold NaN or denormals, which slow every step.
+    // They are zeroed and take the first lane's position and velocity, as a
+    // zero vel would be divided by its length.
+    void FillTail(int width) {
+        if (count == 0)
+            return;
+        for (int lane = count; lane < width; lane++)
+            SetRay(lane, glm::vec3(locX[0], locY[0], locZ[0]), glm::vec3(velX[0], velY[0], velZ[0]));
+    }
+
+    RayResult GetResult(int lane) const {
+        RayResult result;
+        result.termination = termination[lane];
+        result.loc = glm::vec3(locX[lane], locY[lane], locZ[lane]);
+        result.vel = glm::vec3(velX[lane], velY[lane], velZ[lane]);
+        result.bhDist = bhDist[lane];
+        result.accumulatedColor = glm::vec3(accR[lane], accG[lane], accB[lane]);
+        result.transmission = transmission[lane];
+        result.skippedSteps = skippedSteps[lane];
+        result.steps = steps[lane];
+        result.accelEvals = accelEvals[lane];
+        return result;
+    }
+};
+
+#endif
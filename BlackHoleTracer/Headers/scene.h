@@ -0,0 +1,102 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "boiler.hpp"
+#include "camera.h"
+#include "blackhole.h"
+
+#include <algorithm>
+#include <cstdint>
+
+// Bit layout of the "flags" uniform (see RenderScene in main.cpp)
+namespace SceneFlags {
+    constexpr uint32_t USE_RELATIVITY = 1u << 0;
+    constexpr uint32_t SHOW_DISK = 1u << 1;
+    constexpr uint32_t ADAPTIVE_STEP = 1u << 2;
+    constexpr uint32_t PLANAR_ORBIT = 1u << 3;
+    constexpr uint32_t DEFLECTION_TABLE = 1u << 4;
+    constexpr uint32_t FAR_FIELD = 1u << 5;
+    constexpr uint32_t WEAK_FIELD = 1u << 6;
+}
+
+// Everything blackhole.frag reads from its uniforms, so the CPU tracer can
+// reproduce a frame without a GL context.
+struct SceneParams {
+    glm::vec3 camPos = glm::vec3(0.0f);
+    glm::mat4 invView = glm::mat4(1.0f);
+    float fov = glm::radians(90.0f);
+    float aspectRatio = ViewportConfig::VIEWPORT_WIDTH / ViewportConfig::VIEWPORT_HEIGHT;
+
+    glm::vec3 bhPos = glm::vec3(0.0f);
+    float bhMass = 1.0f;
+    float bhRadius = 2.0f;
+
+    float bhSizeBuffer = 1.08f;
+    float diskThickness = 0.2f;
+    uint32_t flags = SceneFlags::USE_RELATIVITY;
+
+    // Local error allowed per step by the adaptive integrator
+    float tolerance = 1e-4f;
+
+    // Outbound rays past this distance finish with the analytic far-field bend
+    float farFieldRadius = 30.0f;
+
+    // Rays passing further than weakFieldThreshold * M skip the march, or
+    // with 0 the threshold is picked so the error stays under the tolerance
+    // (radians, about a third of a pixel at the default zoom)
+    float weakFieldThreshold = 0.0f;
+    float weakFieldTolerance = 2.5e-4f;
+
+    bool UseRelativity() const { return (flags & SceneFlags::USE_RELATIVITY) != 0u; }
+    bool ShowDisk() const { return (flags & SceneFlags::SHOW_DISK) != 0u; }
+    bool AdaptiveStep() const { return (flags & SceneFlags::ADAPTIVE_STEP) != 0u; }
+    // Only meaningful with relativity on, Newtonian rays always use RK4
+    bool PlanarOrbit() const { return UseRelativity() && (flags & SceneFlags::PLANAR_ORBIT) != 0u; }
+    // The table only stores where rays go, the disk still needs a march
+    bool UseDeflectionTable() const {
+        return UseRelativity() && !ShowDisk() && (flags & SceneFlags::DEFLECTION_TABLE) != 0u;
+    }
+    bool FarField() const { return (flags & SceneFlags::FAR_FIELD) != 0u; }
+    bool WeakField() const { return (flags & SceneFlags::WEAK_FIELD) != 0u; }
+    // Never inside the disk, an outbound ray there could still pick up light
+    float FarFieldRadius() const {
+        float minRadius = ShowDisk() ? bhRadius * 6.0f : bhRadius * 2.0f;
+        return std::max(farFieldRadius, minRadius);
+    }
+
+    // Same uniforms, so the same frame. Used to tell when progressive
+    // refinement has to start over.
+    bool operator==(const SceneParams& other) const {
+        return camPos == other.camPos && invView == other.invView && fov == other.fov
+            && aspectRatio == other.aspectRatio && bhPos == other.bhPos && bhMass == other.bhMass
+            && bhRadius == other.bhRadius && bhSizeBuffer == other.bhSizeBuffer
+            && diskThickness == other.diskThickness && flags == other.flags && tolerance == other.tolerance
+            && farFieldRadius == other.farFieldRadius && weakFieldThreshold == other.weakFieldThreshold
+            && weakFieldTolerance == other.weakFieldTolerance;
+    }
+    bool operator!=(const SceneParams& other) const { return !(*this == other); }
+
+    // Mirrors Display::UpdateUniforms
+    static SceneParams FromScene(Camera& camera, BlackHole& bh, uint32_t flags,
+                                 float bhSizeBuffer, float diskThickness, float aspectRatio,
+                                 float tolerance = 1e-4f, float farFieldRadius = 30.0f) {
+        SceneParams params;
+        params.camPos = camera.GetPosition();
+        params.invView = glm::inverse(camera.GetViewMatrix());
+        params.fov = glm::radians(camera.Zoom());
+        params.aspectRatio = aspectRatio;
+
+        params.bhPos = bh.Position();
+        params.bhMass = bh.Mass();
+        params.bhRadius = bh.Radius();
+
+        params.bhSizeBuffer = bhSizeBuffer;
+        params.diskThickness = diskThickness;
+        params.flags = flags;
+        params.tolerance = tolerance;
+        params.farFieldRadius = farFieldRadius;
+        return params;
+    }
+};
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent thread pool that runs a batch of independent jobs (tiles) with
+// work stealing. Every thread owns a deque seeded with a contiguous run of
+// jobs, pops from its own back and steals from the front of the others once
+// it runs dry, so neighbouring tiles stay on one core until the load evens out.
+class TileScheduler {
+public:
+    // job(index, thread), thread is in [0, GetThreadCount())
+    using Job = std::function<void(int, int)>;
+
+    explicit TileScheduler(int threadCount);
+    ~TileScheduler();
+
+    TileScheduler(const TileScheduler&) = delete;
+    TileScheduler& operator=(const TileScheduler&) = delete;
+
+    // Runs job for every index in [0, jobCount) and returns once all are done.
+    // The calling thread works as thread 0.
+    void Run(int jobCount, const Job& job);
+
+    // Getters / Setters
+    int GetThreadCount() const { return (int)m_Queues.size(); }
+    long long GetStealCount() const { return m_StealCount; }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<int> jobs;
+    };
+
+    void WorkerLoop(int thread);
+    void Drain(int thread);
+    bool PopLocal(int thread, int& index);
+    bool Steal(int thread, int& index);
+
+    std::vector<std::unique_ptr<Queue>> m_Queues;
+    std::vector<std::thread> m_Workers;
+
+    // Frame handshake, m_Generation bumps once per Run
+    std::mutex m_Mutex;
+    std::condition_variable m_Start;
+    std::condition_variable m_Done;
+    const Job* m_Job = nullptr;
+    long long m_Generation = 0;
+    int m_Busy = 0;
+    bool m_Quit = false;
+
+    long long m_StealCount = 0;
+};
+
+#endif
@@ -4,76 +4,202 @@
 #include "boiler.hpp"
 
 #include <glad/glad.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
 #include <string>
-#include <fstream>
-#include <sstream>
+#include <thread>
 #include <iostream>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
+// A vertex and fragment program, or a compute program, with its compile and
+// link logs printed. Sources can #include "file" next to them.
+//
+// Linked programs are kept in a cache directory through glGetProgramBinary,
+// keyed by a hash of both sources and the GL vendor, renderer and version
+// strings, so a launch with unchanged shaders skips compiling. A binary the
+// driver no longer takes is rebuilt from source.
+//
+// With hot reload on, a thread watches the source files and reads them when
+// they change. Poll starts the compile on the GL thread and, with
+// KHR/ARB_parallel_shader_compile, only looks at the result once the driver
+// reports it complete, so frames keep drawing with the old program. A
+// program that links replaces ID between frames, one that does not keeps
+// the old one and prints why.
+//
+// defines are put after the #version line of both sources, so one file
+// can build several variants. Each has its own cache entry. A background
+// build returns with ID 0 and leaves the compile to Poll, as a reload.
+// sourceDirectory is read in place of the paths' own directories, as
+// SetHotReload's watchDirectory, so a variant can be built from the sources
+// another shader reloaded.
 class Shader {
     public: 
         unsigned int ID;
         
-        Shader(const char* vertexPath, const char* fragmentPath) {
-            std::string vertexCode;
-            std::string fragmentCode;
-            std::ifstream vShaderFile;
-            std::ifstream fShaderFile;
-
-            vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-            fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-            try {
-                vShaderFile.open(vertexPath);
-                fShaderFile.open(fragmentPath);
-                std::stringstream vShaderStream, fShaderStream;
-
-                vShaderStream << vShaderFile.rdbuf();
-                fShaderStream << fShaderFile.rdbuf();
-                vShaderFile.close();
-                fShaderFile.close();
-
-                vertexCode = vShaderStream.str();
-                fragmentCode = fShaderStream.str();
-            } catch (std::ifstream::failure e) {
-                std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
-            }
+        Shader(const char* vertexPath, const char* fragmentPath, const std::string& defines = "", bool background = false,
+               const std::string& sourceDirectory = "");
+        static std::unique_ptr<Shader> Compute(const char* computePath, const std::string& defines = "", bool background = false,
+                                               const std::string& sourceDirectory = "");
+        ~Shader();
 
-            const char* vShaderCode = vertexCode.c_str();
-            const char* fShaderCode = fragmentCode.c_str();
-            
-            unsigned int vertex, fragment;
-            
-            vertex = glCreateShader(GL_VERTEX_SHADER);
-            glShaderSource(vertex, 1, &vShaderCode, NULL);
-            glCompileShader(vertex);
-
-            fragment = glCreateShader(GL_FRAGMENT_SHADER);
-            glShaderSource(fragment, 1, &fShaderCode, NULL);
-            glCompileShader(fragment);
-
-            ID = glCreateProgram();
-            glAttachShader(ID, vertex);
-            glAttachShader(ID, fragment);
-            glLinkProgram(ID);
-
-            glDeleteShader(vertex);
-            glDeleteShader(fragment);
-        }
+        Shader(const Shader&) = delete;
+        Shader& operator=(const Shader&) = delete;
+
+        // Watches watchDirectory/<file name> and its includes when that
+        // exists, so edits in the source tree reach a build that runs from a
+        // copy, otherwise the paths it was loaded from
+        void SetHotReload(bool enabled, const std::string& watchDirectory = "");
+        bool IsHotReloading() const { return m_Watcher.joinable(); }
+        // Where the sources are read from, empty for the paths as given.
+        // Hot reload switches it to the watched directory.
+        const std::string& GetSourceDirectory() const { return m_SourceDirectory; }
+        // Call once a frame. True on the frame a reloaded program took over,
+        // its uniforms are all back to their defaults and need setting again.
+        bool Poll();
+        bool IsCompiling() const { return m_PendingProgram != 0; }
+        // Waits for the build in flight and takes it as Poll would
+        bool Finish();
+
+        bool IsLinked() const { return m_Linked; }
+        bool WasCached() const { return m_Cached; }
+        // Last build, from the cache or compiled
+        double GetBuildMilliseconds() const { return m_BuildMilliseconds; }
+        int GetReloadCount() const { return m_Reloads; }
+
+        // "shadercache" by default, next to wherever the app runs from
+        static void SetCacheDirectory(const std::string& directory) { s_CacheDirectory = directory; }
+
+        // Active, so not compiled out
+        bool HasUniform(const std::string& name) const { return m_Locations.count(name) != 0; }
 
         void use() { glUseProgram(ID); }
+        void setVec2(const std::string& name, const glm::vec2& value) const {
+            glUniform2fv(Location(name), 1, &value[0]);
+        }
+        void setIVec2(const std::string& name, const glm::ivec2& value) const {
+            glUniform2iv(Location(name), 1, &value[0]);
+        }
         void setVec3(const std::string& name, const glm::vec3& value) const {
-            glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+            glUniform3fv(Location(name), 1, &value[0]);
         }
         void setFloat(const std::string &name, float value) const {
-            glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+            glUniform1f(Location(name), value);
         }
         void setMat4(const std::string &name, const glm::mat4 &value) const {
-            glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(value));
+            glUniformMatrix4fv(Location(name), 1, GL_FALSE, glm::value_ptr(value));
         }
         void setUInt(const std::string &name, uint32_t &value) const {
-            glUniform1ui(glGetUniformLocation(ID, name.c_str()), value);
+            glUniform1ui(Location(name), value);
         }
         void setInt(const std::string &name, int value) const {
-            glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+            glUniform1i(Location(name), value);
+        }
+        void setIntArray(const std::string &name, const int* values, int count) const {
+            glUniform1iv(Location(name), count, values);
+        }
+
+        // Points a uniform block at a GL_UNIFORM_BUFFER binding
+        void bindBlock(const std::string& name, GLuint binding) const {
+            GLuint index = glGetUniformBlockIndex(ID, name.c_str());
+            if (index == GL_INVALID_INDEX)
+                std::cerr << "Shader has no uniform block " << name << std::endl;
+            else
+                glUniformBlockBinding(ID, index, binding);
+        }
+
+    private:
+        struct Sources {
+            std::string vertex;
+            std::string fragment;
+            std::string compute;
+            std::vector<std::string> files;     // read to make them
+        };
+
+        Shader() : ID(0) {}
+        void Build(bool background);
+        static bool ReadFile(const std::string& path, std::string& text, std::vector<std::string>& files, int depth = 0);
+        // From directory when it is not empty, with the defines in
+        bool ReadSources(const std::string& directory, Sources& sources) const;
+        static void InjectDefines(std::string& source, const std::string& defines);
+        // Starts compiling and linking without waiting on either
+        static GLuint BeginBuild(const Sources& sources);
+        // Prints the logs, false if it did not link
+        static bool CheckBuild(GLuint program, const std::string& name);
+        static std::string CacheKey(const Sources& sources);
+        static std::string CachePath(const std::string& key);
+        static GLuint LoadCached(const std::string& key);
+        static void SaveCached(GLuint program, const std::string& key);
+        void WatchLoop(std::string directory);
+        void StartPending(const Sources& sources);
+        bool TakePending();
+
+        // Every active uniform outside a block, so setting one is a hash
+        // lookup rather than a glGetUniformLocation
+        void CacheLocations() {
+            m_Locations.clear();
+            m_Unknown.clear();
+            GLint count = 0, maxLength = 0;
+            glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+            glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+            std::string name(std::max(maxLength, 1), '\0');
+            for (GLuint i = 0; i < (GLuint)count; i++) {
+                GLsizei length = 0;
+                GLint size = 0;
+                GLenum type = 0;
+                glGetActiveUniform(ID, i, (GLsizei)name.size(), &length, &size, &type, &name[0]);
+                std::string uniform = name.substr(0, length);
+
+                GLint location = glGetUniformLocation(ID, uniform.c_str());
+                if (location < 0)
+                    continue;
+                // Arrays are listed as name[0]
+                size_t bracket = uniform.find('[');
+                if (bracket != std::string::npos)
+                    uniform.resize(bracket);
+                m_Locations[uniform] = location;
+            }
         }
+
+        // Unknown names warn once. They are often just unused and compiled
+        // out, -1 makes the glUniform call a no-op either way.
+        GLint Location(const std::string& name) const {
+            auto it = m_Locations.find(name);
+            if (it != m_Locations.end())
+                return it->second;
+            if (m_Unknown.insert(name).second)
+                std::cerr << "Shader has no active uniform " << name << std::endl;
+            return -1;
+        }
+
+        std::unordered_map<std::string, GLint> m_Locations;
+        mutable std::unordered_set<std::string> m_Unknown;
+
+        std::string m_VertexPath, m_FragmentPath, m_ComputePath;
+        std::string m_Name;             // the file names, for the logs
+        std::string m_Defines;
+        std::string m_SourceDirectory;
+        bool m_Linked = false;
+        bool m_Cached = false;
+        double m_BuildMilliseconds = 0.0;
+        int m_Reloads = 0;
+
+        // Hot reload. The watcher hands changed sources over in m_Changed.
+        std::thread m_Watcher;
+        std::atomic<bool> m_Watching{false};
+        std::mutex m_ChangedMutex;
+        std::unique_ptr<Sources> m_Changed;
+        GLuint m_PendingProgram = 0;    // compiling in the background
+        std::string m_PendingKey;
+        bool m_PendingCached = false;
+        std::chrono::steady_clock::time_point m_PendingStart;
+        bool m_PendingChecked = false;  // without parallel compile, one Poll late
+
+        static inline std::string s_CacheDirectory = "shadercache";
 };
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,132 @@
+#ifndef SKYBOX_H
+#define SKYBOX_H
+
+#include "boiler.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+
+class SkyTiles;
+
+// Texel formats of a skybox. RGB32F is what stbi_loadf gives for a .hdr,
+// the others only come from a converted .bhsky file.
+enum class SkyFormat : uint32_t {
+    RGB32F = 0,
+    RGB9E5 = 1,     // shared exponent, 4 bytes, GL_UNSIGNED_INT_5_9_9_9_REV
+    RGB16F = 2      // half floats, 6 bytes, GL_HALF_FLOAT
+};
+
+enum class SkyLayout : uint32_t {
+    Equirect = 0,   // one panorama, u along phi and v along theta
+    Cube = 1        // six square faces in GL_TEXTURE_CUBE_MAP_POSITIVE_X order
+};
+
+struct SkyLevel {
+    int width = 0;                  // of one face
+    int height = 0;
+    const void* data = nullptr;     // tightly packed rows, bottom row first, faces one after another
+};
+
+// CPU-side HDR sky, sampled the same way the shader samples u_skybox
+// (GL_LINEAR, rows flipped on load, seamless across cube faces).
+//
+// Load takes either an image stb_image can read, which is decoded into
+// RGB32F, or a .bhsky file written by Save. .bhsky files are memory mapped
+// and used in place: the rows are already bottom first and the mip chain is
+// already built, so the texture upload takes the mapped levels as they are
+// and the CPU samples decode texels straight from the mapping. Radiance
+// .hdr files are decoded on every core (see radiance.h), into RGB32F or any
+// other format.
+//
+// LoadCube is what the renderers use. It turns an equirectangular sky into
+// a cubemap the first time and keeps it next to the source (CachePath), so
+// escaping rays are looked up by direction without atan and asin.
+//
+// A .bhtiles file (see skytiles.h) loads as a tiled cube. Nothing is read
+// up front and Sample decodes the tiles it touches into a bounded cache.
+class Skybox {
+public:
+    static const int MAX_LEVELS = 16;
+    static const int CUBE_FACES = 6;
+
+    Skybox() {}
+    explicit Skybox(const std::string& path) { Load(path); }
+
+    // The levels point into the pixels, so only moves keep them valid
+    Skybox(const Skybox&) = delete;
+    Skybox& operator=(const Skybox&) = delete;
+    Skybox(Skybox&&) = default;
+    Skybox& operator=(Skybox&&) = default;
+
+    // hdrFormat is what a Radiance .hdr decodes into, other images are
+    // always RGB32F and .bhsky files keep theirs
+    bool Load(const std::string& path, SkyFormat hdrFormat = SkyFormat::RGB32F);
+    // Loads path as a cubemap, converting and caching it when it is not one.
+    // A cache older than the source is converted again.
+    bool LoadCube(const std::string& path, SkyFormat cacheFormat = SkyFormat::RGB9E5);
+    // Writes a .bhsky of the loaded sky with a full mip chain
+    bool Save(const std::string& path, SkyFormat format) const;
+    // Resamples an equirectangular sky to RGB32F faces of faceSize texels,
+    // by default a quarter of the width so the equator keeps its resolution
+    Skybox ToCube(int faceSize = 0) const;
+
+    // Either layout, direction must be normalized. Cubes filter the given
+    // mip level, equirectangular skies always level 0.
+    glm::vec3 Sample(const glm::vec3& direction, int level = 0) const;
+    // Equirectangular only
+    glm::vec3 Sample(const glm::vec2& uv) const;
+    // Texel of a cube level, past the edge of a face it comes from the face
+    // next to it
+    glm::vec3 CubeTexel(int level, int face, int x, int y) const;
+
+    // Mip level whose texels are about radiansPerPixel wide at the middle of
+    // a face, the renderers use the size of a pixel at the middle of the frame
+    int LevelForPixelAngle(float radiansPerPixel) const;
+    static int LevelForPixelAngle(int faceSize, int levelCount, float radiansPerPixel);
+
+    bool IsLoaded() const { return m_LevelCount > 0; }
+    bool IsMapped() const { return m_Mapping != nullptr; }
+    bool IsTiled() const { return m_Tiles != nullptr; }
+    const std::shared_ptr<SkyTiles>& GetTiles() const { return m_Tiles; }
+    SkyFormat GetFormat() const { return m_Format; }
+    SkyLayout GetLayout() const { return m_Layout; }
+    int GetFaceCount() const { return m_Layout == SkyLayout::Cube ? CUBE_FACES : 1; }
+    int GetWidth() const { return m_Levels[0].width; }
+    int GetHeight() const { return m_Levels[0].height; }
+    int GetLevelCount() const { return m_LevelCount; }
+    const SkyLevel& GetLevel(int level) const { return m_Levels[level]; }
+    const void* GetFace(int level, int face) const;
+    // Milliseconds the last Load or LoadCube took
+    double GetLoadMilliseconds() const { return m_LoadMilliseconds; }
+
+    static size_t TexelSize(SkyFormat format);
+    static const char* FormatName(SkyFormat format);
+    // Where LoadCube keeps the cubemap of path, "sky.hdr" -> "sky.cube.bhsky"
+    static std::string CachePath(const std::string& path);
+
+    // Shared with SkyTiles
+    static std::shared_ptr<const unsigned char> MapFile(const std::string& path, size_t& size);
+    static void EncodeTexel(const glm::vec3& color, SkyFormat format, unsigned char* out);
+    static glm::vec3 DecodeTexel(const void* texels, size_t index, SkyFormat format);
+    // GL_TEXTURE_CUBE_MAP face selection, s and t run 0 to 1 across the face
+    static int CubeFace(const glm::vec3& direction, float& s, float& t);
+    // The inverse, not normalized. s and t may run past the face.
+    static glm::vec3 CubeDirection(int face, float s, float t);
+
+private:
+    bool LoadMapped(const std::string& path, std::shared_ptr<const unsigned char> mapping, size_t size);
+    glm::vec3 Texel(int level, int face, int x, int y) const;
+
+    SkyFormat m_Format = SkyFormat::RGB32F;
+    SkyLayout m_Layout = SkyLayout::Equirect;
+    SkyLevel m_Levels[MAX_LEVELS];
+    int m_LevelCount = 0;
+    double m_LoadMilliseconds = 0.0;
+
+    // Owns the pixels, one of them. m_Data holds texels of any format.
+    std::vector<float> m_Data;
+    std::shared_ptr<const unsigned char> m_Mapping;
+    std::shared_ptr<SkyTiles> m_Tiles;
+};
+
+#endif
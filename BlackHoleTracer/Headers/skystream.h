@@ -0,0 +1,143 @@
+#ifndef SKYSTREAM_H
+#define SKYSTREAM_H
+
+#include "boiler.hpp"
+#include "shader.h"
+#include "skytiles.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Keeps the tiles of a SkyTiles sky that the frame samples resident on the
+// GPU, so the texture memory is the atlas size whatever the panorama is.
+//
+// Tiles live in the slots of an atlas texture, and a page table texture
+// maps every page to its slot + 1 or 0 (see TiledSkyColor in trace.glsl,
+// which falls back a level at a time to a resident tile). The top level is
+// loaded up front and never evicted.
+//
+// What the frame needs comes from feedback passes: the main shader tracing
+// every FEEDBACK_SCALE-th pixel into a target that only keeps SkyFeedback,
+// the page each escaping ray wanted. Each pass starts from another pixel of
+// the FEEDBACK_SCALE square, so a still view is covered after that many
+// squared. A pass is read back through a buffer object a frame or more
+// later. The missing pages and the tiles above them are copied out of the
+// mapped file by a loader thread, and Update uploads a few a frame into the
+// slots that went longest without being wanted.
+class SkyStreamer {
+public:
+    static const int PAGE_TABLE_WIDTH = 256;    // SKY_PAGE_TABLE_WIDTH in trace.glsl
+    static const int FEEDBACK_SCALE = 8;
+
+    SkyStreamer(std::shared_ptr<SkyTiles> tiles, int width, int height, int atlasSlots = 1024,
+                int uploadsPerFrame = 16);
+    ~SkyStreamer();
+
+    SkyStreamer(const SkyStreamer&) = delete;
+    SkyStreamer& operator=(const SkyStreamer&) = delete;
+
+    // The u_sky* uniforms, the shader must be in use
+    void SetUniforms(const Shader& shader) const;
+
+    // Call once a frame before drawing. Takes the last feedback when the GPU
+    // is done with it, queues what is missing and uploads what has loaded.
+    void Update();
+    // While the last pass is still being read, nothing. Otherwise after the
+    // scene changed, until the passes have covered every pixel, or while
+    // pages the last pass wanted are not resident.
+    bool WantsFeedback(bool sceneChanged);
+    // Binds the feedback target and its viewport and returns the pixel the
+    // pass starts from. Trace every GetFeedbackScale()-th pixel from there
+    // into it, then EndFeedback. The caller restores its framebuffer.
+    glm::ivec2 BeginFeedback();
+    void EndFeedback();
+    int GetFeedbackScale() const { return m_FeedbackScale; }
+
+    // Offline renders trace every pixel in one feedback pass, and wait in
+    // Update for it and every tile it asks for, so each frame is drawn from
+    // the levels it wants
+    void SetBlocking(bool blocking);
+    bool IsBlocking() const { return m_Blocking; }
+
+    struct Stats {
+        int resident = 0;           // slots in use
+        int slots = 0;
+        int pending = 0;            // requested, not uploaded yet
+        int missing = 0;            // wanted by the last feedback, not resident
+        long long uploaded = 0;
+        long long evicted = 0;
+        long long dropped = 0;      // loaded tiles with no slot to go to
+        size_t atlasBytes = 0;
+    };
+    Stats GetStats() const;
+
+    // Getters
+    GLuint GetAtlasTexture() const { return m_AtlasTextureID; }
+    GLuint GetPageTableTexture() const { return m_PageTableTextureID; }
+    const SkyTiles& GetTiles() const { return *m_Tiles; }
+
+private:
+    struct Slot {
+        int page = -1;
+        long long lastUse = 0;      // frame of the last feedback that wanted it
+        bool pinned = false;
+    };
+    struct LoadedTile {
+        int page;
+        std::vector<unsigned char> texels;
+    };
+
+    void CreateFeedbackTarget();
+    void DeleteFeedbackTarget();
+    void ReadFeedback(bool wait);
+    bool Upload(int page, const unsigned char* texels);
+    int FreeSlot() const;
+    void SetPageEntry(int page, uint32_t entry);
+    void LoaderLoop();
+
+    std::shared_ptr<SkyTiles> m_Tiles;
+    GLenum m_InternalFormat, m_Type;
+    int m_UploadsPerFrame;
+    bool m_Blocking = false;
+    long long m_Frame = 0;
+    long long m_FeedbackFrame = 0;  // frame of the last feedback read
+
+    GLuint m_AtlasTextureID = 0;
+    int m_AtlasColumns = 0;
+    std::vector<Slot> m_Slots;
+    GLuint m_PageTableTextureID = 0;
+    std::vector<int> m_PageSlots;       // -1 when not resident
+    std::vector<bool> m_PageRequested;
+    std::vector<int> m_Wanted;          // pages of the last feedback
+    int m_Missing = 0;
+
+    int m_Width, m_Height;
+    int m_FeedbackScale = FEEDBACK_SCALE;
+    int m_FeedbackPass = 0;             // since the scene last changed
+    GLuint m_FeedbackFBO = 0;
+    GLuint m_FeedbackTextureID = 0;
+    GLuint m_FeedbackPBO = 0;
+    GLsync m_FeedbackFence = nullptr;
+    int m_FeedbackWidth = 0, m_FeedbackHeight = 0;
+    std::vector<float> m_FeedbackPages;
+
+    // Loader thread
+    std::mutex m_Mutex;
+    std::condition_variable m_Wake;     // loader, a request or quit
+    std::condition_variable m_Idle;     // Update, the queue ran dry
+    std::deque<int> m_Requests;
+    std::deque<LoadedTile> m_Loaded;
+    bool m_Loading = false;
+    bool m_Quit = false;
+    std::thread m_Loader;
+
+    long long m_Uploaded = 0;
+    long long m_Evicted = 0;
+    long long m_Dropped = 0;
+};
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef SKYTILES_H
+#define SKYTILES_H
+
+#include "skybox.h"
+#include <algorithm>
+#include <atomic>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+// A cube sky cut into square tiles, for panoramas too big to decode or
+// upload whole. Every level of the mip chain is cut into tiles of the same
+// size, so a tile of level L covers four of level L - 1. The levels stop at
+// the first one that fits a face in one tile.
+//
+// Tiles are stored with a border texel on every side, taken across the face
+// edge where there is one, so bilinear filtering inside a tile never needs
+// its neighbors. A tile is numbered by its page: levels from the finest,
+// then faces, rows and columns of tiles.
+//
+// .bhtiles layout, little endian: the header, then every page at
+// dataOffset + page * GetTileBytes(), rows bottom first.
+//
+// The file is memory mapped and only the tiles that are sampled are ever
+// read. Sample decodes them into an LRU cache of floats that stays under
+// SetCacheLimit, and can be called from many threads at once.
+class SkyTiles {
+public:
+    static const int BORDER = 1;
+    static const int DEFAULT_TILE_SIZE = 128;
+    static const char MAGIC[8];
+
+    SkyTiles() {}
+    SkyTiles(const SkyTiles&) = delete;
+    SkyTiles& operator=(const SkyTiles&) = delete;
+
+    // Cuts a cube with its mip chain into a .bhtiles file
+    static bool Build(const Skybox& cube, const std::string& path, int tileSize = DEFAULT_TILE_SIZE,
+                      SkyFormat format = SkyFormat::RGB9E5);
+    // Takes over the mapping of a file that starts with MAGIC
+    bool Open(const std::string& path, std::shared_ptr<const unsigned char> mapping, size_t size);
+
+    // Bilinear over the tile direction falls in, as Skybox::Sample
+    glm::vec3 Sample(const glm::vec3& direction, int level) const;
+    // Inside the face only
+    glm::vec3 Texel(int level, int face, int x, int y) const;
+
+    // Page of the tile holding texel (x, y), either may sit one texel
+    // outside the face as in bilinear filtering
+    int TexelPage(int level, int face, int x, int y) const;
+    int Page(int level, int face, int tileX, int tileY) const;
+    void PageLocation(int page, int& level, int& face, int& tileX, int& tileY) const;
+    // Page of the tile one level up that covers this one, -1 at the top
+    int ParentPage(int page) const;
+    // Encoded texels of a page, GetTileStride() squared
+    const unsigned char* GetTileData(int page) const;
+
+    SkyFormat GetFormat() const { return m_Format; }
+    int GetFaceSize() const { return m_FaceSize; }
+    int GetTileSize() const { return m_TileSize; }
+    int GetTileStride() const { return m_TileSize + 2 * BORDER; }
+    size_t GetTileBytes() const { return m_TileBytes; }
+    int GetLevelCount() const { return m_LevelCount; }
+    int GetLevelSize(int level) const { return std::max(m_FaceSize >> level, 1); }
+    int GetTilesAcross(int level) const { return (GetLevelSize(level) + m_TileSize - 1) / m_TileSize; }
+    int GetLevelFirstPage(int level) const { return m_LevelPages[level]; }
+    int GetPageCount() const { return m_LevelPages[m_LevelCount]; }
+
+    // Decoded tiles, bytes are about GetTileStride() squared * 12 a tile
+    void SetCacheLimit(size_t bytes) { m_CacheLimit = bytes; }
+    size_t GetCacheLimit() const { return m_CacheLimit; }
+    size_t GetCacheBytes() const;
+    long long GetCacheMisses() const { return m_Misses; }
+
+private:
+    struct CachedTile {
+        std::vector<glm::vec3> texels;
+        std::atomic<long long> lastUse{0};
+    };
+    std::shared_ptr<const CachedTile> Decoded(int page) const;
+
+    SkyFormat m_Format = SkyFormat::RGB9E5;
+    int m_FaceSize = 0;
+    int m_TileSize = 0;
+    int m_LevelCount = 0;
+    int m_LevelPages[Skybox::MAX_LEVELS + 1] = {};  // first page of every level, then the page count
+    size_t m_TileBytes = 0;
+    const unsigned char* m_Tiles = nullptr;
+    std::shared_ptr<const unsigned char> m_Mapping;
+
+    size_t m_CacheLimit = (size_t)256 << 20;
+    mutable std::shared_mutex m_CacheMutex;
+    mutable std::unordered_map<int, std::shared_ptr<CachedTile>> m_Cache;
+    mutable std::atomic<long long> m_Clock{0};     // ticks on every miss
+    mutable std::atomic<long long> m_Misses{0};
+};
+
+#endif
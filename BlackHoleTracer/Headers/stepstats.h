@@ -0,0 +1,55 @@
+#ifndef STEPSTATS_H
+#define STEPSTATS_H
+
+#include "ray.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Per-pixel cost of one frame, laid out like the color buffer (bottom row
+// first). Filled by Tracer on the CPU and read back from the second render
+// target of blackhole.frag on the GPU.
+struct StepBuffer {
+    int width = 0;
+    int height = 0;
+    std::vector<int> steps;          // integrator steps, rejected adaptive steps included
+    std::vector<int> accelEvals;     // acceleration (or Binet derivative) evaluations
+    std::vector<RayTermination> termination;
+
+    void Resize(int w, int h);
+    void Set(int x, int y, const RayResult& ray);
+    size_t Size() const { return steps.size(); }
+};
+
+struct StepSummary {
+    int pixels = 0;
+    float meanSteps = 0.0f;
+    int p99Steps = 0;
+    int maxSteps = 0;
+    float meanAccelEvals = 0.0f;
+    int p99AccelEvals = 0;
+    float exhaustedPercent = 0.0f;   // pixels that ran out of MAX_STEPS
+    int terminationCounts[4] = {};   // indexed by RayTermination
+};
+
+enum class HeatmapMode {
+    Steps,
+    AccelEvals,
+    Termination
+};
+
+namespace StepStats {
+    StepSummary Summarize(const StepBuffer& buffer);
+
+    // RGBA8 image, steps and evaluations on a log scale up to MAX_STEPS
+    // (MAX_STEPS * 7 evaluations), termination as flat colors
+    void Heatmap(const StepBuffer& buffer, HeatmapMode mode, float opacity, std::vector<uint8_t>& rgba);
+
+    // Writes <path>-steps.png, <path>-termination.png and <path>-stats.txt
+    bool Export(const StepBuffer& buffer, const std::string& path);
+
+    const char* TerminationName(RayTermination termination);
+}
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include "scene.h"
+#include "deflection.h"
+#include "lensmap.h"
+#include "logpolar.h"
+#include "packet.h"
+#include "ray.h"
+#include "scheduler.h"
+#include "skybox.h"
+#include "stepstats.h"
+
+#include <memory>
+
+// Counters from the last Render
+struct TraceStats {
+    long long rays = 0;
+    long long analyticCaptures = 0;  // rays resolved without finishing the march
+    long long analyticEscapes = 0;   // rays finished by the far-field or weak-field paths
+    long long skippedSteps = 0;      // estimated march steps those rays saved
+    long long lensSamples = 0;       // pixels shaded from the lens map without tracing
+
+    void Add(const TraceStats& other) {
+        rays += other.rays;
+        analyticCaptures += other.analyticCaptures;
+        analyticEscapes += other.analyticEscapes;
+        skippedSteps += other.skippedSteps;
+        lensSamples += other.lensSamples;
+    }
+};
+
+// Wall time of one tile from the last Render, in pixels of the output
+struct TileTiming {
+    int x0, y0, x1, y1;
+    int thread;
+    float milliseconds;
+};
+
+// Far-field completion against marching the same rays out to ESCAPE_RADIUS
+struct FarFieldReport {
+    int rays = 0;              // sampled rays the completion finished
+    float maxError = 0.0f;     // radians between the two escape directions
+    float meanError = 0.0f;
+    float meanSkippedSteps = 0.0f;
+};
+
+// Image-space adaptive sampling, see Tracer::RenderAdaptive
+struct AdaptiveSettings {
+    int coarseStride = 8;           // power of two, the first blocks are this many pixels across
+    float tolerance = 2e-3f;        // radians the bend may miss its interpolation by at a block's midpoints
+    float colorTolerance = 0.02f;   // the same for disk light and transmission
+};
+
+// Headless CPU reference of blackhole.frag. Renders a full frame across all
+// cores into an RGB float buffer laid out like glReadPixels (bottom row first).
+// The frame is cut into square tiles handed out by a work-stealing scheduler,
+// so threads that land on the photon ring do not hold up the rest.
+class Tracer {
+public:
+    Tracer(int width, int height);
+
+    // Rebuilds the deflection table first if the scene asks for it and it is
+    // stale. With the lens cache on, a scene that only orbits the camera
+    // around the last fully traced one is shaded from the lens map instead.
+    void Render(const SceneParams& scene, const Skybox& skybox, std::vector<float>& pixels);
+    // Coarse-to-fine version of Render, one pass per call. While interacting,
+    // or once the scene changes, it traces every GetCoarseStride()-th pixel
+    // and fills the blocks in between. Each later call halves the stride and
+    // only traces the pixels earlier passes have not. Returns true once the
+    // frame is at full resolution, further calls are then free.
+    bool RenderProgressive(const SceneParams& scene, const Skybox& skybox, std::vector<float>& pixels,
+                           bool interacting);
+
+    // Traces a LogPolarGrid of about quality * width * height rays around the
+    // hole's image and resamples it to the frame, see logpolar.h
+    void RenderLogPolar(const SceneParams& scene, const Skybox& skybox, std::vector<float>& pixels, float quality);
+
+    // Traces the corners and midpoints of coarseStride blocks. Blocks whose
+    // midpoints end differently or land off the interpolation of their
+    // corners (bend past tolerance, disk light) are split into four and
+    // refined the same way, down to single pixels. Pixels inside the rest
+    // interpolate the bend and disk light of the nearest traced rays and
+    // still get their own sky lookup. GetSampleMask shows what was traced.
+    void RenderAdaptive(const SceneParams& scene, const Skybox& skybox, std::vector<float>& pixels,
+                        const AdaptiveSettings& settings = AdaptiveSettings());
+    // 255 where the last RenderAdaptive traced a ray, 0 where it interpolated
+    const std::vector<uint8_t>& GetSampleMask() const { return m_SampleMask; }
+    bool SaveSampleMask(const std::string& path) const;
+
+    // One fragment of blackhole.frag, texCoord in [0, 1]
+    glm::vec3 TracePixel(const SceneParams& scene, const Skybox& skybox, const glm::vec2& texCoord) const;
+    // Traces every stride-th pixel with and without FAR_FIELD
+    FarFieldReport MeasureFarField(const SceneParams& scene, int stride = 4) const;
+
+    // Final color of a marched ray (sky lookup, redshift, disk blend, tone map)
+    glm::vec3 ShadeRay(const SceneParams& scene, const Skybox& skybox, const RayResult& ray) const;
+
+    // Getters / Setters
+    int GetWidth() const { return m_Width; }
+    int GetHeight() const { return m_Height; }
+    int GetThreadCount() const { return m_ThreadCount; }
+    void SetThreadCount(int threads);
+    int GetTileSize() const { return m_TileSize; }
+    void SetTileSize(int size) { m_TileSize = std::max(size, 1); }
+    int GetCoarseStride() const { return m_CoarseStride; }
+    void SetCoarseStride(int stride);
+    int GetProgressiveStride() const { return m_ProgressiveStride; }
+    PacketKernel GetPacketKernel() const { return m_PacketKernel; }
+    void SetPacketKernel(PacketKernel kernel) { m_PacketKernel = kernel; }
+    const DeflectionTable& GetDeflectionTable() const { return m_DeflectionTable; }
+    const TraceStats& GetStats() const { return m_Stats; }
+    const std::vector<TileTiming>& GetTileTimings() const { return m_TileTimings; }
+    // Per-pixel steps and termination, only filled while recording is on
+    bool IsRecordingSteps() const { return m_RecordSteps; }
+    void SetRecordSteps(bool record) { m_RecordSteps = record; }
+    const StepBuffer& GetStepBuffer() const { return m_StepBuffer; }
+    // Keeps where every ray went so orbiting the camera skips the march, see
+    // lensmap.h. Not used while steps are recorded.
+    bool IsLensCacheEnabled() const { return m_LensCache; }
+    void SetLensCache(bool enabled);
+    const LensMap& GetLensMap() const { return m_LensMap; }
+    const LogPolarGrid& GetLogPolarGrid() const { return m_LogPolarGrid; }
+    long long GetStealCount() const { return m_Scheduler->GetStealCount(); }
+
+private:
+    // Padded to a cache line so threads counting rays do not share one
+    struct alignas(64) ThreadStats {
+        TraceStats stats;
+    };
+
+    void RenderPass(const SceneParams& scene, const Skybox& skybox, std::vector<float>& pixels,
+                    int stride, bool reuse);
+    void RenderTile(const SceneParams& scene, const Skybox& skybox, float* pixels,
+                    int x0, int y0, int x1, int y1, int stride, bool reuse,
+                    TraceStats* stats, StepBuffer* steps, LensMap* lens) const;
+    void TraceLogPolarRow(const SceneParams& scene, const Skybox& skybox, int j, TraceStats* stats);
+    // Marches the primary rays through texCoords, batched into packets
+    void TraceRays(const SceneParams& scene, const glm::vec2* texCoords, int count, RayResult* results,
+                   TraceStats* stats) const;
+    struct AdaptiveBlock {
+        int x0, y0, size;
+    };
+    void TraceAdaptivePoints(const SceneParams& scene, std::vector<int>& points);
+    bool NeedsRefinement(const SceneParams& scene, const AdaptiveSettings& settings, const AdaptiveBlock& block) const;
+    void InterpolateBlock(const SceneParams& scene, const AdaptiveBlock& block);
+    bool CanReuseLensMap(const SceneParams& scene) const;
+    void ResampleLensMap(const SceneParams& scene, const Skybox& skybox, std::vector<float>& pixels);
+
+    int m_Width, m_Height;
+    int m_ThreadCount;
+    int m_TileSize = 32;
+    std::unique_ptr<TileScheduler> m_Scheduler;
+    PacketKernel m_PacketKernel = PacketKernel::Auto;
+    DeflectionTable m_DeflectionTable;
+    TraceStats m_Stats;
+    std::vector<TileTiming> m_TileTimings;
+    bool m_RecordSteps = false;
+    int m_CoarseStride = 8;
+    int m_ProgressiveStride = 0;    // stride of the last pass, 0 before the first
+    SceneParams m_ProgressiveScene;
+    StepBuffer m_StepBuffer;
+    bool m_LensCache = false;
+    LensMap m_LensMap;
+    LogPolarGrid m_LogPolarGrid;
+    std::vector<float> m_LogPolarSamples;
+    std::vector<RayResult> m_AdaptiveRays;
+    std::vector<uint8_t> m_SampleMask;
+};
+
+#endif
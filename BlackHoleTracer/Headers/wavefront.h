@@ -0,0 +1,90 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "boiler.hpp"
+#include "shader.h"
+
+#include <memory>
+
+// Traces the frame with compute shaders instead of a fragment per pixel.
+// A fragment shader's warp runs as long as its slowest pixel, so sky pixels
+// next to the photon ring wait on rays that take every MAX_STEPS. Here the
+// rays are kept in storage buffers between dispatches:
+//
+//   wavefront.comp pass 0 starts a ray per pixel (StartRay in trace.glsl).
+//   Rays the weak field, the table or the planar march resolve are written
+//   to the image at once, the rest are live.
+//   compact.comp packs the live rays into a list with a prefix sum.
+//   wavefront.comp pass 1 marches the list stepsPerDispatch MarchSteps on,
+//   writing the rays that stop, and the compaction runs again.
+//
+// Every dispatch after the first is indirect, sized by the live count the
+// compaction left on the GPU. That count is only read back every few
+// dispatches to stop early. Needs GL 4.3.
+class WavefrontTracer {
+public:
+    static const int GROUP_SIZE = 256;      // local_size_x of both programs
+    static const int MAX_STEPS = 4000;      // MAX_STEPS in trace.glsl
+
+    static bool IsSupported();
+
+    WavefrontTracer(int width, int height, int stepsPerDispatch = 32);
+    ~WavefrontTracer();
+
+    WavefrontTracer(const WavefrontTracer&) = delete;
+    WavefrontTracer& operator=(const WavefrontTracer&) = delete;
+
+    // Traces into the image. The trace shader needs its block, samplers and
+    // sky uniforms set, and the scene textures bound.
+    void Trace();
+    // The image as a read framebuffer, to blit from
+    GLuint GetFramebuffer() const { return m_FBO; }
+
+    void SetStepsPerDispatch(int steps);
+    int GetStepsPerDispatch() const { return m_StepsPerDispatch; }
+
+    // True on the frame a reloaded trace program took over
+    bool Poll();
+    void SetHotReload(bool enabled, const std::string& watchDirectory);
+    Shader& GetTraceShader() const { return *m_TraceShader; }
+    bool IsReady() const { return m_TraceShader->IsLinked() && m_CompactShader->IsLinked(); }
+
+    struct Stats {
+        int marched = 0;            // rays the last Trace marched in 3D
+        int dispatches = 0;         // march dispatches it took
+    };
+    const Stats& GetStats() const { return m_Stats; }
+
+private:
+    // wavefront.comp's RayState
+    struct RayState {
+        glm::vec4 loc;
+        glm::vec4 vel;
+        glm::vec4 k1v;
+        glm::vec4 accumulatedColor;
+    };
+    // Counters in both programs, the first three are the indirect dispatch
+    struct Counters {
+        uint32_t groups[3];
+        uint32_t liveCount;
+        uint32_t nextCount;
+    };
+
+    void Compact();
+    uint32_t ReadLiveCount();
+
+    std::unique_ptr<Shader> m_TraceShader;
+    std::unique_ptr<Shader> m_CompactShader;
+    int m_StepsPerDispatch;
+
+    // Storage buffers by binding, see wavefront.comp and compact.comp
+    enum { RAYS, LIVE, NEXT_LIVE, ALIVE, PREFIX, BLOCK_SUMS, COUNTERS, BUFFER_COUNT };
+    GLuint m_Buffers[BUFFER_COUNT] = {};
+    GLuint m_ImageTextureID = 0;
+    GLuint m_FBO = 0;
+    Stats m_Stats;
+
+    int m_Width, m_Height;
+};
+
+#endif
@@ -1,185 +1,118 @@
 #version 400 core
-out vec4 FragColor;
+layout(location = 0) out vec4 FragColor;
+// (steps, acceleration evaluations, termination, 1), see stepstats.h
+layout(location = 1) out vec4 StepInfo;
+// Where the ray went, see lensmap.h. (escape direction in the camera frame,
+// redshift) with -1 for captured rays and 0 for rays that never reached the
+// sky, then (disk color, transmission).
+layout(location = 2) out vec4 LensDirection;
+layout(location = 3) out vec4 LensDisk;
+// Page + 1 of the sky tile the ray wanted, 0 for none (see skystream.h)
+layout(location = 4) out vec4 SkyFeedback;
 in vec2 TexCoord;
 
-uniform uint flags;
+#include "trace.glsl"
 
-uniform vec3 camPos;
-uniform mat4 invView;
-
-uniform float diskThickness;
-uniform float bhSizeBuffer;
-
-uniform sampler2D u_skybox; 
 uniform vec3 u_cameraDir;   
 uniform vec3 u_cameraRight; 
 uniform vec3 u_cameraUp;    
-uniform float u_fov;
-
-uniform vec3 bhPos;
-uniform float bhRadius;
-uniform float bhMass;
-
-uniform float u_aspectRatio;
-
-const float G = 1.0;
-const float c = 1.0;
-const float dt = 0.05;
-const float PI = 3.14159265359;
-const int MAX_STEPS = 4000;
-
-vec3 NewtonianAcceleration(vec3 loc) {
-    vec3 dir = bhPos - loc;
-    float d2 = dot(dir, dir);
-    float d3 = d2 * sqrt(d2); 
-    return G * bhMass * dir / d3;
-}
-
-vec3 ToCartesian(vec3 vec) {
-    float r = vec.x;
-    float theta = vec.y;
-    float phi = vec.z;
-
-    float x = r * sin(theta) * cos(phi);
-    float y = r * sin(theta) * sin(phi);
-    float z = r * cos(theta);
-
-    return vec3(x, y, z);
-}
-
-vec3 GeodesicAcceleration(vec3 loc, vec3 vel) {
-    vec3 relativeLoc = loc - bhPos;
-    float r = length(relativeLoc);
-    r = max(r, 0.001);
-
-    float factor = 1.0 - bhRadius / r;
-
-    vec3 nLoc = relativeLoc / r;
-
-    vec3 dVel = -1.5 * (G * bhMass / (r * r * factor)) * (dot(vel, vel) / (c * c) - factor) * nLoc;
-    
-    dVel += (dot(vel, nLoc) / (r * factor)) * vel;
-
-    return dVel;
-}
 
-void March_Geodesic_RK4(inout vec3 loc, inout vec3 vel, float c_dt) {
-    vec3 k1v = GeodesicAcceleration(loc, vel);
-    vec3 k1x = vel;
-
-    vec3 k2v = GeodesicAcceleration(loc + k1x * c_dt * 0.5, vel + k1v * c_dt * 0.5);
-    vec3 k2x = vel + k1v * c_dt * 0.5;
-
-    vec3 k3v = GeodesicAcceleration(loc + k2x * c_dt * 0.5, vel + k2v * c_dt * 0.5);
-    vec3 k3x = vel + k2v * c_dt * 0.5;
-
-    vec3 k4v = GeodesicAcceleration(loc + k3x * c_dt, vel + k3v * c_dt);
-    vec3 k4x = vel + k3v * c_dt;
-
-    loc += (c_dt / 6.0) * (k1x + 2.0 * k2x + 2.0 * k3x + k4x);
-    vel += (c_dt / 6.0) * (k1v + 2.0 * k2v + 2.0 * k3v + k4v);
-    
-    vel *= c / length(vel);
+// Progressive passes render every u_progressiveStride-th pixel into a
+// smaller target, 0 when off (see Display::DrawProgressive). Sky feedback
+// passes do the same from u_progressiveOffset (see Display::DrawSkyFeedback).
+uniform int u_progressiveStride;
+uniform bool u_progressiveReuse;
+uniform sampler2D u_progressivePrevious;
+uniform vec2 u_resolution;
+uniform ivec2 u_progressiveOffset;
+
+// Log-polar passes trace sample (i, j) of a LogPolarGrid per fragment (see
+// logpolar.h), logpolar.frag then resamples them to the frame
+uniform bool u_logPolar;
+uniform vec2 u_logPolarCenter;
+uniform float u_logPolarInner;
+uniform float u_logPolarAngularStep;
+uniform float u_logPolarRadialStep;
+
+// Shade from the lens map of an earlier frame instead of tracing, the camera
+// only orbited since (see Display::DrawLensCache)
+uniform bool u_lensMapReuse;
+uniform sampler2D u_lensDirection;
+uniform sampler2D u_lensDisk;
+
+// Cost of this pixel, written to StepInfo on the way out
+void WriteStepInfo(int termination) {
+    StepInfo = vec4(float(g_steps), float(g_accelEvals), float(termination), 1.0);
 }
 
-void March_Newtonian_RK4(inout vec3 loc, inout vec3 vel, float c_dt) {
-    vec3 k1v = NewtonianAcceleration(loc);
-    vec3 k1x = vel;
-
-    vec3 k2v = NewtonianAcceleration(loc + c_dt / 2.0 * k1x);
-    vec3 k2x = vel + c_dt / 2.0 * k1v;
+void WriteLensMap(int termination, vec3 accumulatedColor, float transmission) {
+    float redshift = 0.0;
+    if (termination == TERMINATION_CAPTURED) redshift = -1.0;
+    else if (termination == TERMINATION_ESCAPED) redshift = g_escapeRedshift;
 
-    vec3 k3v = NewtonianAcceleration(loc + c_dt / 2.0 * k2x);
-    vec3 k3x = vel + c_dt / 2.0 * k2v;
-
-    vec3 k4v = NewtonianAcceleration(loc + c_dt * k3x); 
-    vec3 k4x = vel + c_dt * k3v;
-
-    vel += c_dt / 6.0 * (k1v + 2.0 * k2v + 2.0 * k3v + k4v);
-    vel = normalize(vel) * c;
-
-    loc += c_dt / 6.0 * (k1x + 2.0 * k2x + 2.0 * k3x + k4x);
+    // invView is a rotation, its transpose takes world directions to the camera
+    LensDirection = vec4(transpose(mat3(invView)) * g_escapeDir, redshift);
+    LensDisk = vec4(accumulatedColor, transmission);
 }
 
-vec2 DirectionToUV(vec3 dir) {
-    float phi = atan(dir.z, dir.x);
-    float theta = asin(dir.y);
-    
-    float u = 1.0 - (phi + PI) / (2.0 * PI);
-    float v = theta / PI + 0.5;
-    
-    return vec2(u, v);
+void RecordSkyPage(int page) {
+    SkyFeedback = vec4(float(page + 1));
 }
 
 void main() {
-    bool useRelativity = (flags & (1u << 0)) != 0u;
-    bool showDisk = (flags & (1u << 1)) != 0u;
-
-    vec2 ndc = TexCoord * 2.0 - 1.0;
-    ndc.x *= u_aspectRatio;
-
-    float fovFactor = tan(u_fov * 0.5);
-    vec3 rayDirCam = normalize(vec3(ndc.x * fovFactor, ndc.y * fovFactor, -1.0));
-    vec3 rayDir = normalize((invView * vec4(rayDirCam, 0.0)).xyz);
-    
-    vec3 loc = camPos;
-    vec3 vel = rayDir * c;
-    
-    vec3 pixelColor = vec3(1.0, 0.0, 0.0);
-    float transmission = 1.0;
-    vec3 accumulatedColor = vec3(0.0);
-
-    for (int i = 0; i < MAX_STEPS; i++) {
-        float bhDist = length(loc - bhPos);
-
-        float diskInner = bhRadius * 2.0;
-        float diskOuter = bhRadius * 6.0;
-
-        // BlackHole Collision
-        if (bhDist < bhRadius * bhSizeBuffer) {
-        FragColor = vec4(accumulatedColor, 1.0); // Keep what we found, but hit black
-        return;
+    SkyFeedback = vec4(0.0);
+    TraceFlags traceFlags = SceneTraceFlags();
+
+    if (u_lensMapReuse) {
+        ivec2 texel = ivec2(gl_FragCoord.xy);
+        vec4 lens = texelFetch(u_lensDirection, texel, 0);
+        vec4 disk = texelFetch(u_lensDisk, texel, 0);
+        if (lens.w < 0.0) {
+            FragColor = vec4(disk.rgb, 1.0);
+            return;
         }
 
-        // Escape
-        if (bhDist > 100.0) {
-            vec2 skyUV = DirectionToUV(normalize(vel));
-            pixelColor = texture(u_skybox, skyUV).rgb;
-
-            float redshift = sqrt(1.0 - bhRadius / bhDist);
-            pixelColor /= max(redshift, 0.01);
-            break;
+        vec3 color = vec3(1.0, 0.0, 0.0);
+        if (lens.w > 0.0) {
+            vec3 escapeDir = normalize(mat3(invView) * lens.xyz);
+            color = SkyColor(escapeDir) / lens.w;
         }
+        FragColor = FinalColor(color, disk.rgb, disk.a);
+        return;
+    }
 
-        float currentDt = dt * clamp(bhDist * 0.5, 0.05, 5.0);
-
-        // Disk Collision
-        if(bhDist > diskInner && bhDist < diskOuter && showDisk) {
-            float height = abs(loc.y - bhPos.y);
-            float density = exp(-(height * height) / (diskThickness * diskThickness));
-
-            float radialT = (bhDist - diskInner) / (diskOuter - diskInner);
-            density *= 1.0 - radialT;
-
-            vec3 diskColor = mix(vec3(1.0, 0.7, 0.2), vec3(0.5, 0.1, 0.0), radialT);
-            
-            float stepOpacity = density * currentDt * 2.0; 
-            accumulatedColor += transmission * diskColor * stepOpacity;
-            transmission *= max(0.0, 1.0 - stepOpacity);
+    // Texel (i, j) of a progressive pass is pixel (i, j) * stride of the full
+    // frame. Even texels were traced by the pass before at twice the stride.
+    vec2 texCoord = TexCoord;
+    if (u_progressiveStride > 0) {
+        ivec2 texel = ivec2(gl_FragCoord.xy);
+        if (u_progressiveReuse && texel.x % 2 == 0 && texel.y % 2 == 0) {
+            FragColor = texelFetch(u_progressivePrevious, texel / 2, 0);
+            return;
         }
+        texCoord = (vec2(texel * u_progressiveStride + u_progressiveOffset) + 0.5) / u_resolution;
+    }
 
-        if (transmission < 0.01) break;
+    if (u_logPolar) {
+        float theta = u_logPolarAngularStep * gl_FragCoord.x;
+        float radius = u_logPolarInner * (exp(u_logPolarRadialStep * gl_FragCoord.y) - 1.0);
+        vec2 position = u_logPolarCenter + radius * vec2(cos(theta), sin(theta));
 
-        if  (useRelativity) {
-            March_Geodesic_RK4(loc, vel, currentDt);
-        } else {
-            March_Newtonian_RK4(loc, vel, currentDt);
+        // Off screen, see LogPolarGrid::IsVisible
+        float margin = u_logPolarAngularStep * (radius + u_logPolarInner) + 1.0;
+        if (any(lessThan(position, vec2(-margin))) || any(greaterThan(position, u_resolution + margin))) {
+            FragColor = vec4(0.0, 0.0, 0.0, 1.0);
+            return;
         }
+        texCoord = position / u_resolution;
     }
 
-    pixelColor = mix(pixelColor, accumulatedColor, 1.0 - transmission);
-    pixelColor = pixelColor / (pixelColor + vec3(1.0));
-    pixelColor = pow(pixelColor, vec3(1.0 / 2.2));
+    Ray ray;
+    if (StartRay(texCoord, traceFlags, ray))
+        for (int i = 0; i < MAX_STEPS; i++)
+            if (MarchStep(ray, traceFlags)) break;
 
-    FragColor = vec4(pixelColor, 1.0);
-}
\ No newline at end of file
+    FragColor = RayColor(ray);
+    WriteStepInfo(ray.termination);
+    WriteLensMap(ray.termination, ray.accumulatedColor, ray.transmission);
+}
@@ -0,0 +1,23 @@
+#version 400 core
+out vec4 FragColor;
+in vec2 TexCoord;
+
+// Resamples a log-polar pass of blackhole.frag onto the frame (see
+// LogPolarGrid in logpolar.h). u_samples wraps in angle and clamps in
+// radius, so GL_LINEAR does the bilinear filter.
+uniform sampler2D u_samples;
+uniform vec2 u_center;
+uniform float u_inner;
+uniform float u_radialStep;
+uniform int u_radial;
+
+const float PI = 3.14159265359;
+
+void main() {
+    vec2 offset = gl_FragCoord.xy - u_center;
+    float theta = atan(offset.y, offset.x);
+    if (theta < 0.0) theta += 2.0 * PI;
+
+    float t = log(1.0 + length(offset) / u_inner) / (u_radialStep * float(u_radial));
+    FragColor = vec4(texture(u_samples, vec2(theta / (2.0 * PI), t)).rgb, 1.0);
+}
@@ -0,0 +1,717 @@
+// The tracer itself, shared by blackhole.frag and the wavefront tracer in
+// wavefront.comp: scene uniforms, integrators, sky sampling, and a ray
+// split into StartRay and MarchStep so either can drive the march.
+
+// Scene parameters, one std140 buffer written by Display::UpdateUniforms
+// only when they change (see Display::SceneUniforms)
+layout(std140) uniform SceneBlock {
+    mat4 invView;
+    vec3 camPos;
+    float u_fov;
+    vec3 bhPos;
+    float bhMass;
+    float bhRadius;
+    float u_aspectRatio;
+    float bhSizeBuffer;
+    float diskThickness;
+    float u_tolerance;
+    float u_farFieldRadius;
+    float u_weakFieldImpact;
+    float u_weakFieldTolerance;
+    float u_deflectionCritical;
+    uint flags;
+    float u_skyLevel;
+};
+
+// Specialized variants are built with SPECIALIZED_FLAGS defined to the
+// flags they were made for (see Display::SelectShader). SceneTraceFlags
+// returns constants then and the branches the scene never takes compile out.
+#ifdef SPECIALIZED_FLAGS
+#define SCENE_FLAGS uint(SPECIALIZED_FLAGS)
+#else
+#define SCENE_FLAGS flags
+#endif
+
+uniform samplerCube u_skybox;
+uniform sampler1D u_deflection;
+
+// Tiled sky (see skytiles.h and skystream.h). Resident tiles sit in slots of
+// u_skyAtlas, u_skyPages holds slot + 1 of every page or 0. Pages that are
+// not in fall back to the tile one level up, the top level is always in.
+const int SKY_PAGE_TABLE_WIDTH = 256;
+uniform bool u_skyTiled;
+uniform sampler2D u_skyAtlas;
+uniform usampler2D u_skyPages;
+uniform int u_skyFaceSize;
+uniform int u_skyTileSize;
+uniform int u_skyTileLevels;
+uniform int u_skyLevelPages[16];
+uniform int u_skyAtlasColumns;
+
+// The page a ray wanted, defined by the shader that includes this
+void RecordSkyPage(int page);
+
+const float G = 1.0;
+const float c = 1.0;
+const float dt = 0.05;
+const float PI = 3.14159265359;
+const int MAX_STEPS = 4000;
+
+const float MIN_ADAPTIVE_STEP = 1e-4;
+const float SAFETY = 0.9;
+const float MIN_STEP_SCALE = 0.2;
+const float MAX_STEP_SCALE = 5.0;
+
+const float PLANAR_STEP = 0.01;
+// Same order as RayTermination in ray.h
+const int TERMINATION_CAPTURED = 0;
+const int TERMINATION_ESCAPED = 1;
+const int TERMINATION_OPAQUE = 2;
+const int TERMINATION_EXHAUSTED = 3;
+
+// Cost of this ray
+int g_steps = 0;
+int g_accelEvals = 0;
+
+// Sky direction and redshift of the last EscapeColor
+vec3 g_escapeDir = vec3(0.0);
+float g_escapeRedshift = 0.0;
+
+vec3 NewtonianAcceleration(vec3 loc) {
+    g_accelEvals++;
+    vec3 dir = bhPos - loc;
+    float d2 = dot(dir, dir);
+    float d3 = d2 * sqrt(d2); 
+    return G * bhMass * dir / d3;
+}
+
+vec3 ToCartesian(vec3 vec) {
+    float r = vec.x;
+    float theta = vec.y;
+    float phi = vec.z;
+
+    float x = r * sin(theta) * cos(phi);
+    float y = r * sin(theta) * sin(phi);
+    float z = r * cos(theta);
+
+    return vec3(x, y, z);
+}
+
+vec3 GeodesicAcceleration(vec3 loc, vec3 vel) {
+    g_accelEvals++;
+    vec3 relativeLoc = loc - bhPos;
+    float r = length(relativeLoc);
+    r = max(r, 0.001);
+
+    float factor = 1.0 - bhRadius / r;
+
+    vec3 nLoc = relativeLoc / r;
+
+    vec3 dVel = -1.5 * (G * bhMass / (r * r * factor)) * (dot(vel, vel) / (c * c) - factor) * nLoc;
+    
+    dVel += (dot(vel, nLoc) / (r * factor)) * vel;
+
+    return dVel;
+}
+
+void March_Geodesic_RK4(inout vec3 loc, inout vec3 vel, float c_dt) {
+    vec3 k1v = GeodesicAcceleration(loc, vel);
+    vec3 k1x = vel;
+
+    vec3 k2v = GeodesicAcceleration(loc + k1x * c_dt * 0.5, vel + k1v * c_dt * 0.5);
+    vec3 k2x = vel + k1v * c_dt * 0.5;
+
+    vec3 k3v = GeodesicAcceleration(loc + k2x * c_dt * 0.5, vel + k2v * c_dt * 0.5);
+    vec3 k3x = vel + k2v * c_dt * 0.5;
+
+    vec3 k4v = GeodesicAcceleration(loc + k3x * c_dt, vel + k3v * c_dt);
+    vec3 k4x = vel + k3v * c_dt;
+
+    loc += (c_dt / 6.0) * (k1x + 2.0 * k2x + 2.0 * k3x + k4x);
+    vel += (c_dt / 6.0) * (k1v + 2.0 * k2v + 2.0 * k3v + k4v);
+    
+    vel *= c / length(vel);
+}
+
+void March_Newtonian_RK4(inout vec3 loc, inout vec3 vel, float c_dt) {
+    vec3 k1v = NewtonianAcceleration(loc);
+    vec3 k1x = vel;
+
+    vec3 k2v = NewtonianAcceleration(loc + c_dt / 2.0 * k1x);
+    vec3 k2x = vel + c_dt / 2.0 * k1v;
+
+    vec3 k3v = NewtonianAcceleration(loc + c_dt / 2.0 * k2x);
+    vec3 k3x = vel + c_dt / 2.0 * k2v;
+
+    vec3 k4v = NewtonianAcceleration(loc + c_dt * k3x); 
+    vec3 k4x = vel + c_dt * k3v;
+
+    vel += c_dt / 6.0 * (k1v + 2.0 * k2v + 2.0 * k3v + k4v);
+    vel = normalize(vel) * c;
+
+    loc += c_dt / 6.0 * (k1x + 2.0 * k2x + 2.0 * k3x + k4x);
+}
+
+// RK4 renormalizes |vel| every step, in the small step limit that drops the
+// acceleration along vel, so the adaptive integrator uses that directly
+vec3 ProjectedAcceleration(vec3 loc, vec3 vel, bool useRelativity) {
+    vec3 acc = useRelativity ? GeodesicAcceleration(loc, vel) : NewtonianAcceleration(loc);
+    return acc - (dot(acc, vel) / dot(vel, vel)) * vel;
+}
+
+// Dormand-Prince 5(4), k1v is first same as last. Returns error / tolerance.
+float March_DormandPrince(vec3 loc, vec3 vel, vec3 k1v, float h, bool useRelativity,
+                          out vec3 outLoc, out vec3 outVel, out vec3 outK1v) {
+    vec3 k1x = vel;
+
+    vec3 k2x = vel + h * (1.0 / 5.0) * k1v;
+    vec3 k2v = ProjectedAcceleration(loc + h * (1.0 / 5.0) * k1x, k2x, useRelativity);
+
+    vec3 k3x = vel + h * ((3.0 / 40.0) * k1v + (9.0 / 40.0) * k2v);
+    vec3 k3v = ProjectedAcceleration(loc + h * ((3.0 / 40.0) * k1x + (9.0 / 40.0) * k2x), k3x, useRelativity);
+
+    vec3 k4x = vel + h * ((44.0 / 45.0) * k1v - (56.0 / 15.0) * k2v + (32.0 / 9.0) * k3v);
+    vec3 k4v = ProjectedAcceleration(loc + h * ((44.0 / 45.0) * k1x - (56.0 / 15.0) * k2x + (32.0 / 9.0) * k3x), k4x, useRelativity);
+
+    vec3 k5x = vel + h * ((19372.0 / 6561.0) * k1v - (25360.0 / 2187.0) * k2v + (64448.0 / 6561.0) * k3v - (212.0 / 729.0) * k4v);
+    vec3 k5v = ProjectedAcceleration(loc + h * ((19372.0 / 6561.0) * k1x - (25360.0 / 2187.0) * k2x + (64448.0 / 6561.0) * k3x - (212.0 / 729.0) * k4x), k5x, useRelativity);
+
+    vec3 k6x = vel + h * ((9017.0 / 3168.0) * k1v - (355.0 / 33.0) * k2v + (46732.0 / 5247.0) * k3v + (49.0 / 176.0) * k4v - (5103.0 / 18656.0) * k5v);
+    vec3 k6v = ProjectedAcceleration(loc + h * ((9017.0 / 3168.0) * k1x - (355.0 / 33.0) * k2x + (46732.0 / 5247.0) * k3x + (49.0 / 176.0) * k4x - (5103.0 / 18656.0) * k5x), k6x, useRelativity);
+
+    outLoc = loc + h * ((35.0 / 384.0) * k1x + (500.0 / 1113.0) * k3x + (125.0 / 192.0) * k4x - (2187.0 / 6784.0) * k5x + (11.0 / 84.0) * k6x);
+    outVel = vel + h * ((35.0 / 384.0) * k1v + (500.0 / 1113.0) * k3v + (125.0 / 192.0) * k4v - (2187.0 / 6784.0) * k5v + (11.0 / 84.0) * k6v);
+
+    vec3 k7x = outVel;
+    vec3 k7v = ProjectedAcceleration(outLoc, outVel, useRelativity);
+    outK1v = k7v;
+
+    vec3 errLoc = h * ((71.0 / 57600.0) * k1x - (71.0 / 16695.0) * k3x + (71.0 / 1920.0) * k4x - (17253.0 / 339200.0) * k5x + (22.0 / 525.0) * k6x - (1.0 / 40.0) * k7x);
+    vec3 errVel = h * ((71.0 / 57600.0) * k1v - (71.0 / 16695.0) * k3v + (71.0 / 1920.0) * k4v - (17253.0 / 339200.0) * k5v + (22.0 / 525.0) * k6v - (1.0 / 40.0) * k7v);
+
+    float r = max(length(loc - bhPos), 1.0);
+    return max(length(errLoc) / r, length(errVel) / c) / u_tolerance;
+}
+
+float NextStepScale(float error) {
+    if (error <= 0.0) return MAX_STEP_SCALE;
+    return clamp(SAFETY * pow(error, -0.2), MIN_STEP_SCALE, MAX_STEP_SCALE);
+}
+
+// GL_TEXTURE_CUBE_MAP face selection, as Skybox::CubeFace
+int CubeFace(vec3 d, out vec2 st) {
+    vec3 a = abs(d);
+    int face;
+    vec2 sc;
+    float ma;
+    if (a.x >= a.y && a.x >= a.z) {
+        face = d.x > 0.0 ? 0 : 1;
+        sc = vec2(d.x > 0.0 ? -d.z : d.z, -d.y);
+        ma = a.x;
+    } else if (a.y >= a.z) {
+        face = d.y > 0.0 ? 2 : 3;
+        sc = vec2(d.x, d.y > 0.0 ? d.z : -d.z);
+        ma = a.y;
+    } else {
+        face = d.z > 0.0 ? 4 : 5;
+        sc = vec2(d.z > 0.0 ? d.x : -d.x, -d.y);
+        ma = a.z;
+    }
+    st = 0.5 * (sc / ma + 1.0);
+    return face;
+}
+
+vec3 TiledSkyColor(vec3 dir, int level) {
+    vec2 st;
+    int face = CubeFace(dir, st);
+    int stride = u_skyTileSize + 2;
+    for (int l = level; l < u_skyTileLevels; l++) {
+        int size = max(u_skyFaceSize >> l, 1);
+        int tiles = (size + u_skyTileSize - 1) / u_skyTileSize;
+        vec2 f = st * float(size) - 0.5;
+        ivec2 tile = clamp(ivec2(floor(floor(f) / float(u_skyTileSize))), ivec2(0), ivec2(tiles - 1));
+        int page = u_skyLevelPages[l] + (face * tiles + tile.y) * tiles + tile.x;
+        if (l == level) RecordSkyPage(page);
+
+        uint entry = texelFetch(u_skyPages, ivec2(page % SKY_PAGE_TABLE_WIDTH, page / SKY_PAGE_TABLE_WIDTH), 0).x;
+        if (entry != 0u) {
+            int slot = int(entry) - 1;
+            vec2 origin = vec2(slot % u_skyAtlasColumns, slot / u_skyAtlasColumns) * float(stride);
+            // Inside the tile past its border texel, filtered by the atlas
+            vec2 texel = origin + f - vec2(tile * u_skyTileSize) + 1.5;
+            return textureLod(u_skyAtlas, texel / vec2(textureSize(u_skyAtlas, 0)), 0.0).rgb;
+        }
+    }
+    return vec3(0.0);
+}
+
+// Escaping rays diverge, there are no derivatives to pick a level from, so
+// it comes from the size of a pixel (Skybox::LevelForPixelAngle)
+vec3 SkyColor(vec3 dir) {
+    if (u_skyTiled) return TiledSkyColor(dir, int(u_skyLevel));
+    return textureLod(u_skybox, dir, u_skyLevel).rgb;
+}
+
+vec3 EscapeColor(vec3 vel, float bhDist) {
+    g_escapeDir = normalize(vel);
+    vec3 color = SkyColor(g_escapeDir);
+
+    float redshift = sqrt(1.0 - bhRadius / bhDist);
+    g_escapeRedshift = max(redshift, 0.01);
+    return color / g_escapeRedshift;
+}
+
+// Disk blend, tone map and gamma
+vec4 FinalColor(vec3 pixelColor, vec3 accumulatedColor, float transmission) {
+    pixelColor = mix(pixelColor, accumulatedColor, 1.0 - transmission);
+    pixelColor = pixelColor / (pixelColor + vec3(1.0));
+    pixelColor = pow(pixelColor, vec3(1.0 / 2.2));
+    return vec4(pixelColor, 1.0);
+}
+
+// Never inside the disk, an outbound ray there could still pick up light
+float FarFieldRadius(bool showDisk) {
+    return max(u_farFieldRadius, bhRadius * (showDisk ? 6.0 : 2.0));
+}
+
+// Direction at infinity of a ray that stays far from the hole, integrating
+// the sideways acceleration along the straight line from loc onwards. It
+// falls off as 1/r^2 (Newtonian) or 1/(r^3 f) (geodesic), see
+// Physics::WeakFieldDirection
+vec3 WeakFieldDirection(vec3 loc, vec3 vel, bool useRelativity) {
+    vec3 dir = normalize(vel);
+    vec3 relativeLoc = loc - bhPos;
+    float r = length(relativeLoc);
+
+    float s = dot(relativeLoc, dir);
+    vec3 impact = relativeLoc - s * dir;
+    float b = length(impact);
+
+    float strength, integral;
+    if (useRelativity) {
+        strength = 1.5 * G * bhMass * bhRadius;
+        float b2 = b * b, s2 = s * s;
+        float r4, r5;
+        if (s > 0.0 && b < 0.3 * s) {
+            float y = b2 / s2;
+            r4 = (1.0 - y * (6.0 / 5.0 - y * (9.0 / 7.0 - y * (4.0 / 3.0)))) / (3.0 * s2 * s);
+            r5 = (1.0 - y * (5.0 / 3.0 - y * (35.0 / 16.0 - y * (21.0 / 8.0)))) / (4.0 * s2 * s2);
+        } else {
+            r4 = (0.5 * PI - atan(s / b)) / (2.0 * b2 * b) - s / (2.0 * b2 * r * r);
+            r5 = (2.0 * r * r * r - s * (2.0 * s2 + 3.0 * b2)) / (3.0 * b2 * b2 * r * r * r);
+        }
+        integral = r4 + bhRadius * r5;
+    } else {
+        strength = G * bhMass;
+        integral = s > 0.0 ? 1.0 / (r * (r + s)) : (1.0 - s / r) / (b * b);
+    }
+
+    return normalize(dir - (strength * integral / (c * c)) * impact);
+}
+
+// Weak-field orbit angle from the camera to infinity, the Binet integral to
+// third order in m = M / b (see Physics::WeakFieldOrbitAngle)
+float WeakFieldOrbitAngle(float m, float w, bool inward, out float errorEstimate) {
+    float v = 1.0 - w * w;
+    float sv = sqrt(v);
+    float theta = asin(w);
+    float tn = w / sv;
+
+    float j1 = 1.0 / sv + sv - 2.0;
+    float j2 = tn * tn * tn / 3.0 - 2.0 * tn + 2.5 * theta - 0.5 * w * sv;
+    float j3 = 0.2 / (v * v * sv) - 4.0 / (3.0 * v * sv) + 6.0 / sv + 4.0 * sv - v * sv / 3.0 - 128.0 / 15.0;
+
+    float m2 = m * m;
+    float cameraSide = theta - m * j1 + 1.5 * m2 * j2 - 2.5 * m2 * m * j3;
+    float periapsisSide = 0.5 * PI + m * (2.0 + m * (15.0 * PI / 8.0 + m * (64.0 / 3.0)));
+
+    float m4 = m2 * m2;
+    errorEstimate = 0.3 * m4 / (v * v * v * sv);
+    if (!inward) return cameraSide;
+
+    errorEstimate += 180.0 * m4;
+    return 2.0 * periapsisSide - cameraSide;
+}
+
+// Escape direction of a ray passing further than u_weakFieldImpact, false
+// when it needs the march
+bool WeakFieldEscape(vec3 loc, vec3 vel, bool useRelativity, bool planarOrbit, out vec3 outDir) {
+    vec3 relativeLoc = loc - bhPos;
+    float r = length(relativeLoc);
+    vec3 dir = normalize(vel);
+
+    vec3 e1 = relativeLoc / r;
+    float radial = dot(dir, e1);
+    vec3 perp = dir - radial * e1;
+    float perpLen = length(perp);
+
+    float impact = r * perpLen;
+    if (impact < u_weakFieldImpact || r > 100.0) return false;
+
+    float errorEstimate;
+    if (planarOrbit) {
+        // b of the Binet start state, 1/b^2 = u^2 (1 / sin^2(alpha) - 2Mu)
+        float M = 0.5 * bhRadius;
+        float b = impact / sqrt(1.0 - 2.0 * M * perpLen * perpLen / r);
+        float phi = WeakFieldOrbitAngle(M / b, b / r, radial < 0.0, errorEstimate);
+        outDir = cos(phi) * e1 + sin(phi) * (perp / perpLen);
+    } else {
+        outDir = WeakFieldDirection(loc, vel, useRelativity);
+        float bend = length(cross(outDir, dir));
+        errorEstimate = 2.0 * bend * bend;
+    }
+    return errorEstimate <= u_weakFieldTolerance;
+}
+
+vec2 BinetDerivative(vec2 state) {
+    g_accelEvals++;
+    return vec2(state.y, -state.x + 1.5 * bhRadius * state.x * state.x);
+}
+
+// Schwarzschild light rays stay in one plane: integrate u(phi) = 1 / r with
+// u'' = -u + 3Mu^2 and rotate the outgoing direction back to 3D
+// 1/b^2 = u'^2 + V(u) with V(u) = u^2 (1 - 2Mu), peaked at the photon sphere
+float OrbitPotential(float u) {
+    return u * u * (1.0 - bhRadius * u);
+}
+
+bool IsCaptureCertain(vec2 state) {
+    float uPhoton = 1.0 / (1.5 * bhRadius);
+    float uPeak = min(1.0 / (bhRadius * bhSizeBuffer), uPhoton);
+    float invB2 = state.y * state.y + OrbitPotential(state.x);
+    bool inward = state.y > 0.0;
+
+    if (state.x < uPeak) return inward && invB2 > OrbitPotential(uPeak);
+    return inward || invB2 <= OrbitPotential(uPhoton);
+}
+
+const float GAUSS_NODES[4] = float[](0.1834346425, 0.5255324099, 0.7966664774, 0.9602898565);
+const float GAUSS_WEIGHTS[4] = float[](0.3626837834, 0.3137066459, 0.2223810345, 0.1012285363);
+
+// Orbit angle an outbound ray still turns through on its way to u = 0,
+// dphi = du / sqrt(1/b^2 - V(u)) with u = u_p (1 - t^2) about the periapsis
+// u_p, or about the start for steep rays (see Physics::RemainingOrbitAngle)
+float RemainingOrbitAngle(vec2 state) {
+    float u0 = state.x;
+    float du2 = state.y * state.y;
+    float slope = 2.0 * u0 - 3.0 * bhRadius * u0 * u0;
+
+    float uPhoton = 1.0 / (1.5 * bhRadius);
+    float headroom = OrbitPotential(uPhoton) - OrbitPotential(u0);
+    float uPeak = u0;
+    if (du2 < 0.5 * slope * u0 && du2 < 0.5 * headroom) {
+        float d = du2 / slope;
+        for (int i = 0; i < 4; i++) {
+            float rise = d * ((2.0 * u0 + d) - bhRadius * (3.0 * u0 * u0 + 3.0 * u0 * d + d * d));
+            float riseSlope = 2.0 * (u0 + d) - 3.0 * bhRadius * (u0 + d) * (u0 + d);
+            d = clamp(d - (rise - du2) / riseSlope, 0.0, uPhoton - u0);
+        }
+        uPeak = u0 + d;
+    }
+
+    float tStart = sqrt(max(1.0 - u0 / uPeak, 0.0));
+    float halfWidth = 0.5 * (1.0 - tStart);
+    float center = 0.5 * (1.0 + tStart);
+    float rest = (uPeak == u0) ? du2 : 0.0;
+
+    float phi = 0.0;
+    for (int i = 0; i < 8; i++) {
+        float t = center + halfWidth * (i < 4 ? -GAUSS_NODES[i] : GAUSS_NODES[i - 4]);
+        float u = uPeak * (1.0 - t * t);
+        float drop = uPeak * t * t * ((uPeak + u) - bhRadius * (uPeak * uPeak + uPeak * u + u * u));
+        phi += GAUSS_WEIGHTS[i & 3] * 2.0 * uPeak * t / sqrt(rest + drop);
+    }
+    return halfWidth * phi;
+}
+
+int March_Planar(vec3 startLoc, vec3 startVel, bool showDisk, bool farField, out vec3 outVel, out float outDist,
+                 inout float transmission, inout vec3 accumulatedColor) {
+    vec3 relativeLoc = startLoc - bhPos;
+    float r = length(relativeLoc);
+    vec3 dir = normalize(startVel);
+    outVel = startVel;
+    outDist = r;
+
+    float captureRadius = bhRadius * bhSizeBuffer;
+    if (r < captureRadius) return TERMINATION_CAPTURED;
+    if (r > 100.0) return TERMINATION_ESCAPED;
+
+    vec3 e1 = relativeLoc / r;
+    float radial = dot(dir, e1);
+    vec3 perp = dir - radial * e1;
+    float perpLen = length(perp);
+    if (perpLen < 1e-6) {
+        outDist = 100.0;
+        return radial < 0.0 ? TERMINATION_CAPTURED : TERMINATION_ESCAPED;
+    }
+    vec3 e2 = perp / perpLen;
+
+    float diskInner = bhRadius * 2.0;
+    float diskOuter = bhRadius * 6.0;
+
+    vec2 state = vec2(1.0 / r, -radial / (r * perpLen));
+    float phi = 0.0;
+    int termination = TERMINATION_EXHAUSTED;
+
+    // Resolved by the impact parameter alone, unless the disk is in front
+    if (!showDisk && IsCaptureCertain(state)) return TERMINATION_CAPTURED;
+
+    float uPhoton = 1.0 / (1.5 * bhRadius);
+    float uFarField = 1.0 / FarFieldRadius(showDisk);
+
+    for (int i = 0; i < MAX_STEPS; i++) {
+        // Nothing heading inward below the photon sphere comes back out
+        if (state.x > 1.0 / captureRadius || (state.x > uPhoton && state.y > 0.0)) return TERMINATION_CAPTURED;
+        if (state.x < 1.0 / 100.0) {
+            termination = TERMINATION_ESCAPED;
+            break;
+        }
+
+        // Outbound in the weak field, the rest of the orbit angle is a quadrature
+        if (farField && state.x < uFarField && state.y < 0.0) {
+            float endPhi = phi + RemainingOrbitAngle(state);
+            outVel = (cos(endPhi) * e1 + sin(endPhi) * e2) * c;
+            outDist = 100.0;
+            return TERMINATION_ESCAPED;
+        }
+
+        float bhDist = 1.0 / state.x;
+        if (showDisk && bhDist > diskInner && bhDist < diskOuter) {
+            vec3 loc = bhPos + (cos(phi) * e1 + sin(phi) * e2) * bhDist;
+            float ds = PLANAR_STEP * bhDist * sqrt(1.0 + (state.y * state.y) / (state.x * state.x));
+
+            float height = abs(loc.y - bhPos.y);
+            float density = exp(-(height * height) / (diskThickness * diskThickness));
+
+            float radialT = (bhDist - diskInner) / (diskOuter - diskInner);
+            density *= 1.0 - radialT;
+
+            vec3 diskColor = mix(vec3(1.0, 0.7, 0.2), vec3(0.5, 0.1, 0.0), radialT);
+
+            float stepOpacity = density * ds * 2.0;
+            accumulatedColor += transmission * diskColor * stepOpacity;
+            transmission *= max(0.0, 1.0 - stepOpacity);
+        }
+
+        if (transmission < 0.01) {
+            termination = TERMINATION_OPAQUE;
+            break;
+        }
+
+        g_steps++;
+        vec2 k1 = BinetDerivative(state);
+        vec2 k2 = BinetDerivative(state + k1 * PLANAR_STEP * 0.5);
+        vec2 k3 = BinetDerivative(state + k2 * PLANAR_STEP * 0.5);
+        vec2 k4 = BinetDerivative(state + k3 * PLANAR_STEP);
+        state += (PLANAR_STEP / 6.0) * (k1 + 2.0 * k2 + 2.0 * k3 + k4);
+        phi += PLANAR_STEP;
+    }
+
+    float u = max(state.x, 1.0 / 200.0);
+    vec3 radialDir = cos(phi) * e1 + sin(phi) * e2;
+    vec3 angularDir = -sin(phi) * e1 + cos(phi) * e2;
+    outVel = normalize(-state.y * radialDir + u * angularDir) * c;
+    outDist = 1.0 / u;
+    return termination;
+}
+
+// Exit direction from the precomputed deflection table (see deflection.h),
+// false if the ray is captured
+bool LookupDeflection(vec3 rayDir, out vec3 outDir) {
+    vec3 e1 = normalize(camPos - bhPos);
+    float radial = dot(rayDir, e1);
+    float alpha = acos(clamp(-radial, -1.0, 1.0));
+    if (alpha < u_deflectionCritical) return false;
+
+    float t = sqrt(clamp((alpha - u_deflectionCritical) / (PI - u_deflectionCritical), 0.0, 1.0));
+    // Interpolate by hand, filtering hardware may only have 8 bits of weight
+    // precision and psi changes fast near the photon ring
+    int size = textureSize(u_deflection, 0);
+    float x = t * float(size - 1);
+    int i0 = min(int(x), size - 2);
+    vec2 entry = mix(texelFetch(u_deflection, i0, 0).rg, texelFetch(u_deflection, i0 + 1, 0).rg, x - float(i0));
+    if (entry.y < 0.5) return false;
+
+    vec3 perp = rayDir - radial * e1;
+    float perpLen = length(perp);
+    if (perpLen < 1e-6) {
+        outDir = rayDir;
+        return true;
+    }
+    vec3 e2 = perp / perpLen;
+    outDir = normalize(cos(entry.x) * e1 + sin(entry.x) * e2);
+    return true;
+}
+
+// SceneFlags (see scene.h) as the tracer reads them
+struct TraceFlags {
+    bool useRelativity;
+    bool showDisk;
+    bool adaptiveStep;
+    bool planarOrbit;
+    bool deflectionTable;
+    bool farField;
+    bool weakField;
+};
+
+TraceFlags SceneTraceFlags() {
+    TraceFlags f;
+    f.useRelativity = (SCENE_FLAGS & (1u << 0)) != 0u;
+    f.showDisk = (SCENE_FLAGS & (1u << 1)) != 0u;
+    f.adaptiveStep = (SCENE_FLAGS & (1u << 2)) != 0u;
+    f.planarOrbit = f.useRelativity && (SCENE_FLAGS & (1u << 3)) != 0u;
+    f.deflectionTable = f.useRelativity && !f.showDisk && (SCENE_FLAGS & (1u << 4)) != 0u;
+    f.farField = (SCENE_FLAGS & (1u << 5)) != 0u;
+    f.weakField = (SCENE_FLAGS & (1u << 6)) != 0u;
+    return f;
+}
+
+// A camera ray and what it picked up so far. pixelColor stays red and
+// termination TERMINATION_EXHAUSTED until it stops.
+struct Ray {
+    vec3 loc;
+    vec3 vel;
+    vec3 k1v;               // first stage of the next adaptive step
+    float h;                // size of the next adaptive step
+    float transmission;
+    vec3 accumulatedColor;
+    vec3 pixelColor;
+    int termination;
+};
+
+// Camera ray through texCoord. Rays the weak field, the deflection table or
+// the planar march resolve return false, the rest take MarchStep until it
+// returns true or MAX_STEPS run out.
+bool StartRay(vec2 texCoord, TraceFlags f, out Ray ray) {
+    vec2 ndc = texCoord * 2.0 - 1.0;
+    ndc.x *= u_aspectRatio;
+
+    float fovFactor = tan(u_fov * 0.5);
+    vec3 rayDirCam = normalize(vec3(ndc.x * fovFactor, ndc.y * fovFactor, -1.0));
+    vec3 rayDir = normalize((invView * vec4(rayDirCam, 0.0)).xyz);
+
+    ray.loc = camPos;
+    ray.vel = rayDir * c;
+    ray.pixelColor = vec3(1.0, 0.0, 0.0);
+    ray.transmission = 1.0;
+    ray.accumulatedColor = vec3(0.0);
+    ray.termination = TERMINATION_EXHAUSTED;
+
+    // Rays far from the hole are done in a handful of flops
+    vec3 weakFieldDir;
+    bool weakFieldHit = f.weakField && !f.deflectionTable && WeakFieldEscape(ray.loc, ray.vel, f.useRelativity, f.planarOrbit, weakFieldDir);
+
+    ray.h = dt * clamp(length(ray.loc - bhPos) * 0.5, 0.05, 5.0);
+    bool march3D = !f.planarOrbit && !f.deflectionTable && !weakFieldHit;
+    ray.k1v = (f.adaptiveStep && march3D) ? ProjectedAcceleration(ray.loc, ray.vel, f.useRelativity) : vec3(0.0);
+
+    if (weakFieldHit) {
+        ray.termination = TERMINATION_ESCAPED;
+        ray.pixelColor = EscapeColor(weakFieldDir, 100.0);
+    } else if (f.deflectionTable) {
+        vec3 escapeDir;
+        if (LookupDeflection(rayDir, escapeDir)) {
+            ray.termination = TERMINATION_ESCAPED;
+            ray.pixelColor = EscapeColor(escapeDir, 100.0);
+        } else {
+            ray.termination = TERMINATION_CAPTURED;
+        }
+    } else if (f.planarOrbit) {
+        vec3 escapeVel;
+        float escapeDist;
+        ray.termination = March_Planar(ray.loc, ray.vel, f.showDisk, f.farField, escapeVel, escapeDist,
+                                       ray.transmission, ray.accumulatedColor);
+        if (ray.termination == TERMINATION_ESCAPED)
+            ray.pixelColor = EscapeColor(escapeVel, escapeDist);
+    }
+    return march3D;
+}
+
+// One step of the 3D march, true once the ray stopped. A rejected adaptive
+// step only shrinks h, it counts against MAX_STEPS all the same.
+bool MarchStep(inout Ray ray, TraceFlags f) {
+    float bhDist = length(ray.loc - bhPos);
+
+    float diskInner = bhRadius * 2.0;
+    float diskOuter = bhRadius * 6.0;
+
+    // BlackHole Collision
+    if (bhDist < bhRadius * bhSizeBuffer) {
+        ray.termination = TERMINATION_CAPTURED;
+        return true;
+    }
+
+    // Escape
+    if (bhDist > 100.0) {
+        ray.termination = TERMINATION_ESCAPED;
+        ray.pixelColor = EscapeColor(ray.vel, bhDist);
+        return true;
+    }
+
+    // Outbound in the weak field, the rest of the bend is analytic
+    if (f.farField && bhDist > FarFieldRadius(f.showDisk) && dot(ray.loc - bhPos, ray.vel) > 0.0) {
+        ray.termination = TERMINATION_ESCAPED;
+        ray.pixelColor = EscapeColor(WeakFieldDirection(ray.loc, ray.vel, f.useRelativity), 100.0);
+        return true;
+    }
+
+    float currentDt = dt * clamp(bhDist * 0.5, 0.05, 5.0);
+    bool inDisk = bhDist > diskInner && bhDist < diskOuter && f.showDisk;
+
+    // Adaptive step, rejected steps retry smaller
+    vec3 nextLoc, nextVel, nextK1v;
+    float stepScale = 1.0;
+    if (f.adaptiveStep) {
+        float heuristicDt = currentDt;
+        currentDt = min(ray.h, 0.5 * bhDist);
+        if (inDisk) currentDt = min(currentDt, heuristicDt);
+
+        g_steps++;
+        float error = March_DormandPrince(ray.loc, ray.vel, ray.k1v, currentDt, f.useRelativity, nextLoc, nextVel, nextK1v);
+        stepScale = NextStepScale(error);
+        if (error > 1.0 && currentDt > MIN_ADAPTIVE_STEP) {
+            ray.h = max(currentDt * stepScale, MIN_ADAPTIVE_STEP);
+            return false;
+        }
+    }
+
+    // Disk Collision
+    if (inDisk) {
+        float height = abs(ray.loc.y - bhPos.y);
+        float density = exp(-(height * height) / (diskThickness * diskThickness));
+
+        float radialT = (bhDist - diskInner) / (diskOuter - diskInner);
+        density *= 1.0 - radialT;
+
+        vec3 diskColor = mix(vec3(1.0, 0.7, 0.2), vec3(0.5, 0.1, 0.0), radialT);
+
+        float stepOpacity = density * currentDt * 2.0;
+        ray.accumulatedColor += ray.transmission * diskColor * stepOpacity;
+        ray.transmission *= max(0.0, 1.0 - stepOpacity);
+    }
+
+    if (ray.transmission < 0.01) {
+        ray.termination = TERMINATION_OPAQUE;
+        return true;
+    }
+
+    if (f.adaptiveStep) {
+        ray.loc = nextLoc;
+        ray.vel = nextVel;
+        ray.k1v = nextK1v;
+        ray.h = currentDt * stepScale;
+    } else if (f.useRelativity) {
+        g_steps++;
+        March_Geodesic_RK4(ray.loc, ray.vel, currentDt);
+    } else {
+        g_steps++;
+        March_Newtonian_RK4(ray.loc, ray.vel, currentDt);
+    }
+    return false;
+}
+
+// Captured rays keep what they found in front of the hole, but hit black
+vec4 RayColor(Ray ray) {
+    if (ray.termination == TERMINATION_CAPTURED) return vec4(ray.accumulatedColor, 1.0);
+    return FinalColor(ray.pixelColor, ray.accumulatedColor, ray.transmission);
+}
@@ -0,0 +1,127 @@
+// Offline renderer for keyframed camera paths. Only links the CPU tracer,
+// so it runs on machines without a display.
+#include "batch.h"
+#include "tracer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+const std::string SKYBOX_PATH = "assets/eso0926a - eagle nebula.hdr";
+
+static void PrintUsage(const char* program) {
+    fprintf(stderr,
+        "Usage: %s <camera path> [options]\n"
+        "  -o, --output <pattern>   printf pattern of the frame number (frame_%%05d.png), .hdr for float frames\n"
+        "  -s, --skybox <file>      equirectangular sky (%s)\n"
+        "  --width <pixels>         (%d)\n"
+        "  --height <pixels>        (%d)\n"
+        "  --frames <first>[:<last>]\n"
+        "  --in-flight <frames>     frames traced at once (2)\n"
+        "  --threads <threads>      tracer threads per frame, 0 to split the cores (0)\n"
+        "  --lens-cache             shade frames that only orbit the camera from the last traced rays\n"
+        "  --progressive <stride>   trace each frame coarse to fine from every stride-th pixel,\n"
+        "                           as the window does after a drag\n"
+        "  --log-polar <rays>       trace a log-polar grid of rays per pixel around the hole and\n"
+        "                           resample it to the frame\n"
+        "  --adaptive <tolerance>   trace block corners and split only the blocks whose bend misses\n"
+        "                           its interpolation by more than tolerance radians (2e-3)\n"
+        "  --mask <pattern>         printf pattern of the frame number, writes where --adaptive traced\n"
+        "  --step-stats <pattern>   printf pattern of the frame number, writes <name>-steps.png,\n"
+        "                           <name>-termination.png and <name>-stats.txt for each frame\n"
+        "  --tile-timings <file>    CSV of how long every tile took and on which thread\n"
+        "  --measure-far-field      print the far-field completion's error against the full march for\n"
+        "                           each frame instead of rendering, see Tracer::MeasureFarField\n"
+        "See camerapath.h for the path format.\n",
+        program, SKYBOX_PATH.c_str(), Config::WINDOW_WIDTH, Config::WINDOW_HEIGHT);
+}
+
+int main(int argc, char** argv) {
+    BatchSettings settings;
+    std::string pathFile;
+    std::string skyboxPath = SKYBOX_PATH;
+    bool measureFarField = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if ((arg == "-o" || arg == "--output") && hasValue) {
+            settings.output = argv[++i];
+        } else if ((arg == "-s" || arg == "--skybox") && hasValue) {
+            skyboxPath = argv[++i];
+        } else if (arg == "--width" && hasValue) {
+            settings.width = std::atoi(argv[++i]);
+        } else if (arg == "--height" && hasValue) {
+            settings.height = std::atoi(argv[++i]);
+        } else if (arg == "--frames" && hasValue) {
+            const char* range = argv[++i];
+            settings.firstFrame = std::atoi(range);
+            const char* colon = std::strchr(range, ':');
+            settings.lastFrame = colon ? std::atoi(colon + 1) : settings.firstFrame;
+        } else if (arg == "--in-flight" && hasValue) {
+            settings.framesInFlight = std::atoi(argv[++i]);
+        } else if (arg == "--threads" && hasValue) {
+            settings.threads = std::atoi(argv[++i]);
+        } else if (arg == "--lens-cache") {
+            settings.lensCache = true;
+        } else if (arg == "--progressive" && hasValue) {
+            settings.progressiveStride = std::atoi(argv[++i]);
+        } else if (arg == "--log-polar" && hasValue) {
+            settings.logPolarQuality = (float)std::atof(argv[++i]);
+        } else if (arg == "--adaptive" && hasValue) {
+            settings.adaptiveTolerance = (float)std::atof(argv[++i]);
+        } else if (arg == "--mask" && hasValue) {
+            settings.sampleMask = argv[++i];
+        } else if (arg == "--step-stats" && hasValue) {
+            settings.stepStats = argv[++i];
+        } else if (arg == "--tile-timings" && hasValue) {
+            settings.tileTimings = argv[++i];
+        } else if (arg == "--measure-far-field") {
+            measureFarField = true;
+        } else if (arg[0] != '-' && pathFile.empty()) {
+            pathFile = arg;
+        } else {
+            PrintUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (pathFile.empty() || settings.width <= 0 || settings.height <= 0) {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    CameraPath path;
+    if (!path.Load(pathFile))
+        return EXIT_FAILURE;
+
+    if (measureFarField) {
+        int first = std::max(settings.firstFrame, 0);
+        int last = settings.lastFrame >= 0 ? std::min(settings.lastFrame, path.GetFrameCount() - 1)
+                                           : path.GetFrameCount() - 1;
+        Tracer tracer(settings.width, settings.height);
+        for (int frame = first; frame <= last; frame++) {
+            SceneParams scene = path.GetScene(path.GetFrameTime(frame), (float)settings.width / settings.height);
+            FarFieldReport report = tracer.MeasureFarField(scene);
+            printf("Frame %d: %d rays completed, error mean %.2e max %.2e rad, %.1f steps skipped a ray\n", frame,
+                   report.rays, report.meanError, report.maxError, report.meanSkippedSteps);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    Skybox skybox;
+    if (!skybox.LoadCube(skyboxPath))
+        return EXIT_FAILURE;
+
+    fprintf(stderr, "%d frames at %g fps, %dx%d, %d in flight\n", path.GetFrameCount(), path.fps,
+            settings.width, settings.height, settings.framesInFlight);
+
+    BatchReport report = Batch::RenderPath(path, skybox, settings);
+    fprintf(stderr, "Wrote %d frames in %.1f s (%.2f frames/s, %lld rays)\n", report.frames, report.seconds,
+            report.seconds > 0.0 ? report.frames / report.seconds : 0.0, report.rays);
+    fprintf(stderr, "%lld rays resolved analytically, %lld march steps skipped\n", report.analyticRays,
+            report.skippedSteps);
+    return report.failed == 0 && report.frames > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
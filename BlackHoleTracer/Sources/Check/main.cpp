@@ -0,0 +1,370 @@
+// Checks of the CPU tracer that need no GL context or assets, run by ctest.
+// Each prints what it measured and fails when that is out of bounds.
+#include "camerapath.h"
+#include "physics.h"
+#include "skytiles.h"
+#include "tracer.h"
+#include "stb_image_write.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// Size of the frames the checks render
+static const int WIDTH = 160;
+static const int HEIGHT = 90;
+
+// The default view, or any other one, as bhrender would set it up
+static SceneParams CheckScene(uint32_t flags, float aspectRatio, float radius = 40.0f, float zoom = 90.0f) {
+    CameraPath path;
+    CameraKeyframe key;
+    key.radius = radius;
+    key.zoom = zoom;
+    key.flags = flags;
+    path.keys.push_back(key);
+    return path.GetScene(0.0f, aspectRatio);
+}
+
+// Smooth bands with a fine grid on top, so a ray that ends somewhere else
+// shows. Written out and loaded like any sky, nothing comes from the assets.
+static bool LoadCheckSky(Skybox& sky) {
+    const int width = 512, height = 256;
+    std::vector<float> texels((size_t)width * height * 3);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            bool line = x % 16 == 0 || y % 16 == 0;
+            float* texel = &texels[((size_t)y * width + x) * 3];
+            texel[0] = line ? 4.0f : 0.5f + 0.5f * std::sin(x * 0.05f);
+            texel[1] = line ? 4.0f : 0.5f + 0.5f * std::sin(y * 0.07f);
+            texel[2] = line ? 4.0f : 0.25f;
+        }
+    }
+    const char* path = "bhcheck_sky.hdr";
+    return stbi_write_hdr(path, width, height, 3, texels.data()) != 0 && sky.Load(path);
+}
+
+// Radians between two directions, atan2 keeps small angles precise
+static float AngleBetween(const glm::vec3& a, const glm::vec3& b) {
+    glm::vec3 na = glm::normalize(a), nb = glm::normalize(b);
+    return std::atan2(glm::length(glm::cross(na, nb)), glm::dot(na, nb));
+}
+
+// RK4 and Dormand-Prince on a 40x40 grid of rays, against Dormand-Prince at
+// a 1e-7 tolerance. The adaptive integrator has to take a tenth of the
+// evaluations or fewer for a tenth of the escape direction error or less.
+static bool CheckIntegrator() {
+    const int GRID = 40;
+    SceneParams rk4 = CheckScene(SceneFlags::USE_RELATIVITY, 1.0f);
+    SceneParams adaptive = rk4;
+    adaptive.flags |= SceneFlags::ADAPTIVE_STEP;
+    SceneParams reference = adaptive;
+    reference.tolerance = 1e-7f;
+
+    struct Totals { double evals = 0.0, error = 0.0; };
+    Totals rk4Totals, adaptiveTotals;
+    int rays = 0;
+    for (int y = 0; y < GRID; y++) {
+        for (int x = 0; x < GRID; x++) {
+            glm::vec2 texCoord((x + 0.5f) / GRID, (y + 0.5f) / GRID);
+            glm::vec3 vel = Physics::PrimaryRayDirection(rk4, texCoord) * Constants::c;
+            RayResult exact = Physics::MarchRay(reference, rk4.camPos, vel);
+            RayResult a = Physics::MarchRay(rk4, rk4.camPos, vel);
+            RayResult b = Physics::MarchRay(adaptive, rk4.camPos, vel);
+            if (exact.termination != RayTermination::Escaped || a.termination != RayTermination::Escaped
+                || b.termination != RayTermination::Escaped)
+                continue;
+
+            rays++;
+            rk4Totals.evals += a.accelEvals;
+            rk4Totals.error += AngleBetween(a.vel, exact.vel);
+            adaptiveTotals.evals += b.accelEvals;
+            adaptiveTotals.error += AngleBetween(b.vel, exact.vel);
+        }
+    }
+    if (rays == 0)
+        return false;
+
+    printf("%d escaping rays\n", rays);
+    printf("  RK4:            %7.1f evaluations a ray, mean error %.2e rad\n",
+           rk4Totals.evals / rays, rk4Totals.error / rays);
+    printf("  Dormand-Prince: %7.1f evaluations a ray, mean error %.2e rad (tolerance %.0e)\n",
+           adaptiveTotals.evals / rays, adaptiveTotals.error / rays, adaptive.tolerance);
+    return adaptiveTotals.evals * 10.0 <= rk4Totals.evals && adaptiveTotals.error * 10.0 <= rk4Totals.error;
+}
+
+// Far-field completion against marching the same rays out, see
+// Tracer::MeasureFarField. No ray may miss by half a pixel of the default
+// window, at the default view and from up close.
+static bool CheckFarField() {
+    bool ok = true;
+    for (float radius : { 40.0f, 15.0f }) {
+        SceneParams scene = CheckScene(SceneFlags::USE_RELATIVITY | SceneFlags::FAR_FIELD,
+                                       (float)Config::WINDOW_WIDTH / Config::WINDOW_HEIGHT, radius);
+        float halfPixel = std::tan(scene.fov * 0.5f) / Config::WINDOW_HEIGHT;
+        Tracer tracer(Config::WINDOW_WIDTH / 2, Config::WINDOW_HEIGHT / 2);
+        FarFieldReport report = tracer.MeasureFarField(scene);
+        printf("  r = %g: %d rays, error mean %.2e max %.2e rad (half a pixel %.2e), %.1f steps skipped a ray\n",
+               radius, report.rays, report.meanError, report.maxError, halfPixel, report.meanSkippedSteps);
+        ok &= report.rays > 0 && report.maxError < halfPixel;
+    }
+    return ok;
+}
+
+// Every pixel is traced the same way whichever thread or tile it lands in,
+// so frames must be bit identical across thread counts and tile sizes
+static bool CheckThreads() {
+    Skybox sky;
+    if (!LoadCheckSky(sky))
+        return false;
+
+    struct Layout { int threads, tileSize; };
+    int cores = std::max((int)std::thread::hardware_concurrency(), 2);
+    const Layout layouts[] = { { cores, 32 }, { 3, 7 }, { cores, 64 }, { 2, 1000 } };
+
+    bool ok = true;
+    for (uint32_t flags : { SceneFlags::USE_RELATIVITY | SceneFlags::SHOW_DISK,
+                            SceneFlags::USE_RELATIVITY | SceneFlags::ADAPTIVE_STEP | SceneFlags::FAR_FIELD
+                                | SceneFlags::WEAK_FIELD }) {
+        SceneParams scene = CheckScene(flags, (float)WIDTH / HEIGHT, 30.0f, 60.0f);
+        Tracer reference(WIDTH, HEIGHT);
+        reference.SetThreadCount(1);
+        std::vector<float> expected;
+        reference.Render(scene, sky, expected);
+
+        for (const Layout& layout : layouts) {
+            Tracer tracer(WIDTH, HEIGHT);
+            tracer.SetThreadCount(layout.threads);
+            tracer.SetTileSize(layout.tileSize);
+            std::vector<float> pixels;
+            tracer.Render(scene, sky, pixels);
+
+            bool same = pixels == expected && tracer.GetStats().rays == reference.GetStats().rays
+                && tracer.GetStats().skippedSteps == reference.GetStats().skippedSteps;
+            printf("  flags %u, %d threads, %d pixel tiles: %s\n", flags, layout.threads, layout.tileSize,
+                   same ? "identical" : "DIFFERENT");
+            ok &= same;
+        }
+    }
+    return ok;
+}
+
+// Coarse to fine passes only trace the pixels earlier passes did not, so
+// the finished frame must be Render's, with every pixel traced once
+static bool CheckProgressive() {
+    Skybox sky;
+    if (!LoadCheckSky(sky))
+        return false;
+
+    bool ok = true;
+    SceneParams scene = CheckScene(SceneFlags::USE_RELATIVITY | SceneFlags::SHOW_DISK, (float)WIDTH / HEIGHT,
+                                   30.0f, 60.0f);
+    Tracer reference(WIDTH, HEIGHT);
+    std::vector<float> expected;
+    reference.Render(scene, sky, expected);
+
+    for (int stride : { 4, 8 }) {
+        Tracer tracer(WIDTH, HEIGHT);
+        tracer.SetCoarseStride(stride);
+        std::vector<float> pixels;
+        long long rays = 0;
+        int passes = 0;
+        bool finished = false;
+        while (!finished && passes < 16) {
+            finished = tracer.RenderProgressive(scene, sky, pixels, false);
+            rays += tracer.GetStats().rays;
+            passes++;
+        }
+
+        bool same = finished && pixels == expected && rays == (long long)WIDTH * HEIGHT;
+        printf("  from 1/%d: %d passes, %lld rays for %d pixels, %s\n", stride, passes, rays, WIDTH * HEIGHT,
+               same ? "identical to Render" : "DIFFERENT from Render");
+        ok &= same;
+    }
+    return ok;
+}
+
+// Adaptive sampling against Render at the default view, with and without
+// the disk. It has to trace under 30% of the rays, and the mean difference
+// per channel has to stay under 1e-3 on a sky that runs from 0 to 4.
+static bool CheckAdaptive() {
+    Skybox sky;
+    if (!LoadCheckSky(sky))
+        return false;
+
+    bool ok = true;
+    for (uint32_t flags : { SceneFlags::USE_RELATIVITY, SceneFlags::USE_RELATIVITY | SceneFlags::SHOW_DISK }) {
+        SceneParams scene = CheckScene(flags, (float)WIDTH / HEIGHT);
+        Tracer tracer(WIDTH, HEIGHT);
+        std::vector<float> expected, pixels;
+        tracer.Render(scene, sky, expected);
+        tracer.RenderAdaptive(scene, sky, pixels);
+
+        size_t traced = 0;
+        for (uint8_t sample : tracer.GetSampleMask())
+            traced += sample != 0;
+        double error = 0.0, maxError = 0.0;
+        for (size_t i = 0; i < pixels.size(); i++) {
+            double difference = std::abs(pixels[i] - expected[i]);
+            error += difference;
+            maxError = std::max(maxError, difference);
+        }
+        float fraction = (float)traced / (WIDTH * HEIGHT);
+        error /= pixels.size();
+        printf("  flags %u: %.1f%% of the rays, mean error %.2e, max %.2e\n", flags, fraction * 100.0f, error,
+               maxError);
+        ok &= fraction < 0.3f && error < 1e-3;
+    }
+    return ok;
+}
+
+// What a texel may lose in format: nothing in RGB32F, an 11 bit mantissa
+// in RGB16F (or steps of 2^-24 below its normals), and in RGB9E5 a 9 bit
+// mantissa shared with the brightest channel
+static bool WithinFormat(const glm::vec3& expected, const glm::vec3& actual, SkyFormat format) {
+    float brightest = std::max(expected.x, std::max(expected.y, expected.z));
+    for (int c = 0; c < 3; c++) {
+        float error = std::abs(actual[c] - expected[c]);
+        if (format == SkyFormat::RGB32F && error != 0.0f)
+            return false;
+        if (format == SkyFormat::RGB16F && error > std::max(std::abs(expected[c]) / 1024.0f, 6e-8f))
+            return false;
+        if (format == SkyFormat::RGB9E5 && error > brightest / 256.0f)
+            return false;
+    }
+    return true;
+}
+
+static const SkyFormat FORMATS[] = { SkyFormat::RGB32F, SkyFormat::RGB16F, SkyFormat::RGB9E5 };
+
+// Saving a sky as .bhsky and loading it back has to keep its size, layout
+// and every texel of every level, up to what the format rounds away
+static bool CheckSkyFile() {
+    Skybox sky;
+    if (!LoadCheckSky(sky))
+        return false;
+    Skybox cube = sky.ToCube(64);
+
+    bool ok = true;
+    for (const Skybox* source : { &sky, &cube }) {
+        for (SkyFormat format : FORMATS) {
+            const char* path = "bhcheck_sky.bhsky";
+            Skybox loaded;
+            bool same = source->Save(path, format) && loaded.Load(path) && loaded.IsMapped()
+                && loaded.GetFormat() == format && loaded.GetLayout() == source->GetLayout()
+                && loaded.GetWidth() == source->GetWidth() && loaded.GetHeight() == source->GetHeight();
+
+            // Save builds the mip chain the source may not have, its first
+            // level has to be the source's
+            for (int face = 0; same && face < source->GetFaceCount(); face++) {
+                const SkyLevel& level = source->GetLevel(0);
+                size_t texels = (size_t)level.width * level.height;
+                const void* expected = source->GetFace(0, face);
+                const void* actual = loaded.GetFace(0, face);
+                for (size_t i = 0; same && i < texels; i++)
+                    same = WithinFormat(Skybox::DecodeTexel(expected, i, source->GetFormat()),
+                                        Skybox::DecodeTexel(actual, i, format), format);
+            }
+            printf("  %s %dx%d as %s: %s\n", source->GetLayout() == SkyLayout::Cube ? "cube" : "panorama",
+                   source->GetWidth(), source->GetHeight(), Skybox::FormatName(format),
+                   same ? "round trips" : "DIFFERENT");
+            ok &= same;
+        }
+    }
+    return ok;
+}
+
+// Cutting a cube into .bhtiles and loading it back has to keep every texel
+// of every level the tiles cover. Sampling the tiles, borders included,
+// has to match sampling the cube.
+static bool CheckSkyTiles() {
+    Skybox sky;
+    if (!LoadCheckSky(sky))
+        return false;
+    Skybox cube;
+    const char* cubePath = "bhcheck_sky.cube.bhsky";
+    if (!sky.ToCube(96).Save(cubePath, SkyFormat::RGB32F) || !cube.Load(cubePath))
+        return false;
+
+    bool ok = true;
+    for (SkyFormat format : FORMATS) {
+        const char* path = "bhcheck_sky.bhtiles";
+        Skybox loaded;
+        bool same = SkyTiles::Build(cube, path, 32, format) && loaded.Load(path) && loaded.IsTiled();
+        const SkyTiles* tiles = same ? loaded.GetTiles().get() : nullptr;
+        same = same && tiles->GetFormat() == format && tiles->GetFaceSize() == cube.GetWidth()
+            && tiles->GetLevelCount() <= cube.GetLevelCount();
+
+        for (int level = 0; same && level < tiles->GetLevelCount(); level++) {
+            int size = tiles->GetLevelSize(level);
+            for (int face = 0; face < Skybox::CUBE_FACES; face++)
+                for (int y = 0; y < size; y++)
+                    for (int x = 0; x < size; x++)
+                        same = same && WithinFormat(cube.CubeTexel(level, face, x, y),
+                                                    tiles->Texel(level, face, x, y), format);
+        }
+
+        // Directions across every face, edges and corners included
+        float maxError = 0.0f;
+        for (int level = 0; same && format == SkyFormat::RGB32F && level < tiles->GetLevelCount(); level++) {
+            for (int i = 0; i < 4096; i++) {
+                float z = 1.0f - 2.0f * (i + 0.5f) / 4096.0f;
+                float phi = i * 2.39996323f;
+                float r = std::sqrt(1.0f - z * z);
+                glm::vec3 direction(r * std::cos(phi), r * std::sin(phi), z);
+                glm::vec3 error = glm::abs(tiles->Sample(direction, level) - cube.Sample(direction, level));
+                maxError = std::max(maxError, std::max(error.x, std::max(error.y, error.z)));
+            }
+        }
+        same = same && maxError < 1e-5f;
+        printf("  %d levels of 32 texel tiles as %s: %s", tiles ? tiles->GetLevelCount() : 0,
+               Skybox::FormatName(format), same ? "round trips" : "DIFFERENT");
+        if (format == SkyFormat::RGB32F)
+            printf(", samples within %.1e of the cube", maxError);
+        printf("\n");
+        ok &= same;
+    }
+    return ok;
+}
+
+struct Check {
+    const char* name;
+    bool (*run)();
+};
+
+static const Check CHECKS[] = {
+    { "integrator", CheckIntegrator },
+    { "farfield", CheckFarField },
+    { "threads", CheckThreads },
+    { "progressive", CheckProgressive },
+    { "adaptive", CheckAdaptive },
+    { "bhsky", CheckSkyFile },
+    { "bhtiles", CheckSkyTiles },
+};
+
+int main(int argc, char** argv) {
+    int failed = 0, run = 0;
+    for (const Check& check : CHECKS) {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; i++)
+            selected |= std::strcmp(argv[i], check.name) == 0;
+        if (!selected)
+            continue;
+
+        printf("%s\n", check.name);
+        bool ok = check.run();
+        printf("%s: %s\n", check.name, ok ? "ok" : "FAILED");
+        failed += ok ? 0 : 1;
+        run++;
+    }
+    if (run == 0) {
+        fprintf(stderr, "Usage: %s [check...]\n  checks:", argv[0]);
+        for (const Check& check : CHECKS)
+            fprintf(stderr, " %s", check.name);
+        fprintf(stderr, "\n");
+        return EXIT_FAILURE;
+    }
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,170 @@
+// GPU renderer without a window. Runs blackhole.frag through Display into
+// an offscreen framebuffer on a surfaceless EGL context, for CI and render
+// boxes with no display, and times it.
+#include "offscreen.h"
+#include "display.h"
+#include "capture.h"
+#include "camerapath.h"
+#include "batch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+const std::string SKYBOX_PATH = "assets/eso0926a - eagle nebula.hdr";
+
+static void PrintUsage(const char* program) {
+    fprintf(stderr,
+        "Usage: %s [camera path] [options]\n"
+        "  -o, --output <pattern>   printf pattern of the frame number, nothing is written without it\n"
+        "  -s, --skybox <file>      equirectangular sky (%s)\n"
+        "  --width <pixels>         (%d)\n"
+        "  --height <pixels>        (%d)\n"
+        "  --frames <first>[:<last>]\n"
+        "  --repeat <draws>         draws per frame, all but the first are timed (1)\n"
+        "  --lens-cache             see Display::SetLensCache\n"
+        "  --log-polar <rays>       log-polar sampling at rays per pixel\n"
+        "  --specialize             draw with shader variants built for the flags, see\n"
+        "                           Display::SetSpecializedShaders\n"
+        "  --step-stats <pattern>   printf pattern of the frame number, writes the steps of each\n"
+        "                           frame as bhrender --step-stats does, to compare the two\n"
+        "  --wavefront <steps>      trace with the compute shader wavefront tracer, marching\n"
+        "                           live rays steps at a time (GL 4.3)\n"
+        "Without a camera path it renders the window's starting view.\n",
+        program, SKYBOX_PATH.c_str(), Config::WINDOW_WIDTH, Config::WINDOW_HEIGHT);
+}
+
+int main(int argc, char** argv) {
+    std::string pathFile, output, stepStats;
+    std::string skyboxPath = SKYBOX_PATH;
+    int width = Config::WINDOW_WIDTH, height = Config::WINDOW_HEIGHT;
+    int firstFrame = 0, lastFrame = -1, repeat = 1;
+    bool lensCache = false, specialize = false;
+    float logPolarQuality = 0.0f;
+    int wavefrontSteps = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if ((arg == "-o" || arg == "--output") && hasValue) {
+            output = argv[++i];
+        } else if ((arg == "-s" || arg == "--skybox") && hasValue) {
+            skyboxPath = argv[++i];
+        } else if (arg == "--width" && hasValue) {
+            width = std::atoi(argv[++i]);
+        } else if (arg == "--height" && hasValue) {
+            height = std::atoi(argv[++i]);
+        } else if (arg == "--frames" && hasValue) {
+            const char* range = argv[++i];
+            firstFrame = std::atoi(range);
+            const char* colon = std::strchr(range, ':');
+            lastFrame = colon ? std::atoi(colon + 1) : firstFrame;
+        } else if (arg == "--repeat" && hasValue) {
+            repeat = std::max(std::atoi(argv[++i]), 1);
+        } else if (arg == "--lens-cache") {
+            lensCache = true;
+        } else if (arg == "--specialize") {
+            specialize = true;
+        } else if (arg == "--step-stats" && hasValue) {
+            stepStats = argv[++i];
+        } else if (arg == "--wavefront" && hasValue) {
+            wavefrontSteps = std::max(std::atoi(argv[++i]), 1);
+        } else if (arg == "--log-polar" && hasValue) {
+            logPolarQuality = (float)std::atof(argv[++i]);
+        } else if (arg[0] != '-' && pathFile.empty()) {
+            pathFile = arg;
+        } else {
+            PrintUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (width <= 0 || height <= 0) {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // The starting view of the window when there is no path
+    CameraPath path;
+    if (pathFile.empty())
+        path.keys.push_back(CameraKeyframe());
+    else if (!path.Load(pathFile))
+        return EXIT_FAILURE;
+
+    OffscreenContext context;
+    if (!context.Create())
+        return EXIT_FAILURE;
+
+    OffscreenTarget target(width, height);
+    Display display(width, height, skyboxPath);
+    display.SetLensCache(lensCache);
+    display.SetLogPolar(logPolarQuality > 0.0f, logPolarQuality);
+    // Waits for each variant, so every draw is timed with the one it asked for
+    display.SetSpecializedShaders(specialize, true);
+    display.SetStepStatsEnabled(!stepStats.empty());
+    if (wavefrontSteps > 0) {
+        if (!display.IsWavefrontSupported()) {
+            fprintf(stderr, "The wavefront tracer needs OpenGL 4.3\n");
+            return EXIT_FAILURE;
+        }
+        display.SetWavefront(true, wavefrontSteps);
+    }
+    // Each frame waits for the sky tiles it wants rather than drawing coarser ones
+    if (SkyStreamer* sky = display.GetSkyStreamer())
+        sky->SetBlocking(true);
+
+    FrameCapture capture(width, height);
+    capture.SetBlocking(true);
+
+    using Clock = std::chrono::steady_clock;
+    lastFrame = lastFrame < 0 ? path.GetFrameCount() - 1 : std::min(lastFrame, path.GetFrameCount() - 1);
+    double timedMilliseconds = 0.0;
+    int timedDraws = 0;
+    auto start = Clock::now();
+
+    for (int frame = std::max(firstFrame, 0); frame <= lastFrame; frame++) {
+        CameraKeyframe key = path.Evaluate(path.GetFrameTime(frame));
+        Camera camera(key.radius, key.azimuth, key.polar);
+        camera.Zoom() = key.zoom;
+        BlackHole bh(key.mass, glm::vec3(0.0f));
+
+        float bhSizeBuffer = path.bhSizeBuffer, diskThickness = path.diskThickness, tolerance = path.tolerance;
+        float farFieldRadius = path.farFieldRadius, weakFieldThreshold = path.weakFieldThreshold;
+        float weakFieldTolerance = path.weakFieldTolerance;
+        display.UpdateUniforms(camera, bh, key.flags, bhSizeBuffer, diskThickness, tolerance, farFieldRadius,
+                               weakFieldThreshold, weakFieldTolerance);
+
+        // The first draw also pays for uploads and shader warm-up
+        for (int draw = 0; draw < repeat; draw++) {
+            target.Bind();
+            auto drawStart = Clock::now();
+            display.Draw();
+            glFinish();
+            double milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - drawStart).count();
+            if (draw > 0 || repeat == 1) {
+                timedMilliseconds += milliseconds;
+                timedDraws++;
+            }
+        }
+
+        if (!output.empty()) {
+            target.Bind();
+            capture.Capture(Batch::FramePath(output, frame));
+        }
+        if (!stepStats.empty())
+            StepStats::Export(display.GetStepBuffer(), Batch::FramePath(stepStats, frame));
+    }
+    capture.Flush();
+
+    if (const WavefrontTracer* wavefront = display.GetWavefront())
+        fprintf(stderr, "Wavefront: last frame marched %d rays in %d dispatches of %d steps\n",
+                wavefront->GetStats().marched, wavefront->GetStats().dispatches, wavefront->GetStepsPerDispatch());
+    GLenum error = glGetError();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    fprintf(stderr, "%dx%d: %d draws, %.2f ms per draw, %lld frames written in %.1f s%s\n", width, height,
+            timedDraws, timedDraws ? timedMilliseconds / timedDraws : 0.0, capture.GetWritten(), seconds,
+            error != GL_NO_ERROR ? ", GL error" : "");
+    return error == GL_NO_ERROR && capture.GetFailed() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
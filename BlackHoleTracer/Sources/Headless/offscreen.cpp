@@ -0,0 +1,132 @@
+#include "offscreen.h"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <cstring>
+
+// Present on Mesa, missing from older eglext.h
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+static bool HasExtension(const char* extensions, const char* name) {
+    if (!extensions)
+        return false;
+    size_t length = std::strlen(name);
+    for (const char* at = std::strstr(extensions, name); at; at = std::strstr(at + length, name)) {
+        bool starts = at == extensions || at[-1] == ' ';
+        bool ends = at[length] == ' ' || at[length] == '\0';
+        if (starts && ends)
+            return true;
+    }
+    return false;
+}
+
+OffscreenContext::~OffscreenContext() {
+    if (!m_Display)
+        return;
+    eglMakeCurrent(m_Display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (m_Context)
+        eglDestroyContext(m_Display, m_Context);
+    if (m_Surface)
+        eglDestroySurface(m_Display, m_Surface);
+    eglTerminate(m_Display);
+}
+
+bool OffscreenContext::Create(int major, int minor) {
+    const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    bool surfaceless = getPlatformDisplay && HasExtension(clientExtensions, "EGL_MESA_platform_surfaceless");
+
+    EGLDisplay display = surfaceless
+        ? getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr)
+        : eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    EGLint eglMajor = 0, eglMinor = 0;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &eglMajor, &eglMinor)) {
+        std::cerr << "Failed to initialize EGL" << std::endl;
+        return false;
+    }
+    m_Display = display;
+
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        std::cerr << "EGL has no desktop OpenGL" << std::endl;
+        return false;
+    }
+
+    // Surfaceless contexts need no config, the pbuffer fallback does
+    const char* displayExtensions = eglQueryString(display, EGL_EXTENSIONS);
+    bool noConfig = surfaceless && HasExtension(displayExtensions, "EGL_KHR_no_config_context")
+                    && HasExtension(displayExtensions, "EGL_KHR_surfaceless_context");
+    EGLConfig config = nullptr;
+    if (!noConfig) {
+        const EGLint configAttributes[] = {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+            EGL_NONE
+        };
+        EGLint count = 0;
+        if (!eglChooseConfig(display, configAttributes, &config, 1, &count) || count == 0) {
+            std::cerr << "No EGL config for an OpenGL pbuffer" << std::endl;
+            return false;
+        }
+    }
+
+    const EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, major,
+        EGL_CONTEXT_MINOR_VERSION, minor,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    EGLContext context = eglCreateContext(display, noConfig ? EGL_NO_CONFIG_KHR : config, EGL_NO_CONTEXT,
+                                          contextAttributes);
+    if (context == EGL_NO_CONTEXT) {
+        std::cerr << "Failed to create an OpenGL " << major << "." << minor << " core context" << std::endl;
+        return false;
+    }
+    m_Context = context;
+
+    EGLSurface surface = EGL_NO_SURFACE;
+    if (!noConfig) {
+        const EGLint surfaceAttributes[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+        surface = eglCreatePbufferSurface(display, config, surfaceAttributes);
+        m_Surface = surface;
+    }
+    if (!eglMakeCurrent(display, surface, surface, context)) {
+        std::cerr << "Failed to make the EGL context current" << std::endl;
+        return false;
+    }
+
+    if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress)) {
+        std::cerr << "Failed to load OpenGL functions" << std::endl;
+        return false;
+    }
+    std::cerr << "EGL " << eglMajor << "." << eglMinor << (surfaceless ? " surfaceless" : " pbuffer")
+              << ", OpenGL " << glGetString(GL_VERSION) << ", " << glGetString(GL_RENDERER) << std::endl;
+    return true;
+}
+
+OffscreenTarget::OffscreenTarget(int width, int height) : m_Width(width), m_Height(height) {
+    glGenTextures(1, &m_ColorTextureID);
+    glBindTexture(GL_TEXTURE_2D, m_ColorTextureID);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glGenFramebuffers(1, &m_FBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_FBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_ColorTextureID, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cerr << "Offscreen framebuffer incomplete" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+OffscreenTarget::~OffscreenTarget() {
+    if (m_FBO) glDeleteFramebuffers(1, &m_FBO);
+    if (m_ColorTextureID) glDeleteTextures(1, &m_ColorTextureID);
+}
+
+void OffscreenTarget::Bind() const {
+    glBindFramebuffer(GL_FRAMEBUFFER, m_FBO);
+    glViewport(0, 0, m_Width, m_Height);
+}
@@ -0,0 +1,231 @@
+// Converts a sky panorama into a .bhsky (see skybox.h) that the app and
+// the renderers memory map instead of decoding at startup, optionally
+// ahead of time into the cubemap they would otherwise convert on first load,
+// or into the tiles of a .bhtiles (see skytiles.h) for skies too big for that.
+#include "skybox.h"
+#include "skytiles.h"
+#include "radiance.h"
+#include "stb_image.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+static void PrintUsage(const char* program) {
+    fprintf(stderr,
+        "Usage: %s <sky image> [output] [options]\n"
+        "  --format <rgb9e5|rgb16f|rgb32f>   texel format (rgb9e5)\n"
+        "  --cube                            resample to a cubemap, what the renderers load\n"
+        "  --face <texels>                   cube face size, a quarter of the width by default\n"
+        "  --tiles                           cut the cubemap into streamed tiles (.bhtiles)\n"
+        "  --tile <texels>                   tile size (%d)\n"
+        "  --bench                           time decoding a .hdr against stbi_loadf, writes nothing\n"
+        "The output defaults to the input with a .bhsky extension, or the cube cache\n"
+        "Skybox::LoadCube looks for (.cube.bhsky) with --cube. --tiles writes that\n"
+        "cache too on the way. An output ending in .bhtiles implies --tiles.\n",
+        program, SkyTiles::DEFAULT_TILE_SIZE);
+}
+
+static bool EndsWith(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static double Milliseconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Startup cost of a .hdr sky: stbi_loadf as Skybox::Load used to call it,
+// against indexing the scanlines and decoding them into each format on one
+// thread and on every core. Best of a few runs, the file is mapped and
+// touched first so neither pays for the disk.
+static int Benchmark(const std::string& path) {
+    const int runs = 3;
+    size_t size = 0;
+    std::shared_ptr<const unsigned char> mapping = Skybox::MapFile(path, size);
+    RadianceImage image;
+    if (!mapping || !Radiance::Index(mapping.get(), size, image)) {
+        fprintf(stderr, "%s is not a Radiance .hdr the parallel decoder reads\n", path.c_str());
+        return EXIT_FAILURE;
+    }
+    volatile unsigned char touched = 0;
+    for (size_t i = 0; i < size; i += 4096)
+        touched = touched + mapping.get()[i];
+    size_t texels = (size_t)image.width * image.height;
+    fprintf(stderr, "%s: %dx%d, %s, %.1f MB\n", path.c_str(), image.width, image.height,
+            image.encoded ? "run length encoded" : "flat", size / 1048576.0);
+
+    double best = 1e30;
+    std::vector<float> reference;
+    for (int run = 0; run < runs; run++) {
+        auto start = std::chrono::steady_clock::now();
+        int width, height, components;
+        stbi_set_flip_vertically_on_load(true);
+        float* data = stbi_loadf(path.c_str(), &width, &height, &components, 3);
+        if (!data) {
+            fprintf(stderr, "stbi_loadf failed: %s\n", stbi_failure_reason());
+            return EXIT_FAILURE;
+        }
+        reference.assign(data, data + texels * 3);
+        stbi_image_free(data);
+        best = std::min(best, Milliseconds(start));
+    }
+    double stbMilliseconds = best;
+    fprintf(stderr, "  stbi_loadf               %8.1f ms\n", stbMilliseconds);
+
+    best = 1e30;
+    for (int run = 0; run < runs; run++) {
+        auto start = std::chrono::steady_clock::now();
+        Radiance::Index(mapping.get(), size, image);
+        best = std::min(best, Milliseconds(start));
+    }
+    fprintf(stderr, "  index scanlines          %8.1f ms\n", best);
+
+    int cores = std::max((int)std::thread::hardware_concurrency(), 1);
+    const SkyFormat formats[] = { SkyFormat::RGB32F, SkyFormat::RGB16F, SkyFormat::RGB9E5 };
+    for (SkyFormat format : formats) {
+        std::vector<unsigned char> pixels(texels * Skybox::TexelSize(format));
+        for (int threads : cores > 1 ? std::vector<int>{ 1, cores } : std::vector<int>{ 1 }) {
+            best = 1e30;
+            for (int run = 0; run < runs; run++) {
+                auto start = std::chrono::steady_clock::now();
+                Radiance::Index(mapping.get(), size, image);
+                Radiance::Decode(image, format, pixels.data(), threads);
+                best = std::min(best, Milliseconds(start));
+            }
+
+            // Against stb's floats, bit for bit in RGB32F
+            double maxError = 0.0;
+            for (size_t i = 0; i < texels; i++) {
+                glm::vec3 texel = Skybox::DecodeTexel(pixels.data(), i, format);
+                for (int c = 0; c < 3; c++) {
+                    float expected = reference[i * 3 + c];
+                    double error = std::fabs(texel[c] - expected) / std::max(expected, 1e-4f);
+                    maxError = std::max(maxError, format == SkyFormat::RGB32F && texel[c] != expected ? 1.0 : error);
+                }
+            }
+            fprintf(stderr, "  %-6s on %2d thread%s     %8.1f ms  %5.1fx  max relative error %.2g\n",
+                    Skybox::FormatName(format), threads, threads == 1 ? " " : "s", best, stbMilliseconds / best,
+                    maxError);
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv) {
+    std::string input, output;
+    SkyFormat format = SkyFormat::RGB9E5;
+    bool cube = false, tiles = false, bench = false;
+    int faceSize = 0, tileSize = SkyTiles::DEFAULT_TILE_SIZE;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--format" && hasValue) {
+            std::string name = argv[++i];
+            if (name == "rgb9e5") {
+                format = SkyFormat::RGB9E5;
+            } else if (name == "rgb16f") {
+                format = SkyFormat::RGB16F;
+            } else if (name == "rgb32f") {
+                format = SkyFormat::RGB32F;
+            } else {
+                PrintUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--cube") {
+            cube = true;
+        } else if (arg == "--face" && hasValue) {
+            faceSize = std::atoi(argv[++i]);
+        } else if (arg == "--tiles") {
+            tiles = true;
+        } else if (arg == "--tile" && hasValue) {
+            tileSize = std::atoi(argv[++i]);
+        } else if (arg == "--bench") {
+            bench = true;
+        } else if (arg[0] != '-' && input.empty()) {
+            input = arg;
+        } else if (arg[0] != '-' && output.empty()) {
+            output = arg;
+        } else {
+            PrintUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (input.empty() || tileSize <= 0) {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (bench)
+        return Benchmark(input);
+    // The loaders tell the formats apart by their header, not the extension,
+    // so a mismatch would only show up as the wrong kind of sky
+    if (EndsWith(output, ".bhtiles"))
+        tiles = true;
+    if (tiles && EndsWith(output, ".bhsky")) {
+        fprintf(stderr, "--tiles writes a .bhtiles, not %s\n", output.c_str());
+        return EXIT_FAILURE;
+    }
+    if (output.empty() && cube && !tiles) {
+        output = Skybox::CachePath(input);
+    } else if (output.empty()) {
+        size_t dot = input.find_last_of('.');
+        size_t slash = input.find_last_of("/\\");
+        bool hasExtension = dot != std::string::npos && (slash == std::string::npos || dot > slash);
+        output = (hasExtension ? input.substr(0, dot) : input) + (tiles ? ".bhtiles" : ".bhsky");
+    }
+
+    Skybox source;
+    if (!source.Load(input))
+        return EXIT_FAILURE;
+
+    double decodeMilliseconds = source.GetLoadMilliseconds();
+    auto start = std::chrono::steady_clock::now();
+    if (tiles) {
+        // Tiles are cut from every level of a cube, so it goes through the
+        // cube cache first unless it already is one with its mip chain
+        if (source.GetLayout() != SkyLayout::Cube || source.GetLevelCount() == 1) {
+            if (source.GetLayout() != SkyLayout::Cube)
+                source = source.ToCube(faceSize);
+            std::string cachePath = Skybox::CachePath(input);
+            if (!source.Save(cachePath, format) || !source.Load(cachePath))
+                return EXIT_FAILURE;
+        }
+        if (!SkyTiles::Build(source, output, tileSize, format))
+            return EXIT_FAILURE;
+    } else {
+        if (cube && source.GetLayout() != SkyLayout::Cube)
+            source = source.ToCube(faceSize);
+        if (!source.Save(output, format))
+            return EXIT_FAILURE;
+    }
+    double saveMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    Skybox converted;
+    if (!converted.Load(output))
+        return EXIT_FAILURE;
+
+    size_t bytes = 0;
+    if (converted.IsTiled()) {
+        const SkyTiles& cut = *converted.GetTiles();
+        bytes = (size_t)cut.GetPageCount() * cut.GetTileBytes();
+        fprintf(stderr, "%d tiles of %dx%d texels\n", cut.GetPageCount(), cut.GetTileSize(), cut.GetTileSize());
+    } else {
+        for (int i = 0; i < converted.GetLevelCount(); i++) {
+            const SkyLevel& level = converted.GetLevel(i);
+            bytes += (size_t)level.width * level.height * converted.GetFaceCount() * Skybox::TexelSize(format);
+        }
+    }
+    fprintf(stderr, "%s: %dx%d%s %s, %d levels, %.1f MB in %.0f ms\n", output.c_str(), converted.GetWidth(),
+            converted.GetHeight(), converted.GetLayout() == SkyLayout::Cube ? " faces" : "", Skybox::FormatName(format), converted.GetLevelCount(),
+            bytes / 1048576.0, saveMilliseconds);
+    fprintf(stderr, "Load: %.1f ms decoding %s, %.1f ms mapping %s\n", decodeMilliseconds, input.c_str(),
+            converted.GetLoadMilliseconds(), output.c_str());
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,262 @@
+#include "tracer.h"
+#include "physics.h"
+#include "stb_image_write.h"
+
+#include <algorithm>
+#include <iostream>
+
+// Rays traced per scheduler job
+static constexpr int ADAPTIVE_CHUNK = 256;
+
+// Where an escaped ray ends up relative to where it started. The primary
+// direction changes linearly across a block, so interpolating this instead of
+// the escape direction keeps the sky sharp wherever the bend is smooth.
+static glm::vec3 Bend(const SceneParams& scene, const RayResult& ray, int x, int y, int width, int height) {
+    glm::vec2 texCoord((x + 0.5f) / width, (y + 0.5f) / height);
+    return glm::normalize(ray.vel) - Physics::PrimaryRayDirection(scene, texCoord);
+}
+
+// Corner, midpoint and corner along each axis. Blocks run from one corner to
+// the next, so the last row and column of corners sit on the frame edge.
+static void BlockGrid(int x0, int y0, int size, int width, int height, int xs[3], int ys[3]) {
+    xs[0] = x0;
+    xs[2] = std::min(x0 + size, width - 1);
+    xs[1] = std::min(x0 + size / 2, xs[2]);
+    ys[0] = y0;
+    ys[2] = std::min(y0 + size, height - 1);
+    ys[1] = std::min(y0 + size / 2, ys[2]);
+}
+
+void Tracer::RenderAdaptive(const SceneParams& scene, const Skybox& skybox, std::vector<float>& pixels,
+                            const AdaptiveSettings& settings) {
+    if (m_Width < 2 || m_Height < 2) {
+        Render(scene, skybox, pixels);
+        return;
+    }
+    if (scene.UseDeflectionTable() && !m_DeflectionTable.IsBuiltFor(scene))
+        m_DeflectionTable.Build(scene);
+
+    size_t pixelCount = (size_t)m_Width * m_Height;
+    m_AdaptiveRays.assign(pixelCount, RayResult());
+    m_SampleMask.assign(pixelCount, 0);
+    m_Stats = TraceStats();
+    m_TileTimings.clear();
+
+    int size = 1;
+    while (size * 2 <= settings.coarseStride)
+        size *= 2;
+
+    std::vector<int> points;
+    auto addPoints = [&](const AdaptiveBlock& block) {
+        int xs[3], ys[3];
+        BlockGrid(block.x0, block.y0, block.size, m_Width, m_Height, xs, ys);
+        for (int j = 0; j < 3; j++) {
+            for (int i = 0; i < 3; i++) {
+                size_t index = (size_t)ys[j] * m_Width + xs[i];
+                if (m_SampleMask[index])
+                    continue;
+                m_SampleMask[index] = 255;
+                points.push_back((int)index);
+            }
+        }
+    };
+
+    std::vector<AdaptiveBlock> blocks;
+    for (int y0 = 0; y0 < m_Height - 1; y0 += size)
+        for (int x0 = 0; x0 < m_Width - 1; x0 += size)
+            blocks.push_back({ x0, y0, size });
+
+    // One level per pass, every block of a level has the same size. The
+    // midpoints are the children's corners, so they are traced up front and
+    // checked against the corners before deciding.
+    std::vector<AdaptiveBlock> leaves, children;
+    std::vector<char> refine;
+    while (!blocks.empty()) {
+        points.clear();
+        for (const AdaptiveBlock& block : blocks)
+            addPoints(block);
+        TraceAdaptivePoints(scene, points);
+
+        refine.assign(blocks.size(), 0);
+        int jobs = (int)((blocks.size() + ADAPTIVE_CHUNK - 1) / ADAPTIVE_CHUNK);
+        m_Scheduler->Run(jobs, [&](int job, int) {
+            size_t end = std::min(blocks.size(), (size_t)(job + 1) * ADAPTIVE_CHUNK);
+            for (size_t b = (size_t)job * ADAPTIVE_CHUNK; b < end; b++)
+                refine[b] = NeedsRefinement(scene, settings, blocks[b]);
+        });
+
+        // Children of two pixel blocks have nothing left to fill in
+        children.clear();
+        int half = blocks[0].size / 2;
+        for (size_t b = 0; b < blocks.size() && half > 1; b++) {
+            for (int dy = 0; dy < 2; dy++) {
+                for (int dx = 0; dx < 2; dx++) {
+                    AdaptiveBlock child = { blocks[b].x0 + dx * half, blocks[b].y0 + dy * half, half };
+                    if (child.x0 >= m_Width - 1 || child.y0 >= m_Height - 1)
+                        continue;
+                    if (refine[b])
+                        children.push_back(child);
+                    else
+                        leaves.push_back(child);
+                }
+            }
+        }
+        blocks.swap(children);
+    }
+
+    // Leaves cover the frame without overlapping, see InterpolateBlock
+    int jobs = (int)((leaves.size() + ADAPTIVE_CHUNK - 1) / ADAPTIVE_CHUNK);
+    m_Scheduler->Run(jobs, [&](int job, int) {
+        size_t end = std::min(leaves.size(), (size_t)(job + 1) * ADAPTIVE_CHUNK);
+        for (size_t b = (size_t)job * ADAPTIVE_CHUNK; b < end; b++)
+            InterpolateBlock(scene, leaves[b]);
+    });
+
+    pixels.resize(pixelCount * 3);
+    m_Scheduler->Run(m_Height, [&](int y, int) {
+        for (int x = 0; x < m_Width; x++) {
+            size_t i = (size_t)y * m_Width + x;
+            glm::vec3 color = ShadeRay(scene, skybox, m_AdaptiveRays[i]);
+            pixels[i * 3 + 0] = color.x;
+            pixels[i * 3 + 1] = color.y;
+            pixels[i * 3 + 2] = color.z;
+        }
+    });
+}
+
+void Tracer::TraceAdaptivePoints(const SceneParams& scene, std::vector<int>& points) {
+    std::vector<ThreadStats> threadStats(m_Scheduler->GetThreadCount());
+
+    int jobs = (int)((points.size() + ADAPTIVE_CHUNK - 1) / ADAPTIVE_CHUNK);
+    m_Scheduler->Run(jobs, [&](int job, int thread) {
+        size_t begin = (size_t)job * ADAPTIVE_CHUNK;
+        int count = (int)std::min((size_t)ADAPTIVE_CHUNK, points.size() - begin);
+
+        glm::vec2 texCoords[ADAPTIVE_CHUNK];
+        RayResult results[ADAPTIVE_CHUNK];
+        for (int k = 0; k < count; k++) {
+            int i = points[begin + k];
+            texCoords[k] = glm::vec2((i % m_Width + 0.5f) / m_Width, (i / m_Width + 0.5f) / m_Height);
+        }
+
+        TraceRays(scene, texCoords, count, results, &threadStats[thread].stats);
+        for (int k = 0; k < count; k++)
+            m_AdaptiveRays[points[begin + k]] = results[k];
+    });
+
+    for (const ThreadStats& thread : threadStats)
+        m_Stats.Add(thread.stats);
+}
+
+bool Tracer::NeedsRefinement(const SceneParams& scene, const AdaptiveSettings& settings,
+                             const AdaptiveBlock& block) const {
+    int xs[3], ys[3];
+    BlockGrid(block.x0, block.y0, block.size, m_Width, m_Height, xs, ys);
+
+    const RayResult* rays[9];
+    for (int j = 0; j < 3; j++)
+        for (int i = 0; i < 3; i++)
+            rays[j * 3 + i] = &m_AdaptiveRays[(size_t)ys[j] * m_Width + xs[i]];
+
+    // The shadow edge, the disk's rim and anything else that changes how rays end
+    for (int k = 1; k < 9; k++)
+        if (rays[k]->termination != rays[0]->termination)
+            return true;
+
+    bool escaped = rays[0]->termination == RayTermination::Escaped;
+    glm::vec3 bends[9];
+    if (escaped)
+        for (int k = 0; k < 9; k++)
+            bends[k] = Bend(scene, *rays[k], xs[k % 3], ys[k / 3], m_Width, m_Height);
+
+    // Bilinear prediction of every midpoint from the corners 0, 2, 6 and 8
+    for (int k = 0; k < 9; k++) {
+        if (k == 0 || k == 2 || k == 6 || k == 8)
+            continue;
+
+        float fx = (float)(xs[k % 3] - xs[0]) / (xs[2] - xs[0]);
+        float fy = (float)(ys[k / 3] - ys[0]) / (ys[2] - ys[0]);
+        const float weights[4] = { (1.0f - fx) * (1.0f - fy), fx * (1.0f - fy), (1.0f - fx) * fy, fx * fy };
+        const int corners[4] = { 0, 2, 6, 8 };
+
+        glm::vec3 bend(0.0f), light(0.0f);
+        float transmission = 0.0f;
+        for (int c = 0; c < 4; c++) {
+            if (escaped)
+                bend += weights[c] * bends[corners[c]];
+            light += weights[c] * rays[corners[c]]->accumulatedColor;
+            transmission += weights[c] * rays[corners[c]]->transmission;
+        }
+
+        if (escaped && glm::length(bend - bends[k]) > settings.tolerance)
+            return true;
+
+        glm::vec3 lightError = glm::abs(light - rays[k]->accumulatedColor);
+        float error = std::max(lightError.x, std::max(lightError.y, lightError.z));
+        if (error + std::abs(transmission - rays[k]->transmission) > settings.colorTolerance)
+            return true;
+    }
+    return false;
+}
+
+void Tracer::InterpolateBlock(const SceneParams& scene, const AdaptiveBlock& block) {
+    int x1 = std::min(block.x0 + block.size, m_Width - 1);
+    int y1 = std::min(block.y0 + block.size, m_Height - 1);
+    const int xs[4] = { block.x0, x1, block.x0, x1 };
+    const int ys[4] = { block.y0, block.y0, y1, y1 };
+
+    const RayResult* corners[4];
+    glm::vec3 bends[4];
+    bool escaped = m_AdaptiveRays[(size_t)block.y0 * m_Width + block.x0].termination == RayTermination::Escaped;
+    for (int k = 0; k < 4; k++) {
+        corners[k] = &m_AdaptiveRays[(size_t)ys[k] * m_Width + xs[k]];
+        if (escaped)
+            bends[k] = Bend(scene, *corners[k], xs[k], ys[k], m_Width, m_Height);
+    }
+
+    // Half open, the right and top edges belong to the next block unless
+    // they are the frame's
+    int xEnd = x1 == m_Width - 1 ? x1 + 1 : x1;
+    int yEnd = y1 == m_Height - 1 ? y1 + 1 : y1;
+    for (int y = block.y0; y < yEnd; y++) {
+        float fy = (float)(y - block.y0) / (y1 - block.y0);
+        for (int x = block.x0; x < xEnd; x++) {
+            size_t i = (size_t)y * m_Width + x;
+            if (m_SampleMask[i])
+                continue;
+
+            float fx = (float)(x - block.x0) / (x1 - block.x0);
+            const float weights[4] = { (1.0f - fx) * (1.0f - fy), fx * (1.0f - fy), (1.0f - fx) * fy, fx * fy };
+
+            RayResult ray;
+            ray.termination = corners[0]->termination;
+            ray.bhDist = 0.0f;
+            ray.transmission = 0.0f;
+            glm::vec3 bend(0.0f);
+            for (int k = 0; k < 4; k++) {
+                ray.bhDist += weights[k] * corners[k]->bhDist;
+                ray.accumulatedColor += weights[k] * corners[k]->accumulatedColor;
+                ray.transmission += weights[k] * corners[k]->transmission;
+                if (escaped)
+                    bend += weights[k] * bends[k];
+            }
+
+            if (escaped) {
+                glm::vec2 texCoord((x + 0.5f) / m_Width, (y + 0.5f) / m_Height);
+                ray.vel = glm::normalize(Physics::PrimaryRayDirection(scene, texCoord) + bend) * Constants::c;
+            }
+            m_AdaptiveRays[i] = ray;
+        }
+    }
+}
+
+bool Tracer::SaveSampleMask(const std::string& path) const {
+    bool ok = !m_SampleMask.empty()
+        && stbi_write_png(path.c_str(), m_Width, m_Height, 1, m_SampleMask.data(), m_Width) != 0;
+
+    if (ok)
+        std::cout << "Saved sample mask to: " << path << std::endl;
+    else
+        std::cerr << "Failed to save sample mask: " << path << std::endl;
+    return ok;
+}
@@ -0,0 +1,152 @@
+#include "batch.h"
+#include "tracer.h"
+#include "stb_image_write.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+static bool EndsWith(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// pixels are bottom row first, stb flips them (see stepstats.cpp)
+static bool WriteFrame(const std::string& path, const std::vector<float>& pixels, int width, int height) {
+    if (EndsWith(path, ".hdr"))
+        return stbi_write_hdr(path.c_str(), width, height, 3, pixels.data()) != 0;
+
+    // Same rounding as glReadPixels into GL_UNSIGNED_BYTE
+    std::vector<unsigned char> bytes(pixels.size());
+    for (size_t i = 0; i < pixels.size(); i++)
+        bytes[i] = (unsigned char)(glm::clamp(pixels[i], 0.0f, 1.0f) * 255.0f + 0.5f);
+    return stbi_write_png(path.c_str(), width, height, 3, bytes.data(), width * 3) != 0;
+}
+
+// One frame with whichever renderer the settings pick, the stats of all its passes
+static TraceStats RenderFrame(Tracer& tracer, const BatchSettings& settings, const SceneParams& scene,
+                              const Skybox& skybox, std::vector<float>& pixels) {
+    TraceStats stats;
+    if (settings.logPolarQuality > 0.0f) {
+        tracer.RenderLogPolar(scene, skybox, pixels, settings.logPolarQuality);
+        return tracer.GetStats();
+    }
+    if (settings.adaptiveTolerance > 0.0f) {
+        AdaptiveSettings adaptive;
+        adaptive.tolerance = settings.adaptiveTolerance;
+        tracer.RenderAdaptive(scene, skybox, pixels, adaptive);
+        return tracer.GetStats();
+    }
+    if (settings.progressiveStride > 1) {
+        bool finished = false;
+        while (!finished) {
+            finished = tracer.RenderProgressive(scene, skybox, pixels, false);
+            stats.Add(tracer.GetStats());
+        }
+        return stats;
+    }
+    tracer.Render(scene, skybox, pixels);
+    return tracer.GetStats();
+}
+
+namespace Batch {
+    std::string FramePath(const std::string& pattern, int frame) {
+        int size = std::snprintf(nullptr, 0, pattern.c_str(), frame);
+        if (size < 0)
+            return pattern;
+        std::string path(size + 1, '\0');
+        std::snprintf(&path[0], path.size(), pattern.c_str(), frame);
+        path.resize(size);
+        return path;
+    }
+
+    BatchReport RenderPath(const CameraPath& path, const Skybox& skybox, const BatchSettings& settings) {
+        using Clock = std::chrono::steady_clock;
+
+        BatchReport report;
+        int first = std::max(settings.firstFrame, 0);
+        int last = path.GetFrameCount() - 1;
+        if (settings.lastFrame >= 0)
+            last = std::min(settings.lastFrame, last);
+        if (last < first || settings.width <= 0 || settings.height <= 0)
+            return report;
+
+        std::ofstream timings;
+        if (!settings.tileTimings.empty()) {
+            timings.open(settings.tileTimings);
+            if (timings)
+                timings << "frame,x0,y0,x1,y1,thread,milliseconds\n";
+            else
+                std::cerr << "Failed to open tile timings: " << settings.tileTimings << std::endl;
+        }
+
+        auto start = Clock::now();
+        float aspectRatio = (float)settings.width / settings.height;
+        std::atomic<int> nextFrame(first);
+        std::mutex mutex;
+
+        // The frames in flight split the cores between them rather than each
+        // starting a thread for every core
+        int slots = std::clamp(settings.framesInFlight, 1, last - first + 1);
+        int tracerThreads = settings.threads;
+        if (tracerThreads <= 0)
+            tracerThreads = std::max(1, (int)std::thread::hardware_concurrency() / slots);
+
+        auto worker = [&]() {
+            Tracer tracer(settings.width, settings.height);
+            tracer.SetThreadCount(tracerThreads);
+            tracer.SetLensCache(settings.lensCache);
+            if (settings.progressiveStride > 1)
+                tracer.SetCoarseStride(settings.progressiveStride);
+            tracer.SetRecordSteps(!settings.stepStats.empty());
+            std::vector<float> pixels;
+
+            for (int frame = nextFrame++; frame <= last; frame = nextFrame++) {
+                SceneParams scene = path.GetScene(path.GetFrameTime(frame), aspectRatio);
+                auto frameStart = Clock::now();
+                TraceStats stats = RenderFrame(tracer, settings, scene, skybox, pixels);
+                float milliseconds = std::chrono::duration<float, std::milli>(Clock::now() - frameStart).count();
+
+                std::string file = FramePath(settings.output, frame);
+                bool ok = WriteFrame(file, pixels, settings.width, settings.height);
+                if (tracer.IsRecordingSteps())
+                    ok &= StepStats::Export(tracer.GetStepBuffer(), FramePath(settings.stepStats, frame));
+                if (settings.adaptiveTolerance > 0.0f && !settings.sampleMask.empty())
+                    ok &= tracer.SaveSampleMask(FramePath(settings.sampleMask, frame));
+
+                std::lock_guard<std::mutex> lock(mutex);
+                report.rays += stats.rays;
+                report.analyticRays += stats.analyticCaptures + stats.analyticEscapes;
+                report.skippedSteps += stats.skippedSteps;
+                if (timings.is_open()) {
+                    for (const TileTiming& tile : tracer.GetTileTimings())
+                        timings << frame << "," << tile.x0 << "," << tile.y0 << "," << tile.x1 << "," << tile.y1
+                                << "," << tile.thread << "," << tile.milliseconds << "\n";
+                }
+                if (ok) {
+                    report.frames++;
+                    std::cout << "Frame " << frame << " (" << report.frames + report.failed << "/"
+                              << last - first + 1 << ") " << milliseconds << " ms, "
+                              << stats.analyticCaptures + stats.analyticEscapes << " of " << stats.rays
+                              << " rays analytic, " << stats.skippedSteps << " steps skipped -> " << file << std::endl;
+                } else {
+                    report.failed++;
+                    std::cerr << "Failed to save frame: " << file << std::endl;
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (int i = 1; i < slots; i++)
+            threads.emplace_back(worker);
+        worker();
+        for (std::thread& thread : threads)
+            thread.join();
+
+        report.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        return report;
+    }
+}
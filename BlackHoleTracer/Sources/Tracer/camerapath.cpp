@@ -0,0 +1,188 @@
+#include "camerapath.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+static bool ParseFlags(const std::string& list, uint32_t& flags) {
+    static const struct { const char* name; uint32_t bit; } names[] = {
+        { "relativity", SceneFlags::USE_RELATIVITY },
+        { "disk", SceneFlags::SHOW_DISK },
+        { "adaptive", SceneFlags::ADAPTIVE_STEP },
+        { "planar", SceneFlags::PLANAR_ORBIT },
+        { "deflection", SceneFlags::DEFLECTION_TABLE },
+        { "farfield", SceneFlags::FAR_FIELD },
+        { "weakfield", SceneFlags::WEAK_FIELD },
+    };
+
+    flags = 0u;
+    std::stringstream stream(list);
+    std::string name;
+    while (std::getline(stream, name, ',')) {
+        if (name == "none")
+            continue;
+        auto it = std::find_if(std::begin(names), std::end(names),
+                               [&](const auto& entry) { return name == entry.name; });
+        if (it == std::end(names))
+            return false;
+        flags |= it->bit;
+    }
+    return true;
+}
+
+bool CameraPath::Load(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Failed to open camera path: " << path << std::endl;
+        return false;
+    }
+
+    keys.clear();
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        line = line.substr(0, line.find('#'));
+        std::stringstream stream(line);
+        std::string name;
+        if (!(stream >> name))
+            continue;
+
+        bool ok = true;
+        if (name == "key") {
+            CameraKeyframe key = keys.empty() ? CameraKeyframe() : keys.back();
+            ok = (bool)(stream >> key.time);
+
+            std::string field, value;
+            while (ok && stream >> field) {
+                if (!(stream >> value)) {
+                    ok = false;
+                    break;
+                }
+                char* end = nullptr;
+                float number = std::strtof(value.c_str(), &end);
+                bool isNumber = *end == '\0';
+                if (field == "flags")
+                    ok = ParseFlags(value, key.flags);
+                else if (field == "radius" && isNumber)
+                    key.radius = number;
+                else if (field == "azimuth" && isNumber)
+                    key.azimuth = number;
+                else if (field == "polar" && isNumber)
+                    key.polar = number;
+                else if (field == "zoom" && isNumber)
+                    key.zoom = number;
+                else if (field == "mass" && isNumber)
+                    key.mass = number;
+                else
+                    ok = false;
+            }
+            if (ok && !keys.empty() && key.time <= keys.back().time) {
+                std::cerr << path << ":" << lineNumber << ": keys must be in increasing time" << std::endl;
+                return false;
+            }
+            if (ok)
+                keys.push_back(key);
+        } else {
+            float value = 0.0f;
+            ok = (bool)(stream >> value);
+            if (name == "fps" && value > 0.0f)
+                fps = value;
+            else if (name == "sizeBuffer")
+                bhSizeBuffer = value;
+            else if (name == "diskThickness")
+                diskThickness = value;
+            else if (name == "tolerance")
+                tolerance = value;
+            else if (name == "farFieldRadius")
+                farFieldRadius = value;
+            else if (name == "weakFieldThreshold")
+                weakFieldThreshold = value;
+            else if (name == "weakFieldTolerance")
+                weakFieldTolerance = value;
+            else
+                ok = false;
+        }
+
+        if (!ok) {
+            std::cerr << path << ":" << lineNumber << ": can't parse \"" << line << "\"" << std::endl;
+            return false;
+        }
+    }
+
+    if (keys.empty()) {
+        std::cerr << path << ": no keys" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Cubic Hermite segment with tangents from the neighbouring keys, scaled
+// for uneven spacing in time
+static float Spline(float p0, float p1, float p2, float p3, float t0, float t1, float t2, float t3, float time) {
+    float h = t2 - t1;
+    float m1 = (p2 - p0) / std::max(t2 - t0, 1e-6f) * h;
+    float m2 = (p3 - p1) / std::max(t3 - t1, 1e-6f) * h;
+    float s = (time - t1) / h;
+    float s2 = s * s;
+    float s3 = s2 * s;
+    return (2.0f * s3 - 3.0f * s2 + 1.0f) * p1 + (s3 - 2.0f * s2 + s) * m1
+         + (-2.0f * s3 + 3.0f * s2) * p2 + (s3 - s2) * m2;
+}
+
+CameraKeyframe CameraPath::Evaluate(float time) const {
+    if (keys.empty())
+        return CameraKeyframe();
+    if (time <= keys.front().time)
+        return keys.front();
+    if (time >= keys.back().time)
+        return keys.back();
+
+    size_t i = 0;
+    while (keys[i + 1].time <= time)
+        i++;
+
+    // The ends repeat, so the first and last segments start and stop with
+    // the tangent of a straight line
+    const CameraKeyframe& k0 = keys[i > 0 ? i - 1 : i];
+    const CameraKeyframe& k1 = keys[i];
+    const CameraKeyframe& k2 = keys[i + 1];
+    const CameraKeyframe& k3 = keys[std::min(i + 2, keys.size() - 1)];
+    auto spline = [&](float CameraKeyframe::* field) {
+        return Spline(k0.*field, k1.*field, k2.*field, k3.*field, k0.time, k1.time, k2.time, k3.time, time);
+    };
+
+    CameraKeyframe key = k1;
+    key.time = time;
+    key.radius = spline(&CameraKeyframe::radius);
+    key.azimuth = spline(&CameraKeyframe::azimuth);
+    key.polar = spline(&CameraKeyframe::polar);
+    key.zoom = spline(&CameraKeyframe::zoom);
+    key.mass = spline(&CameraKeyframe::mass);
+    return key;
+}
+
+SceneParams CameraPath::GetScene(float time, float aspectRatio) const {
+    CameraKeyframe key = Evaluate(time);
+    Camera camera(key.radius, key.azimuth, key.polar);
+    camera.Zoom() = key.zoom;
+    BlackHole bh(key.mass, glm::vec3(0.0f));
+
+    SceneParams scene = SceneParams::FromScene(camera, bh, key.flags, bhSizeBuffer, diskThickness, aspectRatio,
+                                               tolerance, farFieldRadius);
+    scene.weakFieldThreshold = weakFieldThreshold;
+    scene.weakFieldTolerance = weakFieldTolerance;
+    return scene;
+}
+
+int CameraPath::GetFrameCount() const {
+    if (keys.empty())
+        return 0;
+    return (int)std::floor(GetDuration() * fps + 1e-3f) + 1;
+}
+
+float CameraPath::GetFrameTime(int frame) const {
+    return keys.empty() ? 0.0f : keys.front().time + frame / fps;
+}
@@ -0,0 +1,101 @@
+#include "deflection.h"
+#include "physics.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Ray leaving a camera at distance cameraRadius from the hole, alpha away
+// from the direction to the hole. The plane is fixed to x/y since only the
+// in-plane result is stored.
+static RayResult MarchAlpha(const SceneParams& scene, float cameraRadius, float alpha) {
+    glm::vec3 loc = scene.bhPos + glm::vec3(cameraRadius, 0.0f, 0.0f);
+    glm::vec3 vel = glm::vec3(-std::cos(alpha), std::sin(alpha), 0.0f) * Constants::c;
+    return Physics::MarchRay_Planar(scene, loc, vel);
+}
+
+void DeflectionTable::Build(const SceneParams& scene) {
+    SceneParams planar = scene;
+    planar.flags = SceneFlags::USE_RELATIVITY | SceneFlags::PLANAR_ORBIT;
+
+    m_CameraRadius = glm::length(scene.camPos - scene.bhPos);
+    m_BhRadius = scene.bhRadius;
+    m_BhSizeBuffer = scene.bhSizeBuffer;
+
+    // Captured rays are the ones aimed within the critical angle of the hole,
+    // find it by bisection on the marched outcome so it agrees with the march
+    float lo = 0.0f, hi = Constants::PI;
+    if (MarchAlpha(planar, m_CameraRadius, lo).termination != RayTermination::Captured) {
+        hi = 0.0f;
+    } else {
+        for (int i = 0; i < 40; i++) {
+            float mid = 0.5f * (lo + hi);
+            if (MarchAlpha(planar, m_CameraRadius, mid).termination == RayTermination::Captured)
+                lo = mid;
+            else
+                hi = mid;
+        }
+    }
+    m_CriticalAngle = hi;
+
+    m_Entries.resize(SIZE);
+    for (int i = 0; i < SIZE; i++) {
+        float alpha = TToAlpha((float)i / (SIZE - 1));
+        RayResult ray = MarchAlpha(planar, m_CameraRadius, alpha);
+
+        bool escaped = ray.termination == RayTermination::Escaped;
+        float psi = escaped ? std::atan2(ray.vel.y, ray.vel.x) : 0.0f;
+
+        // Unwrap so neighbouring entries interpolate across the +-PI seam
+        if (i > 0 && escaped) {
+            float previous = m_Entries[i - 1].x;
+            psi += 2.0f * Constants::PI * std::round((previous - psi) / (2.0f * Constants::PI));
+        }
+        m_Entries[i] = glm::vec2(psi, escaped ? 1.0f : 0.0f);
+    }
+}
+
+bool DeflectionTable::IsBuiltFor(const SceneParams& scene) const {
+    return !m_Entries.empty()
+        && m_CameraRadius == glm::length(scene.camPos - scene.bhPos)
+        && m_BhRadius == scene.bhRadius
+        && m_BhSizeBuffer == scene.bhSizeBuffer;
+}
+
+float DeflectionTable::AlphaToT(float alpha) const {
+    float range = Constants::PI - m_CriticalAngle;
+    if (range <= 0.0f)
+        return 0.0f;
+    return std::sqrt(glm::clamp((alpha - m_CriticalAngle) / range, 0.0f, 1.0f));
+}
+
+float DeflectionTable::TToAlpha(float t) const {
+    return m_CriticalAngle + (Constants::PI - m_CriticalAngle) * t * t;
+}
+
+bool DeflectionTable::Lookup(const SceneParams& scene, const glm::vec3& rayDir, glm::vec3& outDir) const {
+    glm::vec3 e1 = glm::normalize(scene.camPos - scene.bhPos);
+    float radial = glm::dot(rayDir, e1);
+    float alpha = std::acos(glm::clamp(-radial, -1.0f, 1.0f));
+    if (alpha < m_CriticalAngle)
+        return false;
+
+    // Linear interpolation between entries, the shader does the same with texelFetch
+    float x = AlphaToT(alpha) * (SIZE - 1);
+    int i0 = std::min((int)x, SIZE - 2);
+    float frac = x - i0;
+    glm::vec2 entry = glm::mix(m_Entries[i0], m_Entries[i0 + 1], frac);
+    if (entry.y < 0.5f)
+        return false;
+
+    glm::vec3 perp = rayDir - radial * e1;
+    float perpLen = glm::length(perp);
+    if (perpLen < 1e-6f) {
+        // Straight out from the hole, nothing bends it
+        outDir = rayDir;
+        return true;
+    }
+
+    glm::vec3 e2 = perp / perpLen;
+    outDir = glm::normalize(std::cos(entry.x) * e1 + std::sin(entry.x) * e2);
+    return true;
+}
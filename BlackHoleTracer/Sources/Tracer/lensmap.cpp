@@ -0,0 +1,65 @@
+#include "lensmap.h"
+#include "physics.h"
+
+#include <cmath>
+
+void LensMap::Reset(int width, int height) {
+    m_Width = width;
+    m_Height = height;
+    m_Samples.assign((size_t)width * height, Sample());
+    m_Valid = false;
+}
+
+void LensMap::Set(int x, int y, const SceneParams& scene, const RayResult& ray) {
+    Sample& sample = m_Samples[(size_t)y * m_Width + x];
+    sample.termination = ray.termination;
+    sample.bhDist = ray.bhDist;
+    sample.accumulatedColor = ray.accumulatedColor;
+    sample.transmission = ray.transmission;
+
+    // invView is a rotation, its transpose takes world directions to the camera
+    if (ray.termination == RayTermination::Escaped)
+        sample.direction = glm::transpose(glm::mat3(scene.invView)) * glm::normalize(ray.vel);
+}
+
+RayResult LensMap::Get(int x, int y, const SceneParams& scene) const {
+    const Sample& sample = m_Samples[(size_t)y * m_Width + x];
+
+    RayResult ray;
+    ray.termination = sample.termination;
+    ray.bhDist = sample.bhDist;
+    ray.accumulatedColor = sample.accumulatedColor;
+    ray.transmission = sample.transmission;
+    ray.vel = glm::mat3(scene.invView) * sample.direction * Constants::c;
+    return ray;
+}
+
+void LensMap::Finish(const SceneParams& scene) {
+    m_Scene = scene;
+    m_Valid = true;
+}
+
+bool LensMap::SameGeodesics(const SceneParams& a, const SceneParams& b) {
+    // Everything the march reads apart from where the camera is
+    if (a.fov != b.fov || a.aspectRatio != b.aspectRatio || a.bhPos != b.bhPos || a.bhMass != b.bhMass
+        || a.bhRadius != b.bhRadius || a.bhSizeBuffer != b.bhSizeBuffer || a.diskThickness != b.diskThickness
+        || a.flags != b.flags || a.tolerance != b.tolerance || a.farFieldRadius != b.farFieldRadius
+        || a.weakFieldThreshold != b.weakFieldThreshold || a.weakFieldTolerance != b.weakFieldTolerance)
+        return false;
+
+    // The camera orbits the origin, so the symmetry only holds for a hole there
+    if (a.bhPos != glm::vec3(0.0f))
+        return false;
+
+    // camPos is rebuilt from radius and angles every frame, so the same
+    // radius can be a few ulps off
+    float radius = glm::length(a.camPos);
+    float tolerance = 1e-5f * radius;
+    if (std::abs(glm::length(b.camPos) - radius) > tolerance)
+        return false;
+
+    // The disk lies in y = 0, only rotations about y keep it in place
+    if (a.ShowDisk() && std::abs(a.camPos.y - b.camPos.y) > tolerance)
+        return false;
+    return true;
+}
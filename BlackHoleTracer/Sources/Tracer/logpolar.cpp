@@ -0,0 +1,104 @@
+#include "logpolar.h"
+
+#include <algorithm>
+#include <cmath>
+
+LogPolarGrid LogPolarGrid::Build(const SceneParams& scene, int width, int height, float quality) {
+    LogPolarGrid grid;
+    glm::vec2 size((float)width, (float)height);
+    float fovFactor = std::tan(scene.fov * 0.5f);
+
+    // Where the hole lands on screen, the inverse of PrimaryRayDirection.
+    // Behind the camera the grid just stays centred.
+    glm::vec3 local = glm::transpose(glm::mat3(scene.invView)) * (scene.bhPos - scene.camPos);
+    grid.center = size * 0.5f;
+    if (local.z < 0.0f) {
+        glm::vec2 ndc(local.x / (-local.z * fovFactor * scene.aspectRatio), local.y / (-local.z * fovFactor));
+        grid.center = (ndc * 0.5f + glm::vec2(0.5f)) * size;
+    }
+
+    float maxRadius = 1.0f;
+    for (int corner = 0; corner < 4; corner++) {
+        glm::vec2 position((corner & 1) ? size.x : 0.0f, (corner & 2) ? size.y : 0.0f);
+        maxRadius = std::max(maxRadius, glm::length(position - grid.center));
+    }
+
+    // Apparent radius of the photon ring, impact parameter 3 sqrt(3) M seen
+    // from distance d: sin(alpha) = b / d sqrt(1 - 2M / d)
+    float M = 0.5f * scene.bhRadius;
+    float distance = glm::length(local);
+    float alpha = 1.3f;
+    if (distance > 3.0f * M) {
+        float sinAlpha = 3.0f * std::sqrt(3.0f) * M / distance * std::sqrt(1.0f - 2.0f * M / distance);
+        alpha = std::min(std::asin(std::min(sinAlpha, 1.0f)), alpha);
+    }
+    grid.inner = glm::clamp(std::tan(alpha) / fovFactor * size.y * 0.5f, 2.0f, maxRadius);
+
+    // angular * radial = quality * width * height, with angular =
+    // 2pi / (CELL_ASPECT * radialStep) and radial = logRange / radialStep
+    float logRange = std::log1p(maxRadius / grid.inner);
+    float rays = std::max(quality, 0.01f) * size.x * size.y;
+    float radialStep = std::sqrt(2.0f * Constants::PI * logRange / (CELL_ASPECT * rays));
+    grid.angular = glm::clamp((int)std::round(2.0f * Constants::PI / (CELL_ASPECT * radialStep)), 16, 4096);
+    grid.angularStep = 2.0f * Constants::PI / grid.angular;
+    grid.radial = glm::clamp((int)std::ceil(logRange / radialStep), 2, 4096);
+    grid.radialStep = logRange / grid.radial;
+    return grid;
+}
+
+glm::vec2 LogPolarGrid::SamplePosition(int i, int j) const {
+    float theta = angularStep * (i + 0.5f);
+    float radius = inner * (std::exp(radialStep * (j + 0.5f)) - 1.0f);
+    return center + radius * glm::vec2(std::cos(theta), std::sin(theta));
+}
+
+glm::vec2 LogPolarGrid::GridCoordinate(const glm::vec2& position) const {
+    glm::vec2 offset = position - center;
+    float theta = std::atan2(offset.y, offset.x);
+    if (theta < 0.0f)
+        theta += 2.0f * Constants::PI;
+    float radius = glm::length(offset);
+    return glm::vec2(theta / angularStep - 0.5f, std::log1p(radius / inner) / radialStep - 0.5f);
+}
+
+bool LogPolarGrid::IsVisible(const glm::vec2& position, int width, int height) const {
+    // One cell past the edge, cells are at most angularStep * (r + inner) across
+    float margin = angularStep * (glm::length(position - center) + inner) + 1.0f;
+    return position.x > -margin && position.x < width + margin
+        && position.y > -margin && position.y < height + margin;
+}
+
+namespace LogPolar {
+    void Resample(const LogPolarGrid& grid, const std::vector<float>& samples, int width, int height,
+                  std::vector<float>& pixels) {
+        pixels.resize((size_t)width * height * 3);
+
+        // Same filter as the GL_LINEAR lookup in logpolar.frag, wrapping in
+        // angle and clamped in radius
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                glm::vec2 coordinate = grid.GridCoordinate(glm::vec2(x + 0.5f, y + 0.5f));
+                coordinate.y = glm::clamp(coordinate.y, 0.0f, (float)(grid.radial - 1));
+
+                int i0 = (int)std::floor(coordinate.x);
+                int j0 = std::min((int)coordinate.y, grid.radial - 2);
+                float fx = coordinate.x - i0;
+                float fy = coordinate.y - j0;
+                i0 = (i0 % grid.angular + grid.angular) % grid.angular;
+                int i1 = (i0 + 1) % grid.angular;
+
+                const float* s00 = &samples[((size_t)j0 * grid.angular + i0) * 3];
+                const float* s10 = &samples[((size_t)j0 * grid.angular + i1) * 3];
+                const float* s01 = &samples[((size_t)(j0 + 1) * grid.angular + i0) * 3];
+                const float* s11 = &samples[((size_t)(j0 + 1) * grid.angular + i1) * 3];
+
+                float* out = &pixels[((size_t)y * width + x) * 3];
+                for (int c = 0; c < 3; c++) {
+                    float bottom = s00[c] + (s10[c] - s00[c]) * fx;
+                    float top = s01[c] + (s11[c] - s01[c]) * fx;
+                    out[c] = bottom + (top - bottom) * fy;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,131 @@
+#include "packet.h"
+#include "physics.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace Packet {
+#ifdef BHTRACE_X86_KERNELS
+    // Defined in packet_avx2.cpp / packet_avx512.cpp
+    void MarchAVX2(const SceneParams& scene, RayPacket& packet);
+    void MarchAVX512(const SceneParams& scene, RayPacket& packet);
+
+    static bool CpuHasAVX2() {
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) return false;
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        if (!osxsave || (_xgetbv(0) & 0x6) != 0x6) return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+
+    static bool CpuHasAVX512() {
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) return false;
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        if (!osxsave || (_xgetbv(0) & 0xE6) != 0xE6) return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 16)) != 0;
+#else
+        return __builtin_cpu_supports("avx512f");
+#endif
+    }
+#endif
+
+    bool IsSupported(PacketKernel kernel) {
+        switch (kernel) {
+            case PacketKernel::Auto:
+            case PacketKernel::Scalar:
+                return true;
+#ifdef BHTRACE_X86_KERNELS
+            case PacketKernel::AVX2:
+                return CpuHasAVX2();
+            case PacketKernel::AVX512:
+                return CpuHasAVX512();
+#endif
+            default:
+                return false;
+        }
+    }
+
+    PacketKernel Detect() {
+        static const PacketKernel detected = [] {
+            if (IsSupported(PacketKernel::AVX512)) return PacketKernel::AVX512;
+            if (IsSupported(PacketKernel::AVX2)) return PacketKernel::AVX2;
+            return PacketKernel::Scalar;
+        }();
+        return detected;
+    }
+
+    int Width(PacketKernel kernel) {
+        if (kernel == PacketKernel::Auto)
+            kernel = Detect();
+
+        switch (kernel) {
+            case PacketKernel::AVX2: return 8;
+            case PacketKernel::AVX512: return 16;
+            default: return 1;
+        }
+    }
+
+    const char* Name(PacketKernel kernel) {
+        switch (kernel) {
+            case PacketKernel::Auto: return "Auto";
+            case PacketKernel::Scalar: return "Scalar";
+            case PacketKernel::AVX2: return "AVX2";
+            case PacketKernel::AVX512: return "AVX-512";
+        }
+        return "Unknown";
+    }
+
+    void March(PacketKernel kernel, const SceneParams& scene, RayPacket& packet) {
+        if (kernel == PacketKernel::Auto)
+            kernel = Detect();
+
+        // The Binet march is already a handful of flops per step, it stays scalar
+        if (scene.PlanarOrbit())
+            kernel = PacketKernel::Scalar;
+
+#ifdef BHTRACE_X86_KERNELS
+        if (kernel == PacketKernel::AVX512 && CpuHasAVX512()) {
+            packet.FillTail(16);
+            MarchAVX512(scene, packet);
+            return;
+        }
+        if (kernel == PacketKernel::AVX2 && CpuHasAVX2()) {
+            packet.FillTail(8);
+            MarchAVX2(scene, packet);
+            return;
+        }
+#endif
+
+        // Scalar fallback, one ray at a time
+        for (int lane = 0; lane < packet.count; lane++) {
+            RayResult result = Physics::MarchRay(scene,
+                glm::vec3(packet.locX[lane], packet.locY[lane], packet.locZ[lane]),
+                glm::vec3(packet.velX[lane], packet.velY[lane], packet.velZ[lane]));
+
+            packet.locX[lane] = result.loc.x; packet.locY[lane] = result.loc.y; packet.locZ[lane] = result.loc.z;
+            packet.velX[lane] = result.vel.x; packet.velY[lane] = result.vel.y; packet.velZ[lane] = result.vel.z;
+            packet.bhDist[lane] = result.bhDist;
+            packet.accR[lane] = result.accumulatedColor.x;
+            packet.accG[lane] = result.accumulatedColor.y;
+            packet.accB[lane] = result.accumulatedColor.z;
+            packet.transmission[lane] = result.transmission;
+            packet.termination[lane] = result.termination;
+            packet.skippedSteps[lane] = result.skippedSteps;
+            packet.steps[lane] = result.steps;
+            packet.accelEvals[lane] = result.accelEvals;
+        }
+    }
+}
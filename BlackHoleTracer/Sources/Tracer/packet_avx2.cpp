@@ -0,0 +1,49 @@
+// Compiled with AVX2 enabled, only called after Packet::Detect confirms support
+#include "packet_march.h"
+
+#include <immintrin.h>
+
+namespace {
+    struct AVX2Lanes {
+        static constexpr int WIDTH = 8;
+
+        struct Float {
+            __m256 v;
+            friend Float operator+(Float a, Float b) { return { _mm256_add_ps(a.v, b.v) }; }
+            friend Float operator-(Float a, Float b) { return { _mm256_sub_ps(a.v, b.v) }; }
+            friend Float operator*(Float a, Float b) { return { _mm256_mul_ps(a.v, b.v) }; }
+            friend Float operator/(Float a, Float b) { return { _mm256_div_ps(a.v, b.v) }; }
+        };
+        struct Mask { __m256 v; };
+
+        static Float Set(float s) { return { _mm256_set1_ps(s) }; }
+        static Float Load(const float* p) { return { _mm256_load_ps(p) }; }
+        static void Store(float* p, Float a) { _mm256_store_ps(p, a.v); }
+
+        static Float Sqrt(Float a) { return { _mm256_sqrt_ps(a.v) }; }
+        static Float Min(Float a, Float b) { return { _mm256_min_ps(a.v, b.v) }; }
+        static Float Max(Float a, Float b) { return { _mm256_max_ps(a.v, b.v) }; }
+
+        static Mask Less(Float a, Float b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+        static Mask Greater(Float a, Float b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+        static Mask And(Mask a, Mask b) { return { _mm256_and_ps(a.v, b.v) }; }
+        static Mask Or(Mask a, Mask b) { return { _mm256_or_ps(a.v, b.v) }; }
+        // a & ~b
+        static Mask AndNot(Mask a, Mask b) { return { _mm256_andnot_ps(b.v, a.v) }; }
+
+        static Float Select(Mask m, Float a, Float b) { return { _mm256_blendv_ps(b.v, a.v, m.v) }; }
+        static int Bits(Mask m) { return _mm256_movemask_ps(m.v); }
+
+        static Mask FirstLanes(int count) {
+            __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+            __m256i limit = _mm256_set1_epi32(count);
+            return { _mm256_castsi256_ps(_mm256_cmpgt_epi32(limit, lanes)) };
+        }
+    };
+}
+
+namespace Packet {
+    void MarchAVX2(const SceneParams& scene, RayPacket& packet) {
+        MarchPacket<AVX2Lanes>(scene, packet);
+    }
+}
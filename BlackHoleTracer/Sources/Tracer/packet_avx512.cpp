@@ -0,0 +1,47 @@
+// Compiled with AVX-512F enabled, only called after Packet::Detect confirms support
+#include "packet_march.h"
+
+#include <immintrin.h>
+
+namespace {
+    struct AVX512Lanes {
+        static constexpr int WIDTH = 16;
+
+        struct Float {
+            __m512 v;
+            friend Float operator+(Float a, Float b) { return { _mm512_add_ps(a.v, b.v) }; }
+            friend Float operator-(Float a, Float b) { return { _mm512_sub_ps(a.v, b.v) }; }
+            friend Float operator*(Float a, Float b) { return { _mm512_mul_ps(a.v, b.v) }; }
+            friend Float operator/(Float a, Float b) { return { _mm512_div_ps(a.v, b.v) }; }
+        };
+        struct Mask { __mmask16 v; };
+
+        static Float Set(float s) { return { _mm512_set1_ps(s) }; }
+        static Float Load(const float* p) { return { _mm512_load_ps(p) }; }
+        static void Store(float* p, Float a) { _mm512_store_ps(p, a.v); }
+
+        static Float Sqrt(Float a) { return { _mm512_sqrt_ps(a.v) }; }
+        static Float Min(Float a, Float b) { return { _mm512_min_ps(a.v, b.v) }; }
+        static Float Max(Float a, Float b) { return { _mm512_max_ps(a.v, b.v) }; }
+
+        static Mask Less(Float a, Float b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ) }; }
+        static Mask Greater(Float a, Float b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ) }; }
+        static Mask And(Mask a, Mask b) { return { (__mmask16)(a.v & b.v) }; }
+        static Mask Or(Mask a, Mask b) { return { (__mmask16)(a.v | b.v) }; }
+        // a & ~b
+        static Mask AndNot(Mask a, Mask b) { return { (__mmask16)(a.v & ~b.v) }; }
+
+        static Float Select(Mask m, Float a, Float b) { return { _mm512_mask_blend_ps(m.v, b.v, a.v) }; }
+        static int Bits(Mask m) { return (int)m.v; }
+
+        static Mask FirstLanes(int count) {
+            return { (__mmask16)(count >= WIDTH ? 0xFFFF : (1u << count) - 1u) };
+        }
+    };
+}
+
+namespace Packet {
+    void MarchAVX512(const SceneParams& scene, RayPacket& packet) {
+        MarchPacket<AVX512Lanes>(scene, packet);
+    }
+}
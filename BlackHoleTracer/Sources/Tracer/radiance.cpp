@@ -0,0 +1,223 @@
+#include "radiance.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+// Lines of the header, without the newline. Past the end it keeps
+// returning empty lines, as stb's token reader does.
+static std::string ReadLine(const unsigned char* data, size_t size, size_t& position) {
+    size_t start = position;
+    while (position < size && data[position] != '\n')
+        position++;
+    std::string line((const char*)data + start, position - start);
+    if (position < size)
+        position++;
+    return line;
+}
+
+bool Radiance::IsRadiance(const unsigned char* data, size_t size) {
+    size_t position = 0;
+    std::string magic = ReadLine(data, size, position);
+    return magic == "#?RADIANCE" || magic == "#?RGBE";
+}
+
+// Walks the run headers of one channel of an encoded scanline, false on
+// runs that overrun it
+static bool SkipChannel(const unsigned char* data, size_t size, size_t& position, int width) {
+    for (int x = 0; x < width;) {
+        if (position >= size)
+            return false;
+        int count = data[position++];
+        bool run = count > 128;
+        if (run)
+            count -= 128;
+        if (count == 0 || count > width - x)
+            return false;
+        position += run ? 1 : (size_t)count;
+        x += count;
+    }
+    return position <= size;
+}
+
+bool Radiance::Index(const unsigned char* data, size_t size, RadianceImage& image) {
+    image = RadianceImage();
+    size_t position = 0;
+    if (!IsRadiance(data, size))
+        return false;
+    ReadLine(data, size, position);
+
+    bool rgbe = false;
+    for (std::string line = ReadLine(data, size, position); !line.empty(); line = ReadLine(data, size, position))
+        rgbe |= line == "FORMAT=32-bit_rle_rgbe";
+    std::string resolution = ReadLine(data, size, position);
+    if (!rgbe || resolution.compare(0, 3, "-Y ") != 0)
+        return false;
+
+    char* end;
+    long height = std::strtol(resolution.c_str() + 3, &end, 10);
+    while (*end == ' ')
+        end++;
+    if (std::strncmp(end, "+X ", 3) != 0)
+        return false;
+    long width = std::strtol(end + 3, nullptr, 10);
+    if (width <= 0 || height <= 0 || width > (1 << 24) || height > (1 << 24))
+        return false;
+
+    image.width = (int)width;
+    image.height = (int)height;
+    image.data = data;
+    image.scanlines.reserve((size_t)height + 1);
+
+    // Scanlines between 8 and 32767 pixels wide may be encoded, the first
+    // one tells. stb reads the whole file flat when it is not.
+    image.encoded = width >= 8 && width < 32768 && position + 4 <= size && data[position] == 2
+                    && data[position + 1] == 2 && (data[position + 2] & 0x80) == 0;
+    for (int y = 0; y < image.height; y++) {
+        image.scanlines.push_back(position);
+        if (!image.encoded) {
+            position += (size_t)width * 4;
+            continue;
+        }
+
+        if (position + 4 > size || data[position] != 2 || data[position + 1] != 2
+            || ((data[position + 2] << 8) | data[position + 3]) != width) {
+            image.scanlines.clear();
+            return false;
+        }
+        position += 4;
+        for (int channel = 0; channel < 4; channel++)
+            if (!SkipChannel(data, size, position, image.width)) {
+                image.scanlines.clear();
+                return false;
+            }
+    }
+    image.scanlines.push_back(position);
+
+    if (position > size) {
+        image.scanlines.clear();
+        return false;
+    }
+    return true;
+}
+
+// RGBE is three 8 bit mantissas over one exponent, value m * 2^(e - 136).
+// The smaller formats come straight from those bits rather than through a
+// float per texel.
+static glm::vec3 RgbeToFloat(const unsigned char* rgbe) {
+    static const auto scales = [] {
+        std::vector<float> table(256, 0.0f);
+        for (int e = 1; e < 256; e++)
+            table[e] = (float)std::ldexp(1.0f, e - (128 + 8));
+        return table;
+    }();
+    float scale = scales[rgbe[3]];
+    return glm::vec3(rgbe[0] * scale, rgbe[1] * scale, rgbe[2] * scale);
+}
+
+// 9 bit mantissas at 2^(E - 24), so E = e - 113 and the mantissa doubles.
+// Exponents out of its range are left to the float encoder.
+static bool RgbeToRGB9E5(const unsigned char* rgbe, uint32_t& texel) {
+    int exponent = rgbe[3] - 113;
+    if (rgbe[3] == 0) {
+        texel = 0;
+        return true;
+    }
+    if (exponent < 0 || exponent > 31)
+        return false;
+    texel = ((uint32_t)rgbe[0] << 1) | ((uint32_t)rgbe[1] << 10) | ((uint32_t)rgbe[2] << 19) | ((uint32_t)exponent << 27);
+    return true;
+}
+
+// Every mantissa and exponent pair, [e * 256 + m], built once through the
+// float encoder
+static const uint16_t* HalfTable() {
+    static const auto halves = [] {
+        std::vector<uint16_t> table(256 * 256);
+        for (int e = 0; e < 256; e++)
+            for (int m = 0; m < 256; m++) {
+                unsigned char rgbe[4] = { (unsigned char)m, 0, 0, (unsigned char)e };
+                unsigned char texel[6];
+                Skybox::EncodeTexel(RgbeToFloat(rgbe), SkyFormat::RGB16F, texel);
+                std::memcpy(&table[e * 256 + m], texel, 2);
+            }
+        return table;
+    }();
+    return halves.data();
+}
+
+void Radiance::Decode(const RadianceImage& image, SkyFormat format, void* pixels, int threadCount) {
+    if (!image.IsValid())
+        return;
+
+    size_t texelSize = Skybox::TexelSize(format);
+    size_t rowBytes = (size_t)image.width * texelSize;
+    if (threadCount <= 0)
+        threadCount = std::max((int)std::thread::hardware_concurrency(), 1);
+    threadCount = std::min(threadCount, image.height);
+
+    const uint16_t* halfTable = format == SkyFormat::RGB16F ? HalfTable() : nullptr;
+    std::atomic<int> nextRow{0};
+    auto decodeRows = [&] {
+        std::vector<unsigned char> scanline((size_t)image.width * 4);
+        for (int y = nextRow++; y < image.height; y = nextRow++) {
+            const unsigned char* in = image.data + image.scanlines[y];
+            const unsigned char* rgbe = in;
+            if (image.encoded) {
+                // Channels one after another, each in runs and dumps
+                in += 4;
+                for (int channel = 0; channel < 4; channel++)
+                    for (int x = 0; x < image.width;) {
+                        int count = *in++;
+                        if (count > 128) {
+                            count -= 128;
+                            unsigned char value = *in++;
+                            for (int i = 0; i < count; i++)
+                                scanline[(size_t)(x + i) * 4 + channel] = value;
+                        } else {
+                            for (int i = 0; i < count; i++)
+                                scanline[(size_t)(x + i) * 4 + channel] = *in++;
+                        }
+                        x += count;
+                    }
+                rgbe = scanline.data();
+            }
+
+            // Files are top row first
+            unsigned char* out = (unsigned char*)pixels + (size_t)(image.height - 1 - y) * rowBytes;
+            if (format == SkyFormat::RGB32F) {
+                float* texels = (float*)out;
+                for (int x = 0; x < image.width; x++) {
+                    glm::vec3 color = RgbeToFloat(rgbe + (size_t)x * 4);
+                    texels[x * 3 + 0] = color.x;
+                    texels[x * 3 + 1] = color.y;
+                    texels[x * 3 + 2] = color.z;
+                }
+            } else if (format == SkyFormat::RGB16F) {
+                uint16_t* texels = (uint16_t*)out;
+                for (int x = 0; x < image.width; x++) {
+                    const uint16_t* halves = halfTable + rgbe[x * 4 + 3] * 256;
+                    texels[x * 3 + 0] = halves[rgbe[x * 4 + 0]];
+                    texels[x * 3 + 1] = halves[rgbe[x * 4 + 1]];
+                    texels[x * 3 + 2] = halves[rgbe[x * 4 + 2]];
+                }
+            } else {
+                uint32_t* texels = (uint32_t*)out;
+                for (int x = 0; x < image.width; x++)
+                    if (!RgbeToRGB9E5(rgbe + (size_t)x * 4, texels[x]))
+                        Skybox::EncodeTexel(RgbeToFloat(rgbe + (size_t)x * 4), format, (unsigned char*)&texels[x]);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < threadCount; i++)
+        threads.emplace_back(decodeRows);
+    decodeRows();
+    for (std::thread& thread : threads)
+        thread.join();
+}
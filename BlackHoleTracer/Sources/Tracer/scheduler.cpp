@@ -0,0 +1,123 @@
+#include "scheduler.h"
+
+#include <algorithm>
+
+TileScheduler::TileScheduler(int threadCount) {
+    threadCount = std::max(threadCount, 1);
+    for (int t = 0; t < threadCount; t++)
+        m_Queues.push_back(std::make_unique<Queue>());
+
+    // Thread 0 is whoever calls Run
+    for (int t = 1; t < threadCount; t++)
+        m_Workers.emplace_back(&TileScheduler::WorkerLoop, this, t);
+}
+
+TileScheduler::~TileScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Quit = true;
+    }
+    m_Start.notify_all();
+    for (auto& worker : m_Workers)
+        worker.join();
+}
+
+void TileScheduler::Run(int jobCount, const Job& job) {
+    int threadCount = GetThreadCount();
+
+    // Contiguous runs keep each thread on one region of the frame until it
+    // has to steal
+    for (int t = 0; t < threadCount; t++) {
+        int begin = (int)((long long)jobCount * t / threadCount);
+        int end = (int)((long long)jobCount * (t + 1) / threadCount);
+        std::lock_guard<std::mutex> lock(m_Queues[t]->mutex);
+        m_Queues[t]->jobs.clear();
+        for (int i = begin; i < end; i++)
+            m_Queues[t]->jobs.push_back(i);
+    }
+
+    m_StealCount = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Job = &job;
+        m_Busy = threadCount - 1;
+        m_Generation++;
+    }
+    m_Start.notify_all();
+
+    Drain(0);
+
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    m_Done.wait(lock, [this] { return m_Busy == 0; });
+    m_Job = nullptr;
+}
+
+void TileScheduler::WorkerLoop(int thread) {
+    long long generation = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_Start.wait(lock, [&] { return m_Quit || m_Generation != generation; });
+            if (m_Quit)
+                return;
+            generation = m_Generation;
+        }
+
+        Drain(thread);
+
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Busy--;
+        }
+        m_Done.notify_one();
+    }
+}
+
+void TileScheduler::Drain(int thread) {
+    // m_Job stays valid until every thread has checked back in
+    const Job& job = *m_Job;
+    long long steals = 0;
+
+    int index;
+    for (;;) {
+        if (PopLocal(thread, index)) {
+            job(index, thread);
+        } else if (Steal(thread, index)) {
+            steals++;
+            job(index, thread);
+        } else {
+            break;
+        }
+    }
+
+    if (steals > 0) {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_StealCount += steals;
+    }
+}
+
+bool TileScheduler::PopLocal(int thread, int& index) {
+    Queue& queue = *m_Queues[thread];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.jobs.empty())
+        return false;
+    index = queue.jobs.back();
+    queue.jobs.pop_back();
+    return true;
+}
+
+bool TileScheduler::Steal(int thread, int& index) {
+    // Jobs are never added mid-run, so one empty sweep means there is nothing
+    // left to take. Start at the next thread so thieves spread out.
+    int threadCount = GetThreadCount();
+    for (int i = 1; i < threadCount; i++) {
+        Queue& victim = *m_Queues[(thread + i) % threadCount];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.jobs.empty())
+            continue;
+        index = victim.jobs.front();
+        victim.jobs.pop_front();
+        return true;
+    }
+    return false;
+}
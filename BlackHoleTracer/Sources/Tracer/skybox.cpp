@@ -0,0 +1,573 @@
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#include "skybox.h"
+#include "skytiles.h"
+#include "physics.h"
+#include "radiance.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// .bhsky layout, little endian: this header, then every level at its
+// offset, 16 byte aligned, bottom row first. A cube level is its six faces
+// one after another.
+static const char SKY_MAGIC[8] = { 'B', 'H', 'S', 'K', 'Y', 0, 0, 0 };
+static const uint32_t SKY_VERSION = 1;
+
+struct SkyFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t levelCount;
+    uint32_t layout;
+    uint64_t offsets[Skybox::MAX_LEVELS];
+};
+static_assert(sizeof(SkyFileHeader) == 160, "SkyFileHeader is read straight from the file");
+
+std::shared_ptr<const unsigned char> Skybox::MapFile(const std::string& path, size_t& size) {
+    size = 0;
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return nullptr;
+    LARGE_INTEGER fileSize;
+    HANDLE mapping = nullptr;
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!mapping)
+        return nullptr;
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!view)
+        return nullptr;
+    size = (size_t)fileSize.QuadPart;
+    return std::shared_ptr<const unsigned char>((const unsigned char*)view,
+                                                [](const unsigned char* p) { UnmapViewOfFile(p); });
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+    struct stat info;
+    void* view = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+        view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED)
+        return nullptr;
+    size = (size_t)info.st_size;
+    return std::shared_ptr<const unsigned char>((const unsigned char*)view,
+                                                [size](const unsigned char* p) { munmap((void*)p, size); });
+#endif
+}
+
+// EXT_texture_shared_exponent: 9 bit mantissas, 5 bit exponent with bias 15
+static uint32_t EncodeRGB9E5(const glm::vec3& color) {
+    const float maxValue = 511.0f / 512.0f * 65536.0f;
+    float r = color.x > 0.0f ? std::min(color.x, maxValue) : 0.0f;
+    float g = color.y > 0.0f ? std::min(color.y, maxValue) : 0.0f;
+    float b = color.z > 0.0f ? std::min(color.z, maxValue) : 0.0f;
+    float maxChannel = std::max(r, std::max(g, b));
+
+    int exponent = 0;
+    if (maxChannel > 0.0f) {
+        int e;
+        std::frexp(maxChannel, &e);
+        exponent = std::max(e - 1, -16) + 16;
+        if (std::floor(maxChannel / std::ldexp(1.0f, exponent - 24) + 0.5f) >= 512.0f)
+            exponent++;
+    }
+
+    float scale = std::ldexp(1.0f, 24 - exponent);
+    uint32_t rs = (uint32_t)std::floor(r * scale + 0.5f);
+    uint32_t gs = (uint32_t)std::floor(g * scale + 0.5f);
+    uint32_t bs = (uint32_t)std::floor(b * scale + 0.5f);
+    return rs | (gs << 9) | (bs << 18) | ((uint32_t)exponent << 27);
+}
+
+static glm::vec3 DecodeRGB9E5(uint32_t texel) {
+    static const auto scales = [] {
+        std::vector<float> table(32);
+        for (int e = 0; e < 32; e++)
+            table[e] = std::ldexp(1.0f, e - 24);
+        return table;
+    }();
+    float scale = scales[texel >> 27];
+    return glm::vec3((float)(texel & 511), (float)((texel >> 9) & 511), (float)((texel >> 18) & 511)) * scale;
+}
+
+static uint16_t FloatToHalf(float value) {
+    uint16_t sign = std::signbit(value) ? 0x8000 : 0;
+    float a = std::fabs(value);
+    if (std::isnan(a))
+        return 0;
+    a = std::min(a, 65504.0f);
+
+    // Subnormals are multiples of 2^-24
+    if (a < 6.103515625e-05f)
+        return sign | (uint16_t)std::lround(a * 16777216.0f);
+
+    int e;
+    float mantissa = std::frexp(a, &e);
+    uint32_t exponent = (uint32_t)(e + 14);
+    uint32_t fraction = (uint32_t)std::lround((mantissa * 2.0f - 1.0f) * 1024.0f);
+    if (fraction == 1024) {
+        fraction = 0;
+        exponent++;
+    }
+    return sign | (uint16_t)((exponent << 10) | fraction);
+}
+
+static float HalfToFloat(uint16_t half) {
+    static const auto table = [] {
+        std::vector<float> values(65536);
+        for (uint32_t h = 0; h < 65536; h++) {
+            uint32_t exponent = (h >> 10) & 31, fraction = h & 1023;
+            float magnitude = exponent == 0  ? std::ldexp((float)fraction, -24)
+                            : exponent == 31 ? INFINITY
+                                             : std::ldexp((float)(1024 + fraction), (int)exponent - 25);
+            values[h] = (h & 0x8000) ? -magnitude : magnitude;
+        }
+        return values;
+    }();
+    return table[half];
+}
+
+void Skybox::EncodeTexel(const glm::vec3& color, SkyFormat format, unsigned char* out) {
+    if (format == SkyFormat::RGB9E5) {
+        uint32_t texel = EncodeRGB9E5(color);
+        std::memcpy(out, &texel, 4);
+    } else if (format == SkyFormat::RGB16F) {
+        uint16_t texel[3] = { FloatToHalf(color.x), FloatToHalf(color.y), FloatToHalf(color.z) };
+        std::memcpy(out, texel, 6);
+    } else {
+        std::memcpy(out, &color[0], 12);
+    }
+}
+
+glm::vec3 Skybox::DecodeTexel(const void* texels, size_t index, SkyFormat format) {
+    switch (format) {
+    case SkyFormat::RGB9E5:
+        return DecodeRGB9E5(((const uint32_t*)texels)[index]);
+    case SkyFormat::RGB16F: {
+        const uint16_t* p = (const uint16_t*)texels + index * 3;
+        return glm::vec3(HalfToFloat(p[0]), HalfToFloat(p[1]), HalfToFloat(p[2]));
+    }
+    default: {
+        const float* p = (const float*)texels + index * 3;
+        return glm::vec3(p[0], p[1], p[2]);
+    }
+    }
+}
+
+// OpenGL 4.6, table 8.19. t runs along the rows.
+int Skybox::CubeFace(const glm::vec3& d, float& s, float& t) {
+    float ax = std::fabs(d.x), ay = std::fabs(d.y), az = std::fabs(d.z);
+    int face;
+    float sc, tc, ma;
+    if (ax >= ay && ax >= az) {
+        face = d.x > 0.0f ? 0 : 1;
+        sc = d.x > 0.0f ? -d.z : d.z;
+        tc = -d.y;
+        ma = ax;
+    } else if (ay >= az) {
+        face = d.y > 0.0f ? 2 : 3;
+        sc = d.x;
+        tc = d.y > 0.0f ? d.z : -d.z;
+        ma = ay;
+    } else {
+        face = d.z > 0.0f ? 4 : 5;
+        sc = d.z > 0.0f ? d.x : -d.x;
+        tc = -d.y;
+        ma = az;
+    }
+    s = 0.5f * (sc / ma + 1.0f);
+    t = 0.5f * (tc / ma + 1.0f);
+    return face;
+}
+
+glm::vec3 Skybox::CubeDirection(int face, float s, float t) {
+    float sc = 2.0f * s - 1.0f, tc = 2.0f * t - 1.0f;
+    switch (face) {
+    case 0: return glm::vec3(1.0f, -tc, -sc);
+    case 1: return glm::vec3(-1.0f, -tc, sc);
+    case 2: return glm::vec3(sc, 1.0f, tc);
+    case 3: return glm::vec3(sc, -1.0f, -tc);
+    case 4: return glm::vec3(sc, -tc, 1.0f);
+    default: return glm::vec3(-sc, -tc, -1.0f);
+    }
+}
+
+size_t Skybox::TexelSize(SkyFormat format) {
+    switch (format) {
+    case SkyFormat::RGB9E5: return 4;
+    case SkyFormat::RGB16F: return 6;
+    default: return 12;
+    }
+}
+
+const char* Skybox::FormatName(SkyFormat format) {
+    switch (format) {
+    case SkyFormat::RGB9E5: return "RGB9E5";
+    case SkyFormat::RGB16F: return "RGB16F";
+    default: return "RGB32F";
+    }
+}
+
+bool Skybox::Load(const std::string& path, SkyFormat hdrFormat) {
+    auto start = std::chrono::steady_clock::now();
+    *this = Skybox();
+
+    size_t size = 0;
+    std::shared_ptr<const unsigned char> mapping = MapFile(path, size);
+    bool ok;
+    if (mapping && size >= sizeof(SKY_MAGIC) && std::memcmp(mapping.get(), SKY_MAGIC, sizeof(SKY_MAGIC)) == 0) {
+        ok = LoadMapped(path, std::move(mapping), size);
+    } else if (mapping && size >= sizeof(SkyTiles::MAGIC)
+               && std::memcmp(mapping.get(), SkyTiles::MAGIC, sizeof(SkyTiles::MAGIC)) == 0) {
+        auto tiles = std::make_shared<SkyTiles>();
+        ok = tiles->Open(path, std::move(mapping), size);
+        if (ok) {
+            // Sizes only, the texels are in the tiles
+            m_Format = tiles->GetFormat();
+            m_Layout = SkyLayout::Cube;
+            m_LevelCount = tiles->GetLevelCount();
+            for (int i = 0; i < m_LevelCount; i++) {
+                int faceSize = tiles->GetLevelSize(i);
+                m_Levels[i] = { faceSize, faceSize, nullptr };
+            }
+            m_Tiles = std::move(tiles);
+        }
+    } else if (RadianceImage radiance; mapping && Radiance::Index(mapping.get(), size, radiance)) {
+        // Decoded on every core straight from the mapping, into whole floats
+        // of storage whatever the format
+        size_t bytes = (size_t)radiance.width * radiance.height * TexelSize(hdrFormat);
+        m_Data.resize((bytes + sizeof(float) - 1) / sizeof(float));
+        Radiance::Decode(radiance, hdrFormat, m_Data.data());
+        m_Format = hdrFormat;
+        m_Levels[0] = { radiance.width, radiance.height, m_Data.data() };
+        m_LevelCount = 1;
+        ok = true;
+    } else {
+        mapping.reset();
+
+        int width, height, nrComponents;
+        stbi_set_flip_vertically_on_load(true);
+        float* data = stbi_loadf(path.c_str(), &width, &height, &nrComponents, 3);
+        ok = data != nullptr;
+        if (!ok) {
+            std::cerr << "Failed to load HDR image: " << path << std::endl;
+        } else {
+            m_Data.assign(data, data + (size_t)width * height * 3);
+            stbi_image_free(data);
+            m_Levels[0] = { width, height, m_Data.data() };
+            m_LevelCount = 1;
+        }
+    }
+
+    m_LoadMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return ok;
+}
+
+bool Skybox::LoadMapped(const std::string& path, std::shared_ptr<const unsigned char> mapping, size_t size) {
+    SkyFileHeader header;
+    bool valid = size >= sizeof(header);
+    if (valid) {
+        std::memcpy(&header, mapping.get(), sizeof(header));
+        valid = header.version == SKY_VERSION && header.format <= (uint32_t)SkyFormat::RGB16F
+                && header.layout <= (uint32_t)SkyLayout::Cube
+                && header.width > 0 && header.height > 0
+                && (header.layout != (uint32_t)SkyLayout::Cube || header.width == header.height)
+                && header.levelCount > 0 && header.levelCount <= (uint32_t)MAX_LEVELS;
+    }
+
+    SkyFormat format = valid ? (SkyFormat)header.format : SkyFormat::RGB32F;
+    int faces = valid && header.layout == (uint32_t)SkyLayout::Cube ? CUBE_FACES : 1;
+    for (uint32_t i = 0; valid && i < header.levelCount; i++) {
+        int width = std::max((int)(header.width >> i), 1);
+        int height = std::max((int)(header.height >> i), 1);
+        uint64_t bytes = (uint64_t)width * height * faces * TexelSize(format);
+        valid = header.offsets[i] % 16 == 0 && header.offsets[i] <= size && bytes <= size - header.offsets[i];
+        if (valid)
+            m_Levels[i] = { width, height, mapping.get() + header.offsets[i] };
+    }
+    if (!valid) {
+        std::cerr << "Corrupt skybox file: " << path << std::endl;
+        *this = Skybox();
+        return false;
+    }
+
+    m_Format = format;
+    m_Layout = (SkyLayout)header.layout;
+    m_LevelCount = (int)header.levelCount;
+    m_Mapping = std::move(mapping);
+    return true;
+}
+
+std::string Skybox::CachePath(const std::string& path) {
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of("/\\");
+    bool hasExtension = dot != std::string::npos && (slash == std::string::npos || dot > slash);
+    return (hasExtension ? path.substr(0, dot) : path) + ".cube.bhsky";
+}
+
+bool Skybox::LoadCube(const std::string& path, SkyFormat cacheFormat) {
+    auto start = std::chrono::steady_clock::now();
+    auto finish = [&](bool ok) {
+        m_LoadMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return ok;
+    };
+
+    std::string cachePath = CachePath(path);
+    std::error_code error;
+    auto sourceTime = std::filesystem::last_write_time(path, error);
+    bool sourceKnown = !error;
+    auto cacheTime = std::filesystem::last_write_time(cachePath, error);
+    if (!error && sourceKnown && cacheTime >= sourceTime) {
+        Skybox cached;
+        if (cached.Load(cachePath) && cached.GetLayout() == SkyLayout::Cube) {
+            *this = std::move(cached);
+            return finish(true);
+        }
+    }
+
+    if (!Load(path))
+        return finish(false);
+    if (m_Layout == SkyLayout::Cube)
+        return finish(true);
+
+    std::cout << "Converting " << path << " to a cubemap, cached in " << cachePath << std::endl;
+    Skybox cube = ToCube();
+    Skybox cached;
+    if (cube.Save(cachePath, cacheFormat) && cached.Load(cachePath))
+        *this = std::move(cached);
+    else
+        *this = std::move(cube);
+    return finish(true);
+}
+
+Skybox Skybox::ToCube(int faceSize) const {
+    Skybox cube;
+    if (!IsLoaded())
+        return cube;
+    if (m_Layout == SkyLayout::Cube) {
+        std::cerr << "Skybox is already a cubemap" << std::endl;
+        return cube;
+    }
+
+    int size = faceSize > 0 ? faceSize : std::max(GetWidth() / 4, 1);
+    cube.m_Layout = SkyLayout::Cube;
+    cube.m_Data.resize((size_t)CUBE_FACES * size * size * 3);
+
+    // 2x2 samples a texel, the panorama is denser than the faces towards the
+    // poles. Rows are spread over every core, big panoramas take a while.
+    std::atomic<int> nextRow{0};
+    auto convertRows = [&] {
+        for (int row = nextRow++; row < CUBE_FACES * size; row = nextRow++) {
+            int face = row / size, y = row % size;
+            float* out = &cube.m_Data[(size_t)row * size * 3];
+            for (int x = 0; x < size; x++) {
+                glm::vec3 color(0.0f);
+                for (int sy = 0; sy < 2; sy++)
+                    for (int sx = 0; sx < 2; sx++) {
+                        glm::vec3 direction = CubeDirection(face, (x + 0.25f + 0.5f * sx) / size,
+                                                            (y + 0.25f + 0.5f * sy) / size);
+                        color += Sample(Physics::DirectionToUV(glm::normalize(direction)));
+                    }
+                color *= 0.25f;
+                out[x * 3 + 0] = color.x;
+                out[x * 3 + 1] = color.y;
+                out[x * 3 + 2] = color.z;
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 1; i < (int)std::thread::hardware_concurrency(); i++)
+        threads.emplace_back(convertRows);
+    convertRows();
+    for (std::thread& thread : threads)
+        thread.join();
+
+    cube.m_Levels[0] = { size, size, cube.m_Data.data() };
+    cube.m_LevelCount = 1;
+    return cube;
+}
+
+const void* Skybox::GetFace(int level, int face) const {
+    const SkyLevel& l = m_Levels[level];
+    if (!l.data)
+        return nullptr;
+    return (const unsigned char*)l.data + (size_t)face * l.width * l.height * TexelSize(m_Format);
+}
+
+bool Skybox::Save(const std::string& path, SkyFormat format) const {
+    if (!IsLoaded())
+        return false;
+
+    // Every level is box filtered from the one above it in floats, each
+    // face on its own
+    int faces = GetFaceCount();
+    int width = GetWidth(), height = GetHeight();
+    std::vector<glm::vec3> level((size_t)faces * width * height);
+    for (int face = 0; face < faces; face++)
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+                level[((size_t)face * height + y) * width + x] = Texel(0, face, x, y);
+
+    SkyFileHeader header = {};
+    std::memcpy(header.magic, SKY_MAGIC, sizeof(SKY_MAGIC));
+    header.version = SKY_VERSION;
+    header.format = (uint32_t)format;
+    header.layout = (uint32_t)m_Layout;
+    header.width = (uint32_t)width;
+    header.height = (uint32_t)height;
+
+    std::vector<std::vector<unsigned char>> encoded;
+    uint64_t offset = sizeof(header);
+    while (true) {
+        std::vector<unsigned char> bytes(level.size() * TexelSize(format));
+        for (size_t i = 0; i < level.size(); i++)
+            EncodeTexel(level[i], format, &bytes[i * TexelSize(format)]);
+        header.offsets[header.levelCount++] = offset;
+        offset = (offset + bytes.size() + 15) / 16 * 16;
+        encoded.push_back(std::move(bytes));
+
+        if ((width == 1 && height == 1) || header.levelCount == (uint32_t)MAX_LEVELS)
+            break;
+
+        int nextWidth = std::max(width / 2, 1), nextHeight = std::max(height / 2, 1);
+        std::vector<glm::vec3> next((size_t)faces * nextWidth * nextHeight);
+        for (int face = 0; face < faces; face++) {
+            const glm::vec3* src = &level[(size_t)face * width * height];
+            glm::vec3* dst = &next[(size_t)face * nextWidth * nextHeight];
+            for (int y = 0; y < nextHeight; y++) {
+                int y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+                for (int x = 0; x < nextWidth; x++) {
+                    int x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+                    dst[(size_t)y * nextWidth + x] = 0.25f * (src[(size_t)y0 * width + x0] + src[(size_t)y0 * width + x1]
+                                                            + src[(size_t)y1 * width + x0] + src[(size_t)y1 * width + x1]);
+                }
+            }
+        }
+        level.swap(next);
+        width = nextWidth;
+        height = nextHeight;
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    file.write((const char*)&header, sizeof(header));
+    for (uint32_t i = 0; i < header.levelCount; i++) {
+        file.seekp((std::streamoff)header.offsets[i]);
+        file.write((const char*)encoded[i].data(), (std::streamsize)encoded[i].size());
+    }
+    // Pads the last level so the file ends on the alignment too
+    if ((uint64_t)file.tellp() < offset) {
+        file.seekp((std::streamoff)offset - 1);
+        file.put(0);
+    }
+    if (!file) {
+        std::cerr << "Failed to write skybox: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+glm::vec3 Skybox::Texel(int level, int face, int x, int y) const {
+    const SkyLevel& l = m_Levels[level];
+    x = std::clamp(x, 0, l.width - 1);
+    y = std::clamp(y, 0, l.height - 1);
+    if (m_Tiles)
+        return m_Tiles->Texel(level, face, x, y);
+    return DecodeTexel(l.data, ((size_t)face * l.height + y) * l.width + x, m_Format);
+}
+
+glm::vec3 Skybox::CubeTexel(int level, int face, int x, int y) const {
+    int size = m_Levels[level].width;
+    if (x >= 0 && x < size && y >= 0 && y < size)
+        return Texel(level, face, x, y);
+
+    // Where the texel center would sit on the plane of this face, seen from
+    // the face it actually falls on
+    float s, t;
+    int neighbor = CubeFace(CubeDirection(face, (x + 0.5f) / size, (y + 0.5f) / size), s, t);
+    return Texel(level, neighbor, (int)std::floor(s * size), (int)std::floor(t * size));
+}
+
+int Skybox::LevelForPixelAngle(float radiansPerPixel) const {
+    if (m_Layout != SkyLayout::Cube)
+        return 0;
+    return LevelForPixelAngle(GetWidth(), m_LevelCount, radiansPerPixel);
+}
+
+int Skybox::LevelForPixelAngle(int faceSize, int levelCount, float radiansPerPixel) {
+    if (faceSize <= 0 || levelCount <= 1 || !(radiansPerPixel > 0.0f))
+        return 0;
+    // A face is 2 wide on the unit cube, so a texel at its middle spans
+    // 2 / size radians. The coarsest level whose texels are no larger than a
+    // pixel: up to 2x minification, which GL_LINEAR still filters. Only
+    // level 0 is ever magnified.
+    float level = std::floor(std::log2(radiansPerPixel * faceSize * 0.5f));
+    return std::clamp((int)level, 0, levelCount - 1);
+}
+
+glm::vec3 Skybox::Sample(const glm::vec3& direction, int level) const {
+    if (!IsLoaded())
+        return glm::vec3(0.0f);
+    if (m_Layout == SkyLayout::Equirect)
+        return Sample(Physics::DirectionToUV(direction));
+
+    level = std::clamp(level, 0, m_LevelCount - 1);
+    if (m_Tiles)
+        return m_Tiles->Sample(direction, level);
+
+    float s, t;
+    int face = CubeFace(direction, s, t);
+    int size = m_Levels[level].width;
+    float fx = s * size - 0.5f;
+    float fy = t * size - 0.5f;
+    int x0 = (int)std::floor(fx);
+    int y0 = (int)std::floor(fy);
+    float tx = fx - x0;
+    float ty = fy - y0;
+
+    glm::vec3 bottom = glm::mix(CubeTexel(level, face, x0, y0), CubeTexel(level, face, x0 + 1, y0), tx);
+    glm::vec3 top = glm::mix(CubeTexel(level, face, x0, y0 + 1), CubeTexel(level, face, x0 + 1, y0 + 1), tx);
+    return glm::mix(bottom, top, ty);
+}
+
+glm::vec3 Skybox::Sample(const glm::vec2& uv) const {
+    if (!IsLoaded() || m_Layout != SkyLayout::Equirect)
+        return glm::vec3(0.0f);
+
+    // Texel centers sit at (i + 0.5) / size, as in GL_LINEAR filtering
+    float fx = glm::clamp(uv.x, 0.0f, 1.0f) * GetWidth() - 0.5f;
+    float fy = glm::clamp(uv.y, 0.0f, 1.0f) * GetHeight() - 0.5f;
+    int x0 = (int)std::floor(fx);
+    int y0 = (int)std::floor(fy);
+    float tx = fx - x0;
+    float ty = fy - y0;
+
+    glm::vec3 bottom = glm::mix(Texel(0, 0, x0, y0), Texel(0, 0, x0 + 1, y0), tx);
+    glm::vec3 top = glm::mix(Texel(0, 0, x0, y0 + 1), Texel(0, 0, x0 + 1, y0 + 1), tx);
+    return glm::mix(bottom, top, ty);
+}
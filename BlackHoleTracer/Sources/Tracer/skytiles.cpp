@@ -0,0 +1,263 @@
+#include "skytiles.h"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+const char SkyTiles::MAGIC[8] = { 'B', 'H', 'T', 'I', 'L', 'E', 'S', 0 };
+static const uint32_t TILES_VERSION = 1;
+
+struct TileFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t format;
+    uint32_t faceSize;
+    uint32_t tileSize;
+    uint32_t levelCount;
+    uint32_t pageCount;
+    uint64_t dataOffset;
+};
+static_assert(sizeof(TileFileHeader) == 40, "TileFileHeader is read straight from the file");
+
+// Rounds towards minus infinity, texels left of a face are -1
+static int FloorDiv(int x, int d) {
+    return x >= 0 ? x / d : -((d - 1 - x) / d);
+}
+
+bool SkyTiles::Build(const Skybox& cube, const std::string& path, int tileSize, SkyFormat format) {
+    if (!cube.IsLoaded() || cube.GetLayout() != SkyLayout::Cube || tileSize <= 0) {
+        std::cerr << "Sky tiles are cut from a cubemap" << std::endl;
+        return false;
+    }
+
+    SkyTiles layout;
+    layout.m_Format = format;
+    layout.m_FaceSize = cube.GetWidth();
+    layout.m_TileSize = tileSize;
+    int pages = 0;
+    do {
+        layout.m_LevelPages[layout.m_LevelCount] = pages;
+        int tiles = layout.GetTilesAcross(layout.m_LevelCount);
+        pages += Skybox::CUBE_FACES * tiles * tiles;
+        layout.m_LevelCount++;
+    } while (layout.GetTilesAcross(layout.m_LevelCount - 1) > 1 && layout.m_LevelCount < Skybox::MAX_LEVELS);
+    layout.m_LevelPages[layout.m_LevelCount] = pages;
+
+    if (cube.GetLevelCount() < layout.m_LevelCount) {
+        std::cerr << "Sky tiles need the mip chain of the cube, convert it to .bhsky first" << std::endl;
+        return false;
+    }
+
+    int stride = layout.GetTileStride();
+    size_t texelSize = Skybox::TexelSize(format);
+    size_t tileBytes = ((size_t)stride * stride * texelSize + 15) / 16 * 16;
+
+    TileFileHeader header = {};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = TILES_VERSION;
+    header.format = (uint32_t)format;
+    header.faceSize = (uint32_t)layout.m_FaceSize;
+    header.tileSize = (uint32_t)tileSize;
+    header.levelCount = (uint32_t)layout.m_LevelCount;
+    header.pageCount = (uint32_t)pages;
+    header.dataOffset = (sizeof(header) + 15) / 16 * 16;
+
+    std::ofstream file(path, std::ios::binary);
+    file.write((const char*)&header, sizeof(header));
+    file.seekp((std::streamoff)header.dataOffset);
+
+    // Pages are cut in batches spread over every core and written in order,
+    // so only a batch is ever held
+    int threadCount = std::max((int)std::thread::hardware_concurrency(), 1);
+    int batch = 64 * threadCount;
+    std::vector<unsigned char> buffer((size_t)batch * tileBytes);
+    for (int first = 0; first < pages && file; first += batch) {
+        int count = std::min(batch, pages - first);
+        std::fill(buffer.begin(), buffer.end(), (unsigned char)0);
+
+        std::atomic<int> next{0};
+        auto cutPages = [&] {
+            for (int i = next++; i < count; i = next++) {
+                int level, face, tileX, tileY;
+                layout.PageLocation(first + i, level, face, tileX, tileY);
+                unsigned char* out = &buffer[(size_t)i * tileBytes];
+                for (int y = 0; y < stride; y++)
+                    for (int x = 0; x < stride; x++) {
+                        glm::vec3 color = cube.CubeTexel(level, face, tileX * tileSize + x - BORDER,
+                                                         tileY * tileSize + y - BORDER);
+                        Skybox::EncodeTexel(color, format, out + ((size_t)y * stride + x) * texelSize);
+                    }
+            }
+        };
+        std::vector<std::thread> threads;
+        for (int i = 1; i < threadCount; i++)
+            threads.emplace_back(cutPages);
+        cutPages();
+        for (std::thread& thread : threads)
+            thread.join();
+
+        file.write((const char*)buffer.data(), (std::streamsize)((size_t)count * tileBytes));
+    }
+
+    if (!file) {
+        std::cerr << "Failed to write sky tiles: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool SkyTiles::Open(const std::string& path, std::shared_ptr<const unsigned char> mapping, size_t size) {
+    TileFileHeader header;
+    bool valid = size >= sizeof(header);
+    if (valid) {
+        std::memcpy(&header, mapping.get(), sizeof(header));
+        valid = header.version == TILES_VERSION && header.format <= (uint32_t)SkyFormat::RGB16F
+                && header.faceSize > 0 && header.faceSize <= (1u << 20)
+                && header.tileSize > 0 && header.tileSize <= 4096
+                && header.levelCount > 0 && header.levelCount <= (uint32_t)Skybox::MAX_LEVELS
+                && header.dataOffset % 16 == 0 && header.dataOffset <= size;
+    }
+
+    if (valid) {
+        m_Format = (SkyFormat)header.format;
+        m_FaceSize = (int)header.faceSize;
+        m_TileSize = (int)header.tileSize;
+        m_LevelCount = (int)header.levelCount;
+        int stride = GetTileStride();
+        m_TileBytes = ((size_t)stride * stride * Skybox::TexelSize(m_Format) + 15) / 16 * 16;
+
+        int pages = 0;
+        for (int level = 0; level < m_LevelCount; level++) {
+            m_LevelPages[level] = pages;
+            int tiles = GetTilesAcross(level);
+            pages += Skybox::CUBE_FACES * tiles * tiles;
+        }
+        m_LevelPages[m_LevelCount] = pages;
+        valid = (uint32_t)pages == header.pageCount && GetTilesAcross(m_LevelCount - 1) == 1
+                && (uint64_t)pages * m_TileBytes <= size - header.dataOffset;
+    }
+    if (!valid) {
+        std::cerr << "Corrupt skybox file: " << path << std::endl;
+        return false;
+    }
+
+    m_Tiles = mapping.get() + header.dataOffset;
+    m_Mapping = std::move(mapping);
+    return true;
+}
+
+int SkyTiles::Page(int level, int face, int tileX, int tileY) const {
+    int tiles = GetTilesAcross(level);
+    return m_LevelPages[level] + (face * tiles + tileY) * tiles + tileX;
+}
+
+int SkyTiles::TexelPage(int level, int face, int x, int y) const {
+    int last = GetTilesAcross(level) - 1;
+    return Page(level, face, std::clamp(FloorDiv(x, m_TileSize), 0, last), std::clamp(FloorDiv(y, m_TileSize), 0, last));
+}
+
+void SkyTiles::PageLocation(int page, int& level, int& face, int& tileX, int& tileY) const {
+    level = 0;
+    while (level + 1 < m_LevelCount && page >= m_LevelPages[level + 1])
+        level++;
+    int tiles = GetTilesAcross(level);
+    int index = page - m_LevelPages[level];
+    face = index / (tiles * tiles);
+    index %= tiles * tiles;
+    tileY = index / tiles;
+    tileX = index % tiles;
+}
+
+int SkyTiles::ParentPage(int page) const {
+    int level, face, tileX, tileY;
+    PageLocation(page, level, face, tileX, tileY);
+    return level + 1 < m_LevelCount ? Page(level + 1, face, tileX / 2, tileY / 2) : -1;
+}
+
+const unsigned char* SkyTiles::GetTileData(int page) const {
+    return m_Tiles + (size_t)page * m_TileBytes;
+}
+
+size_t SkyTiles::GetCacheBytes() const {
+    std::shared_lock<std::shared_mutex> lock(m_CacheMutex);
+    return m_Cache.size() * (size_t)GetTileStride() * GetTileStride() * sizeof(glm::vec3);
+}
+
+std::shared_ptr<const SkyTiles::CachedTile> SkyTiles::Decoded(int page) const {
+    {
+        std::shared_lock<std::shared_mutex> lock(m_CacheMutex);
+        auto found = m_Cache.find(page);
+        if (found != m_Cache.end()) {
+            // Stamped with the last miss, only written when that moved on
+            long long now = m_Clock.load(std::memory_order_relaxed);
+            if (found->second->lastUse.load(std::memory_order_relaxed) != now)
+                found->second->lastUse.store(now, std::memory_order_relaxed);
+            return found->second;
+        }
+    }
+
+    // Decoded outside the lock, two threads missing the same tile both
+    // decode it and the second copy is dropped
+    int stride = GetTileStride();
+    auto tile = std::make_shared<CachedTile>();
+    tile->texels.resize((size_t)stride * stride);
+    const unsigned char* data = GetTileData(page);
+    for (size_t i = 0; i < tile->texels.size(); i++)
+        tile->texels[i] = Skybox::DecodeTexel(data, i, m_Format);
+    m_Misses++;
+
+    std::unique_lock<std::shared_mutex> lock(m_CacheMutex);
+    auto inserted = m_Cache.emplace(page, tile);
+    if (!inserted.second)
+        return inserted.first->second;
+    tile->lastUse = ++m_Clock;
+
+    // Whoever still holds an evicted tile keeps it until they are done
+    size_t tileBytes = tile->texels.size() * sizeof(glm::vec3);
+    while (m_Cache.size() > 1 && m_Cache.size() * tileBytes > m_CacheLimit) {
+        auto oldest = m_Cache.end();
+        for (auto it = m_Cache.begin(); it != m_Cache.end(); ++it)
+            if (it->first != page && (oldest == m_Cache.end() || it->second->lastUse < oldest->second->lastUse))
+                oldest = it;
+        m_Cache.erase(oldest);
+    }
+    return tile;
+}
+
+glm::vec3 SkyTiles::Texel(int level, int face, int x, int y) const {
+    std::shared_ptr<const CachedTile> tile = Decoded(Page(level, face, x / m_TileSize, y / m_TileSize));
+    int lx = x % m_TileSize + BORDER, ly = y % m_TileSize + BORDER;
+    return tile->texels[(size_t)ly * GetTileStride() + lx];
+}
+
+glm::vec3 SkyTiles::Sample(const glm::vec3& direction, int level) const {
+    if (!m_Mapping)
+        return glm::vec3(0.0f);
+
+    float s, t;
+    int face = Skybox::CubeFace(direction, s, t);
+    int size = GetLevelSize(level);
+    float fx = s * size - 0.5f;
+    float fy = t * size - 0.5f;
+    int x0 = (int)std::floor(fx);
+    int y0 = (int)std::floor(fy);
+    float tx = fx - x0;
+    float ty = fy - y0;
+
+    // The four texels are always in one tile, its border covers the one
+    // past the edge
+    int last = GetTilesAcross(level) - 1;
+    int tileX = std::clamp(FloorDiv(x0, m_TileSize), 0, last);
+    int tileY = std::clamp(FloorDiv(y0, m_TileSize), 0, last);
+    std::shared_ptr<const CachedTile> tile = Decoded(Page(level, face, tileX, tileY));
+
+    int stride = GetTileStride();
+    int lx = x0 - tileX * m_TileSize + BORDER, ly = y0 - tileY * m_TileSize + BORDER;
+    const glm::vec3* bottomRow = &tile->texels[(size_t)ly * stride + lx];
+    const glm::vec3* topRow = bottomRow + stride;
+    glm::vec3 bottom = glm::mix(bottomRow[0], bottomRow[1], tx);
+    glm::vec3 top = glm::mix(topRow[0], topRow[1], tx);
+    return glm::mix(bottom, top, ty);
+}
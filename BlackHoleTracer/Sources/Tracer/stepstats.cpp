@@ -0,0 +1,144 @@
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+#include "stepstats.h"
+#include "physics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+// Everything written through stb is bottom row first, like glReadPixels.
+// stb keeps the flip in a global that writers on other threads read, so it
+// is set once here, before main, and never again.
+[[maybe_unused]] static const bool s_FlipOnWrite = (stbi_flip_vertically_on_write(1), true);
+
+void StepBuffer::Resize(int w, int h) {
+    width = w;
+    height = h;
+    size_t size = (size_t)w * h;
+    steps.assign(size, 0);
+    accelEvals.assign(size, 0);
+    termination.assign(size, RayTermination::Exhausted);
+}
+
+void StepBuffer::Set(int x, int y, const RayResult& ray) {
+    size_t i = (size_t)y * width + x;
+    steps[i] = ray.steps;
+    accelEvals[i] = ray.accelEvals;
+    termination[i] = ray.termination;
+}
+
+namespace StepStats {
+    static int Percentile(std::vector<int> values, float fraction) {
+        if (values.empty())
+            return 0;
+        size_t n = std::min((size_t)(fraction * values.size()), values.size() - 1);
+        std::nth_element(values.begin(), values.begin() + n, values.end());
+        return values[n];
+    }
+
+    StepSummary Summarize(const StepBuffer& buffer) {
+        StepSummary summary;
+        summary.pixels = (int)buffer.Size();
+        if (summary.pixels == 0)
+            return summary;
+
+        double stepSum = 0.0, evalSum = 0.0;
+        for (size_t i = 0; i < buffer.Size(); i++) {
+            stepSum += buffer.steps[i];
+            evalSum += buffer.accelEvals[i];
+            summary.maxSteps = std::max(summary.maxSteps, buffer.steps[i]);
+            summary.terminationCounts[(int)buffer.termination[i]]++;
+        }
+
+        summary.meanSteps = (float)(stepSum / summary.pixels);
+        summary.meanAccelEvals = (float)(evalSum / summary.pixels);
+        summary.p99Steps = Percentile(buffer.steps, 0.99f);
+        summary.p99AccelEvals = Percentile(buffer.accelEvals, 0.99f);
+        summary.exhaustedPercent = 100.0f * summary.terminationCounts[(int)RayTermination::Exhausted] / summary.pixels;
+        return summary;
+    }
+
+    // Dark blue through green to red, t in [0, 1]
+    static glm::vec3 Ramp(float t) {
+        static const glm::vec3 stops[] = {
+            glm::vec3(0.0f, 0.0f, 0.2f), glm::vec3(0.0f, 0.4f, 1.0f), glm::vec3(0.0f, 0.9f, 0.3f),
+            glm::vec3(1.0f, 0.9f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f)
+        };
+        float x = glm::clamp(t, 0.0f, 1.0f) * 4.0f;
+        int i = std::min((int)x, 3);
+        return glm::mix(stops[i], stops[i + 1], x - i);
+    }
+
+    static glm::vec3 TerminationColor(RayTermination termination) {
+        switch (termination) {
+            case RayTermination::Captured: return glm::vec3(0.15f);
+            case RayTermination::Escaped: return glm::vec3(0.2f, 0.45f, 1.0f);
+            case RayTermination::Opaque: return glm::vec3(1.0f, 0.6f, 0.15f);
+            case RayTermination::Exhausted: return glm::vec3(1.0f, 0.0f, 1.0f);
+        }
+        return glm::vec3(0.0f);
+    }
+
+    void Heatmap(const StepBuffer& buffer, HeatmapMode mode, float opacity, std::vector<uint8_t>& rgba) {
+        rgba.resize(buffer.Size() * 4);
+
+        float maxValue = (float)(mode == HeatmapMode::AccelEvals ? Physics::MAX_STEPS * 7 : Physics::MAX_STEPS);
+        float logScale = 1.0f / std::log1p(maxValue);
+        uint8_t alpha = (uint8_t)(glm::clamp(opacity, 0.0f, 1.0f) * 255.0f);
+
+        for (size_t i = 0; i < buffer.Size(); i++) {
+            glm::vec3 color;
+            if (mode == HeatmapMode::Termination) {
+                color = TerminationColor(buffer.termination[i]);
+            } else {
+                int value = mode == HeatmapMode::Steps ? buffer.steps[i] : buffer.accelEvals[i];
+                color = Ramp(std::log1p((float)value) * logScale);
+            }
+
+            uint8_t* out = &rgba[i * 4];
+            out[0] = (uint8_t)(color.x * 255.0f);
+            out[1] = (uint8_t)(color.y * 255.0f);
+            out[2] = (uint8_t)(color.z * 255.0f);
+            out[3] = alpha;
+        }
+    }
+
+    const char* TerminationName(RayTermination termination) {
+        switch (termination) {
+            case RayTermination::Captured: return "captured";
+            case RayTermination::Escaped: return "escaped";
+            case RayTermination::Opaque: return "opaque";
+            case RayTermination::Exhausted: return "exhausted";
+        }
+        return "unknown";
+    }
+
+    bool Export(const StepBuffer& buffer, const std::string& path) {
+        std::vector<uint8_t> rgba;
+
+        Heatmap(buffer, HeatmapMode::Steps, 1.0f, rgba);
+        bool ok = stbi_write_png((path + "-steps.png").c_str(), buffer.width, buffer.height, 4, rgba.data(), buffer.width * 4) != 0;
+
+        Heatmap(buffer, HeatmapMode::Termination, 1.0f, rgba);
+        ok &= stbi_write_png((path + "-termination.png").c_str(), buffer.width, buffer.height, 4, rgba.data(), buffer.width * 4) != 0;
+
+        StepSummary summary = Summarize(buffer);
+        std::ofstream file(path + "-stats.txt");
+        file << "pixels " << summary.pixels << " (" << buffer.width << "x" << buffer.height << ")\n";
+        file << "steps mean " << summary.meanSteps << " p99 " << summary.p99Steps << " max " << summary.maxSteps << "\n";
+        file << "accel evals mean " << summary.meanAccelEvals << " p99 " << summary.p99AccelEvals << "\n";
+        file << "hit MAX_STEPS " << summary.exhaustedPercent << "%\n";
+        for (int t = 0; t < 4; t++) {
+            float percent = summary.pixels > 0 ? 100.0f * summary.terminationCounts[t] / summary.pixels : 0.0f;
+            file << TerminationName((RayTermination)t) << " " << summary.terminationCounts[t] << " (" << percent << "%)\n";
+        }
+        ok &= file.good();
+
+        if (ok)
+            std::cout << "Saved step stats to: " << path << "-*" << std::endl;
+        else
+            std::cerr << "Failed to save step stats: " << path << std::endl;
+        return ok;
+    }
+}
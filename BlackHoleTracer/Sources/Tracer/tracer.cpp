@@ -0,0 +1,440 @@
+#include "tracer.h"
+#include "physics.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+Tracer::Tracer(int width, int height)
+    : m_Width(width), m_Height(height) {
+    SetThreadCount(0);
+}
+
+void Tracer::SetThreadCount(int threads) {
+    if (threads <= 0)
+        threads = (int)std::thread::hardware_concurrency();
+    m_ThreadCount = std::max(threads, 1);
+    m_Scheduler = std::make_unique<TileScheduler>(m_ThreadCount);
+}
+
+glm::vec3 Tracer::ShadeRay(const SceneParams& scene, const Skybox& skybox, const RayResult& ray) const {
+    // The shader returns the disk light without tone mapping on capture
+    if (ray.termination == RayTermination::Captured)
+        return ray.accumulatedColor;
+
+    glm::vec3 pixelColor = glm::vec3(1.0f, 0.0f, 0.0f);
+    if (ray.termination == RayTermination::Escaped) {
+        // The level the shader gets in u_skyLevel
+        int level = skybox.LevelForPixelAngle(2.0f * std::tan(scene.fov * 0.5f) / m_Height);
+        pixelColor = skybox.Sample(glm::normalize(ray.vel), level);
+
+        float redshift = std::sqrt(1.0f - scene.bhRadius / ray.bhDist);
+        pixelColor /= std::max(redshift, 0.01f);
+    }
+
+    pixelColor = glm::mix(pixelColor, ray.accumulatedColor, 1.0f - ray.transmission);
+    pixelColor = pixelColor / (pixelColor + glm::vec3(1.0f));
+    pixelColor = glm::pow(pixelColor, glm::vec3(1.0f / 2.2f));
+
+    return pixelColor;
+}
+
+glm::vec3 Tracer::TracePixel(const SceneParams& scene, const Skybox& skybox, const glm::vec2& texCoord) const {
+    glm::vec3 vel = Physics::PrimaryRayDirection(scene, texCoord) * Constants::c;
+    return ShadeRay(scene, skybox, Physics::MarchRay(scene, scene.camPos, vel));
+}
+
+static void CountRay(TraceStats& stats, const RayResult& ray) {
+    stats.rays++;
+    if (ray.skippedSteps > 0) {
+        if (ray.termination == RayTermination::Captured)
+            stats.analyticCaptures++;
+        else
+            stats.analyticEscapes++;
+        stats.skippedSteps += ray.skippedSteps;
+    }
+}
+
+FarFieldReport Tracer::MeasureFarField(const SceneParams& scene, int stride) const {
+    SceneParams fast = scene;
+    fast.flags = (scene.flags | SceneFlags::FAR_FIELD) & ~SceneFlags::WEAK_FIELD;
+
+    // The reference marches to just short of ESCAPE_RADIUS and only then
+    // completes, so both sides point at infinity and the difference is the
+    // error of starting the completion early
+    SceneParams reference = fast;
+    reference.farFieldRadius = 0.99f * Physics::ESCAPE_RADIUS;
+
+    FarFieldReport report;
+    double errorSum = 0.0, skippedSum = 0.0;
+    stride = std::max(stride, 1);
+
+    for (int y = 0; y < m_Height; y += stride) {
+        for (int x = 0; x < m_Width; x += stride) {
+            glm::vec2 texCoord((x + 0.5f) / m_Width, (y + 0.5f) / m_Height);
+            glm::vec3 vel = Physics::PrimaryRayDirection(scene, texCoord) * Constants::c;
+
+            RayResult completed = Physics::MarchRay(fast, scene.camPos, vel);
+            if (completed.termination != RayTermination::Escaped || completed.skippedSteps == 0)
+                continue;
+
+            RayResult marched = Physics::MarchRay(reference, scene.camPos, vel);
+            if (marched.termination != RayTermination::Escaped)
+                continue;
+
+            // atan2 keeps precision for small angles where acos does not
+            glm::vec3 a = glm::normalize(completed.vel);
+            glm::vec3 b = glm::normalize(marched.vel);
+            float error = std::atan2(glm::length(glm::cross(a, b)), glm::dot(a, b));
+
+            report.rays++;
+            report.maxError = std::max(report.maxError, error);
+            errorSum += error;
+            skippedSum += completed.skippedSteps;
+        }
+    }
+
+    if (report.rays > 0) {
+        report.meanError = (float)(errorSum / report.rays);
+        report.meanSkippedSteps = (float)(skippedSum / report.rays);
+    }
+    return report;
+}
+
+void Tracer::RenderTile(const SceneParams& scene, const Skybox& skybox, float* pixels,
+                        int x0, int y0, int x1, int y1, int stride, bool reuse,
+                        TraceStats* stats, StepBuffer* steps, LensMap* lens) const {
+    // Only every stride-th pixel is traced, and with reuse the ones the
+    // previous pass (twice the stride) already has are skipped
+    int xStart = (x0 + stride - 1) / stride * stride;
+    int yStart = (y0 + stride - 1) / stride * stride;
+    auto reused = [&](int x, int y) {
+        return reuse && x % (2 * stride) == 0 && y % (2 * stride) == 0;
+    };
+
+    if (scene.UseDeflectionTable()) {
+        for (int y = yStart; y < y1; y += stride) {
+            for (int x = xStart; x < x1; x += stride) {
+                if (reused(x, y))
+                    continue;
+
+                glm::vec2 texCoord((x + 0.5f) / m_Width, (y + 0.5f) / m_Height);
+                glm::vec3 rayDir = Physics::PrimaryRayDirection(scene, texCoord);
+
+                RayResult ray;
+                glm::vec3 escapeDir;
+                if (m_DeflectionTable.Lookup(scene, rayDir, escapeDir)) {
+                    ray.termination = RayTermination::Escaped;
+                    ray.vel = escapeDir * Constants::c;
+                    ray.bhDist = Physics::ESCAPE_RADIUS;
+                } else {
+                    ray.termination = RayTermination::Captured;
+                }
+                CountRay(*stats, ray);
+                if (steps)
+                    steps->Set(x, y, ray);
+                if (lens)
+                    lens->Set(x, y, scene, ray);
+                glm::vec3 color = ShadeRay(scene, skybox, ray);
+
+                float* out = pixels + ((size_t)y * m_Width + x) * 3;
+                out[0] = color.x;
+                out[1] = color.y;
+                out[2] = color.z;
+            }
+        }
+        return;
+    }
+
+    int packetWidth = Packet::Width(m_PacketKernel);
+    bool weakField = scene.WeakField();
+    RayPacket packet;
+    int laneX[MAX_PACKET_WIDTH];
+
+    auto writePixel = [&](int x, int y, const RayResult& ray) {
+        CountRay(*stats, ray);
+        if (steps)
+            steps->Set(x, y, ray);
+        if (lens)
+            lens->Set(x, y, scene, ray);
+        glm::vec3 color = ShadeRay(scene, skybox, ray);
+
+        float* out = pixels + ((size_t)y * m_Width + x) * 3;
+        out[0] = color.x;
+        out[1] = color.y;
+        out[2] = color.z;
+    };
+
+    auto marchPacket = [&](int y) {
+        Packet::March(m_PacketKernel, scene, packet);
+        for (int lane = 0; lane < packet.count; lane++)
+            writePixel(laneX[lane], y, packet.GetResult(lane));
+        packet.count = 0;
+    };
+
+    for (int y = yStart; y < y1; y += stride) {
+        packet.count = 0;
+        for (int x = xStart; x < x1; x += stride) {
+            if (reused(x, y))
+                continue;
+
+            // Fragment centers, as interpolated across the screen quad
+            glm::vec2 texCoord((x + 0.5f) / m_Width, (y + 0.5f) / m_Height);
+            glm::vec3 vel = Physics::PrimaryRayDirection(scene, texCoord) * Constants::c;
+
+            // Rays far from the hole never join a packet, so the packets
+            // stay full of rays that need the march
+            RayResult ray;
+            if (weakField && Physics::TryWeakField(scene, scene.camPos, vel, ray)) {
+                writePixel(x, y, ray);
+                continue;
+            }
+
+            laneX[packet.count] = x;
+            packet.SetRay(packet.count, scene.camPos, vel);
+            if (++packet.count == packetWidth)
+                marchPacket(y);
+        }
+        if (packet.count > 0)
+            marchPacket(y);
+    }
+}
+
+void Tracer::Render(const SceneParams& scene, const Skybox& skybox, std::vector<float>& pixels) {
+    if (CanReuseLensMap(scene))
+        ResampleLensMap(scene, skybox, pixels);
+    else
+        RenderPass(scene, skybox, pixels, 1, false);
+    m_ProgressiveStride = 1;
+    m_ProgressiveScene = scene;
+}
+
+bool Tracer::RenderProgressive(const SceneParams& scene, const Skybox& skybox, std::vector<float>& pixels,
+                               bool interacting) {
+    // Orbiting is as cheap as the finest pass, nothing to refine
+    if (CanReuseLensMap(scene)) {
+        ResampleLensMap(scene, skybox, pixels);
+        m_ProgressiveStride = 1;
+        m_ProgressiveScene = scene;
+        return true;
+    }
+
+    if (interacting || m_ProgressiveStride == 0 || scene != m_ProgressiveScene
+        || pixels.size() != (size_t)m_Width * m_Height * 3) {
+        m_ProgressiveStride = m_CoarseStride;
+        m_ProgressiveScene = scene;
+        RenderPass(scene, skybox, pixels, m_ProgressiveStride, false);
+    } else if (m_ProgressiveStride > 1) {
+        m_ProgressiveStride /= 2;
+        RenderPass(scene, skybox, pixels, m_ProgressiveStride, true);
+    }
+    return m_ProgressiveStride == 1;
+}
+
+void Tracer::SetCoarseStride(int stride) {
+    // Powers of two so every pass lands on the previous pass's samples
+    int power = 1;
+    while (power * 2 <= stride)
+        power *= 2;
+    m_CoarseStride = power;
+    m_ProgressiveStride = 0;
+}
+
+void Tracer::RenderLogPolar(const SceneParams& scene, const Skybox& skybox, std::vector<float>& pixels,
+                            float quality) {
+    if (scene.UseDeflectionTable() && !m_DeflectionTable.IsBuiltFor(scene))
+        m_DeflectionTable.Build(scene);
+
+    m_LogPolarGrid = LogPolarGrid::Build(scene, m_Width, m_Height, quality);
+    m_LogPolarSamples.assign((size_t)m_LogPolarGrid.Count() * 3, 0.0f);
+
+    // One job per ring
+    std::vector<ThreadStats> threadStats(m_Scheduler->GetThreadCount());
+    m_Scheduler->Run(m_LogPolarGrid.radial, [&](int j, int thread) {
+        TraceLogPolarRow(scene, skybox, j, &threadStats[thread].stats);
+    });
+
+    m_Stats = TraceStats();
+    for (const ThreadStats& thread : threadStats)
+        m_Stats.Add(thread.stats);
+    m_TileTimings.clear();
+
+    LogPolar::Resample(m_LogPolarGrid, m_LogPolarSamples, m_Width, m_Height, pixels);
+}
+
+void Tracer::TraceLogPolarRow(const SceneParams& scene, const Skybox& skybox, int j, TraceStats* stats) {
+    const LogPolarGrid& grid = m_LogPolarGrid;
+    glm::vec2 size((float)m_Width, (float)m_Height);
+
+    // Samples off screen stay black
+    std::vector<int> indices;
+    std::vector<glm::vec2> texCoords;
+    for (int i = 0; i < grid.angular; i++) {
+        glm::vec2 position = grid.SamplePosition(i, j);
+        if (!grid.IsVisible(position, m_Width, m_Height))
+            continue;
+        indices.push_back(i);
+        texCoords.push_back(position / size);
+    }
+
+    std::vector<RayResult> rays(texCoords.size());
+    TraceRays(scene, texCoords.data(), (int)texCoords.size(), rays.data(), stats);
+
+    for (size_t k = 0; k < rays.size(); k++) {
+        glm::vec3 color = ShadeRay(scene, skybox, rays[k]);
+
+        float* out = &m_LogPolarSamples[((size_t)j * grid.angular + indices[k]) * 3];
+        out[0] = color.x;
+        out[1] = color.y;
+        out[2] = color.z;
+    }
+}
+
+void Tracer::TraceRays(const SceneParams& scene, const glm::vec2* texCoords, int count, RayResult* results,
+                       TraceStats* stats) const {
+    int packetWidth = Packet::Width(m_PacketKernel);
+    RayPacket packet;
+    int laneIndex[MAX_PACKET_WIDTH];
+
+    auto marchPacket = [&]() {
+        Packet::March(m_PacketKernel, scene, packet);
+        for (int lane = 0; lane < packet.count; lane++)
+            results[laneIndex[lane]] = packet.GetResult(lane);
+        packet.count = 0;
+    };
+
+    for (int k = 0; k < count; k++) {
+        glm::vec3 rayDir = Physics::PrimaryRayDirection(scene, texCoords[k]);
+        RayResult& ray = results[k];
+        ray = RayResult();
+
+        if (scene.UseDeflectionTable()) {
+            glm::vec3 escapeDir;
+            if (m_DeflectionTable.Lookup(scene, rayDir, escapeDir)) {
+                ray.termination = RayTermination::Escaped;
+                ray.vel = escapeDir * Constants::c;
+                ray.bhDist = Physics::ESCAPE_RADIUS;
+            } else {
+                ray.termination = RayTermination::Captured;
+            }
+            continue;
+        }
+
+        glm::vec3 vel = rayDir * Constants::c;
+        if (scene.WeakField() && Physics::TryWeakField(scene, scene.camPos, vel, ray))
+            continue;
+
+        laneIndex[packet.count] = k;
+        packet.SetRay(packet.count, scene.camPos, vel);
+        if (++packet.count == packetWidth)
+            marchPacket();
+    }
+    if (packet.count > 0)
+        marchPacket();
+
+    for (int k = 0; k < count; k++)
+        CountRay(*stats, results[k]);
+}
+
+void Tracer::SetLensCache(bool enabled) {
+    if (enabled == m_LensCache)
+        return;
+
+    // A progressive frame already under way has pixels the map never saw
+    m_LensCache = enabled;
+    m_LensMap = LensMap();
+    m_ProgressiveStride = 0;
+}
+
+bool Tracer::CanReuseLensMap(const SceneParams& scene) const {
+    return m_LensCache && !m_RecordSteps && m_LensMap.GetWidth() == m_Width
+        && m_LensMap.GetHeight() == m_Height && m_LensMap.CanReuse(scene);
+}
+
+void Tracer::ResampleLensMap(const SceneParams& scene, const Skybox& skybox, std::vector<float>& pixels) {
+    pixels.resize((size_t)m_Width * m_Height * 3);
+
+    m_Scheduler->Run(m_Height, [&](int y, int) {
+        for (int x = 0; x < m_Width; x++) {
+            glm::vec3 color = ShadeRay(scene, skybox, m_LensMap.Get(x, y, scene));
+
+            float* out = &pixels[((size_t)y * m_Width + x) * 3];
+            out[0] = color.x;
+            out[1] = color.y;
+            out[2] = color.z;
+        }
+    });
+
+    m_Stats = TraceStats();
+    m_Stats.lensSamples = (long long)m_Width * m_Height;
+    m_TileTimings.clear();
+}
+
+void Tracer::RenderPass(const SceneParams& scene, const Skybox& skybox, std::vector<float>& pixels,
+                        int stride, bool reuse) {
+    pixels.resize((size_t)m_Width * m_Height * 3);
+
+    if (scene.UseDeflectionTable() && !m_DeflectionTable.IsBuiltFor(scene))
+        m_DeflectionTable.Build(scene);
+
+    StepBuffer* steps = nullptr;
+    if (m_RecordSteps) {
+        if (!reuse || m_StepBuffer.Size() != (size_t)m_Width * m_Height)
+            m_StepBuffer.Resize(m_Width, m_Height);
+        steps = &m_StepBuffer;
+    }
+
+    // Filled along the way, it only counts once every pixel has been traced
+    LensMap* lens = nullptr;
+    if (m_LensCache) {
+        if (!reuse || m_LensMap.GetWidth() != m_Width || m_LensMap.GetHeight() != m_Height)
+            m_LensMap.Reset(m_Width, m_Height);
+        m_LensMap.Invalidate();
+        lens = &m_LensMap;
+    }
+
+    int tilesX = (m_Width + m_TileSize - 1) / m_TileSize;
+    int tilesY = (m_Height + m_TileSize - 1) / m_TileSize;
+    m_TileTimings.resize((size_t)tilesX * tilesY);
+
+    std::vector<ThreadStats> threadStats(m_Scheduler->GetThreadCount());
+    m_Scheduler->Run((int)m_TileTimings.size(), [&](int tile, int thread) {
+        auto start = std::chrono::steady_clock::now();
+
+        TileTiming& timing = m_TileTimings[tile];
+        timing.x0 = (tile % tilesX) * m_TileSize;
+        timing.y0 = (tile / tilesX) * m_TileSize;
+        timing.x1 = std::min(timing.x0 + m_TileSize, m_Width);
+        timing.y1 = std::min(timing.y0 + m_TileSize, m_Height);
+        RenderTile(scene, skybox, pixels.data(), timing.x0, timing.y0, timing.x1, timing.y1,
+                   stride, reuse, &threadStats[thread].stats, steps, lens);
+
+        timing.thread = thread;
+        timing.milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    });
+
+    m_Stats = TraceStats();
+    for (const ThreadStats& thread : threadStats)
+        m_Stats.Add(thread.stats);
+    if (lens && stride == 1)
+        m_LensMap.Finish(scene);
+
+    // Every traced sample covers its stride x stride block until a finer
+    // pass replaces the rest, the same nearest upscale Display uses
+    if (stride > 1) {
+        for (int y = 0; y < m_Height; y++) {
+            int sampleY = y / stride * stride;
+            for (int x = 0; x < m_Width; x++) {
+                int sampleX = x / stride * stride;
+                if (sampleX == x && sampleY == y)
+                    continue;
+                const float* sample = &pixels[((size_t)sampleY * m_Width + sampleX) * 3];
+                float* out = &pixels[((size_t)y * m_Width + x) * 3];
+                out[0] = sample[0];
+                out[1] = sample[1];
+                out[2] = sample[2];
+            }
+        }
+    }
+}
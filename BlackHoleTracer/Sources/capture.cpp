@@ -0,0 +1,158 @@
+#include "capture.h"
+#include "stb_image_write.h"
+
+#include <algorithm>
+#include <cstring>
+
+FrameCapture::FrameCapture(int width, int height, int ringSize, int workerCount, int queueLimit)
+    : m_Width(width), m_Height(height), m_QueueLimit((size_t)std::max(queueLimit, 1)) {
+    m_Slots.resize(std::max(ringSize, 1));
+    for (Slot& slot : m_Slots) {
+        glGenBuffers(1, &slot.pbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 3, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    for (int i = 0; i < std::max(workerCount, 1); i++)
+        m_Workers.emplace_back(&FrameCapture::WorkerLoop, this);
+}
+
+FrameCapture::~FrameCapture() {
+    Flush();
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Quit = true;
+    }
+    m_Wake.notify_all();
+    for (std::thread& worker : m_Workers)
+        worker.join();
+
+    for (Slot& slot : m_Slots)
+        glDeleteBuffers(1, &slot.pbo);
+}
+
+bool FrameCapture::Capture(const std::string& path) {
+    Poll();
+    m_Captured++;
+    if (m_Blocking && m_InFlight == (int)m_Slots.size())
+        Retire(true);
+    if (m_InFlight == (int)m_Slots.size()) {
+        m_Dropped++;
+        return false;
+    }
+
+    Slot& slot = m_Slots[(m_Head + m_InFlight) % m_Slots.size()];
+    slot.path = path;
+
+    // Rows of GL_RGB are not 4-byte aligned for every width
+    GLint alignment = 4;
+    glGetIntegerv(GL_PACK_ALIGNMENT, &alignment);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+    glReadPixels(0, 0, m_Width, m_Height, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, alignment);
+
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    m_InFlight++;
+    return true;
+}
+
+void FrameCapture::Poll() {
+    while (m_InFlight > 0 && Retire(false)) {}
+}
+
+void FrameCapture::Flush() {
+    while (m_InFlight > 0)
+        Retire(true);
+
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    m_Idle.wait(lock, [&] { return m_Queue.empty() && m_Encoding == 0; });
+}
+
+bool FrameCapture::Retire(bool wait) {
+    Slot& slot = m_Slots[m_Head];
+
+    // The fence only goes up once the commands before it reach the GPU,
+    // which the next swap does when not waiting
+    GLbitfield flags = wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0;
+    GLuint64 timeout = wait ? 1000000000ull : 0ull;
+    GLenum status = glClientWaitSync(slot.fence, flags, timeout);
+    while (wait && status == GL_TIMEOUT_EXPIRED)
+        status = glClientWaitSync(slot.fence, 0, timeout);
+    if (status == GL_TIMEOUT_EXPIRED)
+        return false;
+
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+    m_Head = (m_Head + 1) % (int)m_Slots.size();
+    m_InFlight--;
+    if (status == GL_WAIT_FAILED) {
+        m_Dropped++;
+        return true;
+    }
+
+    std::vector<unsigned char> pixels;
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        if (wait || m_Blocking)
+            m_Idle.wait(lock, [&] { return m_Queue.size() < m_QueueLimit; });
+        if (m_Queue.size() >= m_QueueLimit) {
+            m_Dropped++;
+            return true;
+        }
+        if (!m_FreeBuffers.empty()) {
+            pixels.swap(m_FreeBuffers.back());
+            m_FreeBuffers.pop_back();
+        }
+    }
+
+    size_t size = (size_t)m_Width * m_Height * 3;
+    pixels.resize(size);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+    const void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)size, GL_MAP_READ_BIT);
+    bool ok = mapped != nullptr;
+    if (ok)
+        std::memcpy(pixels.data(), mapped, size);
+    ok &= glUnmapBuffer(GL_PIXEL_PACK_BUFFER) == GL_TRUE;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (!ok) {
+        m_Dropped++;
+        m_FreeBuffers.push_back(std::move(pixels));
+        return true;
+    }
+    m_Queue.push_back({ std::move(slot.path), std::move(pixels) });
+    m_Wake.notify_one();
+    return true;
+}
+
+void FrameCapture::WorkerLoop() {
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    while (true) {
+        m_Wake.wait(lock, [&] { return m_Quit || !m_Queue.empty(); });
+        if (m_Queue.empty())
+            return;
+
+        Job job = std::move(m_Queue.front());
+        m_Queue.pop_front();
+        m_Encoding++;
+        m_Idle.notify_all();
+        lock.unlock();
+
+        bool ok = stbi_write_png(job.path.c_str(), m_Width, m_Height, 3, job.pixels.data(), m_Width * 3) != 0;
+        if (ok) {
+            m_Written++;
+        } else {
+            m_Failed++;
+            std::cerr << "Failed to save frame: " << job.path << std::endl;
+        }
+
+        lock.lock();
+        m_FreeBuffers.push_back(std::move(job.pixels));
+        m_Encoding--;
+        m_Idle.notify_all();
+    }
+}
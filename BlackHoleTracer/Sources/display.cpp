@@ -1,63 +1,482 @@
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
-#define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 #include "display.h"
+#include "physics.h"
+#include "skybox.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <vector>
 #include <ctime>
 #include <iomanip>
 #include <sstream>
+#include <utility>
+
+// The app runs from a copy of the shaders, edits happen in the source tree
+static std::string ShaderSourceDirectory() {
+#ifdef PROJECT_SOURCE_DIR
+    return PROJECT_SOURCE_DIR "/BlackHoleTracer/Shaders";
+#else
+    return "";
+#endif
+}
 
 Display::Display(int width, int height, const std::string& skyboxPath) 
     : m_Width(width), m_Height(height) {
     InitializeOpenGL();
+    m_WavefrontSupported = WavefrontTracer::IsSupported();
     CreateShaders();
     CreateQuad();
     LoadSkyboxTexture(skyboxPath);
 }
 
 Display::~Display() {
+    m_Capture.reset();
+    m_SkyStreamer.reset();
+    m_Wavefront.reset();
     if (m_VAO) glDeleteVertexArrays(1, &m_VAO);
     if (m_VBO) glDeleteBuffers(1, &m_VBO);
+    if (m_SceneUBO) glDeleteBuffers(1, &m_SceneUBO);
     if (m_SkyboxTextureID) glDeleteTextures(1, &m_SkyboxTextureID);
+    if (m_DeflectionTextureID) glDeleteTextures(1, &m_DeflectionTextureID);
+    if (m_HeatmapTextureID) glDeleteTextures(1, &m_HeatmapTextureID);
+    DeleteStepTargets();
+    DeleteProgressiveLevels();
+    DeleteLensTargets();
+    DeleteLogPolarTarget();
+    delete m_LogPolarShader;
+    m_ShaderVariants.clear();
+    delete m_UberShader;
 }
 
 void Display::InitializeOpenGL() {
     glGenTextures(1, &m_SkyboxTextureID);
-    glBindTexture(GL_TEXTURE_2D, m_SkyboxTextureID);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, m_SkyboxTextureID);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    // Filters across face edges, as Skybox::Sample does
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+}
+
+void Display::LoadSkyboxTexture(const std::string& path) {
+    // Only lives until the upload, a mapped .bhsky is unmapped again after
+    Skybox skybox;
+    if (!skybox.LoadCube(path))
+        return;
+
+    if (skybox.IsTiled()) {
+        auto start = std::chrono::steady_clock::now();
+        m_SkyStreamer = std::make_unique<SkyStreamer>(skybox.GetTiles(), m_Width, m_Height);
+        ConfigureShader(*m_UberShader);
+
+        const SkyTiles& tiles = *skybox.GetTiles();
+        m_SkyFaceSize = tiles.GetFaceSize();
+        m_SkyLevelCount = tiles.GetLevelCount();
+        double uploadMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::printf("Streaming HDR Skybox: %s (%dx%d faces, %s, %d pages of %d, %d levels, %.0f MB atlas) in %.1f ms + %.1f ms setup\n",
+                    path.c_str(), tiles.GetFaceSize(), tiles.GetFaceSize(), Skybox::FormatName(tiles.GetFormat()),
+                    tiles.GetPageCount(), tiles.GetTileSize(), m_SkyLevelCount,
+                    m_SkyStreamer->GetStats().atlasBytes / 1048576.0, skybox.GetLoadMilliseconds(), uploadMilliseconds);
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    GLenum internalFormat = GL_RGB32F, type = GL_FLOAT;
+    if (skybox.GetFormat() == SkyFormat::RGB9E5) {
+        internalFormat = GL_RGB9_E5;
+        type = GL_UNSIGNED_INT_5_9_9_9_REV;
+    } else if (skybox.GetFormat() == SkyFormat::RGB16F) {
+        internalFormat = GL_RGB16F;
+        type = GL_HALF_FLOAT;
+    }
+
+    // Half float rows are 6 bytes a texel, not always 4 byte aligned
+    GLint alignment = 4;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, m_SkyboxTextureID);
+    for (int i = 0; i < skybox.GetLevelCount(); i++) {
+        const SkyLevel& level = skybox.GetLevel(i);
+        for (int face = 0; face < Skybox::CUBE_FACES; face++)
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, i, internalFormat, level.width, level.height, 0,
+                         GL_RGB, type, skybox.GetFace(i, face));
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, m_Width, m_Height, 0, GL_RGB, GL_FLOAT, nullptr);
+    // The shader picks the level itself with textureLod, see u_skyLevel
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, skybox.GetLevelCount() - 1);
+    m_SkyFaceSize = skybox.GetWidth();
+    m_SkyLevelCount = skybox.GetLevelCount();
 
+    double uploadMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::printf("Loaded HDR Skybox: %s (%dx%d faces, %s, %d levels%s) in %.1f ms + %.1f ms upload\n", path.c_str(),
+                skybox.GetWidth(), skybox.GetHeight(), Skybox::FormatName(skybox.GetFormat()), skybox.GetLevelCount(),
+                skybox.IsMapped() ? ", mapped" : "", skybox.GetLoadMilliseconds(), uploadMilliseconds);
 }
 
-void Display::LoadSkyboxTexture(const std::string& path) {
-    int width, height, nrComponents;
-    stbi_set_flip_vertically_on_load(true); 
-    
-    float* data = stbi_loadf(path.c_str(), &width, &height, &nrComponents, 0);
-    
-    if (data) {
-        glGenTextures(1, &m_SkyboxTextureID);
-        glBindTexture(GL_TEXTURE_2D, m_SkyboxTextureID);
-        
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, width, height, 0, GL_RGB, GL_FLOAT, data);
-        
+void Display::UpdateDeflectionTexture(const SceneParams& scene) {
+    if (m_DeflectionTable.IsBuiltFor(scene))
+        return;
+
+    m_DeflectionTable.Build(scene);
+
+    if (!m_DeflectionTextureID) {
+        glGenTextures(1, &m_DeflectionTextureID);
+        glBindTexture(GL_TEXTURE_1D, m_DeflectionTextureID);
+        glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+
+    glBindTexture(GL_TEXTURE_1D, m_DeflectionTextureID);
+    glTexImage1D(GL_TEXTURE_1D, 0, GL_RG32F, DeflectionTable::SIZE, 0, GL_RG, GL_FLOAT,
+                 m_DeflectionTable.GetEntries().data());
+}
+
+void Display::SetStepStatsEnabled(bool enabled) {
+    if (enabled == m_StepStatsEnabled)
+        return;
+
+    m_StepStatsEnabled = enabled;
+    if (enabled)
+        CreateStepTargets();
+    else
+        DeleteStepTargets();
+}
+
+void Display::CreateStepTargets() {
+    GLint previousFBO = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFBO);
+
+    glGenFramebuffers(1, &m_StepFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_StepFBO);
+
+    glGenTextures(1, &m_StepColorTextureID);
+    glBindTexture(GL_TEXTURE_2D, m_StepColorTextureID);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, m_Width, m_Height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_StepColorTextureID, 0);
+
+    // Counts stay exact in float up to 2^24
+    glGenTextures(1, &m_StepInfoTextureID);
+    glBindTexture(GL_TEXTURE_2D, m_StepInfoTextureID);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, m_Width, m_Height, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, m_StepInfoTextureID, 0);
+
+    GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, drawBuffers);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cerr << "Step stats framebuffer is incomplete" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFBO);
+}
+
+void Display::DeleteStepTargets() {
+    if (m_StepFBO) glDeleteFramebuffers(1, &m_StepFBO);
+    if (m_StepColorTextureID) glDeleteTextures(1, &m_StepColorTextureID);
+    if (m_StepInfoTextureID) glDeleteTextures(1, &m_StepInfoTextureID);
+    m_StepFBO = m_StepColorTextureID = m_StepInfoTextureID = 0;
+}
+
+void Display::ReadStepBuffer() {
+    m_StepReadback.resize((size_t)m_Width * m_Height * 4);
+    glReadBuffer(GL_COLOR_ATTACHMENT1);
+    glReadPixels(0, 0, m_Width, m_Height, GL_RGBA, GL_FLOAT, m_StepReadback.data());
+
+    m_StepBuffer.Resize(m_Width, m_Height);
+    for (size_t i = 0; i < m_StepBuffer.Size(); i++) {
+        const float* info = &m_StepReadback[i * 4];
+        m_StepBuffer.steps[i] = (int)info[0];
+        m_StepBuffer.accelEvals[i] = (int)info[1];
+        m_StepBuffer.termination[i] = (RayTermination)glm::clamp((int)info[2], 0, 3);
+    }
+}
+
+void Display::UpdateHeatmap(HeatmapMode mode, float opacity) {
+    if (!m_StepStatsEnabled || m_StepBuffer.Size() == 0)
+        return;
+
+    std::vector<uint8_t> rgba;
+    StepStats::Heatmap(m_StepBuffer, mode, opacity, rgba);
+
+    if (!m_HeatmapTextureID) {
+        glGenTextures(1, &m_HeatmapTextureID);
+        glBindTexture(GL_TEXTURE_2D, m_HeatmapTextureID);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+    glBindTexture(GL_TEXTURE_2D, m_HeatmapTextureID);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, m_Width, m_Height, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba.data());
+}
+
+void Display::SetProgressive(bool enabled, int coarseStride) {
+    // Powers of two so every pass lands on the previous pass's samples
+    int stride = 1;
+    while (stride * 2 <= coarseStride)
+        stride *= 2;
 
-        stbi_image_free(data);
-        std::cout << "Loaded HDR Skybox: " << path << std::endl;
+    if (enabled == m_Progressive && stride == m_CoarseStride)
+        return;
+
+    m_Progressive = enabled;
+    m_CoarseStride = stride;
+    m_ProgressiveStride = 0;
+    if (!enabled)
+        DeleteProgressiveLevels();
+}
+
+void Display::DeleteProgressiveLevels() {
+    for (ProgressiveLevel& level : m_ProgressiveLevels) {
+        if (level.fbo) glDeleteFramebuffers(1, &level.fbo);
+        if (level.texture) glDeleteTextures(1, &level.texture);
+    }
+    m_ProgressiveLevels.clear();
+}
+
+void Display::DrawProgressive() {
+    GLint targetFBO = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &targetFBO);
+
+    int stride = m_ProgressiveStride;
+    bool trace = true, reuse = false;
+    if (m_Interacting || m_ProgressiveStride == 0 || m_Scene != m_ProgressiveScene) {
+        stride = m_CoarseStride;
+        m_ProgressiveScene = m_Scene;
+    } else if (m_ProgressiveStride > 1) {
+        stride = m_ProgressiveStride / 2;
+        reuse = true;
     } else {
-        std::cerr << "Failed to load HDR image: " << path << std::endl;
-        stbi_image_free(data);
+        // Nothing left to refine, the finished frame is only presented again
+        trace = false;
+    }
+
+    int levelIndex = 0;
+    while ((1 << levelIndex) < stride)
+        levelIndex++;
+    if ((int)m_ProgressiveLevels.size() <= levelIndex)
+        m_ProgressiveLevels.resize(levelIndex + 1);
+
+    ProgressiveLevel& level = m_ProgressiveLevels[levelIndex];
+    if (!level.fbo) {
+        level.width = (m_Width + stride - 1) / stride;
+        level.height = (m_Height + stride - 1) / stride;
+
+        glGenTextures(1, &level.texture);
+        glBindTexture(GL_TEXTURE_2D, level.texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, level.width, level.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        glGenFramebuffers(1, &level.fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, level.fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, level.texture, 0);
+    }
+
+    if (trace) {
+        glBindFramebuffer(GL_FRAMEBUFFER, level.fbo);
+        glViewport(0, 0, level.width, level.height);
+
+        m_ShaderProgram->use();
+        m_ShaderProgram->setInt("u_progressiveStride", stride);
+        m_ShaderProgram->setInt("u_progressiveReuse", reuse ? 1 : 0);
+        m_ShaderProgram->setVec2("u_resolution", glm::vec2((float)m_Width, (float)m_Height));
+
+        BindSceneTextures();
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, reuse ? m_ProgressiveLevels[levelIndex + 1].texture : 0);
+        glActiveTexture(GL_TEXTURE0);
+
+        glBindVertexArray(m_VAO);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+
+        m_ProgressiveStride = stride;
+    }
+
+    // Nearest upscale, each sample covers its stride x stride block
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, level.fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, targetFBO);
+    glViewport(0, 0, m_Width, m_Height);
+    glBlitFramebuffer(0, 0, level.width, level.height, 0, 0, level.width * stride, level.height * stride,
+                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, targetFBO);
+}
+
+void Display::SetLensCache(bool enabled) {
+    if (enabled == m_LensCache)
+        return;
+
+    m_LensCache = enabled;
+    m_LensReused = false;
+    if (!enabled)
+        DeleteLensTargets();
+}
+
+void Display::CreateLensTargets() {
+    GLint previousFBO = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFBO);
+
+    glGenFramebuffers(1, &m_LensFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_LensFBO);
+
+    // Attachments match the output locations in blackhole.frag
+    GLuint* textures[] = { &m_LensColorTextureID, &m_LensDirectionTextureID, &m_LensDiskTextureID };
+    GLenum attachments[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
+    for (int i = 0; i < 3; i++) {
+        glGenTextures(1, textures[i]);
+        glBindTexture(GL_TEXTURE_2D, *textures[i]);
+        if (i == 0)
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, m_Width, m_Height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        else
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, m_Width, m_Height, 0, GL_RGBA, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, attachments[i], GL_TEXTURE_2D, *textures[i], 0);
+    }
+
+    GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_NONE, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
+    glDrawBuffers(4, drawBuffers);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cerr << "Lens map framebuffer is incomplete" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFBO);
+}
+
+void Display::DeleteLensTargets() {
+    if (m_LensFBO) glDeleteFramebuffers(1, &m_LensFBO);
+    if (m_LensColorTextureID) glDeleteTextures(1, &m_LensColorTextureID);
+    if (m_LensDirectionTextureID) glDeleteTextures(1, &m_LensDirectionTextureID);
+    if (m_LensDiskTextureID) glDeleteTextures(1, &m_LensDiskTextureID);
+    m_LensFBO = m_LensColorTextureID = m_LensDirectionTextureID = m_LensDiskTextureID = 0;
+    m_LensValid = false;
+}
+
+void Display::DrawLensCache() {
+    GLint targetFBO = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &targetFBO);
+    if (!m_LensFBO)
+        CreateLensTargets();
+
+    m_ShaderProgram->use();
+    m_ShaderProgram->setInt("u_progressiveStride", 0);
+
+    BindSceneTextures();
+    glBindVertexArray(m_VAO);
+
+    // The lens textures are only bound while they are not render targets
+    m_LensReused = m_LensValid && LensMap::SameGeodesics(m_LensScene, m_Scene);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, m_LensReused ? m_LensDirectionTextureID : 0);
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_2D, m_LensReused ? m_LensDiskTextureID : 0);
+    glActiveTexture(GL_TEXTURE0);
+
+    if (m_LensReused) {
+        // Straight into the caller's target, one sky lookup per pixel
+        m_ShaderProgram->setInt("u_lensMapReuse", 1);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+        m_ShaderProgram->setInt("u_lensMapReuse", 0);
+        return;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, m_LensFBO);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    m_LensScene = m_Scene;
+    m_LensValid = true;
+
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, targetFBO);
+    glBlitFramebuffer(0, 0, m_Width, m_Height, 0, 0, m_Width, m_Height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, targetFBO);
+}
+
+void Display::SetLogPolar(bool enabled, float quality) {
+    m_LogPolarQuality = quality;
+    if (enabled == m_LogPolar)
+        return;
+
+    m_LogPolar = enabled;
+    if (!enabled)
+        DeleteLogPolarTarget();
+}
+
+void Display::DeleteLogPolarTarget() {
+    if (m_LogPolarFBO) glDeleteFramebuffers(1, &m_LogPolarFBO);
+    if (m_LogPolarTextureID) glDeleteTextures(1, &m_LogPolarTextureID);
+    m_LogPolarFBO = m_LogPolarTextureID = 0;
+    m_LogPolarWidth = m_LogPolarHeight = 0;
+}
+
+void Display::DrawLogPolar() {
+    GLint targetFBO = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &targetFBO);
+
+    if (!m_LogPolarShader) {
+        m_LogPolarShader = new Shader("blackhole.vert", "logpolar.frag");
+        m_LogPolarShader->SetHotReload(m_ShaderHotReload, ShaderSourceDirectory());
+    }
+
+    // The grid follows the hole and its size on screen, so the target is
+    // resized whenever the ray budget lands on a different shape
+    m_LogPolarGrid = LogPolarGrid::Build(m_Scene, m_Width, m_Height, m_LogPolarQuality);
+    if (!m_LogPolarFBO) {
+        glGenTextures(1, &m_LogPolarTextureID);
+        glBindTexture(GL_TEXTURE_2D, m_LogPolarTextureID);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glGenFramebuffers(1, &m_LogPolarFBO);
+    }
+    if (m_LogPolarGrid.angular != m_LogPolarWidth || m_LogPolarGrid.radial != m_LogPolarHeight) {
+        m_LogPolarWidth = m_LogPolarGrid.angular;
+        m_LogPolarHeight = m_LogPolarGrid.radial;
+        glBindTexture(GL_TEXTURE_2D, m_LogPolarTextureID);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, m_LogPolarWidth, m_LogPolarHeight, 0, GL_RGBA, GL_FLOAT, nullptr);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_LogPolarFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_LogPolarTextureID, 0);
     }
+
+    // One ray per grid sample
+    glBindFramebuffer(GL_FRAMEBUFFER, m_LogPolarFBO);
+    glViewport(0, 0, m_LogPolarWidth, m_LogPolarHeight);
+
+    m_ShaderProgram->use();
+    m_ShaderProgram->setInt("u_progressiveStride", 0);
+    m_ShaderProgram->setInt("u_logPolar", 1);
+    m_ShaderProgram->setVec2("u_logPolarCenter", m_LogPolarGrid.center);
+    m_ShaderProgram->setFloat("u_logPolarInner", m_LogPolarGrid.inner);
+    m_ShaderProgram->setFloat("u_logPolarAngularStep", m_LogPolarGrid.angularStep);
+    m_ShaderProgram->setFloat("u_logPolarRadialStep", m_LogPolarGrid.radialStep);
+    m_ShaderProgram->setVec2("u_resolution", glm::vec2((float)m_Width, (float)m_Height));
+
+    BindSceneTextures();
+    glBindVertexArray(m_VAO);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    m_ShaderProgram->setInt("u_logPolar", 0);
+
+    // Resample into the caller's target
+    glBindFramebuffer(GL_FRAMEBUFFER, targetFBO);
+    glViewport(0, 0, m_Width, m_Height);
+
+    m_LogPolarShader->use();
+    m_LogPolarShader->setInt("u_samples", 0);
+    m_LogPolarShader->setVec2("u_center", m_LogPolarGrid.center);
+    m_LogPolarShader->setFloat("u_inner", m_LogPolarGrid.inner);
+    m_LogPolarShader->setFloat("u_radialStep", m_LogPolarGrid.radialStep);
+    m_LogPolarShader->setInt("u_radial", m_LogPolarGrid.radial);
+
+    glBindTexture(GL_TEXTURE_2D, m_LogPolarTextureID);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    m_ShaderProgram->use();
 }
 
 void Display::CreateQuad() {
@@ -86,60 +505,318 @@ void Display::CreateQuad() {
 }
 
 void Display::CreateShaders() { 
-    m_ShaderProgram = new Shader("blackhole.vert", "blackhole.frag");
+    m_UberShader = new Shader("blackhole.vert", "blackhole.frag");
+    m_ShaderProgram = m_UberShader;
+    ConfigureShader(*m_UberShader);
+
+    // Zeroed so the first UpdateUniforms always uploads
+    m_SceneUniforms = SceneUniforms{};
+    m_SceneUniforms.flags = ~0u;
+    glGenBuffers(1, &m_SceneUBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, m_SceneUBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(SceneUniforms), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, SCENE_BLOCK_BINDING, m_SceneUBO);
+}
+
+void Display::ConfigureShader(Shader& shader) {
+    shader.bindBlock("SceneBlock", SCENE_BLOCK_BINDING);
+
+    // Texture units never change. Every sampler gets its own, a cube and a
+    // 2D sampler left on the same unit fail the draw. Variants and the
+    // compute programs leave some out.
+    static const std::pair<const char*, int> samplers[] = {
+        { "u_skybox", 0 }, { "u_deflection", 1 }, { "u_progressivePrevious", 2 }, { "u_lensDirection", 3 },
+        { "u_lensDisk", 4 }, { "u_skyAtlas", 5 }, { "u_skyPages", 6 },
+    };
+    shader.use();
+    for (const auto& [name, unit] : samplers)
+        if (shader.HasUniform(name))
+            shader.setInt(name, unit);
+    if (m_SkyStreamer)
+        m_SkyStreamer->SetUniforms(shader);
+}
+
+void Display::SetShaderHotReload(bool enabled) {
+    m_ShaderHotReload = enabled;
+    m_UberShader->SetHotReload(enabled, ShaderSourceDirectory());
+    // Variants are built from where the uber shader reads, which watching
+    // may have just changed
+    m_ShaderVariants.clear();
+    m_ShaderProgram = m_UberShader;
+    if (m_LogPolarShader)
+        m_LogPolarShader->SetHotReload(enabled, ShaderSourceDirectory());
+    if (m_Wavefront)
+        m_Wavefront->SetHotReload(enabled, ShaderSourceDirectory());
+}
+
+void Display::SetWavefront(bool enabled, int stepsPerDispatch) {
+    if (!enabled || !m_WavefrontSupported) {
+        m_Wavefront.reset();
+        return;
+    }
+    if (!m_Wavefront) {
+        m_Wavefront = std::make_unique<WavefrontTracer>(m_Width, m_Height, stepsPerDispatch);
+        ConfigureShader(m_Wavefront->GetTraceShader());
+        m_Wavefront->SetHotReload(m_ShaderHotReload, ShaderSourceDirectory());
+    }
+    m_Wavefront->SetStepsPerDispatch(stepsPerDispatch);
+}
+
+void Display::SetSpecializedShaders(bool enabled, bool wait) {
+    m_SpecializedShaders = enabled;
+    m_WaitForVariants = wait;
+}
+
+void Display::SelectShader() {
+    m_ShaderProgram = m_UberShader;
+    // Nothing to specialize to before the first UpdateUniforms
+    if (!m_SpecializedShaders || m_SceneUniforms.flags == ~0u)
+        return;
+
+    // Only the flag bits the shader reads, so variants are not told apart
+    // by anything else
+    uint32_t flags = m_SceneUniforms.flags & 0x7Fu;
+    std::unique_ptr<Shader>& variant = m_ShaderVariants[flags];
+    if (!variant) {
+        // From the sources the uber shader last read, the build copies or
+        // the watched ones
+        variant = std::make_unique<Shader>("blackhole.vert", "blackhole.frag",
+                                           "#define SPECIALIZED_FLAGS " + std::to_string(flags), true,
+                                           m_UberShader->GetSourceDirectory());
+        if (variant->IsLinked())
+            ConfigureShader(*variant);
+    }
+    if (m_WaitForVariants && variant->Finish())
+        ConfigureShader(*variant);
+    if (variant->IsLinked())
+        m_ShaderProgram = variant.get();
 }
 
 void Display::Draw() {
+    // A reloaded program draws from this frame on, nothing traced by the
+    // old one is reused. The variants are of the old source.
+    if (m_UberShader->Poll()) {
+        ConfigureShader(*m_UberShader);
+        m_ShaderVariants.clear();
+        m_ProgressiveStride = 0;
+        m_LensValid = false;
+    }
+    for (auto& [flags, variant] : m_ShaderVariants)
+        if (variant->Poll())
+            ConfigureShader(*variant);
+    SelectShader();
+    if (m_LogPolarShader)
+        m_LogPolarShader->Poll();
+    if (m_Wavefront && m_Wavefront->Poll())
+        ConfigureShader(m_Wavefront->GetTraceShader());
+
+    if (m_Capture)
+        m_Capture->Poll();
+
+    if (m_SkyStreamer) {
+        m_SkyStreamer->Update();
+        if (m_SkyStreamer->WantsFeedback(m_Scene != m_SkyFeedbackScene)) {
+            DrawSkyFeedback();
+            // Offline renders take what the feedback asked for before drawing
+            if (m_SkyStreamer->IsBlocking())
+                m_SkyStreamer->Update();
+        }
+    }
+
+    DrawFrame();
+
+    if (m_Recording) {
+        char number[16];
+        std::snprintf(number, sizeof(number), "%05d", m_RecordedFrames++);
+        CaptureFrame(m_RecordingPrefix + number + ".png");
+    }
+}
+
+void Display::DrawFrame() {
+    m_LensReused = false;
+    if (m_LensCache && !m_StepStatsEnabled) {
+        m_ProgressiveStride = 0;
+        DrawLensCache();
+        return;
+    }
+    if (m_LogPolar && !m_StepStatsEnabled) {
+        m_ProgressiveStride = 0;
+        DrawLogPolar();
+        return;
+    }
+    if (m_Progressive && !m_StepStatsEnabled) {
+        DrawProgressive();
+        return;
+    }
+    m_ProgressiveStride = 0;
+    if (m_Wavefront && m_Wavefront->IsReady() && !m_StepStatsEnabled) {
+        DrawWavefront();
+        return;
+    }
+
+    // With step stats on, render offscreen and copy the color back to
+    // whatever framebuffer the caller had bound
+    GLint targetFBO = 0;
+    if (m_StepStatsEnabled) {
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &targetFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_StepFBO);
+    }
+
 glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     
     m_ShaderProgram->use();
+    m_ShaderProgram->setInt("u_progressiveStride", 0);
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, m_SkyboxTextureID);
-
+    BindSceneTextures();
     glBindVertexArray(m_VAO);
     glDrawArrays(GL_TRIANGLES, 0, 6);
+
+    if (m_StepStatsEnabled) {
+        ReadStepBuffer();
+
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, targetFBO);
+        glBlitFramebuffer(0, 0, m_Width, m_Height, 0, 0, m_Width, m_Height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, targetFBO);
+    }
 }
 
-void Display::UpdateUniforms(Camera& camera, BlackHole& bh, uint32_t& flags, float& bhSizeBuffer, float& diskThickness) {
-    m_ShaderProgram->use();
+void Display::DrawWavefront() {
+    GLint targetFBO = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &targetFBO);
 
-    glm::vec3 camPos = camera.GetPosition();
-    glm::mat4 view = camera.GetViewMatrix();
-    m_ShaderProgram->setMat4("invView", glm::inverse(view));
+    BindSceneTextures();
+    m_Wavefront->Trace();
 
-    m_ShaderProgram->setVec3("camPos", camPos);
-    m_ShaderProgram->setFloat("u_fov", glm::radians(camera.Zoom()));
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_Wavefront->GetFramebuffer());
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, targetFBO);
+    glBlitFramebuffer(0, 0, m_Width, m_Height, 0, 0, m_Width, m_Height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, targetFBO);
+}
 
-    m_ShaderProgram->setVec3("bhPos", bh.Position());
-    m_ShaderProgram->setFloat("bhMass", bh.Mass());
-    m_ShaderProgram->setFloat("bhRadius", bh.Radius());
+void Display::BindSceneTextures() {
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, m_SkyboxTextureID);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_1D, m_DeflectionTextureID);
+    if (m_SkyStreamer) {
+        glActiveTexture(GL_TEXTURE5);
+        glBindTexture(GL_TEXTURE_2D, m_SkyStreamer->GetAtlasTexture());
+        glActiveTexture(GL_TEXTURE6);
+        glBindTexture(GL_TEXTURE_2D, m_SkyStreamer->GetPageTableTexture());
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
 
-    float aspectRatio = (float)Config::WINDOW_WIDTH / (float)Config::WINDOW_HEIGHT;
-    m_ShaderProgram->setFloat("u_aspectRatio", aspectRatio);
+void Display::DrawSkyFeedback() {
+    GLint targetFBO = 0, viewport[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &targetFBO);
+    glGetIntegerv(GL_VIEWPORT, viewport);
 
-    m_ShaderProgram->setFloat("bhSizeBuffer", bhSizeBuffer);
-    m_ShaderProgram->setFloat("diskThickness", diskThickness);
-    
-    m_ShaderProgram->setUInt("flags", flags);
-    m_ShaderProgram->setInt("u_skybox", 0);
+    // A progressive pass that starts from another pixel each time, only the
+    // page each ray wanted is kept
+    glm::ivec2 offset = m_SkyStreamer->BeginFeedback();
+    m_ShaderProgram->use();
+    m_ShaderProgram->setInt("u_progressiveStride", m_SkyStreamer->GetFeedbackScale());
+    m_ShaderProgram->setInt("u_progressiveReuse", 0);
+    m_ShaderProgram->setIVec2("u_progressiveOffset", offset);
+    m_ShaderProgram->setVec2("u_resolution", glm::vec2((float)m_Width, (float)m_Height));
+    BindSceneTextures();
+    glBindVertexArray(m_VAO);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    m_ShaderProgram->setIVec2("u_progressiveOffset", glm::ivec2(0));
+    m_SkyStreamer->EndFeedback();
+    m_SkyFeedbackScene = m_Scene;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, targetFBO);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
 }
 
-void Display::SaveFrame(const std::string& filename) {
-    std::vector<unsigned char> pixels(m_Width * m_Height * 3);
-    glReadPixels(0, 0, m_Width, m_Height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+void Display::UpdateUniforms(Camera& camera, BlackHole& bh, uint32_t& flags, float& bhSizeBuffer, float& diskThickness, float& tolerance, float& farFieldRadius,
+                             float& weakFieldThreshold, float& weakFieldTolerance) {
+    float aspectRatio = (float)m_Width / (float)m_Height;
+    SceneParams scene = SceneParams::FromScene(camera, bh, flags, bhSizeBuffer, diskThickness, aspectRatio, tolerance, farFieldRadius);
+    scene.weakFieldThreshold = weakFieldThreshold;
+    scene.weakFieldTolerance = weakFieldTolerance;
+    m_Scene = scene;
+
+    if (scene.UseDeflectionTable())
+        UpdateDeflectionTexture(scene);
+
+    SceneUniforms uniforms = {};
+    uniforms.invView = scene.invView;
+    uniforms.camPos = scene.camPos;
+    uniforms.fov = scene.fov;
+    uniforms.bhPos = scene.bhPos;
+    uniforms.bhMass = scene.bhMass;
+    uniforms.bhRadius = scene.bhRadius;
+    uniforms.aspectRatio = aspectRatio;
+    uniforms.bhSizeBuffer = bhSizeBuffer;
+    uniforms.diskThickness = diskThickness;
+    uniforms.tolerance = tolerance;
+    uniforms.farFieldRadius = farFieldRadius;
+    uniforms.weakFieldImpact = Physics::WeakFieldImpact(scene);
+    uniforms.weakFieldTolerance = weakFieldTolerance;
+    uniforms.deflectionCritical = m_DeflectionTable.GetCriticalAngle();
+    uniforms.flags = flags;
+    uniforms.skyLevel = (float)Skybox::LevelForPixelAngle(m_SkyFaceSize, m_SkyLevelCount,
+                                                          2.0f * std::tan(scene.fov * 0.5f) / m_Height);
 
+    // Most frames nothing moved
+    if (std::memcmp(&uniforms, &m_SceneUniforms, sizeof(SceneUniforms)) == 0)
+        return;
+    m_SceneUniforms = uniforms;
+    glBindBuffer(GL_UNIFORM_BUFFER, m_SceneUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(SceneUniforms), &m_SceneUniforms);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+// Output folder, stamped with the current minute
+static std::string OutputPath(const std::string& filename) {
     auto now = std::time(nullptr);
     auto tm = *std::localtime(&now);
     std::ostringstream oss;
     oss << "../../../Output/" << std::put_time(&tm, "%Y-%m-%d-%H-%M-") << filename;
-    std::string timestampedFilename = oss.str();
+    return oss.str();
+}
 
-    stbi_flip_vertically_on_write(true);
-    if (stbi_write_png(timestampedFilename.c_str(), m_Width, m_Height, 3, pixels.data(), m_Width * 3)) {
-        std::cout << "Saved frame to: " << timestampedFilename << std::endl;
-    } else {
-        std::cerr << "Failed to save frame: " << timestampedFilename << std::endl;
+void Display::SaveStepStats(const std::string& filename) {
+    if (m_StepBuffer.Size() == 0) {
+        std::cerr << "No step stats to save, enable them first" << std::endl;
+        return;
+    }
+
+    StepStats::Export(m_StepBuffer, OutputPath(filename));
+}
+
+void Display::SaveFrame(const std::string& filename) {
+    std::string timestampedFilename = OutputPath(filename);
+    if (CaptureFrame(timestampedFilename))
+        std::cout << "Saving frame to: " << timestampedFilename << std::endl;
+    else
+        std::cerr << "Dropped frame: " << timestampedFilename << std::endl;
+}
+
+void Display::SetRecording(bool recording) {
+    if (recording && !m_Recording) {
+        m_RecordingPrefix = OutputPath("record-");
+        m_RecordedFrames = 0;
     }
+    m_Recording = recording;
+}
+
+bool Display::CaptureFrame(const std::string& path) {
+    if (!m_Capture)
+        m_Capture = std::make_unique<FrameCapture>(m_Width, m_Height);
+
+    // What the window shows, whichever path drew it
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    return m_Capture->Capture(path);
+}
+
+void Display::FlushCapture() {
+    if (m_Capture)
+        m_Capture->Flush();
 }
      
\ No newline at end of file
@@ -3,7 +3,6 @@
 #include "display.h"
 #include "camera.h"
 #include "blackhole.h"
-#include "stb_image.h"
 
 // System Headers
 #include <glad/glad.h>
@@ -13,52 +12,45 @@
 #include <imgui_impl_opengl3.h>
 
 // Headers
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <string>
 
 // Assets/*imagename.hdr*
+// Or a .bhsky converted from it with bhsky, which loads much faster
 const std::string SKYBOX_PATH = "assets/eso0926a - eagle nebula.hdr";
-GLuint skyboxTextureID;
 
 float diskThickness = 0.2f;
 float bhSizeBuffer = 1.08f;
 bool useRelativity = true;
 bool showDisk = false;
+bool useAdaptiveStep = false;
+bool usePlanarOrbit = false;
+bool useDeflectionTable = false;
+float stepTolerance = 1e-4f;
+bool useFarField = false;
+float farFieldRadius = 30.0f;
+bool useWeakField = false;
+float weakFieldThreshold = 0.0f;
+float weakFieldTolerance = 2.5e-4f;
+bool useProgressive = false;
+int progressiveStride = 8;
+bool useLensCache = false;
+bool useLogPolar = false;
+bool useWavefront = false;
+int wavefrontSteps = 32;
+float logPolarQuality = 0.5f;
+bool recordFrames = false;
+bool showStepHeatmap = false;
+bool hotReloadShaders = false;
+bool useSpecializedShaders = true;
+int heatmapMode = 0;
+float heatmapOpacity = 0.6f;
 
 bool isDragging = false;
 double lastX, lastY;
 
-void InitializeScene() {
-    // ... setup VAO/VBO for screen-filling quad ...
-
-    // 2. Load the HDR image
-    int width, height, nrComponents;
-    stbi_set_flip_vertically_on_load(true); 
-    
-    // Use loadf for float data
-    float* data = stbi_loadf(SKYBOX_PATH.c_str(), &width, &height, &nrComponents, 0);
-    
-    if (data) {
-        glGenTextures(1, &skyboxTextureID);
-        glBindTexture(GL_TEXTURE_2D, skyboxTextureID);
-        
-        // 3. Upload to GPU
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, width, height, 0, GL_RGB, GL_FLOAT, data);
-        
-        // 4. Set Texture Parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-        std::cout << "Successfully loaded HDR" << std::endl;
-    } else {
-        std::cerr << "Failed to load HDR image!" << std::endl;
-    }
-}
-
 void RenderImGui(ImGuiIO& io, Camera& camera, BlackHole& blackhole, Display& display) {
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplGlfw_NewFrame();
@@ -69,6 +61,51 @@ void RenderImGui(ImGuiIO& io, Camera& camera, BlackHole& blackhole, Display& dis
     if (ImGui::Button("Save Frame")) {
         display.SaveFrame("output.png");
     }
+    ImGui::SameLine();
+    if (ImGui::Checkbox("Record", &recordFrames))
+        display.SetRecording(recordFrames);
+    if (const FrameCapture* capture = display.GetCapture()) {
+        ImGui::Text("Frames: %lld written, %lld dropped, %d reading back", capture->GetWritten(),
+                    capture->GetDropped(), capture->GetInFlight());
+    }
+    if (const SkyStreamer* sky = display.GetSkyStreamer()) {
+        SkyStreamer::Stats stats = sky->GetStats();
+        ImGui::Text("Sky tiles: %d of %d resident, %d loading, %d missing", stats.resident, stats.slots,
+                    stats.pending, stats.missing);
+        ImGui::Text("Sky tiles: %lld uploaded, %lld evicted, %lld dropped", stats.uploaded, stats.evicted,
+                    stats.dropped);
+    }
+    if (ImGui::Checkbox("Hot Reload Shaders", &hotReloadShaders))
+        display.SetShaderHotReload(hotReloadShaders);
+    if (const Shader* shader = display.GetShader()) {
+        ImGui::Text("Shader: %s in %.1f ms, %d reloads%s", shader->WasCached() ? "program cache" : "compiled",
+                    shader->GetBuildMilliseconds(), shader->GetReloadCount(), shader->IsCompiling() ? ", compiling" : "");
+    }
+    ImGui::Checkbox("Specialized Shaders", &useSpecializedShaders);
+    if (useSpecializedShaders)
+        ImGui::Text("Drawing with the %s, %d variants", display.IsDrawingSpecialized() ? "specialized variant" : "uber-shader",
+                    display.GetShaderVariantCount());
+    ImGui::Separator();
+
+    ImGui::Text("Step Count");
+    if (ImGui::Checkbox("Step Count Heatmap", &showStepHeatmap))
+        display.SetStepStatsEnabled(showStepHeatmap);
+    if (showStepHeatmap) {
+        ImGui::Combo("Heatmap", &heatmapMode, "Steps\0Acceleration Evaluations\0Termination\0");
+        ImGui::SliderFloat("Heatmap Opacity", &heatmapOpacity, 0.0f, 1.0f);
+
+        StepSummary summary = StepStats::Summarize(display.GetStepBuffer());
+        ImGui::Text("Steps: mean %.1f, p99 %d, max %d", summary.meanSteps, summary.p99Steps, summary.maxSteps);
+        ImGui::Text("Acceleration Evaluations: mean %.1f, p99 %d", summary.meanAccelEvals, summary.p99AccelEvals);
+        ImGui::Text("Hit MAX_STEPS: %.2f%%", summary.exhaustedPercent);
+        if (ImGui::Button("Export Step Stats"))
+            display.SaveStepStats("steps");
+
+        // Under the controls, over the scene. GL rows start at the bottom.
+        display.UpdateHeatmap((HeatmapMode)heatmapMode, heatmapOpacity);
+        ImGui::GetBackgroundDrawList()->AddImage((ImTextureID)(intptr_t)display.GetHeatmapTexture(),
+                                                 ImVec2(0.0f, 0.0f), io.DisplaySize, ImVec2(0.0f, 1.0f), ImVec2(1.0f, 0.0f));
+    }
     ImGui::Separator();
 
     ImGui::Text("Black Hole Properties");
@@ -82,7 +119,48 @@ void RenderImGui(ImGuiIO& io, Camera& camera, BlackHole& blackhole, Display& dis
     
     ImGui::Text("Simulation Parameters");
     ImGui::Checkbox("Use Relativistic Geodesics", &useRelativity);
+    if (useRelativity)
+        ImGui::Checkbox("Planar Orbit (Binet Equation)", &usePlanarOrbit);
+    if (useRelativity && !showDisk)
+        ImGui::Checkbox("Deflection Lookup Table", &useDeflectionTable);
     ImGui::Checkbox("Show Accretion Disk", &showDisk);
+    ImGui::Checkbox("Adaptive Step (Dormand-Prince)", &useAdaptiveStep);
+    if (useAdaptiveStep)
+        ImGui::SliderFloat("Step Tolerance", &stepTolerance, 1e-6f, 1e-2f, "%.1e", ImGuiSliderFlags_Logarithmic);
+    ImGui::Checkbox("Far-Field Escape Completion", &useFarField);
+    if (useFarField)
+        ImGui::SliderFloat("Far-Field Radius", &farFieldRadius, 10.0f, 100.0f);
+    ImGui::Checkbox("Progressive Refinement", &useProgressive);
+    if (useProgressive) {
+        ImGui::RadioButton("1/4 While Dragging", &progressiveStride, 4);
+        ImGui::SameLine();
+        ImGui::RadioButton("1/8 While Dragging", &progressiveStride, 8);
+        if (!display.IsProgressiveComplete())
+            ImGui::Text("Refining: 1/%d", display.GetProgressiveStride());
+    }
+    ImGui::Checkbox("Lens Map Cache", &useLensCache);
+    if (useLensCache && display.WasLensMapReused())
+        ImGui::Text("Orbiting from the lens map");
+    ImGui::Checkbox("Log-Polar Sampling", &useLogPolar);
+    if (useLogPolar) {
+        ImGui::SliderFloat("Rays Per Pixel", &logPolarQuality, 0.1f, 2.0f);
+        const LogPolarGrid& grid = display.GetLogPolarGrid();
+        ImGui::Text("Grid: %d angles x %d rings", grid.angular, grid.radial);
+    }
+    if (display.IsWavefrontSupported()) {
+        ImGui::Checkbox("Wavefront Compute Tracer", &useWavefront);
+        if (const WavefrontTracer* wavefront = display.GetWavefront()) {
+            ImGui::SliderInt("Steps Per Dispatch", &wavefrontSteps, 4, 512, "%d", ImGuiSliderFlags_Logarithmic);
+            ImGui::Text("Marched %d rays in %d dispatches", wavefront->GetStats().marched, wavefront->GetStats().dispatches);
+        }
+    } else {
+        ImGui::Text("Wavefront Compute Tracer needs OpenGL 4.3");
+    }
+    ImGui::Checkbox("Weak-Field Fast Path", &useWeakField);
+    if (useWeakField) {
+        ImGui::SliderFloat("Weak-Field Tolerance", &weakFieldTolerance, 1e-6f, 1e-2f, "%.1e", ImGuiSliderFlags_Logarithmic);
+        ImGui::SliderFloat("Weak-Field Threshold (M, 0 = auto)", &weakFieldThreshold, 0.0f, 200.0f);
+    }
     
     ImGui::Separator();
 
@@ -106,8 +184,20 @@ void RenderScene(Display& display, Camera& camera, BlackHole& blackhole) {
 
     if (useRelativity) flags |= (1 << 0);
     if (showDisk) flags |= (1 << 1);
-
-    display.UpdateUniforms(camera, blackhole, flags, bhSizeBuffer, diskThickness);
+    if (useAdaptiveStep) flags |= (1 << 2);
+    if (usePlanarOrbit) flags |= (1 << 3);
+    if (useDeflectionTable) flags |= (1 << 4);
+    if (useFarField) flags |= (1 << 5);
+    if (useWeakField) flags |= (1 << 6);
+
+    display.UpdateUniforms(camera, blackhole, flags, bhSizeBuffer, diskThickness, stepTolerance, farFieldRadius,
+                           weakFieldThreshold, weakFieldTolerance);
+    display.SetSpecializedShaders(useSpecializedShaders);
+    display.SetProgressive(useProgressive, progressiveStride);
+    display.SetLensCache(useLensCache);
+    display.SetLogPolar(useLogPolar, logPolarQuality);
+    display.SetWavefront(useWavefront, wavefrontSteps);
+    display.SetInteracting(isDragging);
     display.Draw();
 }
 
@@ -186,6 +276,8 @@ void CheckKeys(GLFWwindow* mWindow) {
 }
 
 int main() {
+    auto startupStart = std::chrono::steady_clock::now();
+
     // Load GLFW and Create a Window
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
@@ -215,12 +307,13 @@ int main() {
     ImGui_ImplGlfw_InitForOpenGL(mWindow, true);
     ImGui_ImplOpenGL3_Init("#version 400");
 
-    // Skybox setup
-    InitializeScene();
     // Initialize scene objects and settings
     BlackHole blackhole(2.0f, glm::vec3(0.0f, 0.0f, 0.0f));
     Display display(Config::WINDOW_WIDTH, Config::WINDOW_HEIGHT, SKYBOX_PATH);
+    display.SetShaderHotReload(hotReloadShaders);
     Camera camera(40.0f, 1.46f, 1.46f);
+    fprintf(stderr, "Startup took %.0f ms\n",
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startupStart).count());
 
     // Set glfw pointers 
     glfwSetWindowUserPointer(mWindow, &camera);
@@ -240,6 +333,7 @@ int main() {
     }   
     
     // Cleanup
+    display.FlushCapture();
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
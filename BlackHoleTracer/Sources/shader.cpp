@@ -0,0 +1,466 @@
+#include "shader.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// Cache files: this header, the key, then the program binary
+struct ProgramFileHeader {
+    char magic[8];
+    uint32_t binaryFormat;
+    uint32_t keyLength;
+    uint64_t binaryLength;
+};
+static const char PROGRAM_MAGIC[8] = { 'B', 'H', 'P', 'R', 'O', 'G', 0, 0 };
+
+static double Milliseconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool HasExtension(const char* name) {
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++) {
+        const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+        if (extension && std::strcmp(extension, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+// Core since 4.1, the app asks for 4.0. Mesa only has binary formats with
+// its own disk cache on.
+static bool HasProgramBinary() {
+    static const bool supported = [] {
+        GLint major = 0, minor = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &major);
+        glGetIntegerv(GL_MINOR_VERSION, &minor);
+        if (major * 10 + minor < 41 && !HasExtension("GL_ARB_get_program_binary"))
+            return false;
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        return formats > 0;
+    }();
+    return supported;
+}
+
+// Either lets GL_COMPLETION_STATUS be asked without blocking. The driver
+// picks its own thread count until glMaxShaderCompilerThreads says otherwise.
+static bool HasParallelCompile() {
+    static const bool supported = HasExtension("GL_KHR_parallel_shader_compile")
+                                  || HasExtension("GL_ARB_parallel_shader_compile");
+    return supported;
+}
+
+static std::string FileName(const std::string& path) {
+    return std::filesystem::path(path).filename().string();
+}
+
+// FNV-1a, stable from run to run unlike std::hash
+static uint64_t Hash(const std::string& text, uint64_t hash = 14695981039346656037ull) {
+    for (unsigned char c : text)
+        hash = (hash ^ c) * 1099511628211ull;
+    return hash;
+}
+
+Shader::Shader(const char* vertexPath, const char* fragmentPath, const std::string& defines, bool background,
+               const std::string& sourceDirectory)
+    : ID(0), m_VertexPath(vertexPath), m_FragmentPath(fragmentPath), m_Defines(defines), m_SourceDirectory(sourceDirectory) {
+    Build(background);
+}
+
+std::unique_ptr<Shader> Shader::Compute(const char* computePath, const std::string& defines, bool background,
+                                        const std::string& sourceDirectory) {
+    std::unique_ptr<Shader> shader(new Shader());
+    shader->m_ComputePath = computePath;
+    shader->m_Defines = defines;
+    shader->m_SourceDirectory = sourceDirectory;
+    shader->Build(background);
+    return shader;
+}
+
+void Shader::Build(bool background) {
+    m_Name = m_ComputePath.empty() ? FileName(m_VertexPath) + " + " + FileName(m_FragmentPath) : FileName(m_ComputePath);
+    // "#define A 1\n#define B 2\n" reads as [A 1, B 2]
+    if (!m_Defines.empty()) {
+        std::string label;
+        std::istringstream lines(m_Defines);
+        for (std::string line; std::getline(lines, line);)
+            if (!line.empty())
+                label += (label.empty() ? "" : ", ") + (line.compare(0, 8, "#define ") == 0 ? line.substr(8) : line);
+        m_Name += " [" + label + "]";
+    }
+    auto start = std::chrono::steady_clock::now();
+
+    Sources sources;
+    if (!ReadSources(m_SourceDirectory, sources))
+        std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ " << m_Name << std::endl;
+
+    if (background) {
+        StartPending(sources);
+        if (m_PendingCached)
+            TakePending();
+        return;
+    }
+
+    std::string key = CacheKey(sources);
+    ID = LoadCached(key);
+    m_Cached = ID != 0;
+    if (m_Cached) {
+        m_Linked = true;
+    } else {
+        ID = BeginBuild(sources);
+        m_Linked = CheckBuild(ID, m_Name);
+        if (m_Linked)
+            SaveCached(ID, key);
+    }
+    m_BuildMilliseconds = Milliseconds(start);
+    if (m_Linked)
+        std::printf("Shader %s: %s in %.1f ms\n", m_Name.c_str(), m_Cached ? "program cache" : "compiled",
+                    m_BuildMilliseconds);
+
+    CacheLocations();
+}
+
+Shader::~Shader() {
+    SetHotReload(false);
+    if (m_PendingProgram) glDeleteProgram(m_PendingProgram);
+    if (ID) glDeleteProgram(ID);
+}
+
+// Puts included files in place of their #include "name" lines, found next
+// to the file that includes them. #line gives each file its own source
+// string number in the compile logs, files lists them in that order.
+bool Shader::ReadFile(const std::string& path, std::string& text, std::vector<std::string>& files, int depth) {
+    std::ifstream file(path);
+    if (!file || depth > 8)
+        return false;
+    int number = (int)files.size();
+    files.push_back(path);
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string::npos || line.compare(start, 8, "#include") != 0) {
+            text += line + '\n';
+            continue;
+        }
+        size_t open = line.find('"', start), close = line.rfind('"');
+        if (open == std::string::npos || close <= open)
+            return false;
+        std::filesystem::path included = std::filesystem::path(path).parent_path() / line.substr(open + 1, close - open - 1);
+        text += "#line 1 " + std::to_string(files.size()) + "\n";
+        if (!ReadFile(included.string(), text, files, depth + 1))
+            return false;
+        text += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(number) + "\n";
+    }
+    return !file.bad();
+}
+
+bool Shader::ReadSources(const std::string& directory, Sources& sources) const {
+    // From directory/<file name>, or where the shader was loaded from
+    auto path = [&](const std::string& loaded) {
+        return directory.empty() ? loaded : (std::filesystem::path(directory) / FileName(loaded)).string();
+    };
+    sources = Sources();
+    bool read = m_ComputePath.empty()
+                    ? ReadFile(path(m_VertexPath), sources.vertex, sources.files) && ReadFile(path(m_FragmentPath), sources.fragment, sources.files)
+                    : ReadFile(path(m_ComputePath), sources.compute, sources.files);
+    InjectDefines(sources.vertex, m_Defines);
+    InjectDefines(sources.fragment, m_Defines);
+    InjectDefines(sources.compute, m_Defines);
+    return read;
+}
+
+// After the #version line, which has to come first. #line keeps the
+// numbers in the compile logs those of the file.
+void Shader::InjectDefines(std::string& source, const std::string& defines) {
+    if (defines.empty() || source.empty())
+        return;
+    size_t position = 0;
+    int line = 1;
+    size_t version = source.find("#version");
+    if (version != std::string::npos) {
+        size_t end = source.find('\n', version);
+        position = end == std::string::npos ? source.size() : end + 1;
+        line += (int)std::count(source.begin(), source.begin() + position, '\n');
+    }
+    std::string block = defines;
+    if (block.back() != '\n')
+        block += '\n';
+    if (position > 0 && source[position - 1] != '\n')
+        block = '\n' + block;
+    source.insert(position, block + "#line " + std::to_string(line) + "\n");
+}
+
+GLuint Shader::BeginBuild(const Sources& sources) {
+    GLuint program = glCreateProgram();
+    std::vector<GLuint> shaders;
+    auto compile = [&](GLenum type, const std::string& source) {
+        const char* code = source.c_str();
+        GLuint shader = glCreateShader(type);
+        glShaderSource(shader, 1, &code, NULL);
+        glCompileShader(shader);
+        glAttachShader(program, shader);
+        shaders.push_back(shader);
+    };
+    if (!sources.compute.empty()) {
+        compile(GL_COMPUTE_SHADER, sources.compute);
+    } else {
+        compile(GL_VERTEX_SHADER, sources.vertex);
+        compile(GL_FRAGMENT_SHADER, sources.fragment);
+    }
+
+    if (HasProgramBinary())
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(program);
+
+    // Only flagged while attached, CheckBuild still reads their logs
+    for (GLuint shader : shaders)
+        glDeleteShader(shader);
+    return program;
+}
+
+bool Shader::CheckBuild(GLuint program, const std::string& name) {
+    GLuint shaders[2];
+    GLsizei count = 0;
+    glGetAttachedShaders(program, 2, &count, shaders);
+    for (GLsizei i = 0; i < count; i++) {
+        GLint compiled = GL_FALSE;
+        glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &compiled);
+        if (!compiled) {
+            GLint length = 0;
+            glGetShaderiv(shaders[i], GL_INFO_LOG_LENGTH, &length);
+            std::string log(std::max(length, 1), '\0');
+            glGetShaderInfoLog(shaders[i], (GLsizei)log.size(), nullptr, &log[0]);
+            std::cout << "ERROR::SHADER::COMPILATION_FAILED " << name << "\n" << log.c_str() << std::endl;
+        }
+        glDetachShader(program, shaders[i]);
+    }
+
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        GLint length = 0;
+        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+        std::string log(std::max(length, 1), '\0');
+        glGetProgramInfoLog(program, (GLsizei)log.size(), nullptr, &log[0]);
+        std::cout << "ERROR::PROGRAM::LINKING_FAILED " << name << "\n" << log.c_str() << std::endl;
+    }
+    return linked == GL_TRUE;
+}
+
+// A driver update or another GPU makes every old binary useless, so they
+// are part of the key along with the sources
+std::string Shader::CacheKey(const Sources& sources) {
+    std::string key;
+    for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+        const char* value = (const char*)glGetString(name);
+        key += value ? value : "";
+        key += '\n';
+    }
+    char sourceHash[40];
+    std::snprintf(sourceHash, sizeof(sourceHash), "%016llx %016llx",
+                  (unsigned long long)Hash(sources.vertex), (unsigned long long)Hash(sources.fragment + sources.compute));
+    return key + sourceHash;
+}
+
+std::string Shader::CachePath(const std::string& key) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)Hash(key));
+    return (std::filesystem::path(s_CacheDirectory) / name).string();
+}
+
+GLuint Shader::LoadCached(const std::string& key) {
+    if (!HasProgramBinary())
+        return 0;
+    std::ifstream file(CachePath(key), std::ios::binary);
+    ProgramFileHeader header;
+    if (!file.read((char*)&header, sizeof(header)) || std::memcmp(header.magic, PROGRAM_MAGIC, sizeof(PROGRAM_MAGIC)) != 0
+        || header.keyLength != key.size() || header.binaryLength == 0 || header.binaryLength > (64u << 20))
+        return 0;
+
+    // The file name is only a hash, the key itself has to match
+    std::string storedKey(header.keyLength, '\0');
+    std::vector<char> binary(header.binaryLength);
+    if (!file.read(&storedKey[0], storedKey.size()) || storedKey != key
+        || !file.read(binary.data(), (std::streamsize)binary.size()))
+        return 0;
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, header.binaryFormat, binary.data(), (GLsizei)binary.size());
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+void Shader::SaveCached(GLuint program, const std::string& key) {
+    if (!HasProgramBinary())
+        return;
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    ProgramFileHeader header = {};
+    std::memcpy(header.magic, PROGRAM_MAGIC, sizeof(PROGRAM_MAGIC));
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+    header.binaryFormat = format;
+    header.keyLength = (uint32_t)key.size();
+    header.binaryLength = (uint64_t)length;
+
+    // Written aside and renamed, so another instance never reads half a file
+    std::error_code error;
+    std::filesystem::create_directories(s_CacheDirectory, error);
+    std::string path = CachePath(key);
+    std::string partial = path + ".part";
+    {
+        std::ofstream file(partial, std::ios::binary);
+        file.write((const char*)&header, sizeof(header));
+        file.write(key.data(), (std::streamsize)key.size());
+        file.write(binary.data(), length);
+        if (!file)
+            return;
+    }
+    std::filesystem::rename(partial, path, error);
+}
+
+void Shader::SetHotReload(bool enabled, const std::string& watchDirectory) {
+    if (m_Watcher.joinable()) {
+        m_Watching = false;
+        m_Watcher.join();
+    }
+    if (!enabled)
+        return;
+
+    std::string main = m_ComputePath.empty() ? m_FragmentPath : m_ComputePath;
+    std::error_code error;
+    bool watched = !watchDirectory.empty() && std::filesystem::exists(std::filesystem::path(watchDirectory) / FileName(main), error);
+    // Reloads read from here from now on
+    if (watched)
+        m_SourceDirectory = watchDirectory;
+    m_Watching = true;
+    m_Watcher = std::thread(&Shader::WatchLoop, this, m_SourceDirectory);
+}
+
+// Watches every file the last read went through, includes too
+void Shader::WatchLoop(std::string directory) {
+    auto modified = [](const std::string& path) {
+        std::error_code error;
+        auto time = std::filesystem::last_write_time(path, error);
+        return error ? std::filesystem::file_time_type::min() : time;
+    };
+    auto sources = std::make_unique<Sources>();
+    ReadSources(directory, *sources);
+    std::vector<std::string> files = sources->files;
+    std::vector<std::filesystem::file_time_type> times;
+    for (const std::string& file : files)
+        times.push_back(modified(file));
+
+    while (m_Watching) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        bool changed = false;
+        for (size_t i = 0; i < files.size(); i++)
+            changed |= modified(files[i]) != times[i];
+        if (!changed)
+            continue;
+
+        // Editors often save in more than one write
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        sources = std::make_unique<Sources>();
+        bool read = ReadSources(directory, *sources);
+        // An include that was added or removed changes what is watched
+        if (!sources->files.empty())
+            files = sources->files;
+        times.clear();
+        for (const std::string& file : files)
+            times.push_back(modified(file));
+        if (!read)
+            continue;
+
+        std::lock_guard<std::mutex> lock(m_ChangedMutex);
+        m_Changed = std::move(sources);
+    }
+}
+
+void Shader::StartPending(const Sources& sources) {
+    // The newest edit wins over one still compiling. An edit that was
+    // undone is likely still in the cache.
+    if (m_PendingProgram)
+        glDeleteProgram(m_PendingProgram);
+    m_PendingKey = CacheKey(sources);
+    m_PendingStart = std::chrono::steady_clock::now();
+    m_PendingProgram = LoadCached(m_PendingKey);
+    m_PendingCached = m_PendingProgram != 0;
+    if (!m_PendingCached)
+        m_PendingProgram = BeginBuild(sources);
+    m_PendingChecked = false;
+}
+
+bool Shader::TakePending() {
+    bool swapped = false;
+    if (CheckBuild(m_PendingProgram, m_Name)) {
+        if (!m_PendingCached)
+            SaveCached(m_PendingProgram, m_PendingKey);
+        bool first = ID == 0;
+        glDeleteProgram(ID);
+        ID = m_PendingProgram;
+        m_Linked = true;
+        m_Cached = m_PendingCached;
+        m_BuildMilliseconds = Milliseconds(m_PendingStart);
+        if (!first)
+            m_Reloads++;
+        CacheLocations();
+        swapped = true;
+        std::printf("Shader %s: %s from %s in %.1f ms\n", m_Name.c_str(), first ? "built" : "reloaded",
+                    m_Cached ? "the program cache" : "source", m_BuildMilliseconds);
+    } else {
+        glDeleteProgram(m_PendingProgram);
+    }
+    m_PendingProgram = 0;
+    return swapped;
+}
+
+bool Shader::Finish() {
+    return m_PendingProgram && TakePending();
+}
+
+bool Shader::Poll() {
+    bool swapped = false;
+    if (m_PendingProgram) {
+        GLint done = GL_TRUE;
+        if (HasParallelCompile()) {
+            glGetProgramiv(m_PendingProgram, GL_COMPLETION_STATUS_KHR, &done);
+        } else {
+            // Gives a driver that compiles on its own threads a frame, the
+            // status query below waits for whatever is left
+            done = m_PendingChecked;
+            m_PendingChecked = true;
+        }
+        if (done)
+            swapped = TakePending();
+    }
+
+    std::unique_ptr<Sources> changed;
+    {
+        std::lock_guard<std::mutex> lock(m_ChangedMutex);
+        changed = std::move(m_Changed);
+    }
+    if (changed)
+        StartPending(*changed);
+    return swapped;
+}
@@ -0,0 +1,360 @@
+#include "skystream.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+
+SkyStreamer::SkyStreamer(std::shared_ptr<SkyTiles> tiles, int width, int height, int atlasSlots, int uploadsPerFrame)
+    : m_Tiles(std::move(tiles)), m_UploadsPerFrame(std::max(uploadsPerFrame, 1)), m_Width(width), m_Height(height) {
+    m_InternalFormat = GL_RGB32F;
+    m_Type = GL_FLOAT;
+    if (m_Tiles->GetFormat() == SkyFormat::RGB9E5) {
+        m_InternalFormat = GL_RGB9_E5;
+        m_Type = GL_UNSIGNED_INT_5_9_9_9_REV;
+    } else if (m_Tiles->GetFormat() == SkyFormat::RGB16F) {
+        m_InternalFormat = GL_RGB16F;
+        m_Type = GL_HALF_FLOAT;
+    }
+
+    // Square as far as the texture size allows, with room for the pinned
+    // top level and as many again
+    int stride = m_Tiles->GetTileStride();
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    int slots = std::max(atlasSlots, 2 * Skybox::CUBE_FACES);
+    m_AtlasColumns = std::max(std::min((int)std::ceil(std::sqrt((double)slots)), maxSize / stride), 1);
+    int rows = std::max(std::min((slots + m_AtlasColumns - 1) / m_AtlasColumns, maxSize / stride), 1);
+    m_Slots.resize((size_t)m_AtlasColumns * rows);
+
+    glGenTextures(1, &m_AtlasTextureID);
+    glBindTexture(GL_TEXTURE_2D, m_AtlasTextureID);
+    glTexImage2D(GL_TEXTURE_2D, 0, m_InternalFormat, m_AtlasColumns * stride, rows * stride, 0, GL_RGB, m_Type, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+    int pages = m_Tiles->GetPageCount();
+    m_PageSlots.assign(pages, -1);
+    m_PageRequested.assign(pages, false);
+    std::vector<uint32_t> entries((size_t)PAGE_TABLE_WIDTH * ((pages + PAGE_TABLE_WIDTH - 1) / PAGE_TABLE_WIDTH), 0);
+    glGenTextures(1, &m_PageTableTextureID);
+    glBindTexture(GL_TEXTURE_2D, m_PageTableTextureID);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, PAGE_TABLE_WIDTH, (GLsizei)(entries.size() / PAGE_TABLE_WIDTH), 0,
+                 GL_RED_INTEGER, GL_UNSIGNED_INT, entries.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+    // Every lookup falls back to the top level
+    GLint alignment = 4;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int page = m_Tiles->GetLevelFirstPage(m_Tiles->GetLevelCount() - 1); page < pages; page++) {
+        Upload(page, m_Tiles->GetTileData(page));
+        m_Slots[m_PageSlots[page]].pinned = true;
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+
+    CreateFeedbackTarget();
+
+    m_Loader = std::thread(&SkyStreamer::LoaderLoop, this);
+}
+
+SkyStreamer::~SkyStreamer() {
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Quit = true;
+    }
+    m_Wake.notify_all();
+    m_Loader.join();
+
+    DeleteFeedbackTarget();
+    if (m_AtlasTextureID) glDeleteTextures(1, &m_AtlasTextureID);
+    if (m_PageTableTextureID) glDeleteTextures(1, &m_PageTableTextureID);
+}
+
+void SkyStreamer::SetUniforms(const Shader& shader) const {
+    int levelPages[Skybox::MAX_LEVELS] = {};
+    for (int level = 0; level < m_Tiles->GetLevelCount(); level++)
+        levelPages[level] = m_Tiles->GetLevelFirstPage(level);
+
+    shader.setInt("u_skyTiled", 1);
+    shader.setInt("u_skyFaceSize", m_Tiles->GetFaceSize());
+    shader.setInt("u_skyTileSize", m_Tiles->GetTileSize());
+    shader.setInt("u_skyTileLevels", m_Tiles->GetLevelCount());
+    shader.setIntArray("u_skyLevelPages", levelPages, Skybox::MAX_LEVELS);
+    shader.setInt("u_skyAtlasColumns", m_AtlasColumns);
+}
+
+void SkyStreamer::CreateFeedbackTarget() {
+    GLint previousFBO = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFBO);
+    m_FeedbackWidth = (m_Width + m_FeedbackScale - 1) / m_FeedbackScale;
+    m_FeedbackHeight = (m_Height + m_FeedbackScale - 1) / m_FeedbackScale;
+
+    // Pages stay exact in float up to 2^24
+    glGenTextures(1, &m_FeedbackTextureID);
+    glBindTexture(GL_TEXTURE_2D, m_FeedbackTextureID);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, m_FeedbackWidth, m_FeedbackHeight, 0, GL_RED, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    // Only SkyFeedback goes to it
+    glGenFramebuffers(1, &m_FeedbackFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_FeedbackFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_FeedbackTextureID, 0);
+    GLenum drawBuffers[] = { GL_NONE, GL_NONE, GL_NONE, GL_NONE, GL_COLOR_ATTACHMENT0 };
+    glDrawBuffers(5, drawBuffers);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cerr << "Sky feedback framebuffer is incomplete" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFBO);
+
+    glGenBuffers(1, &m_FeedbackPBO);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_FeedbackPBO);
+    glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)m_FeedbackWidth * m_FeedbackHeight * sizeof(float), nullptr,
+                 GL_STREAM_READ);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void SkyStreamer::DeleteFeedbackTarget() {
+    if (m_FeedbackFence) glDeleteSync(m_FeedbackFence);
+    if (m_FeedbackPBO) glDeleteBuffers(1, &m_FeedbackPBO);
+    if (m_FeedbackFBO) glDeleteFramebuffers(1, &m_FeedbackFBO);
+    if (m_FeedbackTextureID) glDeleteTextures(1, &m_FeedbackTextureID);
+    m_FeedbackFence = nullptr;
+    m_FeedbackPBO = m_FeedbackFBO = m_FeedbackTextureID = 0;
+}
+
+void SkyStreamer::SetBlocking(bool blocking) {
+    if (blocking == m_Blocking)
+        return;
+
+    m_Blocking = blocking;
+    m_FeedbackScale = blocking ? 1 : FEEDBACK_SCALE;
+    m_FeedbackPass = 0;
+    DeleteFeedbackTarget();
+    CreateFeedbackTarget();
+}
+
+bool SkyStreamer::WantsFeedback(bool sceneChanged) {
+    if (m_FeedbackFence)
+        return false;
+    if (sceneChanged)
+        m_FeedbackPass = 0;
+    return m_FeedbackPass < m_FeedbackScale * m_FeedbackScale || m_Missing > 0;
+}
+
+glm::ivec2 SkyStreamer::BeginFeedback() {
+    glBindFramebuffer(GL_FRAMEBUFFER, m_FeedbackFBO);
+    glViewport(0, 0, m_FeedbackWidth, m_FeedbackHeight);
+
+    // Bit reversed pass numbers, so the first few passes already land all
+    // over the square rather than along its first row
+    int passes = m_FeedbackScale * m_FeedbackScale;
+    int bits = 0;
+    while ((1 << bits) < passes)
+        bits++;
+    int pass = m_FeedbackPass++ % passes, reversed = 0;
+    for (int i = 0; i < bits; i++)
+        reversed |= ((pass >> i) & 1) << (bits - 1 - i);
+    return glm::ivec2(reversed % m_FeedbackScale, reversed / m_FeedbackScale);
+}
+
+void SkyStreamer::EndFeedback() {
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_FeedbackFBO);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_FeedbackPBO);
+    glReadPixels(0, 0, m_FeedbackWidth, m_FeedbackHeight, GL_RED, GL_FLOAT, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    m_FeedbackFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void SkyStreamer::Update() {
+    m_Frame++;
+    ReadFeedback(m_Blocking);
+
+    std::deque<LoadedTile> loaded;
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        if (m_Blocking)
+            m_Idle.wait(lock, [&] { return m_Requests.empty() && !m_Loading; });
+        size_t count = m_Blocking ? m_Loaded.size() : std::min(m_Loaded.size(), (size_t)m_UploadsPerFrame);
+        for (size_t i = 0; i < count; i++) {
+            loaded.push_back(std::move(m_Loaded.front()));
+            m_Loaded.pop_front();
+        }
+    }
+    if (loaded.empty())
+        return;
+
+    GLint alignment = 4;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (const LoadedTile& tile : loaded) {
+        m_PageRequested[tile.page] = false;
+        if (m_PageSlots[tile.page] < 0 && !Upload(tile.page, tile.texels.data()))
+            m_Dropped++;
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+
+    m_Missing = 0;
+    for (int page : m_Wanted)
+        m_Missing += m_PageSlots[page] < 0;
+}
+
+void SkyStreamer::ReadFeedback(bool wait) {
+    if (!m_FeedbackFence)
+        return;
+
+    GLbitfield flags = wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0;
+    GLuint64 timeout = wait ? 1000000000ull : 0ull;
+    GLenum status = glClientWaitSync(m_FeedbackFence, flags, timeout);
+    while (wait && status == GL_TIMEOUT_EXPIRED)
+        status = glClientWaitSync(m_FeedbackFence, 0, timeout);
+    if (status == GL_TIMEOUT_EXPIRED)
+        return;
+    glDeleteSync(m_FeedbackFence);
+    m_FeedbackFence = nullptr;
+    if (status == GL_WAIT_FAILED)
+        return;
+
+    size_t count = (size_t)m_FeedbackWidth * m_FeedbackHeight;
+    m_FeedbackPages.resize(count);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_FeedbackPBO);
+    const void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)(count * sizeof(float)), GL_MAP_READ_BIT);
+    bool ok = mapped != nullptr;
+    if (ok)
+        std::memcpy(m_FeedbackPages.data(), mapped, count * sizeof(float));
+    ok &= glUnmapBuffer(GL_PIXEL_PACK_BUFFER) == GL_TRUE;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (!ok)
+        return;
+
+    m_FeedbackFrame = m_Frame;
+    m_Wanted.clear();
+    for (float value : m_FeedbackPages) {
+        int page = (int)value - 1;
+        if (page >= 0 && page < m_Tiles->GetPageCount())
+            m_Wanted.push_back(page);
+    }
+    std::sort(m_Wanted.begin(), m_Wanted.end());
+    m_Wanted.erase(std::unique(m_Wanted.begin(), m_Wanted.end()), m_Wanted.end());
+
+    // A missing page is drawn from the first resident tile above it, which
+    // counts as wanted too. Everything on the way up is requested.
+    std::vector<int> requests;
+    m_Missing = 0;
+    for (int page : m_Wanted) {
+        int p = page;
+        while (p >= 0 && m_PageSlots[p] < 0) {
+            if (!m_PageRequested[p]) {
+                m_PageRequested[p] = true;
+                requests.push_back(p);
+            }
+            p = m_Tiles->ParentPage(p);
+        }
+        if (p >= 0)
+            m_Slots[m_PageSlots[p]].lastUse = m_Frame;
+        m_Missing += p != page;
+    }
+    if (requests.empty())
+        return;
+
+    // Pages count up from the finest level, so coarse tiles go first and
+    // stand in sooner
+    std::sort(requests.begin(), requests.end(), std::greater<int>());
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Requests.insert(m_Requests.end(), requests.begin(), requests.end());
+    }
+    m_Wake.notify_one();
+}
+
+int SkyStreamer::FreeSlot() const {
+    // An empty slot, or the one wanted longest ago that the last feedback
+    // did not want
+    int best = -1;
+    for (int i = 0; i < (int)m_Slots.size(); i++) {
+        const Slot& slot = m_Slots[i];
+        if (slot.page < 0)
+            return i;
+        if (!slot.pinned && slot.lastUse < m_FeedbackFrame && (best < 0 || slot.lastUse < m_Slots[best].lastUse))
+            best = i;
+    }
+    return best;
+}
+
+bool SkyStreamer::Upload(int page, const unsigned char* texels) {
+    int index = FreeSlot();
+    if (index < 0)
+        return false;
+
+    Slot& slot = m_Slots[index];
+    if (slot.page >= 0) {
+        m_PageSlots[slot.page] = -1;
+        SetPageEntry(slot.page, 0);
+        m_Evicted++;
+    }
+
+    int stride = m_Tiles->GetTileStride();
+    glBindTexture(GL_TEXTURE_2D, m_AtlasTextureID);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, (index % m_AtlasColumns) * stride, (index / m_AtlasColumns) * stride, stride, stride,
+                    GL_RGB, m_Type, texels);
+
+    slot.page = page;
+    slot.lastUse = m_Frame;
+    m_PageSlots[page] = index;
+    SetPageEntry(page, (uint32_t)index + 1);
+    m_Uploaded++;
+    return true;
+}
+
+void SkyStreamer::SetPageEntry(int page, uint32_t entry) {
+    glBindTexture(GL_TEXTURE_2D, m_PageTableTextureID);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, page % PAGE_TABLE_WIDTH, page / PAGE_TABLE_WIDTH, 1, 1, GL_RED_INTEGER,
+                    GL_UNSIGNED_INT, &entry);
+}
+
+void SkyStreamer::LoaderLoop() {
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    while (true) {
+        m_Wake.wait(lock, [&] { return m_Quit || !m_Requests.empty(); });
+        if (m_Quit)
+            return;
+
+        int page = m_Requests.front();
+        m_Requests.pop_front();
+        m_Loading = true;
+        lock.unlock();
+
+        // Touching the mapping is what reads the file
+        const unsigned char* data = m_Tiles->GetTileData(page);
+        LoadedTile tile = { page, std::vector<unsigned char>(data, data + m_Tiles->GetTileBytes()) };
+
+        lock.lock();
+        m_Loaded.push_back(std::move(tile));
+        m_Loading = false;
+        if (m_Requests.empty())
+            m_Idle.notify_all();
+    }
+}
+
+SkyStreamer::Stats SkyStreamer::GetStats() const {
+    Stats stats;
+    stats.slots = (int)m_Slots.size();
+    for (const Slot& slot : m_Slots)
+        stats.resident += slot.page >= 0;
+    for (bool requested : m_PageRequested)
+        stats.pending += requested;
+    stats.missing = m_Missing;
+    stats.uploaded = m_Uploaded;
+    stats.evicted = m_Evicted;
+    stats.dropped = m_Dropped;
+
+    int stride = m_Tiles->GetTileStride();
+    stats.atlasBytes = m_Slots.size() * stride * stride * Skybox::TexelSize(m_Tiles->GetFormat());
+    return stats;
+}
@@ -0,0 +1,140 @@
+#include "wavefront.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+
+// The live count is read back this often, each read waits for the GPU
+static const int LIVE_CHECK_INTERVAL = 4;
+
+static_assert(sizeof(glm::vec4) == 16, "RayState must match wavefront.comp");
+
+bool WavefrontTracer::IsSupported() {
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    return major * 10 + minor >= 43;
+}
+
+WavefrontTracer::WavefrontTracer(int width, int height, int stepsPerDispatch)
+    : m_TraceShader(Shader::Compute("wavefront.comp")), m_CompactShader(Shader::Compute("compact.comp")),
+      m_StepsPerDispatch(std::max(stepsPerDispatch, 1)), m_Width(width), m_Height(height) {
+    size_t pixels = (size_t)width * height;
+    size_t blocks = (pixels + GROUP_SIZE - 1) / GROUP_SIZE;
+    size_t sizes[BUFFER_COUNT];
+    sizes[RAYS] = pixels * sizeof(RayState);
+    sizes[LIVE] = sizes[NEXT_LIVE] = sizes[ALIVE] = sizes[PREFIX] = pixels * sizeof(uint32_t);
+    sizes[BLOCK_SUMS] = blocks * sizeof(uint32_t);
+    sizes[COUNTERS] = sizeof(Counters);
+
+    glGenBuffers(BUFFER_COUNT, m_Buffers);
+    for (int i = 0; i < BUFFER_COUNT; i++) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_Buffers[i]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)sizes[i], nullptr, GL_DYNAMIC_COPY);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glGenTextures(1, &m_ImageTextureID);
+    glBindTexture(GL_TEXTURE_2D, m_ImageTextureID);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    GLint previousFBO = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFBO);
+    glGenFramebuffers(1, &m_FBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_FBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_ImageTextureID, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFBO);
+}
+
+WavefrontTracer::~WavefrontTracer() {
+    glDeleteBuffers(BUFFER_COUNT, m_Buffers);
+    if (m_ImageTextureID) glDeleteTextures(1, &m_ImageTextureID);
+    if (m_FBO) glDeleteFramebuffers(1, &m_FBO);
+}
+
+void WavefrontTracer::SetStepsPerDispatch(int steps) {
+    m_StepsPerDispatch = std::max(steps, 1);
+}
+
+bool WavefrontTracer::Poll() {
+    m_CompactShader->Poll();
+    return m_TraceShader->Poll();
+}
+
+void WavefrontTracer::SetHotReload(bool enabled, const std::string& watchDirectory) {
+    m_TraceShader->SetHotReload(enabled, watchDirectory);
+    m_CompactShader->SetHotReload(enabled, watchDirectory);
+}
+
+void WavefrontTracer::Trace() {
+    int pixels = m_Width * m_Height;
+    Counters start = { { (uint32_t)((pixels + GROUP_SIZE - 1) / GROUP_SIZE), 1, 1 }, (uint32_t)pixels, 0 };
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_Buffers[COUNTERS]);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(Counters), &start);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    for (int i = 0; i < BUFFER_COUNT; i++)
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, m_Buffers[i]);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, m_Buffers[COUNTERS]);
+    glBindImageTexture(0, m_ImageTextureID, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+
+    m_TraceShader->use();
+    m_TraceShader->setInt("u_pass", 0);
+    m_TraceShader->setInt("u_stepsPerDispatch", m_StepsPerDispatch);
+    m_TraceShader->setIVec2("u_size", glm::ivec2(m_Width, m_Height));
+    glDispatchCompute(start.groups[0], 1, 1);
+
+    // Every live ray takes stepsPerDispatch steps a dispatch until it stops
+    // or reaches MAX_STEPS, so this many always finish the frame
+    m_Stats = Stats();
+    int maxDispatches = (MAX_STEPS + m_StepsPerDispatch - 1) / m_StepsPerDispatch;
+    for (int dispatch = 0; dispatch < maxDispatches; dispatch++) {
+        Compact();
+        if (dispatch % LIVE_CHECK_INTERVAL == 0) {
+            uint32_t live = ReadLiveCount();
+            if (dispatch == 0)
+                m_Stats.marched = (int)live;
+            if (live == 0)
+                break;
+        }
+
+        m_TraceShader->use();
+        m_TraceShader->setInt("u_pass", 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+        glDispatchComputeIndirect(0);
+        m_Stats.dispatches++;
+    }
+
+    glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+}
+
+void WavefrontTracer::Compact() {
+    const GLbitfield barriers = GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT;
+    m_CompactShader->use();
+    for (int pass = 0; pass < 4; pass++) {
+        glMemoryBarrier(barriers);
+        m_CompactShader->setInt("u_pass", pass);
+        // The block passes cover the live list, the others are one group
+        if (pass == 0 || pass == 2)
+            glDispatchComputeIndirect(0);
+        else
+            glDispatchCompute(1, 1, 1);
+    }
+    glMemoryBarrier(barriers);
+
+    std::swap(m_Buffers[LIVE], m_Buffers[NEXT_LIVE]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIVE, m_Buffers[LIVE]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, NEXT_LIVE, m_Buffers[NEXT_LIVE]);
+}
+
+uint32_t WavefrontTracer::ReadLiveCount() {
+    uint32_t live = 0;
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_Buffers[COUNTERS]);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, offsetof(Counters, liveCount), sizeof(live), &live);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return live;
+}